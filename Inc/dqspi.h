@@ -3,11 +3,223 @@
 #ifndef __DQSPI_H__
 #define __DQSPI_H__
 
+#include <stddef.h>
 #include <stdint.h>
 
 
 #define FLASH_ID             0x4016
 #define FLASH_MF_ID          0xEF
+#define FLASH_UID_SIZE       8
+
+/* memory-mapped window of the QSPI flash */
+#define DQSPI_MAP_ADDR       0x90000000UL
+
+/* returned when DQSpiMap() mappings (or an open stream) own the controller,
+ * and during an erase suspend for what the flash would ignore: erases,
+ * register writes, programs into the suspended block */
+#define DQSPI_BUSY           (-2)
+
+/* read back data differs from what was programmed (DQSPI_VERIFY) */
+#define DQSPI_VERIFY_FAIL    (-3)
+
+/* poll WEL after every WREN (one more controller round trip per page) */
+#ifndef DQSPI_STRICT_WEL
+#define DQSPI_STRICT_WEL     0
+#endif
+
+/* RAM write-back page buffer in front of DQSpiWrite() */
+#ifndef DQSPI_WRITE_BUFFER
+#define DQSPI_WRITE_BUFFER   0
+#endif
+
+/* pending page age (ms) after which DQSpiPoll() programs it */
+#ifndef DQSPI_WRITE_BUFFER_TIMEOUT
+#define DQSPI_WRITE_BUFFER_TIMEOUT 100
+#endif
+
+/* read every programmed page back (dual output) and compare its CRC32
+ * with the source; the failing page is kept for DQSpiVerifyStats() */
+#ifndef DQSPI_VERIFY
+#define DQSPI_VERIFY         0
+#endif
+
+/* page programs repeated while the read back only misses 1 -> 0 bits */
+#ifndef DQSPI_VERIFY_RETRIES
+#define DQSPI_VERIFY_RETRIES 1
+#endif
+
+/* DQSpiCrc32() on the CRC unit instead of the lookup table */
+#ifndef DQSPI_HW_CRC
+#define DQSPI_HW_CRC         0
+#endif
+
+/* per-sector CRC32 manifest of [DQSPI_MANIFEST_BASE, + DQSPI_MANIFEST_SIZE),
+ * updated by every program/erase of the driver, checked by
+ * DQSpiVerifyRegion(); its log takes the two 4K sectors at
+ * DQSPI_MANIFEST_ADDR */
+#ifndef DQSPI_MANIFEST
+#define DQSPI_MANIFEST       0
+#endif
+
+#ifndef DQSPI_MANIFEST_BASE
+#define DQSPI_MANIFEST_BASE  0x00200000UL
+#endif
+
+#ifndef DQSPI_MANIFEST_SIZE
+#define DQSPI_MANIFEST_SIZE  0x00100000UL   /* up to 511 sectors */
+#endif
+
+#ifndef DQSPI_MANIFEST_ADDR
+#define DQSPI_MANIFEST_ADDR  0x003EE000UL
+#endif
+
+/* LRU read cache for small indirect reads, 0 lines disables it */
+#ifndef DQSPI_READ_CACHE_LINES
+#define DQSPI_READ_CACHE_LINES 0
+#endif
+
+#ifndef DQSPI_READ_CACHE_LINE_SIZE
+#define DQSPI_READ_CACHE_LINE_SIZE 1024
+#endif
+
+/* enable the Cortex-M7 I/D caches in DQSpiMpuConfig() */
+#ifndef DQSPI_XIP_CACHE
+#define DQSPI_XIP_CACHE      1
+#endif
+
+/* SRAM1/2 not cacheable: required by the loader, whose Buffer is written
+ * by the debugger; applications with their own cache policy clear it */
+#ifndef DQSPI_MPU_SRAM_NOCACHE
+#define DQSPI_MPU_SRAM_NOCACHE 1
+#endif
+
+/* larger changed ranges clean+invalidate the whole D-cache (16 KB) */
+#ifndef DQSPI_XIP_INVALIDATE_MAX
+#define DQSPI_XIP_INVALIDATE_MAX 0x4000
+#endif
+
+/* DWT cycle statistics of every flash operation (dqspi_stat.h) */
+#ifndef DQSPI_STATS
+#define DQSPI_STATS          0
+#endif
+
+/* per-command trace over ITM stimulus port, RAM ring when ITM is off */
+#ifndef DQSPI_TRACE
+#define DQSPI_TRACE          0
+#endif
+
+#ifndef DQSPI_TRACE_PORT
+#define DQSPI_TRACE_PORT     1
+#endif
+
+#ifndef DQSPI_TRACE_RING
+#define DQSPI_TRACE_RING     128   /* records, power of two */
+#endif
+
+/* standalone benchmark run from main() (dqspi_bench.h), destroys the
+ * 64K block at DQSPI_BENCH_ADDR */
+#ifndef DQSPI_BENCH
+#define DQSPI_BENCH          0
+#endif
+
+#ifndef DQSPI_BENCH_ADDR
+#define DQSPI_BENCH_ADDR     0x003F0000UL
+#endif
+
+#ifndef DQSPI_BENCH_LOOPS
+#define DQSPI_BENCH_LOOPS    4
+#endif
+
+#ifndef DQSPI_BENCH_SAMPLES
+#define DQSPI_BENCH_SAMPLES  256   /* latency samples kept per case */
+#endif
+
+/* DMA streaming reader, needs QUADSPI DMA and IRQs (see hal_msp/it) */
+#ifndef DQSPI_STREAM
+#define DQSPI_STREAM         0
+#endif
+
+#ifndef DQSPI_STREAM_MAX_BUFS
+#define DQSPI_STREAM_MAX_BUFS 4
+#endif
+
+/* interrupt driven page program (DMA) and 64K erase with suspend/resume,
+ * for the circular logger (dqspi_log.h); needs the same DMA and IRQs as
+ * DQSPI_STREAM */
+#ifndef DQSPI_LOG
+#define DQSPI_LOG            0
+#endif
+
+
+/* memory-mapped mode settings, the default (all 0) is the 0x3B read
+ * with nCS kept low between accesses */
+typedef struct {
+    uint16_t timeout;       /* nCS released after N idle clocks, 0: never */
+    uint8_t dual_io;        /* 0xBB: address on 2 lines too */
+    uint8_t continuous;     /* 0xBB continuous read mode, requires sioo */
+    uint8_t sioo;           /* send the instruction only once */
+} DQSpiMapProfile;
+
+/* random accesses done by DQSpiMapBench() */
+#ifndef DQSPI_MAP_BENCH_RANDOM
+#define DQSPI_MAP_BENCH_RANDOM 256
+#endif
+
+typedef struct {
+    uint32_t seq_cycles;    /* CPU cycles to read len bytes sequentially */
+    uint32_t rnd_total;     /* CPU cycles of the random 32-bit reads */
+    uint32_t rnd_min;
+    uint32_t rnd_max;
+    uint32_t checksum;      /* keeps the reads from being optimized out */
+} DQSpiMapBenchResult;
+
+/* sequential reader: one chunk is always in flight while the caller
+ * works on the previous ones. With the D-cache on, buf must be 32-byte
+ * aligned and chunk a multiple of 32. */
+typedef struct {
+    uint32_t addr;                          /* next address to fetch */
+    uint32_t end;
+    uint8_t *buf;                           /* nbuf * chunk bytes */
+    uint32_t chunk;
+    uint32_t len[DQSPI_STREAM_MAX_BUFS];    /* valid bytes per buffer */
+    uint8_t nbuf;
+    volatile uint8_t head;                  /* next buffer to fill */
+    volatile uint8_t tail;                  /* next buffer to hand out */
+    volatile uint8_t count;                 /* filled buffers */
+    volatile uint8_t busy;                  /* DMA in flight */
+    volatile uint8_t err;
+} DQSpiStream;
+
+
+/* one step of DQSpiExecBatch(), addresses are flash offsets */
+typedef enum {
+    DQSPI_BATCH_ERASE_4K = 1,
+    DQSPI_BATCH_ERASE_32K,
+    DQSPI_BATCH_ERASE_64K,
+    DQSPI_BATCH_ERASE_CHIP,
+    DQSPI_BATCH_PROGRAM,        /* len bytes of dat, may cross pages */
+    DQSPI_BATCH_VERIFY          /* DQSpiCrc32() of [addr, addr + len) is crc */
+} DQSpiOpCode;
+
+typedef struct {
+    uint8_t op;                 /* DQSpiOpCode */
+    uint32_t addr;
+    uint32_t len;
+    const uint8_t *dat;
+    uint32_t crc;
+} DQSpiOp;
+
+/* per-op status of an op the batch did not reach */
+#define DQSPI_BATCH_NOT_RUN  1
+
+typedef struct {
+    int8_t *status;             /* n entries, or NULL: 0, -1, DQSPI_BUSY, DQSPI_BATCH_NOT_RUN */
+    size_t failed;              /* index of the first failing op, n if none */
+} DQSpiResult;
+
+/* end of an asynchronous program/erase, called from the QUADSPI IRQ (or
+ * from DQSpiPoll() on timeout, DQSpiEraseSuspend() if already done) */
+typedef void (*DQSpiAsyncDone)(int8_t ret);
 
 
 int8_t DQSpiReset(void);
@@ -15,10 +227,43 @@ int8_t DQSpiFlashId(uint8_t *mid, uint16_t *id);
 int8_t DQSpiFlashInfo(uint32_t *blk_num, uint32_t *blk_size, uint32_t *sect_mum, uint32_t *sect_size);
 int8_t DQSpiEraseChip(void);
 int8_t DQSpiEraseBlock(uint32_t addr);
+int8_t DQSpiEraseBlock64(uint32_t addr);
 int8_t DQSpiEraseSector(uint32_t addr);
 int8_t DQSpiRead(uint32_t addr, uint8_t *dat, uint32_t len);
 int8_t DQSpiWrite(uint32_t addr, uint8_t *dat, uint32_t len);
+int8_t DQSpiFlush(void);
+int8_t DQSpiPoll(void);
+int8_t DQSpiExecBatch(const DQSpiOp *ops, size_t n, DQSpiResult *res);
+int8_t DQSpiReadCacheStats(uint32_t *hit, uint32_t *miss);
+int8_t DQSpiVerifyStats(uint32_t *pages, uint32_t *retries, uint32_t *bad_page);
+int8_t DQSpiManifestSync(void);
+int8_t DQSpiManifestRebuild(void);
+int8_t DQSpiVerifyRegion(uint32_t addr, uint32_t len, uint32_t *bad, uint32_t *nbad);
 int8_t DQSpiMemoryMapped(void);
+const uint8_t *DQSpiMap(uint32_t addr, uint32_t len);
+int8_t DQSpiUnmap(const uint8_t *ptr);
+int8_t DQSpiMapProfileSet(const DQSpiMapProfile *p);
+int8_t DQSpiMapProfileGet(DQSpiMapProfile *p);
+int8_t DQSpiMapBench(const DQSpiMapProfile *p, uint32_t len, DQSpiMapBenchResult *res);
+int8_t DQSpiMpuConfig(void);
+int8_t DQSpiPowerDown(void);
+int8_t DQSpiPowerPolicy(uint32_t idle_ms);
+int8_t DQSpiPowerStats(uint32_t *down_ms, uint32_t *wakeups);
+int8_t DQSpiUniqueId(uint8_t *id);
+int8_t DQSpiSecurityRead(uint8_t reg, uint32_t off, uint8_t *dat, uint32_t len);
+int8_t DQSpiSecurityWrite(uint8_t reg, uint32_t off, uint8_t *dat, uint32_t len);
+int8_t DQSpiSecurityErase(uint8_t reg);
+int8_t DQSpiSecurityLocked(uint8_t reg, uint8_t *locked);
+int8_t DQSpiSecurityLock(uint8_t reg);
+int8_t DQSpiStreamOpen(DQSpiStream *s, uint32_t addr, uint32_t len, uint8_t *buf, uint32_t chunk, uint8_t nbuf);
+uint8_t *DQSpiStreamAcquire(DQSpiStream *s, uint32_t *len);
+int8_t DQSpiStreamRelease(DQSpiStream *s);
+int8_t DQSpiStreamClose(DQSpiStream *s);
+int8_t DQSpiProgramAsync(uint32_t addr, const uint8_t *dat, uint32_t len, DQSpiAsyncDone done);
+int8_t DQSpiEraseBlock64Async(uint32_t addr, DQSpiAsyncDone done);
+int8_t DQSpiEraseSuspend(void);
+int8_t DQSpiEraseResume(void);
+uint32_t DQSpiCrc32(uint32_t crc, const uint8_t *dat, uint32_t len);
 
 
 #endif
@@ -0,0 +1,82 @@
+
+#ifndef __DQSPI_BD_H__
+#define __DQSPI_BD_H__
+
+#include <stdint.h>
+
+
+/* Wear-leveled block device over the 4K sectors of
+ * [DQSPI_BD_BASE, + DQSPI_BD_SECTORS * 4K). Logical blocks are remapped
+ * to physical sectors on every erase; the first page of a sector holds
+ * its header (DQSpiBdHdr) with the erase count, the rest is the block:
+ * DQSPI_BD_BLOCK_SIZE bytes, page aligned.
+ *
+ *  dynamic: an erased block goes to the least worn free sector, unless
+ *           its own sector is within DQSPI_BD_DYNAMIC_THRESHOLD erases
+ *  static:  once the erase counts spread by DQSPI_BD_STATIC_THRESHOLD,
+ *           the coldest block moves to the most worn free sector
+ *
+ * The RAM map is rebuilt by DQSpiBdMount() from the headers alone.
+ * Blocks follow NOR rules: erase before program, erased reads 0xFF. */
+#ifndef DQSPI_BD_BASE
+#define DQSPI_BD_BASE        0x00300000UL
+#endif
+
+#ifndef DQSPI_BD_SECTORS
+#define DQSPI_BD_SECTORS     224
+#endif
+
+/* physical sectors without a logical block */
+#ifndef DQSPI_BD_SPARES
+#define DQSPI_BD_SPARES      4
+#endif
+
+#ifndef DQSPI_BD_DYNAMIC_THRESHOLD
+#define DQSPI_BD_DYNAMIC_THRESHOLD 8
+#endif
+
+#ifndef DQSPI_BD_STATIC_THRESHOLD
+#define DQSPI_BD_STATIC_THRESHOLD 256
+#endif
+
+#define DQSPI_BD_SECTOR_SIZE 0x1000
+#define DQSPI_BD_HDR_SIZE    0x100       /* one page, keeps blocks page aligned */
+#define DQSPI_BD_BLOCK_SIZE  (DQSPI_BD_SECTOR_SIZE - DQSPI_BD_HDR_SIZE)
+#define DQSPI_BD_BLOCKS      (DQSPI_BD_SECTORS - DQSPI_BD_SPARES)
+
+#define DQSPI_BD_MAGIC       0x44425144  /* "DQBD" */
+
+typedef struct {
+    uint32_t magic;
+    uint16_t block;        /* logical block */
+    uint16_t reserved;
+    uint32_t ec;           /* erases of this sector */
+    uint32_t seq;          /* the newest copy of a block wins */
+    uint32_t crc;          /* DQSpiCrc32() of the fields above */
+    uint32_t committed;    /* programmed to 0 once the content is complete */
+    uint32_t obsolete;     /* programmed to 0 once a newer copy exists */
+} DQSpiBdHdr;
+
+/* block device callbacks, for a filesystem glue layer */
+typedef struct {
+    int8_t (*read)(uint32_t block, uint32_t off, uint8_t *dat, uint32_t len);
+    int8_t (*prog)(uint32_t block, uint32_t off, const uint8_t *dat, uint32_t len);
+    int8_t (*erase)(uint32_t block);
+    int8_t (*sync)(void);
+    uint32_t block_size;
+    uint32_t block_count;
+    uint32_t prog_size;    /* any size works, a page programs fastest */
+} DQSpiBdOps;
+
+extern const DQSpiBdOps DQSpiBd;
+
+
+int8_t DQSpiBdMount(void);
+int8_t DQSpiBdRead(uint32_t block, uint32_t off, uint8_t *dat, uint32_t len);
+int8_t DQSpiBdProg(uint32_t block, uint32_t off, const uint8_t *dat, uint32_t len);
+int8_t DQSpiBdErase(uint32_t block);
+int8_t DQSpiBdSync(void);
+int8_t DQSpiBdStats(uint32_t *ec_min, uint32_t *ec_max, uint32_t *moves);
+
+
+#endif
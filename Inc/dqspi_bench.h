@@ -0,0 +1,64 @@
+
+#ifndef __DQSPI_BENCH_H__
+#define __DQSPI_BENCH_H__
+
+#include <stdint.h>
+
+#include "dqspi.h"
+
+
+/* Throughput/latency suite of the QSPI flash, built with DQSPI_BENCH.
+ * Results are left in DQSpiBenchBlock (Tools/bench.gdb dumps it) and
+ * printed on ITM port 0 when the debugger enabled it. */
+
+#define DQSPI_BENCH_MAGIC    0x48424451  /* "DQBH" */
+
+typedef enum {
+    DQSPI_BENCH_READ_SEQ = 0,      /* indirect 0x3B, 4K reads */
+    DQSPI_BENCH_READ_RND,          /* indirect 0x3B, 32 byte reads */
+    DQSPI_BENCH_MAP_SEQ_3B,        /* memory-mapped, default profile */
+    DQSPI_BENCH_MAP_RND_3B,
+    DQSPI_BENCH_MAP_SEQ_BB,        /* memory-mapped, 0xBB dual I/O */
+    DQSPI_BENCH_MAP_RND_BB,
+    DQSPI_BENCH_MAP_SEQ_BB_CONT,   /* memory-mapped, 0xBB continuous read */
+    DQSPI_BENCH_MAP_RND_BB_CONT,
+    DQSPI_BENCH_PROGRAM,           /* 256 byte pages */
+    DQSPI_BENCH_ERASE_4K,
+    DQSPI_BENCH_ERASE_32K,
+    DQSPI_BENCH_ERASE_64K,
+    DQSPI_BENCH_NUM
+} DQSpiBenchId;
+
+typedef struct {
+    uint32_t count;        /* timed operations */
+    uint32_t errors;
+    uint32_t bytes;
+    uint64_t cycles;
+    uint32_t kbps;         /* kB/s, MB/s x 1000 */
+    uint32_t p50;          /* latency percentiles of one operation, cycles */
+    uint32_t p90;
+    uint32_t p99;
+    uint32_t max;
+} DQSpiBenchCase;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t cpu_hz;
+    uint32_t flash_id;     /* manufacturer << 16 | device id */
+    uint8_t uid[FLASH_UID_SIZE];
+    uint32_t addr;         /* scratch block */
+    uint32_t checksum;     /* keeps the reads from being optimized out */
+    volatile uint32_t done;
+    DQSpiBenchCase c[DQSPI_BENCH_NUM];
+} DQSpiBenchResult;
+
+
+#if DQSPI_BENCH
+extern DQSpiBenchResult DQSpiBenchBlock;
+
+int8_t DQSpiBench(void);
+void DQSpiBenchDone(void);
+#endif
+
+
+#endif
@@ -0,0 +1,112 @@
+
+#ifndef __DQSPI_KV_H__
+#define __DQSPI_KV_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+
+/* Log-structured key-value store over the 4K sectors of
+ * [DQSPI_KV_BASE, + DQSPI_KV_SECTORS * 4K), for configuration and
+ * counters. Records are only appended; a RAM hash index points at the
+ * newest record of every key, and compaction moves the live records out
+ * of the oldest sector before erasing it.
+ *
+ * A put batch is formatted in RAM and written with one DQSpiWrite(), so
+ * small records share their page programs. The first record of a batch
+ * carries a commit word, programmed to 0 once the whole batch is in the
+ * flash: after a power loss an uncommitted batch is ignored and its
+ * sector takes no more records.
+ *
+ * A lookup is one DQSpiRead(), or a pointer into the XIP window with
+ * DQSpiKvMap(). Keys are strings of 1..DQSPI_KV_KEY_MAX characters. */
+#ifndef DQSPI_KV_BASE
+#define DQSPI_KV_BASE        0x003E0000UL
+#endif
+
+/* one of them is kept free for compaction */
+#ifndef DQSPI_KV_SECTORS
+#define DQSPI_KV_SECTORS     8
+#endif
+
+/* hash index slots, power of two; 3/4 of them can hold keys */
+#ifndef DQSPI_KV_INDEX_SIZE
+#define DQSPI_KV_INDEX_SIZE  128
+#endif
+
+#ifndef DQSPI_KV_KEY_MAX
+#define DQSPI_KV_KEY_MAX     32
+#endif
+
+#ifndef DQSPI_KV_VALUE_MAX
+#define DQSPI_KV_VALUE_MAX   208
+#endif
+
+/* RAM batch buffer: records of one put batch or one compaction step */
+#ifndef DQSPI_KV_BATCH_SIZE
+#define DQSPI_KV_BATCH_SIZE  256
+#endif
+
+/* DQSpiKvPoll() compacts while fewer sectors are free */
+#ifndef DQSPI_KV_GC_FREE
+#define DQSPI_KV_GC_FREE     3
+#endif
+
+#define DQSPI_KV_SECTOR_SIZE 0x1000
+#define DQSPI_KV_MAGIC       0x564B5144  /* "DQKV" */
+
+/* returned by DQSpiKvGet() for a missing key */
+#define DQSPI_KV_NOT_FOUND   1
+
+/* first 16 bytes of a sector in use */
+typedef struct {
+    uint32_t magic;
+    uint32_t seq;          /* sectors are replayed in seq order */
+    uint32_t crc;          /* DQSpiCrc32() of the fields above */
+    uint32_t reserved;
+} DQSpiKvSector;
+
+/* record header, then the key and the value, each padded to 4 bytes */
+typedef struct {
+    uint32_t commit;       /* first record of a batch: 0 once the batch is written */
+    uint32_t crc;          /* DQSpiCrc32() from klen to the end of the value */
+    uint8_t nrec;          /* first record of a batch: records in it, 0 otherwise */
+    uint8_t klen;
+    uint16_t vlen;         /* DQSPI_KV_TOMBSTONE: the key was deleted */
+} DQSpiKvRec;
+
+#define DQSPI_KV_TOMBSTONE   0xFFFE
+/* largest record, 12: sizeof(DQSpiKvRec) */
+#define DQSPI_KV_REC_MAX     (12 + ((DQSPI_KV_KEY_MAX + 3) & ~3) + ((DQSPI_KV_VALUE_MAX + 3) & ~3))
+
+/* one put of DQSpiKvPutBatch(), val NULL deletes the key */
+typedef struct {
+    const char *key;
+    const void *val;
+    uint16_t vlen;
+} DQSpiKvPut;
+
+typedef struct {
+    uint32_t keys;
+    uint32_t live;         /* bytes of the records the index points at */
+    uint32_t free;         /* sectors without records */
+    uint32_t puts;         /* records written by puts, deletes included */
+    uint32_t user_bytes;   /* key and value bytes of those */
+    uint32_t prog_bytes;   /* all bytes programmed: records, commit words,
+                              sector headers, compaction copies */
+    uint32_t copies;       /* records moved by compaction */
+    uint32_t erases;
+} DQSpiKvInfo;
+
+
+int8_t DQSpiKvMount(void);
+int8_t DQSpiKvPutBatch(const DQSpiKvPut *puts, size_t n);
+int8_t DQSpiKvSet(const char *key, const void *val, uint16_t vlen);
+int8_t DQSpiKvDelete(const char *key);
+int8_t DQSpiKvGet(const char *key, void *val, uint16_t size, uint16_t *vlen);
+const void *DQSpiKvMap(const char *key, uint16_t *vlen);
+int8_t DQSpiKvPoll(void);
+int8_t DQSpiKvStats(DQSpiKvInfo *info);
+
+
+#endif
@@ -0,0 +1,89 @@
+
+#ifndef __DQSPI_LOG_H__
+#define __DQSPI_LOG_H__
+
+#include <stdint.h>
+
+
+/* Circular data logger over the 64K blocks of
+ * [DQSPI_LOG_BASE, + DQSPI_LOG_SIZE), needs DQSPI_LOG. Writes are
+ * collected in a ring of RAM pages; full pages are programmed by DMA one
+ * after the other from the QUADSPI IRQ, while the blocks ahead of the
+ * write head are erased in the background. A running erase is suspended
+ * once DQSPI_LOG_SUSPEND_AT pages wait, and resumed when they are in the
+ * flash. Wrapping around erases the oldest block.
+ *
+ * Every page starts with a DQSpiLogPage header. seq counts the pages
+ * since the log was created and gives the position: page p of the area
+ * holds a seq with seq % pages == p, so DQSpiLogOpen() finds the head
+ * with a binary search over the blocks, then over the pages of one.
+ *
+ * A write never spans pages, a page is read back whole by a cursor while
+ * logging goes on. Writes and reads are for thread context. */
+#ifndef DQSPI_LOG_BASE
+#define DQSPI_LOG_BASE       0x00100000UL
+#endif
+
+/* a power of two, at least DQSPI_LOG_ERASE_AHEAD + 2 blocks */
+#ifndef DQSPI_LOG_SIZE
+#define DQSPI_LOG_SIZE       0x00100000UL
+#endif
+
+/* RAM ring: absorbs the writes while the flash is busy erasing */
+#ifndef DQSPI_LOG_PAGES
+#define DQSPI_LOG_PAGES      16
+#endif
+
+/* waiting pages that suspend a running erase */
+#ifndef DQSPI_LOG_SUSPEND_AT
+#define DQSPI_LOG_SUSPEND_AT 4
+#endif
+
+/* blocks kept erased ahead of the write head */
+#ifndef DQSPI_LOG_ERASE_AHEAD
+#define DQSPI_LOG_ERASE_AHEAD 2
+#endif
+
+#define DQSPI_LOG_PAGE_SIZE  0x100
+/* 8: sizeof(DQSpiLogPage) */
+#define DQSPI_LOG_PAYLOAD    (DQSPI_LOG_PAGE_SIZE - 8)
+
+/* returned by DQSpiLogRead() at the write head */
+#define DQSPI_LOG_END        1
+
+typedef struct {
+    uint32_t seq;
+    uint16_t len;          /* payload bytes */
+    uint16_t crc;          /* low half of DQSpiCrc32() of seq, len and the payload */
+} DQSpiLogPage;
+
+/* position of a reader, can be saved and used again after DQSpiLogOpen() */
+typedef struct {
+    uint32_t seq;          /* next page */
+    uint32_t lost;         /* pages erased before they were read, or damaged */
+} DQSpiLogCursor;
+
+typedef struct {
+    uint32_t head;         /* seq of the next page programmed */
+    uint32_t tail;         /* seq of the oldest page on the flash */
+    uint32_t bytes;        /* written since DQSpiLogOpen() */
+    uint32_t dropped;      /* bytes of the writes refused, RAM ring full */
+    uint32_t pages;        /* programmed */
+    uint32_t erases;
+    uint32_t suspends;
+    uint32_t errors;       /* failed programs and erases */
+    uint8_t queued;        /* pages waiting now */
+    uint8_t peak;          /* and at most */
+} DQSpiLogInfo;
+
+
+int8_t DQSpiLogOpen(void);
+int8_t DQSpiLogWrite(const void *dat, uint16_t len);
+int8_t DQSpiLogFlush(void);
+int8_t DQSpiLogPoll(void);
+int8_t DQSpiLogRewind(DQSpiLogCursor *c);
+int8_t DQSpiLogRead(DQSpiLogCursor *c, void *dat, uint16_t *len);
+int8_t DQSpiLogStats(DQSpiLogInfo *info);
+
+
+#endif
@@ -0,0 +1,58 @@
+
+#ifndef __DQSPI_PLAN_H__
+#define __DQSPI_PLAN_H__
+
+#include <stdint.h>
+
+#include "dqspi.h"
+
+
+/* Programming plan: the erases and page programs that turn the flash
+ * content into a new image, computed on the host (Tools/qplan) from the
+ * image and the one already on the device, executed by DQSpiPlanRun().
+ *
+ *   DQSpiPlanHdr | DQSpiPlanOp[count] | program data
+ *
+ * Program data is packed in the order of the program ops. Addresses are
+ * flash offsets (not 0x90000000 based).
+ *
+ * Size: the plan carries the bytes it programs, about the image size for
+ * a blank or unknown device, and Plan() needs all of it in RAM at once:
+ * what the loader RAM leaves for the host buffer (well under the F730's
+ * 256K), LOADER_MAILBOX_BUF_SIZE for LOADER_MBOX_PLAN. Larger plans are
+ * split by qplan -s into self-contained plans run in order. */
+
+#define DQSPI_PLAN_MAGIC     0x4E4C5051  /* "QPLN" */
+#define DQSPI_PLAN_VERSION   1
+
+/* the DQSpiExecBatch() op codes, the plan runs in batches */
+typedef enum {
+    DQSPI_PLAN_ERASE_4K = DQSPI_BATCH_ERASE_4K,
+    DQSPI_PLAN_ERASE_32K = DQSPI_BATCH_ERASE_32K,
+    DQSPI_PLAN_ERASE_64K = DQSPI_BATCH_ERASE_64K,
+    DQSPI_PLAN_ERASE_CHIP = DQSPI_BATCH_ERASE_CHIP,
+    DQSPI_PLAN_PROGRAM = DQSPI_BATCH_PROGRAM
+} DQSpiPlanOpId;
+
+typedef struct {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t reserved;
+    uint32_t count;        /* ops */
+    uint32_t data_len;     /* program data bytes after the ops */
+    uint32_t crc;          /* DQSpiCrc32() of everything after the header */
+} DQSpiPlanHdr;
+
+typedef struct {
+    uint8_t op;            /* DQSpiPlanOpId */
+    uint8_t reserved[3];
+    uint32_t addr;
+    uint32_t len;          /* program: bytes, may cross pages */
+} DQSpiPlanOp;
+
+
+int8_t DQSpiPlanCheck(const uint8_t *plan, uint32_t len);
+int8_t DQSpiPlanRun(const uint8_t *plan, uint32_t len);
+
+
+#endif
@@ -0,0 +1,68 @@
+
+#ifndef __DQSPI_SST_H__
+#define __DQSPI_SST_H__
+
+#include <stdint.h>
+
+
+/* Sorted table: read-only records of a 32-bit key and a value of
+ * val_len bytes, built on the host (Tools/sstgen) and searched in place
+ * through the XIP window, for calibration and translation tables.
+ *
+ *   DQSpiSstHdr | index levels, root first | keys | values
+ *
+ * The keys are stored in order, DQSPI_SST_KEYS to a 32-byte line (the
+ * D-cache line), the last line padded with DQSPI_SST_PAD. The index is
+ * an implicit B+ tree over the key lines: a node is one line of
+ * DQSPI_SST_KEYS keys with DQSPI_SST_FANOUT children, node n of a level
+ * has children n * DQSPI_SST_FANOUT + i of the next level (the key lines
+ * below the last one), and its key i is the first key under child i + 1,
+ * DQSPI_SST_PAD for a child that does not exist. The root is one node,
+ * levels is 0 when the keys fit one line.
+ *
+ * A lookup reads one line per level, one key line and the value:
+ * log9(count / 8) + 2 lines, where a binary search over the keys reads
+ * about log2(count) - 2. The top levels are a few lines every lookup
+ * shares, they stay in the D-cache.
+ *
+ * Value i, of the i-th key in order, is at values + i * val_len. Offsets
+ * are from the table start, sections start on a line, all little
+ * endian. DQSPI_SST_PAD is not a valid key. */
+#define DQSPI_SST_MAGIC      0x54535351  /* "QSST" */
+#define DQSPI_SST_VERSION    1
+
+#define DQSPI_SST_LINE       32
+#define DQSPI_SST_KEYS       (DQSPI_SST_LINE / 4)
+#define DQSPI_SST_FANOUT     (DQSPI_SST_KEYS + 1)
+#define DQSPI_SST_PAD        0xFFFFFFFFUL
+/* 9^8 key lines: more keys than the flash holds */
+#define DQSPI_SST_LEVELS_MAX 8
+
+typedef struct {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t val_len;      /* bytes per value, 0: a set of keys */
+    uint32_t count;        /* records */
+    uint32_t levels;       /* index levels */
+    uint32_t level[DQSPI_SST_LEVELS_MAX];  /* offset of each level, root first */
+    uint32_t keys;         /* offset of the key lines */
+    uint32_t values;       /* offset of the values */
+    uint32_t size;         /* table bytes, header included */
+    uint32_t crc;          /* DQSpiCrc32() of everything after the header */
+} DQSpiSstHdr;
+
+/* an open table, in the XIP window */
+typedef struct {
+    const DQSpiSstHdr *hdr;
+    const uint8_t *base;
+} DQSpiSst;
+
+
+int8_t DQSpiSstOpen(DQSpiSst *t, uint32_t addr);
+int8_t DQSpiSstClose(DQSpiSst *t);
+int8_t DQSpiSstCheck(const DQSpiSst *t);
+const void *DQSpiSstFind(const DQSpiSst *t, uint32_t key);
+const void *DQSpiSstFloor(const DQSpiSst *t, uint32_t key, uint32_t *found);
+
+
+#endif
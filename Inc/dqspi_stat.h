@@ -0,0 +1,103 @@
+
+#ifndef __DQSPI_STAT_H__
+#define __DQSPI_STAT_H__
+
+#include <stdint.h>
+
+#include "dqspi.h"
+
+
+/* Per-operation timing of the QSPI driver, DWT cycle counter based.
+ * Results live in DQSpiStatsBlock: after a programming session dump it
+ * with GDB (dump binary value stats.bin DQSpiStatsBlock) or read the
+ * symbol address with CubeProgrammer. The block and the trace ring are
+ * in .noinit and add up over the Init() calls of a session; they are
+ * reset when magic or size do not match (power-up, another build). */
+
+#define DQSPI_STATS_MAGIC    0x54535144  /* "DQST" */
+#define DQSPI_STAT_BUCKETS   32          /* bucket n: [2^n, 2^(n+1)) cycles */
+
+typedef enum {
+    DQSPI_OP_WREN = 0,
+    DQSPI_OP_PROGRAM,
+    DQSPI_OP_ERASE_4K,
+    DQSPI_OP_ERASE_32K,
+    DQSPI_OP_ERASE_64K,
+    DQSPI_OP_ERASE_CHIP,
+    DQSPI_OP_READ,
+    DQSPI_OP_RESET,
+    DQSPI_OP_MAP,          /* indirect -> memory-mapped */
+    DQSPI_OP_UNMAP,        /* memory-mapped -> indirect */
+    DQSPI_OP_OTHER,        /* status/security register writes */
+    DQSPI_OP_NUM
+} DQSpiOpId;
+
+typedef struct {
+    uint32_t count;
+    uint32_t errors;
+    uint32_t min;
+    uint32_t max;
+    uint64_t total;
+    uint32_t hist[DQSPI_STAT_BUCKETS];
+} DQSpiOpStat;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t cpu_hz;       /* SystemCoreClock when the block was reset */
+    uint32_t size;         /* sizeof(DQSpiStats) */
+    DQSpiOpStat op[DQSPI_OP_NUM];
+} DQSpiStats;
+
+
+/* Trace record, one per command. On ITM it goes out as 5 words on
+ * DQSPI_TRACE_PORT, the first one carries DQSPI_TRACE_MARK in the low
+ * byte so the host decoder (Tools/itmdec) can resynchronise. */
+#define DQSPI_TRACE_MARK     0xA5
+#define DQSPI_TRACE_MAGIC    0x52545144  /* "DQTR" */
+
+typedef struct {
+    uint8_t mark;
+    uint8_t op;            /* DQSpiOpId */
+    uint8_t opcode;        /* flash instruction, 0 if none */
+    int8_t result;
+    uint32_t addr;
+    uint32_t len;
+    uint32_t t0;           /* DWT->CYCCNT at start */
+    uint32_t t1;           /* DWT->CYCCNT at end */
+} DQSpiTraceRec;
+
+/* RAM fallback: head counts every record written, the last
+ * DQSPI_TRACE_RING are kept */
+typedef struct {
+    uint32_t magic;
+    uint32_t cpu_hz;
+    uint32_t size;
+    volatile uint32_t head;
+    DQSpiTraceRec rec[DQSPI_TRACE_RING];
+} DQSpiTrace;
+
+
+#define DQSPI_PROBES         (DQSPI_STATS || DQSPI_TRACE)
+
+#if DQSPI_STATS
+extern DQSpiStats DQSpiStatsBlock;
+#endif
+#if DQSPI_TRACE
+extern DQSpiTrace DQSpiTraceRing;
+#endif
+
+#if DQSPI_PROBES
+uint32_t DQSpiStatBegin(void);
+void DQSpiStatEnd(uint32_t t0, DQSpiOpId op, uint8_t opcode, uint32_t addr, uint32_t len, int8_t ret);
+
+#define DQSPI_STAT_BEGIN(t)                            uint32_t t = DQSpiStatBegin()
+#define DQSPI_STAT_END(t, op, opcode, addr, len, ret)  DQSpiStatEnd(t, op, opcode, addr, len, ret)
+#else
+#define DQSPI_STAT_BEGIN(t)
+#define DQSPI_STAT_END(t, op, opcode, addr, len, ret)
+#endif
+
+void DQSpiStatReset(void);
+
+
+#endif
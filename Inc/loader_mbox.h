@@ -0,0 +1,113 @@
+
+#ifndef __LOADER_MBOX_H__
+#define __LOADER_MBOX_H__
+
+#include <stdint.h>
+
+
+/* Mailbox programming mode: instead of one Write() call per buffer, the
+ * host streams buffers into a RAM ring over SWD while the loader programs
+ * the previous ones, so link transfers and flash busy time overlap.
+ *
+ * Protocol (all words little endian, LoaderMbox at LOADER_MAILBOX_ADDR):
+ *
+ *  1. Call Init() as usual. It fills the read-only part of the mailbox
+ *     (magic, version, nbuf, buf_size) and zeroes head/tail.
+ *  2. Start Mailbox() (set PC, LR to LoaderMboxTrap, resume). It sets
+ *     status to RUNNING and polls head.
+ *  3. Host, for each request, while the target runs:
+ *       wait until head - tail < nbuf
+ *       i = head % nbuf
+ *       write the data to buf[i], then desc[i] (op, addr, len, crc)
+ *       write head + 1              <- publishes the slot
+ *  4. The loader runs desc[tail % nbuf] and increments tail, in order.
+ *     On failure it stops with status ERROR, error = index of the
+ *     failing request, and returns 0.
+ *  5. The last request is LOADER_MBOX_END: Mailbox() finishes, status
+ *     DONE, and returns 1 into LoaderMboxTrap.
+ *
+ * head and tail are free-running counters. The loader gives up with
+ * status TIMEOUT when head does not move for LOADER_MAILBOX_TIMEOUT ms.
+ * Host-written and loader-written fields sit in separate cache lines,
+ * the loader invalidates/cleans them around every access. */
+#ifndef LOADER_MAILBOX
+#define LOADER_MAILBOX       0
+#endif
+
+#ifndef LOADER_MAILBOX_BUFS
+#define LOADER_MAILBOX_BUFS  4
+#endif
+
+#ifndef LOADER_MAILBOX_BUF_SIZE
+#define LOADER_MAILBOX_BUF_SIZE 0x2000
+#endif
+
+/* must match the .loader_mbox section of the linker script */
+#ifndef LOADER_MAILBOX_ADDR
+#define LOADER_MAILBOX_ADDR  0x20020000UL
+#endif
+
+#ifndef LOADER_MAILBOX_TIMEOUT
+#define LOADER_MAILBOX_TIMEOUT 5000
+#endif
+
+#define LOADER_MBOX_MAGIC    0x58424D4C  /* "LMBX" */
+#define LOADER_MBOX_VERSION  1
+
+typedef enum {
+    LOADER_MBOX_WRITE = 1,     /* program len bytes of buf at addr */
+    LOADER_MBOX_ERASE,         /* erase the sectors of [addr, addr + len) */
+    LOADER_MBOX_PLAN,          /* run the Tools/qplan plan in buf */
+    LOADER_MBOX_END            /* leave Mailbox() */
+} LoaderMboxOp;
+
+typedef enum {
+    LOADER_MBOX_IDLE = 0,
+    LOADER_MBOX_RUNNING,
+    LOADER_MBOX_DONE,
+    LOADER_MBOX_ERROR,
+    LOADER_MBOX_TIMEOUT
+} LoaderMboxStatus;
+
+#define LOADER_MBOX_F_CRC    0x01        /* check crc (DQSpiCrc32) of the data */
+
+typedef struct {
+    uint8_t op;            /* LoaderMboxOp */
+    uint8_t flags;
+    uint16_t reserved;
+    uint32_t addr;         /* loader address, 0x90000000 based */
+    uint32_t len;
+    uint32_t crc;
+} LoaderMboxDesc;
+
+typedef struct {
+    /* set by Init() */
+    uint32_t magic;
+    uint32_t version;
+    uint32_t nbuf;
+    uint32_t buf_size;
+    uint32_t reserved0[4];
+    /* loader -> host */
+    volatile uint32_t tail;
+    volatile uint32_t status;  /* LoaderMboxStatus */
+    volatile uint32_t error;   /* request that failed */
+    volatile uint32_t bytes;   /* programmed so far */
+    uint32_t reserved1[4];
+    /* host -> loader */
+    volatile uint32_t head;
+    uint32_t reserved2[7];
+    LoaderMboxDesc desc[LOADER_MAILBOX_BUFS] __attribute__((aligned(32)));
+    uint8_t buf[LOADER_MAILBOX_BUFS][LOADER_MAILBOX_BUF_SIZE] __attribute__((aligned(32)));
+} LoaderMbox;
+
+
+#if LOADER_MAILBOX
+extern LoaderMbox LoaderMboxBlock;
+
+void LoaderMboxInit(void);
+int8_t LoaderMboxService(void);
+void LoaderMboxTrap(void);
+#endif
+
+
+#endif
@@ -0,0 +1,74 @@
+
+#ifndef __LOADER_REC_H__
+#define __LOADER_REC_H__
+
+#include <stdint.h>
+
+
+/* Call recorder of the loader entry points: every Init/Write/SectorErase/
+ * MassErase/Plan/Mailbox call the host makes is logged to LoaderRecLog, with
+ * its arguments, a CRC32 of the Write buffer and its duration. After a
+ * programming session dump it with GDB
+ *     dump binary value rec.bin LoaderRecLog
+ * and feed it to Tools/replay. */
+#ifndef LOADER_RECORD
+#define LOADER_RECORD        0
+#endif
+
+/* calls kept, later ones are only counted */
+#ifndef LOADER_RECORD_SIZE
+#define LOADER_RECORD_SIZE   1024
+#endif
+
+#define LOADER_REC_MAGIC     0x4352444C  /* "LDRC" */
+
+typedef enum {
+    LOADER_CALL_INIT = 0,
+    LOADER_CALL_WRITE,
+    LOADER_CALL_ERASE,
+    LOADER_CALL_MASS,
+    LOADER_CALL_PLAN,
+    LOADER_CALL_MAILBOX,
+    LOADER_CALL_NUM
+} LoaderCallId;
+
+typedef struct {
+    uint8_t call;          /* LoaderCallId */
+    uint8_t ret;           /* value returned to the programmer */
+    uint16_t reserved;
+    uint32_t addr;         /* Write address, SectorErase start, Plan buffer */
+    uint32_t arg;          /* Write/Plan size, SectorErase end, Mailbox bytes */
+    uint32_t digest;       /* CRC32 of the Write/Plan buffer, 0 otherwise */
+    uint32_t cycles;       /* duration, DWT cycles (wraps after ~19 s) */
+    uint32_t ms;           /* duration, HAL ticks */
+} LoaderRecEntry;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t cpu_hz;
+    uint32_t size;
+    volatile uint32_t count;   /* every call, the first size are kept */
+    LoaderRecEntry e[LOADER_RECORD_SIZE];
+} LoaderRec;
+
+typedef struct {
+    uint32_t cycles;
+    uint32_t tick;
+} LoaderRecStamp;
+
+
+#if LOADER_RECORD
+extern LoaderRec LoaderRecLog;
+
+void LoaderRecBegin(LoaderRecStamp *t);
+void LoaderRecEnd(const LoaderRecStamp *t, LoaderCallId call, uint32_t addr, uint32_t arg, const uint8_t *buf, int ret);
+
+#define LOADER_REC_BEGIN(t)                             LoaderRecStamp t; LoaderRecBegin(&t)
+#define LOADER_REC_END(t, call, addr, arg, buf, ret)    LoaderRecEnd(&t, call, addr, arg, buf, ret)
+#else
+#define LOADER_REC_BEGIN(t)
+#define LOADER_REC_END(t, call, addr, arg, buf, ret)
+#endif
+
+
+#endif
@@ -6,10 +6,22 @@
 #include "main.h"
 #include "Dev_Inf.h"
 #include "dqspi.h"
+#include "dqspi_plan.h"
+#include "loader_mbox.h"
+#include "loader_rec.h"
 
-#define DSPI_START_ADDR_MAP          0x90000000
+#define DSPI_START_ADDR_MAP          DQSPI_MAP_ADDR
+
+/* blocks erased per DQSpiExecBatch() call */
+#define LOADER_ERASE_BATCH           8
 
 extern uint32_t g_pfnVectors;
+extern uint32_t __bss_start__[], __bss_end__[];
+
+/* unique ID of the board flash, filled by Init(), zero if it could not be
+ * read: the host reads it by symbol to stamp per-board data in the same
+ * programming session */
+uint8_t LoaderUniqueId[FLASH_UID_SIZE] __attribute__((used));
 
 int main(void);
 void SystemInit(void);
@@ -31,22 +43,31 @@ void SystemInit(void);
   */
 int Write(uint32_t Address, uint32_t Size, uint32_t Buffer)
 {
+    DQSpiOp op = {0};
+    int ret = 1;
+
 	HAL_ResumeTick();
+	LOADER_REC_BEGIN(t);
 
 	DQSpiReset();
 
-    if (DQSpiWrite(Address-DSPI_START_ADDR_MAP, (unsigned char *)Buffer, Size) != 0) {
-    	HAL_SuspendTick();
+    op.op = DQSPI_BATCH_PROGRAM;
+    op.addr = Address-DSPI_START_ADDR_MAP;
+    op.len = Size;
+    op.dat = (const uint8_t *)(uintptr_t)Buffer;
 
-        return 0;
+    if (DQSpiExecBatch(&op, 1, NULL) != 0) {
+        ret = 0;
+    }
+    else {
+        DQSpiReset();
+        DQSpiMemoryMapped();
     }
 
-	DQSpiReset();
-	DQSpiMemoryMapped();
-
+	LOADER_REC_END(t, LOADER_CALL_WRITE, Address, Size, (const uint8_t *)(uintptr_t)Buffer, ret);
 	HAL_SuspendTick();
 
-    return 1;
+    return ret;
 }
 
 /*******************************************************************************
@@ -61,9 +82,12 @@ int Write(uint32_t Address, uint32_t Size, uint32_t Buffer)
 ********************************************************************************/
 int SectorErase(uint32_t EraseStartAddress, uint32_t EraseEndAddress)
 {
-	uint32_t sct_start, sect_size, sct_end, i;
+	DQSpiOp ops[LOADER_ERASE_BATCH] = {0};
+	uint32_t sct_start, sect_size, sct_end, i, n;
+	int ret = 1;
 
 	HAL_ResumeTick();
+	LOADER_REC_BEGIN(t);
 
 	DQSpiFlashInfo(NULL, &sect_size, NULL, NULL);
 
@@ -75,42 +99,121 @@ int SectorErase(uint32_t EraseStartAddress, uint32_t EraseEndAddress)
     if (sct_start > sct_end)
     	sct_end = sct_start + 1;
 
-    for (i=sct_start; i!=sct_end; i++) {
-        if (DQSpiEraseBlock(i*sect_size) != 0) {
-        	HAL_SuspendTick();
-
-            return 0;
+    /* sect_size is the 32K block of Dev_Inf */
+    for (i=sct_start; i!=sct_end && ret != 0; ) {
+        for (n=0; n!=LOADER_ERASE_BATCH && i!=sct_end; n++, i++) {
+            ops[n].op = DQSPI_BATCH_ERASE_32K;
+            ops[n].addr = i*sect_size;
+        }
+        if (DQSpiExecBatch(ops, n, NULL) != 0) {
+            ret = 0;
         }
     }
 
-	DQSpiReset();
-	DQSpiMemoryMapped();
+    if (ret != 0) {
+        DQSpiReset();
+        DQSpiMemoryMapped();
+    }
 
+	LOADER_REC_END(t, LOADER_CALL_ERASE, EraseStartAddress, EraseEndAddress, NULL, ret);
 	HAL_SuspendTick();
 
-    return 1;
+    return ret;
 }
 
 
 int MassErase(void)
 {
+	int ret = 1;
+
+	HAL_ResumeTick();
+	LOADER_REC_BEGIN(t);
+
+	DQSpiReset();
+
+	if (DQSpiEraseChip() != 0) {
+		ret = 0;
+	}
+	else {
+		DQSpiReset();
+		DQSpiMemoryMapped();
+	}
+
+	LOADER_REC_END(t, LOADER_CALL_MASS, 0, 0, NULL, ret);
+	HAL_SuspendTick();
+
+	return ret;
+}
+
+
+/*******************************************************************************
+ Description :
+ Run a programming plan (Tools/qplan) the host placed in RAM: only the
+ erases and page programs of the bytes that changed
+ Inputs :
+ 				Buffer	: plan address
+ 				Size	: plan length in bytes, the whole plan in RAM: larger
+ 				          images go as several plans (qplan -s, see
+ 				          Inc/dqspi_plan.h)
+ outputs :
+ 				"1" : Operation succeeded
+ 				"0" : Operation failure
+********************************************************************************/
+int Plan(uint32_t Buffer, uint32_t Size)
+{
+	int ret = 1;
+
 	HAL_ResumeTick();
+	LOADER_REC_BEGIN(t);
 
 	DQSpiReset();
 
-	if (DQSpiEraseChip() == 0) {
-    	HAL_SuspendTick();
+	if (DQSpiPlanRun((const uint8_t *)(uintptr_t)Buffer, Size) != 0) {
+		ret = 0;
+	}
+	else {
+		DQSpiReset();
+		DQSpiMemoryMapped();
+	}
+
+	LOADER_REC_END(t, LOADER_CALL_PLAN, Buffer, Size, (const uint8_t *)(uintptr_t)Buffer, ret);
+	HAL_SuspendTick();
+
+	return ret;
+}
+
 
-		return 0;
+#if LOADER_MAILBOX
+/*******************************************************************************
+ Description :
+ Serve the RAM mailbox (Inc/loader_mbox.h) until the host posts END: the
+ host fills the next buffers over SWD while this one is programmed
+ outputs :
+ 				"1" : Operation succeeded
+ 				"0" : Operation failure, see LoaderMboxBlock.status
+********************************************************************************/
+int Mailbox(void)
+{
+	int ret = 1;
+
+	HAL_ResumeTick();
+	LOADER_REC_BEGIN(t);
+
+	DQSpiReset();
+
+	if (LoaderMboxService() != 0) {
+		ret = 0;
 	}
 
 	DQSpiReset();
 	DQSpiMemoryMapped();
 
+	LOADER_REC_END(t, LOADER_CALL_MAILBOX, 0, LoaderMboxBlock.bytes, NULL, ret);
 	HAL_SuspendTick();
 
-	return 1;
+	return ret;
 }
+#endif
 
 
 /**
@@ -128,11 +231,20 @@ int MassErase(void)
   */
 int Init(void)
 {
+    uint32_t *p;
     int ret;
 
+    /* the loader is entered without the startup code: .bss still holds
+     * what the previous session left */
+    for (p = __bss_start__; p != __bss_end__; p++) {
+        *p = 0;
+    }
+
+    LOADER_REC_BEGIN(t);
+
     __disable_irq();
     SystemInit();
-    SCB->VTOR = (uint32_t)&g_pfnVectors;
+    SCB->VTOR = (uint32_t)(uintptr_t)&g_pfnVectors;
     __enable_irq();
 
 	ret = main();
@@ -141,8 +253,16 @@ int Init(void)
 		ret = 0;
 	}
 
+	/* only a stamp for the host, the loader works without it */
+	DQSpiUniqueId(LoaderUniqueId);
+
+#if LOADER_MAILBOX
+	LoaderMboxInit();
+#endif
+
 	DQSpiMemoryMapped();
 
+	LOADER_REC_END(t, LOADER_CALL_INIT, 0, 0, NULL, ret);
 	HAL_SuspendTick();
 
     return ret;
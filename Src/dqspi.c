@@ -1,7 +1,10 @@
 
+#include <string.h>
+
 #include "main.h"
 
 #include "dqspi.h"
+#include "dqspi_stat.h"
 
 // W25Q32FV winbond
 
@@ -55,14 +58,22 @@
 
 #define BLOCK_ERASE_CMD                      0x52 // 32k block
 
+#define BLOCK64_ERASE_CMD                    0xD8 // 64k block
+
 #define CHIP_ERASE_CMD                       0xC7 // 0x60
 
 #define PROG_ERASE_RESUME_CMD                0x7A
 #define PROG_ERASE_SUSPEND_CMD               0x75
 
+/* Power Operations */
+#define POWER_DOWN_CMD                       0xB9
+#define RELEASE_POWER_DOWN_CMD               0xAB
+
 /* One-Time Programmable Operations */
 #define READ_UIC_ID_CMD                      0x4B
 #define PROG_SECURITY_REG_CMD                0x42
+#define ERASE_SECURITY_REG_CMD               0x44
+#define READ_SECURITY_REG_CMD                0x48
 
 /* Default dummy clocks cycles */
 #define DUMMY_CLOCK_CYCLES_READ              8
@@ -77,40 +88,253 @@
 #define W25Q32FV_FSR_BUSY                    ((uint8_t)0x01)    /*!< busy */
 #define W25Q32FV_FSR_WREN                    ((uint8_t)0x02)    /*!< write enable */
 #define W25Q32FV_FSR_QE                      ((uint8_t)0x02)    /*!< quad enable */
+#define W25Q32FV_FSR_LB1                     ((uint8_t)0x08)    /*!< security register 1 lock (SR2) */
+#define W25Q32FV_FSR_SUS                     ((uint8_t)0x80)    /*!< erase/program suspended (SR2) */
 
 /* altternate bytes */
 #define W25Q32FV_ALTERNATE_BYTE_M            0xFF
+#define W25Q32FV_CONTINUOUS_READ_M           0x20    /* M5-4 = 10 */
 
 /* flash info */
 #define W25Q32FV_FLASH_SIZE                  0x00400000UL // 32Mbit =>4Mbyte
 #define W25Q32FV_SECTOR_SIZE                 0x00001000UL // 4K
 #define W25Q32FV_BLOCK_SIZE                  0x00008000UL // 32K
+#define W25Q32FV_BLOCK64_SIZE                0x00010000UL // 64K
 #define W25Q32FV_PAGE_SIZE                   0x00000100UL // 256 bytes
+#define W25Q32FV_SECURITY_REG_NUM            3
+#define W25Q32FV_SECURITY_REG_SIZE           0x00000100UL // 256 bytes
+#define W25Q32FV_UID_SIZE                    FLASH_UID_SIZE
+
+/* max program/erase times (ms), datasheet tPP, tSE, tBE1, tBE2, tCE + margin */
+#define W25Q32FV_PAGE_PROG_MAX_TIME          10
+#define W25Q32FV_SECTOR_ERASE_MAX_TIME       1000
+#define W25Q32FV_BLOCK_ERASE_MAX_TIME        3000
+#define W25Q32FV_BLOCK64_ERASE_MAX_TIME      3000
+#define W25Q32FV_CHIP_ERASE_MAX_TIME         60000
+#define W25Q32FV_STATUS_WRITE_MAX_TIME       100
+
+/* power-down enter (tDP) and release (tRES1) times, us */
+#define W25Q32FV_TDP                         3
+#define W25Q32FV_TRES1                       3
 
 
 extern QSPI_HandleTypeDef hqspi;
 
+#if DQSPI_WRITE_BUFFER
+#define WBUF_EMPTY                           0xFFFFFFFFUL
+
+/* write-back page buffer: pending bytes are ANDed like the flash does */
+static struct {
+	uint32_t page;       /* page address, WBUF_EMPTY if nothing pending */
+	uint32_t tick;       /* HAL tick of the first pending write */
+	uint16_t lo, hi;     /* dirty range [lo, hi) inside the page */
+	uint8_t dat[W25Q32FV_PAGE_SIZE];
+	uint8_t mask[W25Q32FV_PAGE_SIZE / 8];   /* bytes written, the rest is 0xFF fill */
+} wbuf = {.page = WBUF_EMPTY};
+#endif
+
+#if DQSPI_READ_CACHE_LINES
+#if (DQSPI_READ_CACHE_LINE_SIZE & (DQSPI_READ_CACHE_LINE_SIZE - 1)) != 0
+#error "DQSPI_READ_CACHE_LINE_SIZE must be a power of 2"
+#endif
+
+/* read cache lines live in SRAM1 (see .dqspi_sram in the linker script) */
+static uint8_t rcache_dat[DQSPI_READ_CACHE_LINES][DQSPI_READ_CACHE_LINE_SIZE] __attribute__((section(".dqspi_sram"), aligned(32)));
+
+static struct {
+	uint32_t addr;
+	uint32_t stamp;      /* LRU stamp, 0 if the line is free */
+} rcache_tag[DQSPI_READ_CACHE_LINES];
+
+static uint32_t rcache_clock;
+static uint32_t rcache_hit, rcache_miss;
+#endif
+
+#if DQSPI_STREAM
+static DQSpiStream *stream;  /* the open stream, the controller serves one */
+#endif
+
+#if DQSPI_LOG
+/* asynchronous program/erase: one on the bus, one erase suspended */
+#define ASYNC_IDLE                           0
+#define ASYNC_PROG                           1
+#define ASYNC_ERASE                          2
+
+static struct {
+	volatile uint8_t op;         /* ASYNC_xxx on the bus, the controller is taken */
+	uint8_t suspended;           /* reads and programs allowed meanwhile */
+	uint32_t erase_addr;         /* block of the running or suspended erase */
+	uint32_t tick;               /* start of op */
+	uint32_t timeout;            /* ms, checked by DQSpiPoll() */
+	DQSpiAsyncDone done;         /* of op */
+	DQSpiAsyncDone erase_done;   /* of the suspended erase */
+} async;
+
+static void DQSpiAsyncEnd(int8_t ret);
+#endif
+
+/* controller mode, only left for indirect when no mapping is live */
+#define QSPI_MODE_INDIRECT                   0
+#define QSPI_MODE_MAPPED                     1
+
+static uint8_t qspi_mode = QSPI_MODE_INDIRECT;
+static uint32_t map_refs;
+
+/* memory-mapped profile, continuous read mode left armed in the flash */
+static DQSpiMapProfile map_profile;
+static uint8_t map_continuous;
+
+/* auto power-down: idle time before sleeping (0: off) and counters */
+static uint32_t pd_idle;
+static uint32_t pd_last;     /* tick of the last driver access */
+static uint32_t pd_since;    /* tick the flash entered power-down */
+static uint8_t pd_state;
+static uint32_t pd_time, pd_wakeups;
+
+/* page read back by verify and the CRC checks */
+static uint8_t rd_page[W25Q32FV_PAGE_SIZE] __attribute__((aligned(4)));
+
+#if DQSPI_VERIFY
+static uint32_t verify_pages, verify_retries;
+static uint32_t verify_bad = 0xFFFFFFFF;   /* last page that failed */
+#endif
+
+#if DQSPI_MANIFEST
+#define MAN_SECTORS          (DQSPI_MANIFEST_SIZE / W25Q32FV_SECTOR_SIZE)
+#define MAN_MAGIC            0x4E414D51     /* "QMAN" */
+#define MAN_ERASED_CRC       0xF154670AUL   /* DQSpiCrc32() of an erased sector */
+#define MAN_FULL             W25Q32FV_SECTOR_SIZE
+#define MAN_REC_BUF          (W25Q32FV_PAGE_SIZE / sizeof(DQSpiManRec))
+
+#if ((DQSPI_MANIFEST_BASE | DQSPI_MANIFEST_SIZE | DQSPI_MANIFEST_ADDR) & (W25Q32FV_SECTOR_SIZE - 1)) != 0
+#error "DQSPI_MANIFEST_BASE/SIZE/ADDR must be 4K aligned"
+#endif
+#if MAN_SECTORS == 0 || MAN_SECTORS > 511
+#error "DQSPI_MANIFEST_SIZE: 1 to 511 sectors"
+#endif
+#if DQSPI_MANIFEST_ADDR + 2 * W25Q32FV_SECTOR_SIZE > DQSPI_MANIFEST_BASE && DQSPI_MANIFEST_ADDR < DQSPI_MANIFEST_BASE + DQSPI_MANIFEST_SIZE
+#error "the manifest log cannot be inside the region it covers"
+#endif
+
+/* log sector: a header {MAN_MAGIC, seq}, then a record per CRC change,
+ * the latest one of a sector wins and no record means erased; the sector
+ * with the highest seq is current */
+typedef struct {
+    uint16_t sector;
+    uint16_t check;         /* ~sector */
+    uint32_t crc;
+} DQSpiManRec;
+
+/* CRC table as on the flash plus the changes since, from the first
+ * program/erase to the next sync */
+static struct {
+    uint8_t loaded;
+    uint32_t seq;
+    uint32_t log;           /* current log sector */
+    uint32_t off;           /* next free record, MAN_FULL: compact first */
+    uint8_t writing;        /* the manifest's own program/erase */
+    uint8_t stale;          /* log damaged or erased, rewrite it */
+    uint8_t pending;        /* dirty marks made while the log could not be
+                             * read, MAN_PEND_LOG: the log was hit too */
+    uint8_t dirty[(MAN_SECTORS + 7) / 8];
+    uint32_t crc[MAN_SECTORS];
+} man;
+
+#define MAN_PEND_REGION     1
+#define MAN_PEND_LOG        2
+
+static DQSpiManRec man_rec[MAN_REC_BUF];
+
+static void DQSpiManDirty(uint32_t addr, uint32_t len);
+#endif
+
+/* unique ID, read once */
+static uint8_t uid[W25Q32FV_UID_SIZE];
+static uint8_t uid_valid;
+
+/* range changed since mapped mode was left, stale in the CPU caches */
+static uint32_t xip_lo = W25Q32FV_FLASH_SIZE, xip_hi;
+
+
+/* Commands shared by every program/erase sequence, built once */
+static QSPI_CommandTypeDef wren_cmd = {
+	.InstructionMode = QSPI_INSTRUCTION_1_LINE,
+	.Instruction = WRITE_ENABLE_CMD,
+	.AddressMode = QSPI_ADDRESS_NONE,
+	.AlternateByteMode = QSPI_ALTERNATE_BYTES_NONE,
+	.DataMode = QSPI_DATA_NONE,
+	.DummyCycles = 0,
+	.DdrMode = QSPI_DDR_MODE_DISABLE,
+	.DdrHoldHalfCycle = QSPI_DDR_HHC_ANALOG_DELAY,
+	.SIOOMode = QSPI_SIOO_INST_EVERY_CMD
+};
+
+static QSPI_CommandTypeDef rdsr1_cmd = {
+	.InstructionMode = QSPI_INSTRUCTION_1_LINE,
+	.Instruction = READ_STATUS_REG1_CMD,
+	.AddressMode = QSPI_ADDRESS_NONE,
+	.AlternateByteMode = QSPI_ALTERNATE_BYTES_NONE,
+	.DataMode = QSPI_DATA_1_LINE,
+	.DummyCycles = 0,
+	.DdrMode = QSPI_DDR_MODE_DISABLE,
+	.DdrHoldHalfCycle = QSPI_DDR_HHC_ANALOG_DELAY,
+	.SIOOMode = QSPI_SIOO_INST_EVERY_CMD
+};
+
+/* page program, address and length set per page */
+static const QSPI_CommandTypeDef prog_cmd = {
+	.InstructionMode = QSPI_INSTRUCTION_1_LINE,
+	.Instruction = PAGE_PROG_CMD,
+	.AddressMode = QSPI_ADDRESS_1_LINE,
+	.AddressSize = QSPI_ADDRESS_24_BITS,
+	.DataMode = QSPI_DATA_1_LINE,
+	.AlternateByteMode = QSPI_ALTERNATE_BYTES_NONE,
+	.DummyCycles = 0,
+	.DdrMode = QSPI_DDR_MODE_DISABLE,
+	.DdrHoldHalfCycle = QSPI_DDR_HHC_ANALOG_DELAY,
+	.SIOOMode = QSPI_SIOO_INST_EVERY_CMD
+};
+
+/* indirect read, dual output fast read; address and length set per call */
+static const QSPI_CommandTypeDef read_cmd = {
+	.InstructionMode = QSPI_INSTRUCTION_1_LINE,
+	.Instruction = DUAL_OUT_FAST_READ_CMD,
+	.AddressMode = QSPI_ADDRESS_1_LINE,
+	.AddressSize = QSPI_ADDRESS_24_BITS,
+	.DataMode = QSPI_DATA_2_LINES,
+	.AlternateByteMode = QSPI_ALTERNATE_BYTES_NONE,
+	.AlternateBytesSize = 0,
+	.AlternateBytes = 0,
+	.DummyCycles = DUMMY_CLOCK_CYCLES_READ,
+	.DdrMode = QSPI_DDR_MODE_DISABLE,
+	.DdrHoldHalfCycle = QSPI_DDR_HHC_ANALOG_DELAY,
+	.SIOOMode = QSPI_SIOO_INST_EVERY_CMD
+};
+
+static QSPI_AutoPollingTypeDef busy_poll = {
+	.Match = 0x00,
+	.Mask = W25Q32FV_FSR_BUSY,
+	.MatchMode = QSPI_MATCH_MODE_AND,
+	.StatusBytesSize = 1,
+	.Interval = 0x10,
+	.AutomaticStop = QSPI_AUTOMATIC_STOP_ENABLE
+};
+
 
 static int8_t DQSpiWriteEnable(void)
 {
-	QSPI_CommandTypeDef sCommand = {0};
+#if DQSPI_STRICT_WEL
 	QSPI_AutoPollingTypeDef sConfig = {0};
+#endif
+	int8_t ret = -1;
+	DQSPI_STAT_BEGIN(t);
 
 	/* Enable write operations ------------------------------------------ */
-	sCommand.InstructionMode = QSPI_INSTRUCTION_1_LINE;
-	sCommand.Instruction = WRITE_ENABLE_CMD;
-	sCommand.AddressMode = QSPI_ADDRESS_NONE;
-	sCommand.AlternateByteMode = QSPI_ALTERNATE_BYTES_NONE;
-	sCommand.DataMode = QSPI_DATA_NONE;
-	sCommand.DummyCycles = 0;
-	sCommand.DdrMode = QSPI_DDR_MODE_DISABLE;
-	sCommand.DdrHoldHalfCycle = QSPI_DDR_HHC_ANALOG_DELAY;
-	sCommand.SIOOMode = QSPI_SIOO_INST_EVERY_CMD;
-
-	if (HAL_QSPI_Command(&hqspi, &sCommand, HAL_QSPI_TIMEOUT_DEFAULT_VALUE) != HAL_OK) {
-	  return -1;
+	if (HAL_QSPI_Command(&hqspi, &wren_cmd, HAL_QSPI_TIMEOUT_DEFAULT_VALUE) == HAL_OK) {
+	  ret = 0;
 	}
 
+#if DQSPI_STRICT_WEL
 	/* Configure automatic polling mode to wait for write enabling ---- */
 	sConfig.Match = W25Q32FV_FSR_WREN;
 	sConfig.Mask = W25Q32FV_FSR_WREN;
@@ -119,48 +343,313 @@ static int8_t DQSpiWriteEnable(void)
 	sConfig.Interval = 0x10;
 	sConfig.AutomaticStop = QSPI_AUTOMATIC_STOP_ENABLE;
 
-	sCommand.Instruction = READ_STATUS_REG1_CMD;
-	sCommand.DataMode = QSPI_DATA_1_LINE;
+	if (ret == 0 && HAL_QSPI_AutoPolling(&hqspi, &rdsr1_cmd, &sConfig, HAL_QSPI_TIMEOUT_DEFAULT_VALUE) != HAL_OK) {
+	  ret = -1;
+	}
+#endif
+
+	DQSPI_STAT_END(t, DQSPI_OP_WREN, WRITE_ENABLE_CMD, 0, 0, ret);
 
-	if (HAL_QSPI_AutoPolling(&hqspi, &sCommand, &sConfig, HAL_QSPI_TIMEOUT_DEFAULT_VALUE) != HAL_OK) {
-	  return -1;
+	return ret;
+}
+
+
+static int8_t DQSpiAutoPollingMemReady(uint32_t timeout)
+{
+	/* Configure automatic polling mode to wait for memory ready ------ */
+	if (HAL_QSPI_AutoPolling(&hqspi, &rdsr1_cmd, &busy_poll, timeout) != HAL_OK) {
+		return -1;
 	}
 
 	return 0;
 }
 
 
-static uint8_t DQSpiAutoPollingMemReady(void)
+/* During an erase suspend the part ignores erases, status and security
+ * register writes, and programs into the suspended block: BUSY would
+ * clear as if they had run. DQSPI_BUSY for those. */
+static int8_t DQSpiSuspendCheck(uint32_t instruction, uint32_t addr, uint32_t len)
 {
-	QSPI_CommandTypeDef sCommand = {0};
-	QSPI_AutoPollingTypeDef sConfig = {0};
+#if DQSPI_LOG
+	if (async.suspended &&
+	    (instruction != prog_cmd.Instruction ||
+	     (addr < async.erase_addr + W25Q32FV_BLOCK64_SIZE && addr + len > async.erase_addr))) {
+		return DQSPI_BUSY;
+	}
+#endif
 
-	/* Configure automatic polling mode to wait for memory ready ------ */
-	sCommand.InstructionMode = QSPI_INSTRUCTION_1_LINE;
-	sCommand.Instruction = READ_STATUS_REG1_CMD;
-	sCommand.AddressMode = QSPI_ADDRESS_NONE;
-	sCommand.AlternateByteMode = QSPI_ALTERNATE_BYTES_NONE;
-	sCommand.DataMode = QSPI_DATA_1_LINE;
-	sCommand.DummyCycles = 0;
-	sCommand.DdrMode = QSPI_DDR_MODE_DISABLE;
-	sCommand.DdrHoldHalfCycle  = QSPI_DDR_HHC_ANALOG_DELAY;
-	sCommand.SIOOMode = QSPI_SIOO_INST_EVERY_CMD;
-
-	sConfig.Match = 0x00;
-	sConfig.Mask = W25Q32FV_FSR_BUSY;
-	sConfig.MatchMode = QSPI_MATCH_MODE_AND;
-	sConfig.StatusBytesSize = 1;
-	sConfig.Interval = 0x10;
-	sConfig.AutomaticStop = QSPI_AUTOMATIC_STOP_ENABLE;
+	return 0;
+}
+
+
+#if DQSPI_PROBES
+static DQSpiOpId DQSpiStatOp(uint32_t instruction)
+{
+	switch (instruction) {
+	case PAGE_PROG_CMD:
+		return DQSPI_OP_PROGRAM;
+	case SECTOR_ERASE_CMD:
+		return DQSPI_OP_ERASE_4K;
+	case BLOCK_ERASE_CMD:
+		return DQSPI_OP_ERASE_32K;
+	case BLOCK64_ERASE_CMD:
+		return DQSPI_OP_ERASE_64K;
+	case CHIP_ERASE_CMD:
+		return DQSPI_OP_ERASE_CHIP;
+	default:
+		return DQSPI_OP_OTHER;
+	}
+}
+#endif
+
+
+/* WREN + program/erase command (+ data) + BUSY polling in one call.
+ * WEL is polled only with DQSPI_STRICT_WEL: on this part WREN latches
+ * immediately and the extra auto-polling costs a full controller round
+ * trip per page. With crc, the CRC32 of the data is computed while the
+ * flash is busy. */
+static int8_t DQSpiWriteSeq(QSPI_CommandTypeDef *cmd, uint8_t *dat, uint32_t timeout, uint32_t *crc)
+{
+	int8_t ret = -1;
+	DQSPI_STAT_BEGIN(t);
+
+	if (DQSpiSuspendCheck(cmd->Instruction, cmd->Address, cmd->NbData) != 0) {
+		return DQSPI_BUSY;
+	}
+
+	if (DQSpiWriteEnable() == 0 &&
+	    HAL_QSPI_Command(&hqspi, cmd, HAL_QPSI_TIMEOUT_DEFAULT_VALUE) == HAL_OK &&
+	    (dat == NULL || HAL_QSPI_Transmit(&hqspi, dat, HAL_QPSI_TIMEOUT_DEFAULT_VALUE) == HAL_OK)) {
+		if (crc != NULL) {
+			*crc = DQSpiCrc32(0, dat, cmd->NbData);
+		}
+		ret = DQSpiAutoPollingMemReady(timeout);
+	}
+
+	DQSPI_STAT_END(t, DQSpiStatOp(cmd->Instruction), cmd->Instruction, cmd->Address, cmd->NbData, ret);
+
+	return ret;
+}
+
+
+#if DQSPI_READ_CACHE_LINES
+static void DQSpiCacheInvalidate(uint32_t addr, uint32_t len)
+{
+	uint32_t i;
+
+	for (i = 0; i != DQSPI_READ_CACHE_LINES; i++) {
+		if (rcache_tag[i].addr < addr + len && rcache_tag[i].addr + DQSPI_READ_CACHE_LINE_SIZE > addr) {
+			rcache_tag[i].stamp = 0;
+		}
+	}
+}
+#endif
+
+
+#if DQSPI_WRITE_BUFFER
+/* pending data inside an erased range would be erased anyway: drop it */
+static void DQSpiWbufDrop(uint32_t addr, uint32_t len)
+{
+	if (wbuf.page != WBUF_EMPTY && wbuf.page >= addr && wbuf.page < addr + len) {
+		wbuf.page = WBUF_EMPTY;
+	}
+}
+
+
+/* apply the pending bytes to data just read from the flash */
+static void DQSpiWbufOverlay(uint32_t addr, uint8_t *dat, uint32_t len)
+{
+	uint32_t a, b;
+
+	if (wbuf.page == WBUF_EMPTY)
+		return;
+
+	a = wbuf.page + wbuf.lo;
+	b = wbuf.page + wbuf.hi;
+	if (a < addr)
+		a = addr;
+	if (b > addr + len)
+		b = addr + len;
+
+	for (; a < b; a++) {
+		dat[a - addr] &= wbuf.dat[a - wbuf.page];
+	}
+}
+#endif
+
+
+/* the XIP view of [addr, addr + len) is stale once back in mapped mode */
+static void DQSpiXipDirty(uint32_t addr, uint32_t len)
+{
+	if (addr < xip_lo)
+		xip_lo = addr;
+	if (addr + len > xip_hi)
+		xip_hi = addr + len;
+}
+
+
+/* drop CPU cache lines of the window changed by program/erase */
+static void DQSpiXipInvalidate(void)
+{
+	uint32_t lo, hi;
+
+	if (xip_lo >= xip_hi)
+		return;
+
+	if (SCB->CCR & SCB_CCR_DC_Msk) {
+		lo = xip_lo & ~31UL;
+		hi = (xip_hi + 31) & ~31UL;
+
+		/* by-address maintenance is 1 op per line: bound it by the cache size */
+		if (hi - lo <= DQSPI_XIP_INVALIDATE_MAX) {
+			SCB_InvalidateDCache_by_Addr((uint32_t *)(DQSPI_MAP_ADDR + lo), hi - lo);
+		}
+		else {
+			SCB_CleanInvalidateDCache();
+		}
+	}
+
+	/* code may be executed in place */
+	if (SCB->CCR & SCB_CCR_IC_Msk) {
+		SCB_InvalidateICache();
+	}
+
+	xip_lo = W25Q32FV_FLASH_SIZE;
+	xip_hi = 0;
+}
+
+
+/* flash content in [addr, addr + len) is about to be erased */
+static void DQSpiInvalidate(uint32_t addr, uint32_t len)
+{
+	DQSpiXipDirty(addr, len);
+
+#if DQSPI_READ_CACHE_LINES
+	DQSpiCacheInvalidate(addr, len);
+#endif
+
+#if DQSPI_WRITE_BUFFER
+	DQSpiWbufDrop(addr, len);
+#endif
+}
+
+
+static void DQSpiCycInit(void)
+{
+	CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+	DWT->LAR = 0xC5ACCE55;
+	DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+}
+
+
+static void DQSpiDelayUs(uint32_t us)
+{
+	uint32_t t, n;
+
+	DQSpiCycInit();
+	n = us * (SystemCoreClock / 1000000);
+	t = DWT->CYCCNT;
+	while ((DWT->CYCCNT - t) < n)
+		;
+}
+
+
+/* release from power-down; always sent when forced since the flash may
+ * have been put to sleep by a previous owner (e.g. the application) */
+static int8_t DQSpiWake(uint8_t force)
+{
+	QSPI_CommandTypeDef s_command = wren_cmd;
+
+	if (!pd_state && !force)
+		return 0;
+
+	s_command.Instruction = RELEASE_POWER_DOWN_CMD;
+	if (HAL_QSPI_Command(&hqspi, &s_command, HAL_QPSI_TIMEOUT_DEFAULT_VALUE) != HAL_OK) {
+		return -1;
+	}
+	DQSpiDelayUs(W25Q32FV_TRES1);
+
+	if (pd_state) {
+		pd_state = 0;
+		pd_wakeups++;
+		pd_time += HAL_GetTick() - pd_since;
+	}
+
+	return 0;
+}
 
-	if (HAL_QSPI_AutoPolling(&hqspi, &sCommand, &sConfig, HAL_QSPI_TIMEOUT_DEFAULT_VALUE) != HAL_OK) {
+
+/* a 0xBB frame with M = 0xFF takes the flash out of continuous read mode */
+static int8_t DQSpiContinuousExit(void)
+{
+	QSPI_CommandTypeDef s_command = {0};
+
+	if (!map_continuous)
+		return 0;
+
+	s_command.InstructionMode = QSPI_INSTRUCTION_NONE;
+	s_command.AddressMode = QSPI_ADDRESS_2_LINES;
+	s_command.AddressSize = QSPI_ADDRESS_24_BITS;
+	s_command.Address = 0xFFFFFF;
+	s_command.AlternateByteMode = QSPI_ALTERNATE_BYTES_2_LINES;
+	s_command.AlternateBytesSize = QSPI_ALTERNATE_BYTES_8_BITS;
+	s_command.AlternateBytes = W25Q32FV_ALTERNATE_BYTE_M;
+	s_command.DataMode = QSPI_DATA_NONE;
+	s_command.DummyCycles = 0;
+	s_command.DdrMode = QSPI_DDR_MODE_DISABLE;
+	s_command.DdrHoldHalfCycle = QSPI_DDR_HHC_ANALOG_DELAY;
+	s_command.SIOOMode = QSPI_SIOO_INST_EVERY_CMD;
+
+	if (HAL_QSPI_Command(&hqspi, &s_command, HAL_QPSI_TIMEOUT_DEFAULT_VALUE) != HAL_OK) {
 		return -1;
 	}
+	map_continuous = 0;
 
 	return 0;
 }
 
 
+/* get the controller in indirect mode, unless someone holds it */
+static int8_t DQSpiIndirect(void)
+{
+#if DQSPI_STREAM
+	if (stream != NULL)
+		return DQSPI_BUSY;
+#endif
+#if DQSPI_LOG
+	if (async.op != ASYNC_IDLE)
+		return DQSPI_BUSY;
+#endif
+
+	pd_last = HAL_GetTick();
+
+	if (qspi_mode == QSPI_MODE_MAPPED) {
+		int8_t ret = 0;
+		DQSPI_STAT_BEGIN(t);
+
+		if (map_refs != 0)
+			return DQSPI_BUSY;
+
+		/* abort leaves memory-mapped mode */
+		if (HAL_QSPI_Abort(&hqspi) != HAL_OK) {
+			ret = -1;
+		}
+		else {
+			qspi_mode = QSPI_MODE_INDIRECT;
+			ret = DQSpiContinuousExit();
+		}
+
+		DQSPI_STAT_END(t, DQSPI_OP_UNMAP, 0, 0, 0, ret);
+		if (ret != 0) {
+			return ret;
+		}
+	}
+
+	/* every access wakes the flash transparently */
+	return DQSpiWake(0);
+}
+
+
 static uint8_t DQSpiResetMemory(void)
 {
     QSPI_CommandTypeDef s_command = {0};
@@ -188,7 +677,7 @@ static uint8_t DQSpiResetMemory(void)
     }
 
     /* Configure automatic polling mode to wait the memory is ready */
-    if (DQSpiAutoPollingMemReady() != 0) {
+    if (DQSpiAutoPollingMemReady(HAL_QPSI_TIMEOUT_DEFAULT_VALUE) != 0) {
         return -1;
     }
 
@@ -198,21 +687,48 @@ static uint8_t DQSpiResetMemory(void)
 
 int8_t DQSpiReset(void)
 {
+    DQSPI_STAT_BEGIN(t);
+
+    if (map_refs != 0)
+        return DQSPI_BUSY;
+#if DQSPI_STREAM
+    if (stream != NULL)
+        return DQSPI_BUSY;
+#endif
+#if DQSPI_LOG
+    if (async.op != ASYNC_IDLE || async.suspended)
+        return DQSPI_BUSY;
+#endif
+
 	// deinit HAL
     if (HAL_QSPI_DeInit(&hqspi) !=  HAL_OK) {
         return -1;
     }
+    qspi_mode = QSPI_MODE_INDIRECT;
 
     // init HAL
     if (HAL_QSPI_Init(&hqspi) != HAL_OK) {
         return -1;
     }
 
+    /* the reset command would be taken as an address otherwise */
+    if (DQSpiContinuousExit() != 0) {
+        return -1;
+    }
+
+    /* a flash in power-down ignores everything but the release */
+    if (DQSpiWake(1) != 0) {
+        return -1;
+    }
+    pd_last = HAL_GetTick();
+
     /* QSPI memory reset */
     if (DQSpiResetMemory() != 0) {
         return -1;
     }
 
+    DQSPI_STAT_END(t, DQSPI_OP_RESET, RESET_MEMORY_CMD, 0, 0, 0);
+
     return 0;
 }
 
@@ -222,6 +738,10 @@ int8_t DQSpiFlashId(uint8_t *mid, uint16_t *id)
     QSPI_CommandTypeDef s_command = {0};
     uint8_t dat[3];
 
+    if (DQSpiIndirect() != 0) {
+        return -1;
+    }
+
     /* Initialize the read command */
     s_command.InstructionMode = QSPI_INSTRUCTION_1_LINE;
     s_command.Instruction = JEDEC_ID_CMD;
@@ -278,154 +798,274 @@ int8_t DQSpiFlashInfo(uint32_t *blk_num, uint32_t *blk_size, uint32_t *sect_mum,
 }
 
 
-int8_t DQSpiEraseChip(void)
+/* erase command of the size aligned range around addr, whose cached
+ * copies are dropped from now on */
+static void DQSpiEraseCmd(QSPI_CommandTypeDef *cmd, uint32_t instruction, uint32_t addr, uint32_t size)
 {
-    QSPI_CommandTypeDef s_command = {0};
+    DQSpiInvalidate(addr & ~(size - 1), size);
+#if DQSPI_MANIFEST
+    DQSpiManDirty(addr & ~(size - 1), size);
+#endif
 
     /* Initialize the erase command */
-    s_command.InstructionMode = QSPI_INSTRUCTION_1_LINE;
-    s_command.Instruction = CHIP_ERASE_CMD;
-    s_command.AddressMode = QSPI_ADDRESS_NONE;
-    s_command.AlternateByteMode = QSPI_ALTERNATE_BYTES_NONE;
-    s_command.DataMode = QSPI_DATA_NONE;
-    s_command.DummyCycles = 0;
-    s_command.DdrMode = QSPI_DDR_MODE_DISABLE;
-    s_command.DdrHoldHalfCycle = QSPI_DDR_HHC_ANALOG_DELAY;
-    s_command.SIOOMode = QSPI_SIOO_INST_EVERY_CMD;
+    cmd->InstructionMode = QSPI_INSTRUCTION_1_LINE;
+    cmd->Instruction = instruction;
+    cmd->AddressMode = (instruction == CHIP_ERASE_CMD) ? QSPI_ADDRESS_NONE : QSPI_ADDRESS_1_LINE;
+    cmd->AddressSize = QSPI_ADDRESS_24_BITS;
+    cmd->Address = addr;
+    cmd->AlternateByteMode = QSPI_ALTERNATE_BYTES_NONE;
+    cmd->DataMode = QSPI_DATA_NONE;
+    cmd->DummyCycles = 0;
+    cmd->DdrMode = QSPI_DDR_MODE_DISABLE;
+    cmd->DdrHoldHalfCycle = QSPI_DDR_HHC_ANALOG_DELAY;
+    cmd->SIOOMode = QSPI_SIOO_INST_EVERY_CMD;
+}
 
-    /* Enable write operations */
-    if (DQSpiWriteEnable() != 0) {
-        return -1;
-    }
 
-    /* Send the command */
-    if (HAL_QSPI_Command(&hqspi, &s_command, HAL_QPSI_TIMEOUT_DEFAULT_VALUE) != HAL_OK) {
-        return -1;
+/* erase command, controller already in indirect mode */
+static int8_t DQSpiEraseSeq(uint32_t instruction, uint32_t addr, uint32_t size, uint32_t timeout)
+{
+    QSPI_CommandTypeDef s_command = {0};
+
+    if (DQSpiSuspendCheck(instruction, addr, size) != 0) {
+        return DQSPI_BUSY;
     }
 
-    /* Configure automatic polling mode to wait for end of erase */
-    if (DQSpiAutoPollingMemReady() != 0) {
-        return -1;
+    DQSpiEraseCmd(&s_command, instruction, addr, size);
+
+    /* WREN, erase command and wait for end of erase */
+    return DQSpiWriteSeq(&s_command, NULL, timeout, NULL);
+}
+
+
+int8_t DQSpiEraseChip(void)
+{
+    int8_t ret;
+
+    ret = DQSpiIndirect();
+    if (ret != 0) {
+        return ret;
     }
 
-    return 0;
+    return DQSpiEraseSeq(CHIP_ERASE_CMD, 0, W25Q32FV_FLASH_SIZE, W25Q32FV_CHIP_ERASE_MAX_TIME);
 }
 
 
 int8_t DQSpiEraseBlock(uint32_t addr)
 {
-    QSPI_CommandTypeDef s_command = {0};
+    int8_t ret;
 
-    /* Initialize the erase command */
-    s_command.InstructionMode = QSPI_INSTRUCTION_1_LINE;
-    s_command.Instruction = BLOCK_ERASE_CMD;
-    s_command.AddressMode = QSPI_ADDRESS_1_LINE;
-    s_command.AddressSize = QSPI_ADDRESS_24_BITS;
-    s_command.Address = addr;
-    s_command.AlternateByteMode = QSPI_ALTERNATE_BYTES_NONE;
-    s_command.DataMode = QSPI_DATA_NONE;
-    s_command.DummyCycles = 0;
-    s_command.DdrMode = QSPI_DDR_MODE_DISABLE;
-    s_command.DdrHoldHalfCycle = QSPI_DDR_HHC_ANALOG_DELAY;
-    s_command.SIOOMode = QSPI_SIOO_INST_EVERY_CMD;
-
-    /* Enable write operations */
-    if (DQSpiWriteEnable() != 0) {
-        return -1;
+    ret = DQSpiIndirect();
+    if (ret != 0) {
+        return ret;
     }
 
-    /* Send the command */
-    if (HAL_QSPI_Command(&hqspi, &s_command, HAL_QPSI_TIMEOUT_DEFAULT_VALUE) != HAL_OK) {
-        return -1;
-    }
+    return DQSpiEraseSeq(BLOCK_ERASE_CMD, addr, W25Q32FV_BLOCK_SIZE, W25Q32FV_BLOCK_ERASE_MAX_TIME);
+}
 
-    /* Configure automatic polling mode to wait for end of erase */
-    if (DQSpiAutoPollingMemReady() != 0) {
-        return -1;
+
+int8_t DQSpiEraseBlock64(uint32_t addr)
+{
+    int8_t ret;
+
+    ret = DQSpiIndirect();
+    if (ret != 0) {
+        return ret;
     }
 
-    return 0;
+    return DQSpiEraseSeq(BLOCK64_ERASE_CMD, addr, W25Q32FV_BLOCK64_SIZE, W25Q32FV_BLOCK64_ERASE_MAX_TIME);
 }
 
 
 int8_t DQSpiEraseSector(uint32_t addr)
 {
-    QSPI_CommandTypeDef s_command = {0};
+    int8_t ret;
+
+    ret = DQSpiIndirect();
+    if (ret != 0) {
+        return ret;
+    }
+
+    return DQSpiEraseSeq(SECTOR_ERASE_CMD, addr, W25Q32FV_SECTOR_SIZE, W25Q32FV_SECTOR_ERASE_MAX_TIME);
+}
+
+
+static int8_t DQSpiReadIndirect(uint32_t addr, uint8_t *dat, uint32_t len)
+{
+    QSPI_CommandTypeDef s_command = read_cmd;
 
-    /* Initialize the erase command */
-    s_command.InstructionMode = QSPI_INSTRUCTION_1_LINE;
-    s_command.Instruction = SECTOR_ERASE_CMD;
-    s_command.AddressMode = QSPI_ADDRESS_1_LINE;
-    s_command.AddressSize = QSPI_ADDRESS_24_BITS;
     s_command.Address = addr;
-    s_command.AlternateByteMode = QSPI_ALTERNATE_BYTES_NONE;
-    s_command.DataMode = QSPI_DATA_NONE;
-    s_command.DummyCycles = 0;
-    s_command.DdrMode = QSPI_DDR_MODE_DISABLE;
-    s_command.DdrHoldHalfCycle = QSPI_DDR_HHC_ANALOG_DELAY;
-    s_command.SIOOMode = QSPI_SIOO_INST_EVERY_CMD;
+    s_command.NbData = len;
 
-    /* Enable write operations */
-    if (DQSpiWriteEnable() != 0) {
+    /* Configure the command */
+    if (HAL_QSPI_Command(&hqspi, &s_command, HAL_QPSI_TIMEOUT_DEFAULT_VALUE) != HAL_OK) {
         return -1;
     }
 
-    /* Send the command */
-    if (HAL_QSPI_Command(&hqspi, &s_command, HAL_QPSI_TIMEOUT_DEFAULT_VALUE) != HAL_OK) {
+    /* Reception of the data */
+    if (HAL_QSPI_Receive(&hqspi, dat, HAL_QPSI_TIMEOUT_DEFAULT_VALUE) != HAL_OK) {
         return -1;
     }
 
-    /* Configure automatic polling mode to wait for end of erase */
-    if (DQSpiAutoPollingMemReady() != 0) {
-        return -1;
+    return 0;
+}
+
+
+#if DQSPI_READ_CACHE_LINES
+static int8_t DQSpiReadCached(uint32_t addr, uint8_t *dat, uint32_t len)
+{
+    uint32_t line, off, n, i, v;
+
+    while (len != 0) {
+        line = addr & ~(DQSPI_READ_CACHE_LINE_SIZE - 1);
+        off = addr - line;
+        n = DQSPI_READ_CACHE_LINE_SIZE - off;
+        if (n > len) {
+            n = len;
+        }
+
+        /* lookup, remembering the least recently used line as victim */
+        v = 0;
+        for (i = 0; i != DQSPI_READ_CACHE_LINES; i++) {
+            if (rcache_tag[i].stamp != 0 && rcache_tag[i].addr == line)
+                break;
+            if (rcache_tag[i].stamp < rcache_tag[v].stamp)
+                v = i;
+        }
+
+        if (i != DQSPI_READ_CACHE_LINES) {
+            rcache_hit++;
+            v = i;
+        }
+        else {
+            rcache_miss++;
+            rcache_tag[v].stamp = 0;
+            if (DQSpiReadIndirect(line, rcache_dat[v], DQSPI_READ_CACHE_LINE_SIZE) != 0) {
+                return -1;
+            }
+            rcache_tag[v].addr = line;
+        }
+        rcache_tag[v].stamp = ++rcache_clock;
+
+        memcpy(dat, &rcache_dat[v][off], n);
+
+        addr += n;
+        dat += n;
+        len -= n;
     }
 
     return 0;
 }
+#endif
 
 
 int8_t DQSpiRead(uint32_t addr, uint8_t *dat, uint32_t len)
 {
-    QSPI_CommandTypeDef s_command = {0};
-
-    /* Initialize the read command */
-    s_command.InstructionMode = QSPI_INSTRUCTION_1_LINE;
-    s_command.Instruction = DUAL_OUT_FAST_READ_CMD;
-    s_command.AddressMode = QSPI_ADDRESS_1_LINE;
-    s_command.AddressSize = QSPI_ADDRESS_24_BITS;
-    s_command.Address = addr;
-    s_command.DataMode = QSPI_DATA_2_LINES;
-    s_command.AlternateByteMode = QSPI_ALTERNATE_BYTES_NONE;
-    s_command.AlternateBytesSize = 0;
-    s_command.AlternateBytes = 0;
-    s_command.DummyCycles = DUMMY_CLOCK_CYCLES_READ;
-    s_command.NbData = len;
-    s_command.DdrMode = QSPI_DDR_MODE_DISABLE;
-    s_command.DdrHoldHalfCycle = QSPI_DDR_HHC_ANALOG_DELAY;
-    s_command.SIOOMode = QSPI_SIOO_INST_EVERY_CMD;
+    int8_t ret;
+    DQSPI_STAT_BEGIN(t);
+
+    if (qspi_mode == QSPI_MODE_MAPPED) {
+        /* no need to leave mapped mode, read through the window */
+        memcpy(dat, (const uint8_t *)(DQSPI_MAP_ADDR + addr), len);
+        pd_last = HAL_GetTick();
+        ret = 0;
+    }
+    else {
+        ret = DQSpiIndirect();
+        if (ret != 0) {
+            return ret;
+        }
 
+#if DQSPI_READ_CACHE_LINES
+        /* small reads go through the cache, bulk reads would only thrash it */
+        if (len < DQSPI_READ_CACHE_LINE_SIZE) {
+            ret = DQSpiReadCached(addr, dat, len);
+        }
+        else
+#endif
+        {
+            ret = DQSpiReadIndirect(addr, dat, len);
+        }
+    }
 
-    /* Configure the command */
-    if (HAL_QSPI_Command(&hqspi, &s_command, HAL_QPSI_TIMEOUT_DEFAULT_VALUE) != HAL_OK) {
-        return -1;
+#if DQSPI_WRITE_BUFFER
+    if (ret == 0) {
+        DQSpiWbufOverlay(addr, dat, len);
     }
+#endif
 
-    /* Reception of the data */
-    if (HAL_QSPI_Receive(&hqspi, dat, HAL_QPSI_TIMEOUT_DEFAULT_VALUE) != HAL_OK) {
-        return -1;
+    DQSPI_STAT_END(t, DQSPI_OP_READ, DUAL_OUT_FAST_READ_CMD, addr, len, ret);
+
+    return ret;
+}
+
+
+#if DQSPI_VERIFY
+/* Program one page and read it back: the source CRC is computed while the
+ * page programs, the check costs the read only. Missing 1 -> 0 bits are
+ * programmed again, a 0 where the source has a 1 needs an erase. mask has
+ * a bit per byte of the page, only bytes with it set are checked (the
+ * write buffer's 0xFF fill leaves the flash as it was); NULL checks all. */
+static int8_t DQSpiProgramPage(QSPI_CommandTypeDef *cmd, uint8_t *dat, const uint8_t *mask)
+{
+    uint32_t crc, i, o, n = cmd->NbData;
+    uint8_t tries = 0, miss;
+
+    for (;;) {
+        if (DQSpiWriteSeq(cmd, dat, W25Q32FV_PAGE_PROG_MAX_TIME, &crc) != 0 ||
+            DQSpiReadIndirect(cmd->Address, rd_page, n) != 0) {
+            return -1;
+        }
+        verify_pages++;
+        if (DQSpiCrc32(0, rd_page, n) == crc) {
+            return 0;
+        }
+
+        for (i = 0, miss = 0; i != n; i++) {
+            o = (cmd->Address + i) % W25Q32FV_PAGE_SIZE;
+            if (mask != NULL && !(mask[o / 8] & (1 << (o % 8)))) {
+                continue;
+            }
+            if ((dat[i] & ~rd_page[i]) != 0) {
+                break;
+            }
+            miss |= ~dat[i] & rd_page[i];
+        }
+        if (i == n && miss == 0) {
+            return 0;
+        }
+        if (i != n || tries++ == DQSPI_VERIFY_RETRIES) {
+            verify_bad = cmd->Address & ~(W25Q32FV_PAGE_SIZE - 1);
+            return DQSPI_VERIFY_FAIL;
+        }
+        verify_retries++;
     }
+}
+#endif
 
-    return 0;
+
+/* flash content in [addr, addr + len) is about to be programmed */
+static void DQSpiProgDirty(uint32_t addr, uint32_t len)
+{
+#if DQSPI_READ_CACHE_LINES
+    DQSpiCacheInvalidate(addr, len);
+#endif
+    DQSpiXipDirty(addr, len);
+#if DQSPI_MANIFEST
+    DQSpiManDirty(addr, len);
+#endif
 }
 
 
-int8_t DQSpiWrite(uint32_t addr, uint8_t *dat, uint32_t len)
+/* page programs, controller already in indirect mode; mask: the bytes to
+ * verify, by page offset (NULL: all) */
+static int8_t DQSpiProgramMasked(uint32_t addr, uint8_t *dat, const uint8_t *mask, uint32_t len)
 {
-    QSPI_CommandTypeDef s_command = {0};
+    QSPI_CommandTypeDef s_command = prog_cmd;
     uint32_t end_addr, current_size, current_addr;
-
-    if (len == 0)
-    	return 0;
+#if DQSPI_VERIFY
+    int8_t ret;
+#endif
 
     /* Calculation of the size between the write address and the end of the page */
     current_size = W25Q32FV_PAGE_SIZE - (addr % W25Q32FV_PAGE_SIZE);
@@ -439,81 +1079,1596 @@ int8_t DQSpiWrite(uint32_t addr, uint8_t *dat, uint32_t len)
     current_addr = addr;
     end_addr = addr + len;
 
-    /* Initialize the program command */
-    s_command.InstructionMode = QSPI_INSTRUCTION_1_LINE;
-    s_command.Instruction = PAGE_PROG_CMD;
-    s_command.AddressMode = QSPI_ADDRESS_1_LINE;
-    s_command.DataMode = QSPI_DATA_1_LINE;
+    if (DQSpiSuspendCheck(s_command.Instruction, addr, len) != 0) {
+        return DQSPI_BUSY;
+    }
+
+    DQSpiProgDirty(addr, len);
+
+    /* Perform the write page by page */
+    do {
+        s_command.Address = current_addr;
+        s_command.NbData = current_size;
+
+#if DQSPI_VERIFY
+        ret = DQSpiProgramPage(&s_command, dat, mask);
+        if (ret != 0) {
+            return ret;
+        }
+#else
+        (void)mask;
+
+        /* WREN, program command, data and wait for end of program */
+        if (DQSpiWriteSeq(&s_command, dat, W25Q32FV_PAGE_PROG_MAX_TIME, NULL) != 0) {
+            return -1;
+        }
+#endif
+
+        /* Update the address and size variables for next page programming */
+        current_addr += current_size;
+        dat += current_size;
+        current_size = ((current_addr + W25Q32FV_PAGE_SIZE) > end_addr) ? (end_addr - current_addr) : W25Q32FV_PAGE_SIZE;
+    } while (current_addr < end_addr);
+
+    return 0;
+}
+
+
+static int8_t DQSpiProgramSeq(uint32_t addr, uint8_t *dat, uint32_t len)
+{
+    return DQSpiProgramMasked(addr, dat, NULL, len);
+}
+
+
+static int8_t DQSpiProgram(uint32_t addr, uint8_t *dat, uint32_t len)
+{
+    int8_t ret;
+
+    if (len == 0)
+    	return 0;
+
+    ret = DQSpiIndirect();
+    if (ret != 0) {
+        return ret;
+    }
+
+    return DQSpiProgramSeq(addr, dat, len);
+}
+
+
+int8_t DQSpiWrite(uint32_t addr, uint8_t *dat, uint32_t len)
+{
+#if DQSPI_WRITE_BUFFER
+    uint32_t page, off, n, i;
+    int8_t ret;
+
+    if (DQSpiPoll() != 0) {
+        return -1;
+    }
+
+    while (len != 0) {
+        page = addr & ~(W25Q32FV_PAGE_SIZE - 1);
+        off = addr - page;
+        n = W25Q32FV_PAGE_SIZE - off;
+        if (n > len) {
+            n = len;
+        }
+
+        if (n == W25Q32FV_PAGE_SIZE && wbuf.page != page) {
+            /* full pages gain nothing from buffering */
+            n = len & ~(W25Q32FV_PAGE_SIZE - 1);
+            if (wbuf.page >= page && wbuf.page < page + n) {
+                n = wbuf.page - page;
+            }
+            ret = DQSpiProgram(addr, dat, n);
+            if (ret != 0) {
+                return ret;
+            }
+        }
+        else {
+            if (wbuf.page != page) {
+                ret = DQSpiFlush();
+                if (ret != 0) {
+                    return ret;
+                }
+                memset(wbuf.dat, 0xFF, sizeof(wbuf.dat));
+                memset(wbuf.mask, 0, sizeof(wbuf.mask));
+                wbuf.page = page;
+                wbuf.tick = HAL_GetTick();
+                wbuf.lo = W25Q32FV_PAGE_SIZE;
+                wbuf.hi = 0;
+            }
+
+            /* programming only clears bits: merge the same way */
+            for (i = 0; i != n; i++) {
+                wbuf.dat[off + i] &= dat[i];
+                wbuf.mask[(off + i) / 8] |= 1 << ((off + i) % 8);
+            }
+            if (off < wbuf.lo)
+                wbuf.lo = off;
+            if (off + n > wbuf.hi)
+                wbuf.hi = off + n;
+        }
+
+        addr += n;
+        dat += n;
+        len -= n;
+    }
+
+    return 0;
+#else
+    return DQSpiProgram(addr, dat, len);
+#endif
+}
+
+
+int8_t DQSpiFlush(void)
+{
+#if DQSPI_WRITE_BUFFER
+    uint32_t page;
+
+    int8_t ret;
+
+    if (wbuf.page == WBUF_EMPTY)
+        return 0;
+
+    /* refused while mapped or during an erase suspend: keep the data
+     * for a later flush */
+    ret = DQSpiIndirect();
+    if (ret == 0) {
+        ret = DQSpiSuspendCheck(prog_cmd.Instruction, wbuf.page + wbuf.lo, wbuf.hi - wbuf.lo);
+    }
+    if (ret != 0) {
+        return ret;
+    }
+
+    /* the buffer is released even on failure, the error is reported once */
+    page = wbuf.page;
+    wbuf.page = WBUF_EMPTY;
+
+    return DQSpiProgramMasked(page + wbuf.lo, &wbuf.dat[wbuf.lo], wbuf.mask, wbuf.hi - wbuf.lo);
+#else
+    return 0;
+#endif
+}
+
+
+int8_t DQSpiPoll(void)
+{
+    int8_t ret;
+
+#if DQSPI_LOG
+    /* a lost interrupt or a flash that stopped answering */
+    if (async.op != ASYNC_IDLE) {
+        HAL_NVIC_DisableIRQ(QUADSPI_IRQn);
+        if (async.op != ASYNC_IDLE && (HAL_GetTick() - async.tick) > async.timeout) {
+            HAL_QSPI_Abort(&hqspi);
+            DQSpiAsyncEnd(-1);
+        }
+        HAL_NVIC_EnableIRQ(QUADSPI_IRQn);
+        return 0;
+    }
+#endif
+
+#if DQSPI_WRITE_BUFFER
+    if (wbuf.page != WBUF_EMPTY && (HAL_GetTick() - wbuf.tick) >= DQSPI_WRITE_BUFFER_TIMEOUT) {
+        ret = DQSpiFlush();
+        /* retried on the next poll once the mappings are released */
+        return (ret == DQSPI_BUSY) ? 0 : ret;
+    }
+#endif
+
+    /* sleep only when nobody can touch the window */
+    if (pd_idle != 0 && !pd_state && map_refs == 0 && (HAL_GetTick() - pd_last) >= pd_idle) {
+        ret = DQSpiPowerDown();
+        return (ret == DQSPI_BUSY) ? 0 : ret;
+    }
+
+    return 0;
+}
+
+
+/* everything is checked before the first command: a bad op leaves the
+ * flash untouched */
+static int8_t DQSpiBatchCheck(const DQSpiOp *op)
+{
+    uint32_t align;
+
+    switch (op->op) {
+    case DQSPI_BATCH_ERASE_4K:
+        align = W25Q32FV_SECTOR_SIZE;
+        break;
+    case DQSPI_BATCH_ERASE_32K:
+        align = W25Q32FV_BLOCK_SIZE;
+        break;
+    case DQSPI_BATCH_ERASE_64K:
+        align = W25Q32FV_BLOCK64_SIZE;
+        break;
+    case DQSPI_BATCH_ERASE_CHIP:
+        return 0;
+    case DQSPI_BATCH_PROGRAM:
+        if (op->dat == NULL && op->len != 0) {
+            return -1;
+        }
+        /* fall through */
+    case DQSPI_BATCH_VERIFY:
+        return (op->len <= W25Q32FV_FLASH_SIZE && op->addr <= W25Q32FV_FLASH_SIZE - op->len) ? 0 : -1;
+    default:
+        return -1;
+    }
+
+    return (op->addr < W25Q32FV_FLASH_SIZE && (op->addr & (align - 1)) == 0) ? 0 : -1;
+}
+
+
+/* CRC of the flash content, read back page by page */
+static int8_t DQSpiBatchVerify(uint32_t addr, uint32_t len, uint32_t crc)
+{
+    uint32_t n, c = 0;
+
+    while (len != 0) {
+        n = (len < sizeof(rd_page)) ? len : sizeof(rd_page);
+        if (DQSpiReadIndirect(addr, rd_page, n) != 0) {
+            return -1;
+        }
+        c = DQSpiCrc32(c, rd_page, n);
+        addr += n;
+        len -= n;
+    }
+
+    return (c == crc) ? 0 : -1;
+}
+
+
+/* Run ops in order in one indirect session: the controller leaves mapped
+ * mode and the flash wakes once, not once per call. The first failing op
+ * stops the batch. */
+int8_t DQSpiExecBatch(const DQSpiOp *ops, size_t n, DQSpiResult *res)
+{
+    const DQSpiOp *op;
+    size_t i, failed = n;
+    int8_t ret = 0;
+
+    for (i = 0; i != n; i++) {
+        if (res != NULL && res->status != NULL) {
+            res->status[i] = DQSPI_BATCH_NOT_RUN;
+        }
+        if (failed == n && DQSpiBatchCheck(&ops[i]) != 0) {
+            failed = i;
+        }
+    }
+    if (failed != n) {
+        ret = -1;
+    }
+    else if (n != 0) {
+        /* pending buffered data goes first, the batch bypasses the buffer */
+        ret = DQSpiFlush();
+        if (ret == 0) {
+            ret = DQSpiIndirect();
+        }
+        if (ret != 0) {
+            failed = 0;
+        }
+    }
+
+    for (i = 0; i != n && ret == 0; i++) {
+        op = &ops[i];
+        switch (op->op) {
+        case DQSPI_BATCH_ERASE_4K:
+            ret = DQSpiEraseSeq(SECTOR_ERASE_CMD, op->addr, W25Q32FV_SECTOR_SIZE, W25Q32FV_SECTOR_ERASE_MAX_TIME);
+            break;
+        case DQSPI_BATCH_ERASE_32K:
+            ret = DQSpiEraseSeq(BLOCK_ERASE_CMD, op->addr, W25Q32FV_BLOCK_SIZE, W25Q32FV_BLOCK_ERASE_MAX_TIME);
+            break;
+        case DQSPI_BATCH_ERASE_64K:
+            ret = DQSpiEraseSeq(BLOCK64_ERASE_CMD, op->addr, W25Q32FV_BLOCK64_SIZE, W25Q32FV_BLOCK64_ERASE_MAX_TIME);
+            break;
+        case DQSPI_BATCH_ERASE_CHIP:
+            ret = DQSpiEraseSeq(CHIP_ERASE_CMD, 0, W25Q32FV_FLASH_SIZE, W25Q32FV_CHIP_ERASE_MAX_TIME);
+            break;
+        case DQSPI_BATCH_PROGRAM:
+            if (op->len != 0) {
+                /* the data is only transmitted */
+                ret = DQSpiProgramSeq(op->addr, (uint8_t *)op->dat, op->len);
+            }
+            break;
+        default:
+            ret = DQSpiBatchVerify(op->addr, op->len, op->crc);
+            break;
+        }
+        if (ret != 0) {
+            failed = i;
+        }
+        if (res != NULL && res->status != NULL) {
+            res->status[i] = ret;
+        }
+    }
+
+    if (res != NULL) {
+        if (res->status != NULL && failed != n) {
+            res->status[failed] = ret;
+        }
+        res->failed = failed;
+    }
+
+    return ret;
+}
+
+
+#if DQSPI_MANIFEST
+/* CRC table from the log, controller in indirect mode */
+static int8_t DQSpiManLoad(void)
+{
+    uint32_t hdr[2][2], off, i, n;
+    const DQSpiManRec *r;
+    int cur = -1, end;
+
+    for (i = 0; i != MAN_SECTORS; i++) {
+        man.crc[i] = MAN_ERASED_CRC;
+    }
+    man.seq = 0;
+    man.log = DQSPI_MANIFEST_ADDR;
+    man.off = MAN_FULL;
+    man.writing = 0;
+    man.stale = 0;
+
+    for (i = 0; i != 2; i++) {
+        if (DQSpiReadIndirect(DQSPI_MANIFEST_ADDR + i * W25Q32FV_SECTOR_SIZE, (uint8_t *)hdr[i], sizeof(hdr[i])) != 0) {
+            return -1;
+        }
+        if (hdr[i][0] == MAN_MAGIC && (cur < 0 || (int32_t)(hdr[i][1] - hdr[cur][1]) > 0)) {
+            cur = i;
+        }
+    }
+
+    if (cur >= 0) {
+        man.seq = hdr[cur][1];
+        man.log = DQSPI_MANIFEST_ADDR + cur * W25Q32FV_SECTOR_SIZE;
+
+        for (off = sizeof(hdr[0]), end = 0; off < W25Q32FV_SECTOR_SIZE && !end; off += n) {
+            n = W25Q32FV_SECTOR_SIZE - off;
+            if (n > sizeof(rd_page)) {
+                n = sizeof(rd_page);
+            }
+            if (DQSpiReadIndirect(man.log + off, rd_page, n) != 0) {
+                return -1;
+            }
+
+            for (i = 0; i != n; i += sizeof(*r)) {
+                r = (const DQSpiManRec *)&rd_page[i];
+                if ((uint16_t)(r->check ^ r->sector) != 0xFFFF || r->sector >= MAN_SECTORS) {
+                    /* end of the log, appended to only if erased */
+                    if (r->sector == 0xFFFF && r->check == 0xFFFF && r->crc == 0xFFFFFFFF) {
+                        man.off = off + i;
+                    }
+                    else {
+                        man.stale = 1;
+                    }
+                    end = 1;
+                    break;
+                }
+                man.crc[r->sector] = r->crc;
+            }
+        }
+    }
+
+    /* the dirty marks are kept until a sync: a log hit while it could not
+     * be read is not trusted, every sector is recomputed */
+    if (man.pending & MAN_PEND_LOG) {
+        memset(man.dirty, 0xFF, sizeof(man.dirty));
+        man.off = MAN_FULL;
+        man.stale = 1;
+    }
+    man.pending = 0;
+    man.loaded = 1;
+
+    return 0;
+}
+
+
+/* [addr, addr + len) is about to change, its sectors get a new CRC on
+ * the next sync */
+static void DQSpiManDirty(uint32_t addr, uint32_t len)
+{
+    uint8_t log, region;
+    uint32_t s, e;
+
+    if (man.writing == 1 && man.loaded) {
+        return;
+    }
+
+    log = addr < DQSPI_MANIFEST_ADDR + 2 * W25Q32FV_SECTOR_SIZE && addr + len > DQSPI_MANIFEST_ADDR;
+    region = addr < DQSPI_MANIFEST_BASE + DQSPI_MANIFEST_SIZE && addr + len > DQSPI_MANIFEST_BASE;
+    if (!log && !region) {
+        return;
+    }
+    /* not dropped: the next sync loads the log and records the change */
+    if (!man.loaded && DQSpiManLoad() != 0) {
+        man.pending |= log ? MAN_PEND_LOG : MAN_PEND_REGION;
+    }
+
+    /* the log itself goes: rewritten whole from the table */
+    if (log && man.loaded) {
+        man.off = MAN_FULL;
+        man.stale = 1;
+    }
+    if (!region) {
+        return;
+    }
+    s = (addr < DQSPI_MANIFEST_BASE) ? 0 : (addr - DQSPI_MANIFEST_BASE) / W25Q32FV_SECTOR_SIZE;
+    e = (addr + len - DQSPI_MANIFEST_BASE + W25Q32FV_SECTOR_SIZE - 1) / W25Q32FV_SECTOR_SIZE;
+    if (e > MAN_SECTORS) {
+        e = MAN_SECTORS;
+    }
+    for (; s != e; s++) {
+        man.dirty[s >> 3] |= 1 << (s & 7);
+    }
+}
+
+
+static int8_t DQSpiManSectorCrc(uint32_t addr, uint32_t *crc)
+{
+    uint32_t off;
+
+    *crc = 0;
+    for (off = 0; off != W25Q32FV_SECTOR_SIZE; off += sizeof(rd_page)) {
+        if (DQSpiReadIndirect(addr + off, rd_page, sizeof(rd_page)) != 0) {
+            return -1;
+        }
+        *crc = DQSpiCrc32(*crc, rd_page, sizeof(rd_page));
+    }
+
+    return 0;
+}
+
+
+/* whole table to the other log sector, header last: a torn compaction
+ * leaves the previous log current */
+static int8_t DQSpiManCompact(void)
+{
+    uint32_t hdr[2], log, off = sizeof(hdr), s, n = 0;
+    int8_t ret;
+
+    log = (man.log == DQSPI_MANIFEST_ADDR) ? DQSPI_MANIFEST_ADDR + W25Q32FV_SECTOR_SIZE : DQSPI_MANIFEST_ADDR;
+    hdr[0] = MAN_MAGIC;
+    hdr[1] = man.seq + 1;
+
+    man.writing = 1;
+    ret = DQSpiEraseSeq(SECTOR_ERASE_CMD, log, W25Q32FV_SECTOR_SIZE, W25Q32FV_SECTOR_ERASE_MAX_TIME);
+    for (s = 0; s != MAN_SECTORS && ret == 0; s++) {
+        if (man.crc[s] != MAN_ERASED_CRC) {
+            man_rec[n].sector = s;
+            man_rec[n].check = ~s;
+            man_rec[n].crc = man.crc[s];
+            n++;
+        }
+        if (n != 0 && (n == MAN_REC_BUF || s + 1 == MAN_SECTORS)) {
+            ret = DQSpiProgramSeq(log + off, (uint8_t *)man_rec, n * sizeof(man_rec[0]));
+            off += n * sizeof(man_rec[0]);
+            n = 0;
+        }
+    }
+    if (ret == 0) {
+        ret = DQSpiProgramSeq(log, (uint8_t *)hdr, sizeof(hdr));
+    }
+    man.writing = 0;
+
+    if (ret == 0) {
+        man.log = log;
+        man.seq++;
+        man.off = off;
+        man.stale = 0;
+    }
+
+    return ret;
+}
+
+
+static int8_t DQSpiManAppend(uint32_t n)
+{
+    int8_t ret;
+
+    if (man.off + n * sizeof(man_rec[0]) > MAN_FULL) {
+        return DQSpiManCompact();
+    }
+
+    man.writing = 1;
+    ret = DQSpiProgramSeq(man.log + man.off, (uint8_t *)man_rec, n * sizeof(man_rec[0]));
+    man.writing = 0;
+    man.off = (ret == 0) ? man.off + n * sizeof(man_rec[0]) : MAN_FULL;
+
+    return ret;
+}
+
+
+/* records for the sectors whose CRC changed, controller in indirect mode */
+static int8_t DQSpiManSync(void)
+{
+    uint32_t s, crc, n = 0;
+    int8_t ret = 0;
+
+    if (!man.loaded) {
+        if (!man.pending) {
+            return 0;
+        }
+        ret = DQSpiManLoad();
+        if (ret != 0) {
+            return ret;
+        }
+    }
+
+    for (s = 0; s != MAN_SECTORS && ret == 0; s++) {
+        if ((man.dirty[s >> 3] & (1 << (s & 7))) == 0) {
+            continue;
+        }
+        ret = DQSpiManSectorCrc(DQSPI_MANIFEST_BASE + s * W25Q32FV_SECTOR_SIZE, &crc);
+        if (ret != 0 || crc == man.crc[s]) {
+            continue;
+        }
+        man.crc[s] = crc;
+        man_rec[n].sector = s;
+        man_rec[n].check = ~s;
+        man_rec[n].crc = crc;
+        if (++n == MAN_REC_BUF) {
+            ret = DQSpiManAppend(n);
+            n = 0;
+        }
+    }
+    if (ret == 0 && n != 0) {
+        ret = DQSpiManAppend(n);
+    }
+    if (ret == 0 && man.stale) {
+        ret = DQSpiManCompact();
+    }
+
+    /* the table lives only until the flash has it */
+    if (ret == 0) {
+        memset(man.dirty, 0, sizeof(man.dirty));
+        man.loaded = 0;
+    }
+
+    return ret;
+}
+#endif
+
+
+/* record the CRC of the sectors changed since the last sync; done by
+ * DQSpiMemoryMapped() too */
+int8_t DQSpiManifestSync(void)
+{
+#if DQSPI_MANIFEST
+    int8_t ret;
+
+    ret = DQSpiFlush();
+    if (ret != 0 || (!man.loaded && !man.pending)) {
+        return ret;
+    }
+
+    ret = DQSpiIndirect();
+    if (ret != 0) {
+        return ret;
+    }
+
+    return DQSpiManSync();
+#else
+    return -1;
+#endif
+}
+
+
+/* manifest of the current content, for data written without the driver */
+int8_t DQSpiManifestRebuild(void)
+{
+#if DQSPI_MANIFEST
+    int8_t ret;
+
+    ret = DQSpiFlush();
+    if (ret == 0) {
+        ret = DQSpiIndirect();
+    }
+    if (ret == 0) {
+        ret = DQSpiManLoad();
+    }
+    if (ret != 0) {
+        return ret;
+    }
+
+    memset(man.dirty, 0xFF, sizeof(man.dirty));
+    man.off = MAN_FULL;
+    man.stale = 1;
+
+    return DQSpiManSync();
+#else
+    return -1;
+#endif
+}
+
+
+/* Compare the sectors of [addr, addr + len) with the manifest, CRCs
+ * computed from the memory-mapped window. Offsets of the bad sectors go
+ * to bad, *nbad is its size on entry and the number of bad sectors on
+ * return (more than fit in bad are counted only). */
+int8_t DQSpiVerifyRegion(uint32_t addr, uint32_t len, uint32_t *bad, uint32_t *nbad)
+{
+#if DQSPI_MANIFEST
+    const uint8_t *p;
+    uint32_t s, e, max, found = 0;
+    int8_t ret;
+
+    if (nbad == NULL || (bad == NULL && *nbad != 0) || len == 0 || addr < DQSPI_MANIFEST_BASE ||
+        len > DQSPI_MANIFEST_SIZE || addr - DQSPI_MANIFEST_BASE > DQSPI_MANIFEST_SIZE - len) {
+        return -1;
+    }
+    max = *nbad;
+
+    /* changes made through the driver are not errors: record them first */
+    ret = DQSpiManifestSync();
+    if (ret == 0) {
+        ret = DQSpiIndirect();
+    }
+    if (ret == 0) {
+        ret = DQSpiManLoad();
+    }
+    if (ret != 0) {
+        return ret;
+    }
+    man.loaded = 0;
+
+    p = DQSpiMap(DQSPI_MANIFEST_BASE, DQSPI_MANIFEST_SIZE);
+    if (p == NULL) {
+        return -1;
+    }
+
+    s = (addr - DQSPI_MANIFEST_BASE) / W25Q32FV_SECTOR_SIZE;
+    e = (addr - DQSPI_MANIFEST_BASE + len - 1) / W25Q32FV_SECTOR_SIZE;
+    for (; s <= e; s++) {
+        if (DQSpiCrc32(0, p + s * W25Q32FV_SECTOR_SIZE, W25Q32FV_SECTOR_SIZE) != man.crc[s]) {
+            if (found < max) {
+                bad[found] = DQSPI_MANIFEST_BASE + s * W25Q32FV_SECTOR_SIZE;
+            }
+            found++;
+        }
+    }
+
+    DQSpiUnmap(p);
+    *nbad = found;
+
+    return 0;
+#else
+    (void)addr;
+    (void)len;
+    (void)bad;
+    (void)nbad;
+
+    return -1;
+#endif
+}
+
+
+int8_t DQSpiPowerDown(void)
+{
+    QSPI_CommandTypeDef s_command = wren_cmd;
+    int8_t ret;
+
+    if (pd_state)
+        return 0;
+#if DQSPI_LOG
+    /* the flash would forget the suspended erase */
+    if (async.suspended)
+        return DQSPI_BUSY;
+#endif
+
+    /* the buffered page would be lost for the sleep duration */
+    ret = DQSpiFlush();
+    if (ret != 0) {
+        return ret;
+    }
+
+    ret = DQSpiIndirect();
+    if (ret != 0) {
+        return ret;
+    }
+
+    s_command.Instruction = POWER_DOWN_CMD;
+    if (HAL_QSPI_Command(&hqspi, &s_command, HAL_QPSI_TIMEOUT_DEFAULT_VALUE) != HAL_OK) {
+        return -1;
+    }
+    DQSpiDelayUs(W25Q32FV_TDP);
+
+    pd_state = 1;
+    pd_since = HAL_GetTick();
+
+    return 0;
+}
+
+
+int8_t DQSpiPowerPolicy(uint32_t idle_ms)
+{
+    pd_idle = idle_ms;
+    pd_last = HAL_GetTick();
+
+    return 0;
+}
+
+
+int8_t DQSpiPowerStats(uint32_t *down_ms, uint32_t *wakeups)
+{
+    if (down_ms != NULL) {
+        *down_ms = pd_time + (pd_state ? HAL_GetTick() - pd_since : 0);
+    }
+
+    if (wakeups != NULL) {
+        *wakeups = pd_wakeups;
+    }
+
+    return 0;
+}
+
+
+#if DQSPI_STREAM
+/* start the DMA for the next free buffer; called from thread and ISR */
+static void DQSpiStreamKick(DQSpiStream *s)
+{
+    QSPI_CommandTypeDef s_command = read_cmd;
+    uint32_t n;
+
+    if (s->busy || s->err || s->addr >= s->end || s->count == s->nbuf)
+        return;
+
+    n = s->end - s->addr;
+    if (n > s->chunk) {
+        n = s->chunk;
+    }
+
+    s_command.Address = s->addr;
+    s_command.NbData = n;
+
+    s->busy = 1;
+    s->len[s->head] = n;
+    if (HAL_QSPI_Command(&hqspi, &s_command, HAL_QPSI_TIMEOUT_DEFAULT_VALUE) != HAL_OK ||
+        HAL_QSPI_Receive_DMA(&hqspi, s->buf + (uint32_t)s->head * s->chunk) != HAL_OK) {
+        s->busy = 0;
+        s->err = 1;
+        return;
+    }
+    s->addr += n;
+}
+
+
+void HAL_QSPI_RxCpltCallback(QSPI_HandleTypeDef *h)
+{
+    DQSpiStream *s = stream;
+
+    if (s == NULL)
+        return;
+
+    s->head = (s->head + 1) % s->nbuf;
+    s->count++;
+    s->busy = 0;
+
+    /* keep the bus busy: next chunk goes in flight right away */
+    DQSpiStreamKick(s);
+}
+
+
+int8_t DQSpiStreamOpen(DQSpiStream *s, uint32_t addr, uint32_t len, uint8_t *buf, uint32_t chunk, uint8_t nbuf)
+{
+    if (stream != NULL || nbuf < 2 || nbuf > DQSPI_STREAM_MAX_BUFS || chunk == 0 || buf == NULL)
+        return -1;
+
+    /* pending writes would not be seen by the DMA */
+    if (DQSpiFlush() != 0 || DQSpiIndirect() != 0) {
+        return -1;
+    }
+
+    memset(s, 0, sizeof(*s));
+    s->addr = addr;
+    s->end = addr + len;
+    s->buf = buf;
+    s->chunk = chunk;
+    s->nbuf = nbuf;
+
+    stream = s;
+    DQSpiStreamKick(s);
+
+    return s->err ? -1 : 0;
+}
+
+
+uint8_t *DQSpiStreamAcquire(DQSpiStream *s, uint32_t *len)
+{
+    uint32_t tick = HAL_GetTick();
+
+    /* wait the oldest buffer, unless nothing more is coming */
+    while (s->count == 0) {
+        if (s->err || (!s->busy && s->addr >= s->end))
+            return NULL;
+        if ((HAL_GetTick() - tick) > HAL_QPSI_TIMEOUT_DEFAULT_VALUE) {
+            s->err = 1;
+            return NULL;
+        }
+    }
+
+    if (len != NULL) {
+        *len = s->len[s->tail];
+    }
+
+    /* DMA wrote behind the D-cache */
+    if (SCB->CCR & SCB_CCR_DC_Msk) {
+        SCB_InvalidateDCache_by_Addr((uint32_t *)(s->buf + (uint32_t)s->tail * s->chunk), s->chunk);
+    }
+
+    return s->buf + (uint32_t)s->tail * s->chunk;
+}
+
+
+int8_t DQSpiStreamRelease(DQSpiStream *s)
+{
+    if (s->count == 0)
+        return -1;
+
+    s->tail = (s->tail + 1) % s->nbuf;
+
+    /* the ISR may run Kick as well: keep it out while updating */
+    HAL_NVIC_DisableIRQ(QUADSPI_IRQn);
+    s->count--;
+    DQSpiStreamKick(s);
+    HAL_NVIC_EnableIRQ(QUADSPI_IRQn);
+
+    return s->err ? -1 : 0;
+}
+
+
+int8_t DQSpiStreamClose(DQSpiStream *s)
+{
+    int8_t ret = s->err ? -1 : 0;
+
+    if (s->busy) {
+        if (HAL_QSPI_Abort(&hqspi) != HAL_OK) {
+            ret = -1;
+        }
+    }
+
+    stream = NULL;
+
+    return ret;
+}
+#endif
+
+
+#if DQSPI_LOG
+static void DQSpiAsyncEnd(int8_t ret)
+{
+    DQSpiAsyncDone done = async.done;
+
+    async.op = ASYNC_IDLE;
+    async.done = NULL;
+    if (done != NULL) {
+        done(ret);
+    }
+}
+
+
+/* data sent: the controller polls BUSY until the page is programmed */
+void HAL_QSPI_TxCpltCallback(QSPI_HandleTypeDef *h)
+{
+    (void)h;
+
+    if (async.op != ASYNC_PROG)
+        return;
+
+    if (HAL_QSPI_AutoPolling_IT(&hqspi, &rdsr1_cmd, &busy_poll) != HAL_OK) {
+        DQSpiAsyncEnd(-1);
+    }
+}
+
+
+void HAL_QSPI_StatusMatchCallback(QSPI_HandleTypeDef *h)
+{
+    (void)h;
+
+    if (async.op != ASYNC_IDLE) {
+        DQSpiAsyncEnd(0);
+    }
+}
+
+
+/* One page program: WREN and the command, then the data by DMA while the
+ * CPU goes on; done runs in the QUADSPI IRQ once BUSY clears. Callers in
+ * thread context mask QUADSPI_IRQn around the call. With the D-cache on,
+ * dat must be 32-byte aligned. */
+int8_t DQSpiProgramAsync(uint32_t addr, const uint8_t *dat, uint32_t len, DQSpiAsyncDone done)
+{
+    QSPI_CommandTypeDef s_command = prog_cmd;
+    int8_t ret;
+
+    /* the flash would wrap inside the page */
+    if (len == 0 || (addr % W25Q32FV_PAGE_SIZE) + len > W25Q32FV_PAGE_SIZE)
+        return -1;
+
+    ret = DQSpiIndirect();
+    if (ret != 0) {
+        return ret;
+    }
+
+    if (DQSpiSuspendCheck(s_command.Instruction, addr, len) != 0) {
+        return DQSPI_BUSY;
+    }
+
+    DQSpiProgDirty(addr, len);
+
+    /* the DMA reads the memory behind the D-cache */
+    if (SCB->CCR & SCB_CCR_DC_Msk) {
+        SCB_CleanDCache_by_Addr((uint32_t *)dat, len);
+    }
+
+    s_command.Address = addr;
+    s_command.NbData = len;
+
+    async.op = ASYNC_PROG;
+    async.done = done;
+    async.tick = HAL_GetTick();
+    async.timeout = W25Q32FV_PAGE_PROG_MAX_TIME;
+    if (DQSpiWriteEnable() != 0 ||
+        HAL_QSPI_Command(&hqspi, &s_command, HAL_QPSI_TIMEOUT_DEFAULT_VALUE) != HAL_OK ||
+        HAL_QSPI_Transmit_DMA(&hqspi, (uint8_t *)dat) != HAL_OK) {
+        async.op = ASYNC_IDLE;
+        async.done = NULL;
+        return -1;
+    }
+
+    return 0;
+}
+
+
+/* 64K erase polled by the controller, as DQSpiProgramAsync() */
+int8_t DQSpiEraseBlock64Async(uint32_t addr, DQSpiAsyncDone done)
+{
+    QSPI_CommandTypeDef s_command = {0};
+    int8_t ret;
+
+    /* the flash takes no erase while one is suspended */
+    if (async.suspended)
+        return DQSPI_BUSY;
+
+    ret = DQSpiIndirect();
+    if (ret != 0) {
+        return ret;
+    }
+
+    DQSpiEraseCmd(&s_command, BLOCK64_ERASE_CMD, addr, W25Q32FV_BLOCK64_SIZE);
+
+    async.op = ASYNC_ERASE;
+    async.erase_addr = addr & ~(W25Q32FV_BLOCK64_SIZE - 1);
+    async.done = done;
+    async.tick = HAL_GetTick();
+    async.timeout = W25Q32FV_BLOCK64_ERASE_MAX_TIME;
+    if (DQSpiWriteEnable() != 0 ||
+        HAL_QSPI_Command(&hqspi, &s_command, HAL_QPSI_TIMEOUT_DEFAULT_VALUE) != HAL_OK ||
+        HAL_QSPI_AutoPolling_IT(&hqspi, &rdsr1_cmd, &busy_poll) != HAL_OK) {
+        async.op = ASYNC_IDLE;
+        async.done = NULL;
+        return -1;
+    }
+
+    return 0;
+}
+
+
+/* Suspend the running erase: the flash then takes reads, and programs
+ * outside the erased block, until DQSpiEraseResume(). An erase that ended
+ * meanwhile calls its done here instead. Same IRQ masking as above. */
+int8_t DQSpiEraseSuspend(void)
+{
+    QSPI_CommandTypeDef s_command = wren_cmd;
+    uint8_t sr2;
+
+    if (async.op != ASYNC_ERASE)
+        return -1;
+
+    /* the abort stops the status polling, not the erase; BUSY clears
+     * after tSUS */
+    s_command.Instruction = PROG_ERASE_SUSPEND_CMD;
+    if (HAL_QSPI_Abort(&hqspi) != HAL_OK ||
+        HAL_QSPI_Command(&hqspi, &s_command, HAL_QPSI_TIMEOUT_DEFAULT_VALUE) != HAL_OK ||
+        DQSpiAutoPollingMemReady(HAL_QPSI_TIMEOUT_DEFAULT_VALUE) != 0) {
+        DQSpiAsyncEnd(-1);
+        return -1;
+    }
+
+    s_command = rdsr1_cmd;
+    s_command.Instruction = READ_STATUS_REG2_CMD;
+    s_command.NbData = 1;
+    if (HAL_QSPI_Command(&hqspi, &s_command, HAL_QPSI_TIMEOUT_DEFAULT_VALUE) != HAL_OK ||
+        HAL_QSPI_Receive(&hqspi, &sr2, HAL_QPSI_TIMEOUT_DEFAULT_VALUE) != HAL_OK) {
+        DQSpiAsyncEnd(-1);
+        return -1;
+    }
+
+    if (!(sr2 & W25Q32FV_FSR_SUS)) {
+        DQSpiAsyncEnd(0);
+        return 0;
+    }
+
+    async.erase_done = async.done;
+    async.done = NULL;
+    async.suspended = 1;
+    async.op = ASYNC_IDLE;
+
+    return 0;
+}
+
+
+/* on failure the erase stays suspended, the call can be repeated */
+int8_t DQSpiEraseResume(void)
+{
+    QSPI_CommandTypeDef s_command = wren_cmd;
+    int8_t ret;
+
+    if (!async.suspended)
+        return -1;
+
+    ret = DQSpiIndirect();
+    if (ret != 0) {
+        return ret;
+    }
+
+    s_command.Instruction = PROG_ERASE_RESUME_CMD;
+    if (HAL_QSPI_Command(&hqspi, &s_command, HAL_QPSI_TIMEOUT_DEFAULT_VALUE) != HAL_OK) {
+        return -1;
+    }
+
+    async.op = ASYNC_ERASE;
+    async.done = async.erase_done;
+    async.erase_done = NULL;
+    async.suspended = 0;
+    async.tick = HAL_GetTick();
+    async.timeout = W25Q32FV_BLOCK64_ERASE_MAX_TIME;
+    if (HAL_QSPI_AutoPolling_IT(&hqspi, &rdsr1_cmd, &busy_poll) != HAL_OK) {
+        DQSpiAsyncEnd(-1);
+        return -1;
+    }
+
+    return 0;
+}
+#endif
+
+
+#if DQSPI_STREAM || DQSPI_LOG
+void HAL_QSPI_ErrorCallback(QSPI_HandleTypeDef *h)
+{
+    (void)h;
+
+#if DQSPI_STREAM
+    if (stream != NULL) {
+        stream->busy = 0;
+        stream->err = 1;
+    }
+#endif
+#if DQSPI_LOG
+    if (async.op != ASYNC_IDLE) {
+        DQSpiAsyncEnd(-1);
+    }
+#endif
+}
+#endif
+
+
+int8_t DQSpiReadCacheStats(uint32_t *hit, uint32_t *miss)
+{
+#if DQSPI_READ_CACHE_LINES
+	if (hit != NULL) {
+		*hit = rcache_hit;
+	}
+
+	if (miss != NULL) {
+		*miss = rcache_miss;
+	}
+
+	return 0;
+#else
+	(void)hit;
+	(void)miss;
+
+	return -1;
+#endif
+}
+
+
+/* bad_page: flash offset of the last page that failed, 0xFFFFFFFF if none */
+int8_t DQSpiVerifyStats(uint32_t *pages, uint32_t *retries, uint32_t *bad_page)
+{
+#if DQSPI_VERIFY
+	if (pages != NULL) {
+		*pages = verify_pages;
+	}
+
+	if (retries != NULL) {
+		*retries = verify_retries;
+	}
+
+	if (bad_page != NULL) {
+		*bad_page = verify_bad;
+	}
+
+	return 0;
+#else
+	(void)pages;
+	(void)retries;
+	(void)bad_page;
+
+	return -1;
+#endif
+}
+
+
+int8_t DQSpiMemoryMapped(void)
+{
+    QSPI_CommandTypeDef s_command = {0};
+    QSPI_MemoryMappedTypeDef s_mem_mapped_cfg = {0};
+
+    if (qspi_mode == QSPI_MODE_MAPPED)
+        return 0;
+#if DQSPI_STREAM
+    if (stream != NULL)
+        return DQSPI_BUSY;
+#endif
+#if DQSPI_LOG
+    if (async.op != ASYNC_IDLE)
+        return DQSPI_BUSY;
+#endif
+
+    DQSPI_STAT_BEGIN(t);
+
+    /* Configure the command for the read instruction */
+    s_command.InstructionMode = QSPI_INSTRUCTION_1_LINE;
     s_command.AddressSize = QSPI_ADDRESS_24_BITS;
-    s_command.AlternateByteMode = QSPI_ALTERNATE_BYTES_NONE;
-    s_command.DummyCycles = 0;
+    s_command.DataMode = QSPI_DATA_2_LINES;
     s_command.DdrMode = QSPI_DDR_MODE_DISABLE;
     s_command.DdrHoldHalfCycle = QSPI_DDR_HHC_ANALOG_DELAY;
-    s_command.SIOOMode = QSPI_SIOO_INST_EVERY_CMD;
+    if (map_profile.dual_io || map_profile.continuous) {
+        /* 0xBB: address and mode bits on 2 lines, no dummy clocks */
+        s_command.Instruction = DUAL_INOUT_FAST_READ_CMD;
+        s_command.AddressMode = QSPI_ADDRESS_2_LINES;
+        s_command.AlternateByteMode = QSPI_ALTERNATE_BYTES_2_LINES;
+        s_command.AlternateBytesSize = QSPI_ALTERNATE_BYTES_8_BITS;
+        s_command.AlternateBytes = map_profile.continuous ? W25Q32FV_CONTINUOUS_READ_M : 0x00;
+        s_command.DummyCycles = 0;
+    }
+    else {
+        s_command.Instruction = DUAL_OUT_FAST_READ_CMD;
+        s_command.AddressMode = QSPI_ADDRESS_1_LINE;
+        s_command.AlternateByteMode = QSPI_ALTERNATE_BYTES_NONE;
+        s_command.AlternateBytesSize = 0;
+        s_command.AlternateBytes = 0;
+        s_command.DummyCycles = DUMMY_CLOCK_CYCLES_READ;
+    }
+    /* the flash skips the instruction only in continuous read mode */
+    s_command.SIOOMode = map_profile.continuous ? QSPI_SIOO_INST_ONLY_FIRST_CMD : QSPI_SIOO_INST_EVERY_CMD;
 
-    /* Perform the write page by page */
-    do {
-        s_command.Address = current_addr;
-        s_command.NbData = current_size;
+    /* Pending writes must reach the flash before the CPU reads it directly */
+    if (DQSpiFlush() != 0) {
+        return -1;
+    }
+
+    if (DQSpiWake(0) != 0) {
+        return -1;
+    }
+    pd_last = HAL_GetTick();
 
-    	/* Enable write operations */
-    	if (DQSpiWriteEnable() != 0) {
-    		return -1;
-    	}
+#if DQSPI_MANIFEST
+    /* a failed sync keeps its changes for the next one, mapping goes on */
+    DQSpiManSync();
+#endif
 
-        /* Configure the command */
-        if (HAL_QSPI_Command(&hqspi, &s_command, HAL_QPSI_TIMEOUT_DEFAULT_VALUE) != HAL_OK) {
+    /* nothing can refill the lines until the window is enabled again */
+    DQSpiXipInvalidate();
+
+    /* Configure the memory mapped mode: without timeout nCS stays low and
+     * the prefetch alive after a read, but the flash never enters standby */
+    if (map_profile.timeout != 0) {
+        s_mem_mapped_cfg.TimeOutActivation = QSPI_TIMEOUT_COUNTER_ENABLE;
+        s_mem_mapped_cfg.TimeOutPeriod = map_profile.timeout;
+    }
+    else {
+        s_mem_mapped_cfg.TimeOutActivation = QSPI_TIMEOUT_COUNTER_DISABLE;
+        s_mem_mapped_cfg.TimeOutPeriod = 0;
+    }
+
+    if (HAL_QSPI_MemoryMapped(&hqspi, &s_command, &s_mem_mapped_cfg) != HAL_OK) {
+        return -1;;
+    }
+    qspi_mode = QSPI_MODE_MAPPED;
+    map_continuous = map_profile.continuous;
+
+    DQSPI_STAT_END(t, DQSPI_OP_MAP, s_command.Instruction, 0, 0, 0);
+
+    return 0;
+}
+
+
+const uint8_t *DQSpiMap(uint32_t addr, uint32_t len)
+{
+    if (addr >= W25Q32FV_FLASH_SIZE || len > W25Q32FV_FLASH_SIZE - addr)
+        return NULL;
+
+    /* first mapping: pending writes must land before the window is used */
+    if (map_refs == 0) {
+        if (DQSpiFlush() != 0 || DQSpiMemoryMapped() != 0) {
+            return NULL;
+        }
+    }
+
+    map_refs++;
+
+    return (const uint8_t *)(DQSPI_MAP_ADDR + addr);
+}
+
+
+int8_t DQSpiUnmap(const uint8_t *ptr)
+{
+    if (map_refs == 0 || ptr < (const uint8_t *)DQSPI_MAP_ADDR || ptr >= (const uint8_t *)(DQSPI_MAP_ADDR + W25Q32FV_FLASH_SIZE))
+        return -1;
+
+    map_refs--;
+    pd_last = HAL_GetTick();
+
+    return 0;
+}
+
+
+int8_t DQSpiMapProfileSet(const DQSpiMapProfile *p)
+{
+    int8_t ret;
+
+    if (p->sioo != p->continuous)
+        return -1;
+
+    /* mapped mode is re-entered with the new settings */
+    ret = DQSpiIndirect();
+    if (ret != 0) {
+        return ret;
+    }
+
+    map_profile = *p;
+
+    return 0;
+}
+
+
+int8_t DQSpiMapProfileGet(DQSpiMapProfile *p)
+{
+    *p = map_profile;
+
+    return 0;
+}
+
+
+int8_t DQSpiMapBench(const DQSpiMapProfile *p, uint32_t len, DQSpiMapBenchResult *res)
+{
+    DQSpiMapProfile old = map_profile;
+    const volatile uint32_t *w;
+    uint32_t i, t, c, rnd, sum;
+    int8_t ret;
+
+    if (len == 0 || len > W25Q32FV_FLASH_SIZE)
+        return -1;
+
+    ret = DQSpiMapProfileSet(p);
+    if (ret != 0) {
+        return ret;
+    }
+
+    DQSpiCycInit();
+    memset(res, 0, sizeof(*res));
+    res->rnd_min = 0xFFFFFFFF;
+
+    w = (const volatile uint32_t *)DQSpiMap(0, W25Q32FV_FLASH_SIZE);
+    if (w == NULL) {
+        DQSpiMapProfileSet(&old);
+        return -1;
+    }
+
+    /* measure the QSPI, not the D-cache */
+    SCB_CleanInvalidateDCache();
+
+    sum = 0;
+    t = DWT->CYCCNT;
+    for (i = 0; i != len / 4; i++) {
+        sum += w[i];
+    }
+    res->seq_cycles = DWT->CYCCNT - t;
+
+    SCB_CleanInvalidateDCache();
+
+    rnd = 0x12345678;
+    for (i = 0; i != DQSPI_MAP_BENCH_RANDOM; i++) {
+        rnd = rnd * 1664525 + 1013904223;
+        t = DWT->CYCCNT;
+        sum += w[(rnd >> 10) % (W25Q32FV_FLASH_SIZE / 4)];
+        c = DWT->CYCCNT - t;
+        res->rnd_total += c;
+        if (c < res->rnd_min)
+            res->rnd_min = c;
+        if (c > res->rnd_max)
+            res->rnd_max = c;
+    }
+    res->checksum = sum;
+
+    DQSpiUnmap((const uint8_t *)w);
+
+    return DQSpiMapProfileSet(&old);
+}
+
+
+int8_t DQSpiMpuConfig(void)
+{
+    MPU_Region_InitTypeDef r = {0};
+
+    HAL_MPU_Disable();
+
+    /* whole QSPI bank: no access, strongly ordered, never executed, so
+     * speculative reads cannot reach the controller past the device */
+    r.Enable = MPU_REGION_ENABLE;
+    r.Number = MPU_REGION_NUMBER0;
+    r.BaseAddress = DQSPI_MAP_ADDR;
+    r.Size = MPU_REGION_SIZE_256MB;
+    r.SubRegionDisable = 0x00;
+    r.TypeExtField = MPU_TEX_LEVEL0;
+    r.AccessPermission = MPU_REGION_NO_ACCESS;
+    r.DisableExec = MPU_INSTRUCTION_ACCESS_DISABLE;
+    r.IsShareable = MPU_ACCESS_SHAREABLE;
+    r.IsCacheable = MPU_ACCESS_NOT_CACHEABLE;
+    r.IsBufferable = MPU_ACCESS_NOT_BUFFERABLE;
+    HAL_MPU_ConfigRegion(&r);
+
+    /* the device itself: read-only normal memory, write-through cacheable */
+    r.Number = MPU_REGION_NUMBER1;
+    r.Size = MPU_REGION_SIZE_4MB;
+    r.AccessPermission = MPU_REGION_PRIV_RO_URO;
+    r.DisableExec = MPU_INSTRUCTION_ACCESS_ENABLE;
+    r.IsShareable = MPU_ACCESS_NOT_SHAREABLE;
+    r.IsCacheable = MPU_ACCESS_CACHEABLE;
+    HAL_MPU_ConfigRegion(&r);
+
+#if DQSPI_MPU_SRAM_NOCACHE
+    /* the programmer writes Buffer in SRAM behind the D-cache */
+    r.Number = MPU_REGION_NUMBER2;
+    r.BaseAddress = SRAM1_BASE & ~(0x40000UL - 1);
+    r.Size = MPU_REGION_SIZE_256KB;
+    r.TypeExtField = MPU_TEX_LEVEL1;
+    r.AccessPermission = MPU_REGION_FULL_ACCESS;
+    r.IsCacheable = MPU_ACCESS_NOT_CACHEABLE;
+    HAL_MPU_ConfigRegion(&r);
+#endif
+
+    HAL_MPU_Enable(MPU_PRIVILEGED_DEFAULT);
+
+#if DQSPI_XIP_CACHE
+    /* enabling invalidates the whole cache: only do it once */
+    if ((SCB->CCR & SCB_CCR_IC_Msk) == 0) {
+        SCB_EnableICache();
+    }
+
+    if ((SCB->CCR & SCB_CCR_DC_Msk) == 0) {
+        SCB_EnableDCache();
+    }
+#endif
+
+    return 0;
+}
+
+
+int8_t DQSpiUniqueId(uint8_t *id)
+{
+    QSPI_CommandTypeDef s_command = {0};
+
+    if (!uid_valid) {
+        if (DQSpiIndirect() != 0) {
             return -1;
         }
 
-        /* Transmission of the data */
-        if (HAL_QSPI_Transmit(&hqspi, dat, HAL_QPSI_TIMEOUT_DEFAULT_VALUE) != HAL_OK) {
+        /* 0x4B, 4 dummy bytes, 64-bit ID */
+        s_command.InstructionMode = QSPI_INSTRUCTION_1_LINE;
+        s_command.Instruction = READ_UIC_ID_CMD;
+        s_command.AddressMode = QSPI_ADDRESS_NONE;
+        s_command.AlternateByteMode = QSPI_ALTERNATE_BYTES_NONE;
+        s_command.DataMode = QSPI_DATA_1_LINE;
+        s_command.DummyCycles = 32;
+        s_command.NbData = W25Q32FV_UID_SIZE;
+        s_command.DdrMode = QSPI_DDR_MODE_DISABLE;
+        s_command.DdrHoldHalfCycle = QSPI_DDR_HHC_ANALOG_DELAY;
+        s_command.SIOOMode = QSPI_SIOO_INST_EVERY_CMD;
+
+        if (HAL_QSPI_Command(&hqspi, &s_command, HAL_QPSI_TIMEOUT_DEFAULT_VALUE) != HAL_OK) {
             return -1;
         }
 
-        /* Configure automatic polling mode to wait for end of program */
-        if (DQSpiAutoPollingMemReady() != 0) {
+        if (HAL_QSPI_Receive(&hqspi, uid, HAL_QPSI_TIMEOUT_DEFAULT_VALUE) != HAL_OK) {
             return -1;
         }
+        uid_valid = 1;
+    }
 
-        /* Update the address and size variables for next page programming */
-        current_addr += current_size;
-        dat += current_size;
-        current_size = ((current_addr + W25Q32FV_PAGE_SIZE) > end_addr) ? (end_addr - current_addr) : W25Q32FV_PAGE_SIZE;
-    } while (current_addr < end_addr);
+    memcpy(id, uid, W25Q32FV_UID_SIZE);
 
     return 0;
 }
 
 
-int8_t DQSpiMemoryMapped(void)
+/* security register n (1..3) is at address n << 12 */
+static int8_t DQSpiSecurityAddr(uint8_t reg, uint32_t off, uint32_t len, uint32_t *addr)
+{
+    if (reg < 1 || reg > W25Q32FV_SECURITY_REG_NUM || off >= W25Q32FV_SECURITY_REG_SIZE || len > W25Q32FV_SECURITY_REG_SIZE - off)
+        return -1;
+
+    *addr = ((uint32_t)reg << 12) | off;
+
+    return 0;
+}
+
+
+int8_t DQSpiSecurityRead(uint8_t reg, uint32_t off, uint8_t *dat, uint32_t len)
 {
     QSPI_CommandTypeDef s_command = {0};
-    QSPI_MemoryMappedTypeDef s_mem_mapped_cfg = {0};
+    uint32_t addr;
+    int8_t ret;
+
+    if (len == 0 || DQSpiSecurityAddr(reg, off, len, &addr) != 0)
+        return -1;
+
+    ret = DQSpiIndirect();
+    if (ret != 0) {
+        return ret;
+    }
 
-    /* Configure the command for the read instruction */
     s_command.InstructionMode = QSPI_INSTRUCTION_1_LINE;
-    s_command.Instruction = DUAL_OUT_FAST_READ_CMD;
+    s_command.Instruction = READ_SECURITY_REG_CMD;
     s_command.AddressMode = QSPI_ADDRESS_1_LINE;
     s_command.AddressSize = QSPI_ADDRESS_24_BITS;
-    s_command.DataMode = QSPI_DATA_2_LINES;
+    s_command.Address = addr;
     s_command.AlternateByteMode = QSPI_ALTERNATE_BYTES_NONE;
-    s_command.AlternateBytesSize = 0;
-    s_command.AlternateBytes = 0;
+    s_command.DataMode = QSPI_DATA_1_LINE;
     s_command.DummyCycles = DUMMY_CLOCK_CYCLES_READ;
+    s_command.NbData = len;
     s_command.DdrMode = QSPI_DDR_MODE_DISABLE;
     s_command.DdrHoldHalfCycle = QSPI_DDR_HHC_ANALOG_DELAY;
     s_command.SIOOMode = QSPI_SIOO_INST_EVERY_CMD;
 
-    /* Configure the memory mapped mode */
-    s_mem_mapped_cfg.TimeOutActivation = QSPI_TIMEOUT_COUNTER_DISABLE;
-    s_mem_mapped_cfg.TimeOutPeriod = 0;
+    if (HAL_QSPI_Command(&hqspi, &s_command, HAL_QPSI_TIMEOUT_DEFAULT_VALUE) != HAL_OK) {
+        return -1;
+    }
 
-    if (HAL_QSPI_MemoryMapped(&hqspi, &s_command, &s_mem_mapped_cfg) != HAL_OK) {
-        return -1;;
+    if (HAL_QSPI_Receive(&hqspi, dat, HAL_QPSI_TIMEOUT_DEFAULT_VALUE) != HAL_OK) {
+        return -1;
+    }
+
+    return 0;
+}
+
+
+int8_t DQSpiSecurityWrite(uint8_t reg, uint32_t off, uint8_t *dat, uint32_t len)
+{
+    QSPI_CommandTypeDef s_command = {0};
+    uint32_t addr;
+    int8_t ret;
+
+    if (len == 0 || DQSpiSecurityAddr(reg, off, len, &addr) != 0)
+        return -1;
+
+    ret = DQSpiIndirect();
+    if (ret != 0) {
+        return ret;
+    }
+
+    /* a register is one page: a single program */
+    s_command.InstructionMode = QSPI_INSTRUCTION_1_LINE;
+    s_command.Instruction = PROG_SECURITY_REG_CMD;
+    s_command.AddressMode = QSPI_ADDRESS_1_LINE;
+    s_command.AddressSize = QSPI_ADDRESS_24_BITS;
+    s_command.Address = addr;
+    s_command.AlternateByteMode = QSPI_ALTERNATE_BYTES_NONE;
+    s_command.DataMode = QSPI_DATA_1_LINE;
+    s_command.DummyCycles = 0;
+    s_command.NbData = len;
+    s_command.DdrMode = QSPI_DDR_MODE_DISABLE;
+    s_command.DdrHoldHalfCycle = QSPI_DDR_HHC_ANALOG_DELAY;
+    s_command.SIOOMode = QSPI_SIOO_INST_EVERY_CMD;
+
+    return DQSpiWriteSeq(&s_command, dat, W25Q32FV_PAGE_PROG_MAX_TIME, NULL);
+}
+
+
+int8_t DQSpiSecurityErase(uint8_t reg)
+{
+    QSPI_CommandTypeDef s_command = {0};
+    uint32_t addr;
+    int8_t ret;
+
+    if (DQSpiSecurityAddr(reg, 0, 0, &addr) != 0)
+        return -1;
+
+    ret = DQSpiIndirect();
+    if (ret != 0) {
+        return ret;
+    }
+
+    s_command.InstructionMode = QSPI_INSTRUCTION_1_LINE;
+    s_command.Instruction = ERASE_SECURITY_REG_CMD;
+    s_command.AddressMode = QSPI_ADDRESS_1_LINE;
+    s_command.AddressSize = QSPI_ADDRESS_24_BITS;
+    s_command.Address = addr;
+    s_command.AlternateByteMode = QSPI_ALTERNATE_BYTES_NONE;
+    s_command.DataMode = QSPI_DATA_NONE;
+    s_command.DummyCycles = 0;
+    s_command.DdrMode = QSPI_DDR_MODE_DISABLE;
+    s_command.DdrHoldHalfCycle = QSPI_DDR_HHC_ANALOG_DELAY;
+    s_command.SIOOMode = QSPI_SIOO_INST_EVERY_CMD;
+
+    return DQSpiWriteSeq(&s_command, NULL, W25Q32FV_SECTOR_ERASE_MAX_TIME, NULL);
+}
+
+
+int8_t DQSpiSecurityLocked(uint8_t reg, uint8_t *locked)
+{
+    QSPI_CommandTypeDef s_command = rdsr1_cmd;
+    uint32_t addr;
+    uint8_t sr2;
+    int8_t ret;
+
+    if (DQSpiSecurityAddr(reg, 0, 0, &addr) != 0)
+        return -1;
+
+    ret = DQSpiIndirect();
+    if (ret != 0) {
+        return ret;
     }
 
+    s_command.Instruction = READ_STATUS_REG2_CMD;
+    s_command.NbData = 1;
+    if (HAL_QSPI_Command(&hqspi, &s_command, HAL_QPSI_TIMEOUT_DEFAULT_VALUE) != HAL_OK) {
+        return -1;
+    }
+
+    if (HAL_QSPI_Receive(&hqspi, &sr2, HAL_QPSI_TIMEOUT_DEFAULT_VALUE) != HAL_OK) {
+        return -1;
+    }
+
+    *locked = (sr2 & (W25Q32FV_FSR_LB1 << (reg - 1))) ? 1 : 0;
+
     return 0;
 }
 
 
+/* LB1..LB3 are one-time programmable: the register becomes read-only forever */
+int8_t DQSpiSecurityLock(uint8_t reg)
+{
+    QSPI_CommandTypeDef s_command = rdsr1_cmd;
+    uint8_t sr2;
+    int8_t ret;
+
+    if (reg < 1 || reg > W25Q32FV_SECURITY_REG_NUM)
+        return -1;
+
+    ret = DQSpiIndirect();
+    if (ret != 0) {
+        return ret;
+    }
+
+    s_command.Instruction = READ_STATUS_REG2_CMD;
+    s_command.NbData = 1;
+    if (HAL_QSPI_Command(&hqspi, &s_command, HAL_QPSI_TIMEOUT_DEFAULT_VALUE) != HAL_OK) {
+        return -1;
+    }
+
+    if (HAL_QSPI_Receive(&hqspi, &sr2, HAL_QPSI_TIMEOUT_DEFAULT_VALUE) != HAL_OK) {
+        return -1;
+    }
+
+    sr2 |= W25Q32FV_FSR_LB1 << (reg - 1);
+
+    /* non-volatile status write: WREN, 0x31, wait tW */
+    s_command.Instruction = WRITE_STATUS_REG2_CMD;
+
+    return DQSpiWriteSeq(&s_command, &sr2, W25Q32FV_STATUS_WRITE_MAX_TIME, NULL);
+}
@@ -0,0 +1,313 @@
+#include <stddef.h>
+#include <string.h>
+
+#include "main.h"
+
+#include "dqspi.h"
+#include "dqspi_bd.h"
+
+
+#if (DQSPI_BD_BASE & (DQSPI_BD_SECTOR_SIZE - 1)) != 0
+#error "DQSPI_BD_BASE must be 4K aligned"
+#endif
+#if DQSPI_BD_SPARES < 1 || DQSPI_BD_SECTORS <= DQSPI_BD_SPARES || DQSPI_BD_SECTORS >= 0xFFFF
+#error "DQSPI_BD_SECTORS/SPARES: at least one spare and one block"
+#endif
+
+#define BD_NONE              0xFFFF
+
+/* RAM map: 8 bytes per sector */
+static struct {
+    uint8_t mounted;
+    uint32_t seq;
+    uint32_t moves;
+    uint16_t l2p[DQSPI_BD_BLOCKS];
+    uint16_t p2l[DQSPI_BD_SECTORS];
+    uint32_t ec[DQSPI_BD_SECTORS];
+} bd;
+
+static uint8_t bd_page[DQSPI_BD_HDR_SIZE];
+
+const DQSpiBdOps DQSpiBd = {
+    .read = DQSpiBdRead,
+    .prog = DQSpiBdProg,
+    .erase = DQSpiBdErase,
+    .sync = DQSpiBdSync,
+    .block_size = DQSPI_BD_BLOCK_SIZE,
+    .block_count = DQSPI_BD_BLOCKS,
+    .prog_size = 1
+};
+
+
+static uint32_t BdAddr(uint32_t p)
+{
+    return DQSPI_BD_BASE + p * DQSPI_BD_SECTOR_SIZE;
+}
+
+
+static uint32_t BdHdrCrc(const DQSpiBdHdr *h)
+{
+    return DQSpiCrc32(0, (const uint8_t *)h, offsetof(DQSpiBdHdr, crc));
+}
+
+
+/* program one word of a header to 0 */
+static int8_t BdMark(uint32_t p, uint32_t field)
+{
+    uint32_t zero = 0;
+
+    return DQSpiWrite(BdAddr(p) + field, (uint8_t *)&zero, sizeof(zero));
+}
+
+
+/* free sector with the lowest (or highest) erase count */
+static uint16_t BdFree(uint8_t worn)
+{
+    uint16_t p, best = BD_NONE;
+
+    for (p = 0; p != DQSPI_BD_SECTORS; p++) {
+        if (bd.p2l[p] != BD_NONE) {
+            continue;
+        }
+        if (best == BD_NONE || (worn ? bd.ec[p] > bd.ec[best] : bd.ec[p] < bd.ec[best])) {
+            best = p;
+        }
+    }
+
+    return best;
+}
+
+
+/* erase p and give it to block b; the content is valid once committed */
+static int8_t BdClaim(uint16_t p, uint16_t b, uint8_t commit)
+{
+    DQSpiBdHdr h;
+
+    if (DQSpiEraseSector(BdAddr(p)) != 0) {
+        return -1;
+    }
+    bd.ec[p]++;
+
+    memset(&h, 0xFF, sizeof(h));
+    h.magic = DQSPI_BD_MAGIC;
+    h.block = b;
+    h.reserved = 0xFFFF;
+    h.ec = bd.ec[p];
+    h.seq = ++bd.seq;
+    h.crc = BdHdrCrc(&h);
+    if (commit) {
+        h.committed = 0;
+    }
+
+    return DQSpiWrite(BdAddr(p), (uint8_t *)&h, sizeof(h));
+}
+
+
+/* the old copy is only marked: its erase count stays readable. The map
+ * moves even when the mark fails, the mount takes the higher seq. */
+static int8_t BdMap(uint16_t b, uint16_t p)
+{
+    uint16_t q = bd.l2p[b];
+    int8_t ret = 0;
+
+    if (q != BD_NONE && q != p) {
+        ret = BdMark(q, offsetof(DQSpiBdHdr, obsolete));
+        bd.p2l[q] = BD_NONE;
+    }
+    bd.l2p[b] = p;
+    bd.p2l[p] = b;
+
+    return ret;
+}
+
+
+/* move the coldest block to the most worn free sector, so its sector
+ * takes its share of erases */
+static int8_t BdStatic(void)
+{
+    uint16_t p, q = BD_NONE, b;
+    uint32_t max = 0, off;
+
+    for (p = 0; p != DQSPI_BD_SECTORS; p++) {
+        if (bd.ec[p] > max) {
+            max = bd.ec[p];
+        }
+        if (bd.p2l[p] != BD_NONE && (q == BD_NONE || bd.ec[p] < bd.ec[q])) {
+            q = p;
+        }
+    }
+    if (q == BD_NONE || max - bd.ec[q] <= DQSPI_BD_STATIC_THRESHOLD) {
+        return 0;
+    }
+    p = BdFree(1);
+    if (p == BD_NONE || bd.ec[p] <= bd.ec[q]) {
+        return 0;
+    }
+
+    b = bd.p2l[q];
+    if (BdClaim(p, b, 0) != 0) {
+        return -1;
+    }
+    for (off = DQSPI_BD_HDR_SIZE; off != DQSPI_BD_SECTOR_SIZE; off += sizeof(bd_page)) {
+        if (DQSpiRead(BdAddr(q) + off, bd_page, sizeof(bd_page)) != 0 ||
+            DQSpiWrite(BdAddr(p) + off, bd_page, sizeof(bd_page)) != 0) {
+            return -1;
+        }
+    }
+    if (BdMark(p, offsetof(DQSpiBdHdr, committed)) != 0) {
+        return -1;
+    }
+
+    bd.moves++;
+
+    return BdMap(b, p);
+}
+
+
+/* map from the sector headers: for a block claimed twice (power loss
+ * between the new copy and the obsolete mark) the higher seq wins */
+int8_t DQSpiBdMount(void)
+{
+    DQSpiBdHdr h;
+    uint32_t seq, min = 0xFFFFFFFF;
+    uint16_t p, q;
+
+    memset(&bd, 0, sizeof(bd));
+    memset(bd.l2p, 0xFF, sizeof(bd.l2p));
+    memset(bd.p2l, 0xFF, sizeof(bd.p2l));
+
+    for (p = 0; p != DQSPI_BD_SECTORS; p++) {
+        if (DQSpiRead(BdAddr(p), (uint8_t *)&h, sizeof(h)) != 0) {
+            return -1;
+        }
+        if (h.magic != DQSPI_BD_MAGIC || h.crc != BdHdrCrc(&h)) {
+            bd.ec[p] = 0xFFFFFFFF;
+            continue;
+        }
+        bd.ec[p] = h.ec;
+        if (h.ec < min) {
+            min = h.ec;
+        }
+        if ((int32_t)(h.seq - bd.seq) > 0) {
+            bd.seq = h.seq;
+        }
+        if (h.committed != 0 || h.obsolete == 0 || h.block >= DQSPI_BD_BLOCKS) {
+            continue;
+        }
+
+        q = bd.l2p[h.block];
+        if (q != BD_NONE) {
+            if (DQSpiRead(BdAddr(q) + offsetof(DQSpiBdHdr, seq), (uint8_t *)&seq, sizeof(seq)) != 0) {
+                return -1;
+            }
+            if ((int32_t)(h.seq - seq) < 0) {
+                continue;
+            }
+            bd.p2l[q] = BD_NONE;
+        }
+        bd.l2p[h.block] = p;
+        bd.p2l[p] = h.block;
+    }
+
+    /* no header: never used, or power lost right after the erase */
+    for (p = 0; p != DQSPI_BD_SECTORS; p++) {
+        if (bd.ec[p] == 0xFFFFFFFF) {
+            bd.ec[p] = (min == 0xFFFFFFFF) ? 0 : min;
+        }
+    }
+
+    bd.mounted = 1;
+
+    return 0;
+}
+
+
+/* unmapped blocks read as erased */
+int8_t DQSpiBdRead(uint32_t block, uint32_t off, uint8_t *dat, uint32_t len)
+{
+    if (!bd.mounted || block >= DQSPI_BD_BLOCKS || off > DQSPI_BD_BLOCK_SIZE || len > DQSPI_BD_BLOCK_SIZE - off) {
+        return -1;
+    }
+    if (bd.l2p[block] == BD_NONE) {
+        memset(dat, 0xFF, len);
+        return 0;
+    }
+
+    return DQSpiRead(BdAddr(bd.l2p[block]) + DQSPI_BD_HDR_SIZE + off, dat, len);
+}
+
+
+int8_t DQSpiBdProg(uint32_t block, uint32_t off, const uint8_t *dat, uint32_t len)
+{
+    if (!bd.mounted || block >= DQSPI_BD_BLOCKS || off > DQSPI_BD_BLOCK_SIZE || len > DQSPI_BD_BLOCK_SIZE - off ||
+        bd.l2p[block] == BD_NONE) {
+        return -1;
+    }
+
+    /* DQSpiWrite() does not modify the data */
+    return DQSpiWrite(BdAddr(bd.l2p[block]) + DQSPI_BD_HDR_SIZE + off, (uint8_t *)dat, len);
+}
+
+
+int8_t DQSpiBdErase(uint32_t block)
+{
+    uint16_t p, q;
+
+    if (!bd.mounted || block >= DQSPI_BD_BLOCKS) {
+        return -1;
+    }
+
+    /* erased in place while its sector is not much more worn */
+    q = bd.l2p[block];
+    p = BdFree(0);
+    if (q != BD_NONE && (p == BD_NONE || bd.ec[q] <= bd.ec[p] + DQSPI_BD_DYNAMIC_THRESHOLD)) {
+        p = q;
+    }
+    if (p == BD_NONE || BdClaim(p, block, 1) != 0) {
+        return -1;
+    }
+    if (BdMap(block, p) != 0) {
+        return -1;
+    }
+
+    return BdStatic();
+}
+
+
+int8_t DQSpiBdSync(void)
+{
+    return DQSpiFlush();
+}
+
+
+int8_t DQSpiBdStats(uint32_t *ec_min, uint32_t *ec_max, uint32_t *moves)
+{
+    uint32_t lo = 0xFFFFFFFF, hi = 0;
+    uint16_t p;
+
+    if (!bd.mounted) {
+        return -1;
+    }
+
+    for (p = 0; p != DQSPI_BD_SECTORS; p++) {
+        if (bd.ec[p] < lo)
+            lo = bd.ec[p];
+        if (bd.ec[p] > hi)
+            hi = bd.ec[p];
+    }
+
+    if (ec_min != NULL) {
+        *ec_min = lo;
+    }
+
+    if (ec_max != NULL) {
+        *ec_max = hi;
+    }
+
+    if (moves != NULL) {
+        *moves = bd.moves;
+    }
+
+    return 0;
+}
+
@@ -0,0 +1,295 @@
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "main.h"
+
+#include "dqspi_bench.h"
+
+
+#if DQSPI_BENCH
+#define BENCH_BLOCK          0x10000UL
+#define BENCH_CHUNK          0x1000UL
+#define BENCH_RND_LEN        32
+#define BENCH_PAGE           256
+
+DQSpiBenchResult DQSpiBenchBlock __attribute__((used));
+
+static const char *bench_name[DQSPI_BENCH_NUM] = {
+    "read_seq", "read_rnd",
+    "map_seq_3b", "map_rnd_3b",
+    "map_seq_bb", "map_rnd_bb",
+    "map_seq_bb_cont", "map_rnd_bb_cont",
+    "program", "erase_4k", "erase_32k", "erase_64k"
+};
+
+static const DQSpiMapProfile bench_prof[3] = {
+    {0, 0, 0, 0},
+    {0, 1, 0, 0},
+    {0, 1, 1, 1}
+};
+
+static uint8_t bench_buf[BENCH_CHUNK] __attribute__((aligned(32)));
+static uint32_t smp[DQSPI_BENCH_SAMPLES];
+static uint32_t nsmp;
+static uint32_t rnd;
+
+
+static uint32_t BenchRand(void)
+{
+    rnd = rnd * 1664525 + 1013904223;
+
+    return rnd >> 8;
+}
+
+
+static int BenchCmp(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+
+static void BenchSample(DQSpiBenchId id, uint32_t t, uint32_t bytes, int8_t ret)
+{
+    DQSpiBenchCase *bc = &DQSpiBenchBlock.c[id];
+    uint32_t c = DWT->CYCCNT - t;
+
+    bc->count++;
+    if (ret != 0) {
+        bc->errors++;
+    }
+    bc->bytes += bytes;
+    bc->cycles += c;
+    if (nsmp != DQSPI_BENCH_SAMPLES) {
+        smp[nsmp++] = c;
+    }
+}
+
+
+static void BenchEnd(DQSpiBenchId id)
+{
+    DQSpiBenchCase *bc = &DQSpiBenchBlock.c[id];
+
+    if (nsmp != 0) {
+        qsort(smp, nsmp, sizeof(smp[0]), BenchCmp);
+        bc->p50 = smp[nsmp * 50 / 100];
+        bc->p90 = smp[nsmp * 90 / 100];
+        bc->p99 = smp[nsmp * 99 / 100];
+        bc->max = smp[nsmp - 1];
+    }
+    if (bc->cycles != 0) {
+        bc->kbps = (uint64_t)bc->bytes * DQSpiBenchBlock.cpu_hz / bc->cycles / 1000;
+    }
+    nsmp = 0;
+}
+
+
+static void BenchErase(void)
+{
+    uint32_t base = DQSpiBenchBlock.addr;
+    uint32_t i, l, t;
+    int8_t ret;
+
+    for (l = 0; l != DQSPI_BENCH_LOOPS; l++) {
+        t = DWT->CYCCNT;
+        ret = DQSpiEraseBlock64(base);
+        BenchSample(DQSPI_BENCH_ERASE_64K, t, BENCH_BLOCK, ret);
+    }
+    BenchEnd(DQSPI_BENCH_ERASE_64K);
+
+    for (l = 0; l != DQSPI_BENCH_LOOPS; l++) {
+        for (i = 0; i != BENCH_BLOCK; i += 0x8000) {
+            t = DWT->CYCCNT;
+            ret = DQSpiEraseBlock(base + i);
+            BenchSample(DQSPI_BENCH_ERASE_32K, t, 0x8000, ret);
+        }
+    }
+    BenchEnd(DQSPI_BENCH_ERASE_32K);
+
+    for (l = 0; l != DQSPI_BENCH_LOOPS; l++) {
+        for (i = 0; i != BENCH_BLOCK; i += 0x1000) {
+            t = DWT->CYCCNT;
+            ret = DQSpiEraseSector(base + i);
+            BenchSample(DQSPI_BENCH_ERASE_4K, t, 0x1000, ret);
+        }
+    }
+    BenchEnd(DQSPI_BENCH_ERASE_4K);
+}
+
+
+static void BenchProgram(void)
+{
+    uint32_t base = DQSpiBenchBlock.addr;
+    uint32_t i, j, l, t;
+    int8_t ret;
+
+    for (l = 0; l != DQSPI_BENCH_LOOPS; l++) {
+        if (DQSpiEraseBlock64(base) != 0) {
+            DQSpiBenchBlock.c[DQSPI_BENCH_PROGRAM].errors++;
+        }
+        rnd = 0x12345678;
+        for (i = 0; i != BENCH_BLOCK; i += BENCH_PAGE) {
+            for (j = 0; j != BENCH_PAGE; j += 4) {
+                *(uint32_t *)&bench_buf[j] = BenchRand();
+            }
+            t = DWT->CYCCNT;
+            ret = DQSpiWrite(base + i, bench_buf, BENCH_PAGE);
+            BenchSample(DQSPI_BENCH_PROGRAM, t, BENCH_PAGE, ret);
+        }
+    }
+#if DQSPI_WRITE_BUFFER
+    DQSpiFlush();
+#endif
+    BenchEnd(DQSPI_BENCH_PROGRAM);
+}
+
+
+static void BenchRead(uint32_t size)
+{
+    uint32_t base = DQSpiBenchBlock.addr;
+    uint32_t i, l, t;
+    int8_t ret;
+
+    for (l = 0; l != DQSPI_BENCH_LOOPS; l++) {
+        for (i = 0; i != BENCH_BLOCK; i += BENCH_CHUNK) {
+            t = DWT->CYCCNT;
+            ret = DQSpiRead(base + i, bench_buf, BENCH_CHUNK);
+            BenchSample(DQSPI_BENCH_READ_SEQ, t, BENCH_CHUNK, ret);
+            DQSpiBenchBlock.checksum += bench_buf[l];
+        }
+    }
+    BenchEnd(DQSPI_BENCH_READ_SEQ);
+
+    rnd = 0x87654321;
+    for (i = 0; i != DQSPI_BENCH_SAMPLES; i++) {
+        uint32_t a = BenchRand() % (size - BENCH_RND_LEN);
+
+        t = DWT->CYCCNT;
+        ret = DQSpiRead(a, bench_buf, BENCH_RND_LEN);
+        BenchSample(DQSPI_BENCH_READ_RND, t, BENCH_RND_LEN, ret);
+        DQSpiBenchBlock.checksum += bench_buf[0];
+    }
+    BenchEnd(DQSPI_BENCH_READ_RND);
+}
+
+
+static void BenchMapped(uint32_t size)
+{
+    DQSpiMapProfile old;
+    const uint8_t *p;
+    uint32_t base = DQSpiBenchBlock.addr;
+    uint32_t i, l, k, t;
+    DQSpiBenchId id;
+
+    DQSpiMapProfileGet(&old);
+    for (k = 0; k != 3; k++) {
+        id = DQSPI_BENCH_MAP_SEQ_3B + 2 * k;
+        if (DQSpiMapProfileSet(&bench_prof[k]) != 0 || (p = DQSpiMap(0, size)) == NULL) {
+            DQSpiBenchBlock.c[id].errors++;
+            continue;
+        }
+
+        /* measure the QSPI, not the D-cache */
+        for (l = 0; l != DQSPI_BENCH_LOOPS; l++) {
+            SCB_CleanInvalidateDCache();
+            for (i = 0; i != BENCH_BLOCK; i += BENCH_CHUNK) {
+                t = DWT->CYCCNT;
+                memcpy(bench_buf, p + base + i, BENCH_CHUNK);
+                BenchSample(id, t, BENCH_CHUNK, 0);
+                DQSpiBenchBlock.checksum += bench_buf[l];
+            }
+        }
+        BenchEnd(id);
+
+        SCB_CleanInvalidateDCache();
+        rnd = 0x87654321;
+        for (i = 0; i != DQSPI_BENCH_SAMPLES; i++) {
+            uint32_t a = BenchRand() % (size - BENCH_RND_LEN);
+
+            t = DWT->CYCCNT;
+            memcpy(bench_buf, p + a, BENCH_RND_LEN);
+            BenchSample(id + 1, t, BENCH_RND_LEN, 0);
+            DQSpiBenchBlock.checksum += bench_buf[0];
+        }
+        BenchEnd(id + 1);
+
+        DQSpiUnmap(p);
+    }
+    DQSpiMapProfileSet(&old);
+}
+
+
+static void BenchReport(void)
+{
+    const DQSpiBenchCase *bc;
+    uint32_t mhz = DQSpiBenchBlock.cpu_hz / 1000000;
+    char line[128];
+    char *c;
+    uint32_t i;
+
+    if (!(ITM->TCR & ITM_TCR_ITMENA_Msk) || !(ITM->TER & 1))
+        return;
+
+    snprintf(line, sizeof(line), "dqspi bench id %06lx, cpu %lu MHz, latency ns\r\n",
+             (unsigned long)DQSpiBenchBlock.flash_id, (unsigned long)mhz);
+    for (c = line; *c; c++)
+        ITM_SendChar(*c);
+
+    for (i = 0; i != DQSPI_BENCH_NUM; i++) {
+        bc = &DQSpiBenchBlock.c[i];
+        snprintf(line, sizeof(line), "%-16s %5lu.%03lu MB/s p50 %lu p90 %lu p99 %lu max %lu err %lu\r\n",
+                 bench_name[i], (unsigned long)(bc->kbps / 1000), (unsigned long)(bc->kbps % 1000),
+                 (unsigned long)(bc->p50 * 1000ULL / mhz), (unsigned long)(bc->p90 * 1000ULL / mhz),
+                 (unsigned long)(bc->p99 * 1000ULL / mhz), (unsigned long)(bc->max * 1000ULL / mhz),
+                 (unsigned long)bc->errors);
+        for (c = line; *c; c++)
+            ITM_SendChar(*c);
+    }
+}
+
+
+/* breakpoint of Tools/bench.gdb */
+void __attribute__((noinline)) DQSpiBenchDone(void)
+{
+    __asm volatile ("" ::: "memory");
+}
+
+
+int8_t DQSpiBench(void)
+{
+    uint32_t blk_num, blk_size;
+    uint16_t id;
+    uint8_t mid;
+
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->LAR = 0xC5ACCE55;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+
+    memset(&DQSpiBenchBlock, 0, sizeof(DQSpiBenchBlock));
+    DQSpiBenchBlock.cpu_hz = SystemCoreClock;
+    DQSpiBenchBlock.addr = DQSPI_BENCH_ADDR;
+
+    if (DQSpiReset() != 0 || DQSpiFlashId(&mid, &id) != 0 ||
+        DQSpiFlashInfo(&blk_num, &blk_size, NULL, NULL) != 0) {
+        DQSpiBenchDone();
+        return -1;
+    }
+    DQSpiBenchBlock.flash_id = (uint32_t)mid << 16 | id;
+    DQSpiUniqueId(DQSpiBenchBlock.uid);
+    DQSpiBenchBlock.magic = DQSPI_BENCH_MAGIC;
+
+    BenchErase();
+    BenchProgram();
+    BenchRead(blk_num * blk_size);
+    BenchMapped(blk_num * blk_size);
+
+    DQSpiBenchBlock.done = 1;
+    BenchReport();
+    DQSpiBenchDone();
+
+    return 0;
+}
+#endif
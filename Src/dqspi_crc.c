@@ -0,0 +1,68 @@
+
+#include "main.h"
+
+#include "dqspi.h"
+
+
+/* CRC-32 (IEEE 802.3, reflected, as zlib/crc32 compute it) */
+#define CRC32_POLY           0xEDB88320UL
+
+#if DQSPI_HW_CRC
+/* same CRC on the CRC unit: input bit-reversed per word (per byte for
+ * the tail), output reversed; the unit state is the reversed complement
+ * of the previous result */
+uint32_t DQSpiCrc32(uint32_t crc, const uint8_t *dat, uint32_t len)
+{
+    __HAL_RCC_CRC_CLK_ENABLE();
+
+    CRC->POL = 0x04C11DB7UL;
+    CRC->INIT = __RBIT(~crc);
+    CRC->CR = CRC_CR_REV_OUT | CRC_CR_REV_IN | CRC_CR_RESET;
+
+    for (; len >= 4; len -= 4, dat += 4) {
+        CRC->DR = __UNALIGNED_UINT32_READ(dat);
+    }
+
+    CRC->CR = CRC_CR_REV_OUT | CRC_CR_REV_IN_0;
+    while (len--) {
+        *(__IO uint8_t *)&CRC->DR = *dat++;
+    }
+
+    return ~CRC->DR;
+}
+#else
+
+static uint32_t crc_table[256];
+static uint8_t crc_table_valid;
+
+
+static void DQSpiCrcInit(void)
+{
+    uint32_t i, j, c;
+
+    for (i = 0; i != 256; i++) {
+        c = i;
+        for (j = 0; j != 8; j++) {
+            c = (c & 1) ? (c >> 1) ^ CRC32_POLY : c >> 1;
+        }
+        crc_table[i] = c;
+    }
+    crc_table_valid = 1;
+}
+
+
+/* start with crc = 0, chain calls by passing the previous result */
+uint32_t DQSpiCrc32(uint32_t crc, const uint8_t *dat, uint32_t len)
+{
+    if (!crc_table_valid) {
+        DQSpiCrcInit();
+    }
+
+    crc = ~crc;
+    while (len--) {
+        crc = crc_table[(crc ^ *dat++) & 0xFF] ^ (crc >> 8);
+    }
+
+    return ~crc;
+}
+#endif
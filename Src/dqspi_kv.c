@@ -0,0 +1,684 @@
+#include <stddef.h>
+#include <string.h>
+
+#include "main.h"
+
+#include "dqspi.h"
+#include "dqspi_kv.h"
+
+
+#if (DQSPI_KV_BASE & (DQSPI_KV_SECTOR_SIZE - 1)) != 0
+#error "DQSPI_KV_BASE must be 4K aligned"
+#endif
+#if DQSPI_KV_SECTORS < 3 || DQSPI_KV_SECTORS > 64
+#error "DQSPI_KV_SECTORS: 3..64"
+#endif
+#if (DQSPI_KV_INDEX_SIZE & (DQSPI_KV_INDEX_SIZE - 1)) != 0
+#error "DQSPI_KV_INDEX_SIZE must be a power of two"
+#endif
+#if DQSPI_KV_KEY_MAX < 1 || DQSPI_KV_KEY_MAX > 255 || DQSPI_KV_VALUE_MAX >= DQSPI_KV_TOMBSTONE
+#error "DQSPI_KV_KEY_MAX/VALUE_MAX out of range"
+#endif
+#if DQSPI_KV_REC_MAX > DQSPI_KV_BATCH_SIZE || (DQSPI_KV_BATCH_SIZE & 3) != 0
+#error "DQSPI_KV_BATCH_SIZE must hold the largest record"
+#endif
+
+#define KV_NONE              0xFF
+#define KV_PAD(n)            (((uint32_t)(n) + 3) & ~3UL)
+#define KV_MASK              (DQSPI_KV_INDEX_SIZE - 1)
+#define KV_KEYS_MAX          (DQSPI_KV_INDEX_SIZE * 3 / 4)
+#define KV_REC_MIN           (sizeof(DQSpiKvRec) + 4)
+
+/* live bytes that always fit: a sector kept free for compaction, and
+ * up to a record lost at the end of every other one */
+#define KV_CAPACITY          ((DQSPI_KV_SECTORS - 2) * (DQSPI_KV_SECTOR_SIZE - sizeof(DQSpiKvSector) - DQSPI_KV_REC_MAX))
+
+typedef struct {
+    uint32_t hash;
+    uint16_t loc;          /* record offset in the store / 4, 0: empty slot */
+    uint16_t len;
+} KvSlot;
+
+static struct {
+    uint8_t mounted;
+    uint8_t head;                          /* sector taking the appends */
+    uint32_t seq;
+    uint32_t sec_seq[DQSPI_KV_SECTORS];    /* 0: free */
+    uint16_t used[DQSPI_KV_SECTORS];       /* append offset, 4K once closed */
+    uint8_t erased[DQSPI_KV_SECTORS];      /* free and known blank */
+    DQSpiKvInfo info;
+    KvSlot idx[DQSPI_KV_INDEX_SIZE];
+} kv;
+
+/* records of one batch; also the record of a lookup */
+static uint8_t kv_buf[DQSPI_KV_BATCH_SIZE] __attribute__((aligned(4)));
+/* header and key of an index comparison */
+static uint8_t kv_key[sizeof(DQSpiKvRec) + DQSPI_KV_KEY_MAX] __attribute__((aligned(4)));
+
+
+static uint32_t KvSecAddr(uint32_t s)
+{
+    return DQSPI_KV_BASE + s * DQSPI_KV_SECTOR_SIZE;
+}
+
+
+static uint32_t KvAddr(uint32_t loc)
+{
+    return DQSPI_KV_BASE + loc * 4;
+}
+
+
+/* FNV-1a */
+static uint32_t KvHash(const char *key, uint8_t klen)
+{
+    uint32_t h = 2166136261UL;
+
+    while (klen-- != 0) {
+        h ^= (uint8_t)*key++;
+        h *= 16777619UL;
+    }
+
+    return h;
+}
+
+
+/* 0 for a key out of 1..DQSPI_KV_KEY_MAX characters */
+static uint8_t KvKeyLen(const char *key)
+{
+    uint32_t n = 0;
+
+    if (key == NULL) {
+        return 0;
+    }
+    while (key[n] != '\0') {
+        if (++n > DQSPI_KV_KEY_MAX) {
+            return 0;
+        }
+    }
+
+    return n;
+}
+
+
+static uint32_t KvRecLen(const DQSpiKvRec *r)
+{
+    return sizeof(*r) + KV_PAD(r->klen) + (r->vlen == DQSPI_KV_TOMBSTONE ? 0 : KV_PAD(r->vlen));
+}
+
+
+static uint32_t KvRecCrc(const uint8_t *rec)
+{
+    const DQSpiKvRec *r = (const DQSpiKvRec *)rec;
+    uint32_t end = sizeof(*r) + KV_PAD(r->klen) + (r->vlen == DQSPI_KV_TOMBSTONE ? 0 : r->vlen);
+
+    return DQSpiCrc32(0, rec + offsetof(DQSpiKvRec, klen), end - offsetof(DQSpiKvRec, klen));
+}
+
+
+/* slot of the key, or the empty slot ending its probe sequence; buf gets
+ * the start of the record compared, up to size bytes */
+static int32_t KvLookup(const char *key, uint8_t klen, uint32_t h, uint8_t *buf, uint32_t size)
+{
+    const DQSpiKvRec *r = (const DQSpiKvRec *)buf;
+    uint32_t i;
+
+    for (i = h & KV_MASK; ; i = (i + 1) & KV_MASK) {
+        if (kv.idx[i].loc == 0) {
+            return i;
+        }
+        if (kv.idx[i].hash != h) {
+            continue;
+        }
+        if (DQSpiRead(KvAddr(kv.idx[i].loc), buf, kv.idx[i].len < size ? kv.idx[i].len : size) != 0) {
+            return -1;
+        }
+        if (r->klen == klen && memcmp(buf + sizeof(*r), key, klen) == 0) {
+            return i;
+        }
+    }
+}
+
+
+/* linear probing: the rest of the cluster moves back over the hole */
+static void KvRemove(uint32_t i)
+{
+    uint32_t j = i, k;
+
+    for (;;) {
+        j = (j + 1) & KV_MASK;
+        if (kv.idx[j].loc == 0) {
+            break;
+        }
+        /* j stays unless its home slot is at or before i */
+        k = kv.idx[j].hash & KV_MASK;
+        if (((j - k) & KV_MASK) >= ((j - i) & KV_MASK)) {
+            kv.idx[i] = kv.idx[j];
+            i = j;
+        }
+    }
+    kv.idx[i].loc = 0;
+}
+
+
+/* the record at loc is now the newest of its key */
+static int8_t KvIndex(const char *key, uint8_t klen, uint32_t loc, uint32_t len, uint8_t del)
+{
+    uint32_t h = KvHash(key, klen);
+    int32_t i = KvLookup(key, klen, h, kv_key, sizeof(kv_key));
+    KvSlot *s;
+
+    if (i < 0) {
+        return -1;
+    }
+    s = &kv.idx[i];
+
+    if (s->loc != 0) {
+        kv.info.live -= s->len;
+        if (del) {
+            KvRemove(i);
+            kv.info.keys--;
+            return 0;
+        }
+    }
+    else {
+        if (del) {
+            return 0;
+        }
+        if (kv.info.keys == KV_KEYS_MAX) {
+            return -1;
+        }
+        kv.info.keys++;
+        s->hash = h;
+    }
+    s->loc = loc;
+    s->len = len;
+    kv.info.live += len;
+
+    return 0;
+}
+
+
+/* oldest sector in use, the head aside */
+static uint8_t KvTail(void)
+{
+    uint8_t s, t = KV_NONE;
+
+    for (s = 0; s != DQSPI_KV_SECTORS; s++) {
+        if (s != kv.head && kv.sec_seq[s] != 0 && (t == KV_NONE || kv.sec_seq[s] < kv.sec_seq[t])) {
+            t = s;
+        }
+    }
+
+    return t;
+}
+
+
+/* bytes of the live records in sector s */
+static uint32_t KvLive(uint8_t s)
+{
+    uint32_t lo = s * DQSPI_KV_SECTOR_SIZE / 4, hi = lo + DQSPI_KV_SECTOR_SIZE / 4, live = 0, i;
+
+    for (i = 0; i != DQSPI_KV_INDEX_SIZE; i++) {
+        if (kv.idx[i].loc != 0 && kv.idx[i].loc >= lo && kv.idx[i].loc < hi) {
+            live += kv.idx[i].len;
+        }
+    }
+
+    return live;
+}
+
+
+/* next free sector after the head becomes the head, erased if not known blank */
+static int8_t KvOpen(void)
+{
+    DQSpiKvSector h;
+    uint8_t s, i;
+
+    for (i = 1; i <= DQSPI_KV_SECTORS; i++) {
+        s = ((kv.head == KV_NONE ? DQSPI_KV_SECTORS - 1 : kv.head) + i) % DQSPI_KV_SECTORS;
+        if (kv.sec_seq[s] == 0) {
+            break;
+        }
+    }
+    if (i > DQSPI_KV_SECTORS) {
+        return -1;
+    }
+
+    if (!kv.erased[s]) {
+        if (DQSpiEraseSector(KvSecAddr(s)) != 0) {
+            return -1;
+        }
+        kv.info.erases++;
+    }
+    kv.erased[s] = 0;
+
+    h.magic = DQSPI_KV_MAGIC;
+    h.seq = ++kv.seq;
+    h.crc = DQSpiCrc32(0, (const uint8_t *)&h, offsetof(DQSpiKvSector, crc));
+    h.reserved = 0xFFFFFFFF;
+    if (DQSpiWrite(KvSecAddr(s), (uint8_t *)&h, sizeof(h)) != 0) {
+        return -1;
+    }
+    kv.info.prog_bytes += sizeof(h);
+
+    kv.sec_seq[s] = h.seq;
+    kv.used[s] = sizeof(h);
+    kv.head = s;
+    kv.info.free--;
+
+    return 0;
+}
+
+
+/* write the batch in kv_buf at the head, then its commit word; nothing
+ * more goes to a sector after a failed batch */
+static int8_t KvAppend(uint32_t len)
+{
+    uint32_t addr = KvSecAddr(kv.head) + kv.used[kv.head], zero = 0;
+
+    if (DQSpiWrite(addr, kv_buf, len) != 0 || DQSpiFlush() != 0 ||
+        DQSpiWrite(addr + offsetof(DQSpiKvRec, commit), (uint8_t *)&zero, sizeof(zero)) != 0 || DQSpiFlush() != 0) {
+        kv.used[kv.head] = DQSPI_KV_SECTOR_SIZE;
+        return -1;
+    }
+    kv.used[kv.head] += len;
+    kv.info.prog_bytes += len + sizeof(zero);
+
+    return 0;
+}
+
+
+static int8_t KvGcStep(void);
+
+/* room for len bytes at the head; puts leave the last free sector to
+ * compaction, which then frees one */
+static int8_t KvReserve(uint32_t len, uint8_t gc)
+{
+    uint32_t n = 0;
+    int8_t ret;
+
+    if (kv.head != KV_NONE && kv.used[kv.head] + len <= DQSPI_KV_SECTOR_SIZE) {
+        return 0;
+    }
+
+    while (!gc && kv.info.free < 2) {
+        ret = KvGcStep();
+        if (ret < 0 || (ret == 1 && ++n > DQSPI_KV_SECTORS)) {
+            return -1;
+        }
+    }
+
+    return KvOpen();
+}
+
+
+/* one compaction step on the oldest sector: a batch of its live records
+ * is copied to the head, or it is erased once none is left. 1: sector freed */
+static int8_t KvGcStep(void)
+{
+    uint16_t sel[DQSPI_KV_BATCH_SIZE / KV_REC_MIN];
+    uint32_t lo, hi, len = 0, off, loc, i, n = 0, zero = 0;
+    DQSpiKvRec *r;
+    uint8_t t;
+
+    t = KvTail();
+    if (t == KV_NONE) {
+        return -1;
+    }
+
+    lo = t * DQSPI_KV_SECTOR_SIZE / 4;
+    hi = lo + DQSPI_KV_SECTOR_SIZE / 4;
+    for (i = 0; i != DQSPI_KV_INDEX_SIZE && n != DQSPI_KV_BATCH_SIZE / KV_REC_MIN; i++) {
+        if (kv.idx[i].loc == 0 || kv.idx[i].loc < lo || kv.idx[i].loc >= hi) {
+            continue;
+        }
+        if (len + kv.idx[i].len > sizeof(kv_buf)) {
+            break;
+        }
+        sel[n++] = i;
+        len += kv.idx[i].len;
+    }
+
+    if (n == 0) {
+        /* header cleared first: a sector half erased is not replayed */
+        if (DQSpiWrite(KvSecAddr(t), (uint8_t *)&zero, sizeof(zero)) != 0 ||
+            DQSpiEraseSector(KvSecAddr(t)) != 0) {
+            return -1;
+        }
+        kv.sec_seq[t] = 0;
+        kv.erased[t] = 1;
+        kv.info.free++;
+        kv.info.erases++;
+        kv.info.prog_bytes += sizeof(zero);
+        return 1;
+    }
+
+    if (KvReserve(len, 1) != 0) {
+        return -1;
+    }
+    for (i = 0, off = 0; i != n; i++) {
+        r = (DQSpiKvRec *)(kv_buf + off);
+        if (DQSpiRead(KvAddr(kv.idx[sel[i]].loc), kv_buf + off, kv.idx[sel[i]].len) != 0) {
+            return -1;
+        }
+        r->commit = 0xFFFFFFFF;
+        r->nrec = i == 0 ? n : 0;
+        off += kv.idx[sel[i]].len;
+    }
+
+    loc = (kv.head * DQSPI_KV_SECTOR_SIZE + kv.used[kv.head]) / 4;
+    if (KvAppend(len) != 0) {
+        return -1;
+    }
+    for (i = 0; i != n; i++) {
+        kv.idx[sel[i]].loc = loc;
+        loc += kv.idx[sel[i]].len / 4;
+    }
+    kv.info.copies += n;
+
+    return 0;
+}
+
+
+/* replay the records of sector s into the index; the sector is closed
+ * at the first record that is not intact and committed */
+static int8_t KvScan(uint8_t s)
+{
+    const DQSpiKvRec *r = (const DQSpiKvRec *)kv_buf;
+    uint32_t off = sizeof(DQSpiKvSector), left = 0, n, i;
+
+    while (off + sizeof(*r) <= DQSPI_KV_SECTOR_SIZE) {
+        n = DQSPI_KV_SECTOR_SIZE - off < sizeof(kv_buf) ? DQSPI_KV_SECTOR_SIZE - off : sizeof(kv_buf);
+        if (DQSpiRead(KvSecAddr(s) + off, kv_buf, n) != 0) {
+            return -1;
+        }
+
+        for (i = 0; i != sizeof(*r) && kv_buf[i] == 0xFF; i++)
+            ;
+        if (i == sizeof(*r) && left == 0) {
+            break;
+        }
+        if (i == sizeof(*r) || r->klen == 0 || r->klen > DQSPI_KV_KEY_MAX ||
+            (r->vlen > DQSPI_KV_VALUE_MAX && r->vlen != DQSPI_KV_TOMBSTONE) || KvRecLen(r) > n ||
+            (r->nrec == 0) != (left != 0) || (r->nrec != 0 && r->commit != 0) || r->crc != KvRecCrc(kv_buf)) {
+            off = DQSPI_KV_SECTOR_SIZE;
+            break;
+        }
+
+        if (r->nrec != 0) {
+            left = r->nrec;
+        }
+        left--;
+        if (KvIndex((const char *)kv_buf + sizeof(*r), r->klen, (s * DQSPI_KV_SECTOR_SIZE + off) / 4, KvRecLen(r),
+                    r->vlen == DQSPI_KV_TOMBSTONE) != 0) {
+            return -1;
+        }
+        off += KvRecLen(r);
+    }
+    kv.used[s] = off;
+
+    return 0;
+}
+
+
+/* index from the records, sectors replayed oldest first */
+int8_t DQSpiKvMount(void)
+{
+    DQSpiKvSector h;
+    uint8_t s, t;
+
+    memset(&kv, 0, sizeof(kv));
+    kv.head = KV_NONE;
+
+    for (s = 0; s != DQSPI_KV_SECTORS; s++) {
+        if (DQSpiRead(KvSecAddr(s), (uint8_t *)&h, sizeof(h)) != 0) {
+            return -1;
+        }
+        if (h.magic == DQSPI_KV_MAGIC && h.seq != 0 &&
+            h.crc == DQSpiCrc32(0, (const uint8_t *)&h, offsetof(DQSpiKvSector, crc))) {
+            kv.sec_seq[s] = h.seq;
+        }
+        else {
+            kv.info.free++;
+        }
+    }
+
+    for (;;) {
+        t = KV_NONE;
+        for (s = 0; s != DQSPI_KV_SECTORS; s++) {
+            if (kv.sec_seq[s] > kv.seq && (t == KV_NONE || kv.sec_seq[s] < kv.sec_seq[t])) {
+                t = s;
+            }
+        }
+        if (t == KV_NONE) {
+            break;
+        }
+        if (KvScan(t) != 0) {
+            return -1;
+        }
+        kv.head = t;
+        kv.seq = kv.sec_seq[t];
+    }
+
+    kv.mounted = 1;
+
+    return 0;
+}
+
+
+/* the batch goes to the flash with one DQSpiWrite(), then its commit word */
+int8_t DQSpiKvPutBatch(const DQSpiKvPut *puts, size_t n)
+{
+    DQSpiKvRec *r;
+    uint32_t len = 0, live, add, off, loc, i;
+    uint8_t klen;
+    int32_t j;
+
+    if (!kv.mounted || puts == NULL || n == 0 || n > 255) {
+        return -1;
+    }
+    for (i = 0; i != n; i++) {
+        klen = KvKeyLen(puts[i].key);
+        if (klen == 0 || (puts[i].val != NULL && puts[i].vlen > DQSPI_KV_VALUE_MAX)) {
+            return -1;
+        }
+        len += sizeof(*r) + KV_PAD(klen) + (puts[i].val != NULL ? KV_PAD(puts[i].vlen) : 0);
+    }
+    if (len > sizeof(kv_buf)) {
+        return -1;
+    }
+
+    /* near full: count what the batch really adds */
+    if (kv.info.keys + n > KV_KEYS_MAX || kv.info.live + len > KV_CAPACITY) {
+        for (i = 0, live = kv.info.live + len, add = 0; i != n; i++) {
+            klen = KvKeyLen(puts[i].key);
+            j = KvLookup(puts[i].key, klen, KvHash(puts[i].key, klen), kv_key, sizeof(kv_key));
+            if (j < 0) {
+                return -1;
+            }
+            if (kv.idx[j].loc != 0) {
+                live -= kv.idx[j].len;
+            }
+            else if (puts[i].val != NULL) {
+                add++;
+            }
+        }
+        if (kv.info.keys + add > KV_KEYS_MAX || live > KV_CAPACITY) {
+            return -1;
+        }
+    }
+
+    if (KvReserve(len, 0) != 0) {
+        return -1;
+    }
+
+    for (i = 0, off = 0; i != n; i++) {
+        r = (DQSpiKvRec *)(kv_buf + off);
+        klen = KvKeyLen(puts[i].key);
+        memset(r, 0xFF, sizeof(*r) + KV_PAD(klen) + (puts[i].val != NULL ? KV_PAD(puts[i].vlen) : 0));
+        r->nrec = i == 0 ? n : 0;
+        r->klen = klen;
+        r->vlen = puts[i].val != NULL ? puts[i].vlen : DQSPI_KV_TOMBSTONE;
+        memcpy(kv_buf + off + sizeof(*r), puts[i].key, klen);
+        if (puts[i].val != NULL) {
+            memcpy(kv_buf + off + sizeof(*r) + KV_PAD(klen), puts[i].val, puts[i].vlen);
+        }
+        r->crc = KvRecCrc(kv_buf + off);
+        off += KvRecLen(r);
+    }
+
+    loc = (kv.head * DQSPI_KV_SECTOR_SIZE + kv.used[kv.head]) / 4;
+    if (KvAppend(len) != 0) {
+        return -1;
+    }
+
+    for (i = 0; i != n; i++) {
+        klen = KvKeyLen(puts[i].key);
+        len = sizeof(*r) + KV_PAD(klen) + (puts[i].val != NULL ? KV_PAD(puts[i].vlen) : 0);
+        if (KvIndex(puts[i].key, klen, loc, len, puts[i].val == NULL) != 0) {
+            return -1;
+        }
+        loc += len / 4;
+        kv.info.puts++;
+        kv.info.user_bytes += klen + (puts[i].val != NULL ? puts[i].vlen : 0);
+    }
+
+    return 0;
+}
+
+
+int8_t DQSpiKvSet(const char *key, const void *val, uint16_t vlen)
+{
+    DQSpiKvPut p;
+
+    if (val == NULL) {
+        return -1;
+    }
+    p.key = key;
+    p.val = val;
+    p.vlen = vlen;
+
+    return DQSpiKvPutBatch(&p, 1);
+}
+
+
+int8_t DQSpiKvDelete(const char *key)
+{
+    DQSpiKvPut p;
+
+    p.key = key;
+    p.val = NULL;
+    p.vlen = 0;
+
+    return DQSpiKvPutBatch(&p, 1);
+}
+
+
+/* one DQSpiRead() of the whole record */
+int8_t DQSpiKvGet(const char *key, void *val, uint16_t size, uint16_t *vlen)
+{
+    const DQSpiKvRec *r = (const DQSpiKvRec *)kv_buf;
+    uint8_t klen = KvKeyLen(key);
+    int32_t i;
+
+    if (!kv.mounted || klen == 0) {
+        return -1;
+    }
+    i = KvLookup(key, klen, KvHash(key, klen), kv_buf, sizeof(kv_buf));
+    if (i < 0) {
+        return -1;
+    }
+    if (kv.idx[i].loc == 0) {
+        return DQSPI_KV_NOT_FOUND;
+    }
+    if (r->vlen > size) {
+        return -1;
+    }
+
+    memcpy(val, kv_buf + sizeof(*r) + KV_PAD(klen), r->vlen);
+    if (vlen != NULL) {
+        *vlen = r->vlen;
+    }
+
+    return 0;
+}
+
+
+/* the value in the XIP window, word aligned; DQSpiUnmap() it when done.
+ * Writes, puts included, get DQSPI_BUSY while it is mapped */
+const void *DQSpiKvMap(const char *key, uint16_t *vlen)
+{
+    const DQSpiKvRec *r;
+    const uint8_t *p;
+    uint8_t klen = KvKeyLen(key);
+    uint32_t h, i;
+
+    if (!kv.mounted || klen == 0) {
+        return NULL;
+    }
+
+    h = KvHash(key, klen);
+    for (i = h & KV_MASK; kv.idx[i].loc != 0; i = (i + 1) & KV_MASK) {
+        if (kv.idx[i].hash != h) {
+            continue;
+        }
+        p = DQSpiMap(KvAddr(kv.idx[i].loc), kv.idx[i].len);
+        if (p == NULL) {
+            return NULL;
+        }
+        r = (const DQSpiKvRec *)p;
+        if (r->klen == klen && memcmp(p + sizeof(*r), key, klen) == 0) {
+            if (vlen != NULL) {
+                *vlen = r->vlen;
+            }
+            return p + sizeof(*r) + KV_PAD(klen);
+        }
+        DQSpiUnmap(p);
+    }
+
+    return NULL;
+}
+
+
+/* background work, one flash operation at most: compaction while fewer
+ * than DQSPI_KV_GC_FREE sectors are free and the oldest one has dead
+ * records, otherwise the erase of a free sector ahead of its use */
+int8_t DQSpiKvPoll(void)
+{
+    uint8_t s;
+
+    if (!kv.mounted) {
+        return -1;
+    }
+
+    s = KvTail();
+    if (kv.info.free < DQSPI_KV_GC_FREE && s != KV_NONE && KvLive(s) < kv.used[s] - sizeof(DQSpiKvSector)) {
+        return KvGcStep() < 0 ? -1 : 0;
+    }
+
+    for (s = 0; s != DQSPI_KV_SECTORS; s++) {
+        if (kv.sec_seq[s] == 0 && !kv.erased[s]) {
+            if (DQSpiEraseSector(KvSecAddr(s)) != 0) {
+                return -1;
+            }
+            kv.erased[s] = 1;
+            kv.info.erases++;
+            break;
+        }
+    }
+
+    return 0;
+}
+
+
+int8_t DQSpiKvStats(DQSpiKvInfo *info)
+{
+    if (!kv.mounted || info == NULL) {
+        return -1;
+    }
+
+    *info = kv.info;
+
+    return 0;
+}
+
@@ -0,0 +1,571 @@
+#include <stddef.h>
+#include <string.h>
+
+#include "main.h"
+
+#include "dqspi.h"
+#include "dqspi_log.h"
+
+
+#if DQSPI_LOG
+
+#define LOG_BLOCK_SIZE       0x10000UL
+#define LOG_PAGES            (DQSPI_LOG_SIZE / DQSPI_LOG_PAGE_SIZE)
+#define LOG_BLOCK_PAGES      (LOG_BLOCK_SIZE / DQSPI_LOG_PAGE_SIZE)
+#define LOG_BLOCKS           (DQSPI_LOG_SIZE / LOG_BLOCK_SIZE)
+
+#if (DQSPI_LOG_BASE & (LOG_BLOCK_SIZE - 1)) != 0 || (DQSPI_LOG_SIZE & (DQSPI_LOG_SIZE - 1)) != 0
+#error "DQSPI_LOG_BASE must be 64K aligned, DQSPI_LOG_SIZE a power of two"
+#endif
+#if DQSPI_LOG_SIZE < (DQSPI_LOG_ERASE_AHEAD + 2) * LOG_BLOCK_SIZE || DQSPI_LOG_ERASE_AHEAD < 1
+#error "DQSPI_LOG_SIZE: at least DQSPI_LOG_ERASE_AHEAD + 2 blocks"
+#endif
+#if DQSPI_LOG_PAGES < 2 || DQSPI_LOG_PAGES > 255 || DQSPI_LOG_SUSPEND_AT < 1 || DQSPI_LOG_SUSPEND_AT > DQSPI_LOG_PAGES
+#error "DQSPI_LOG_PAGES: 2..255, DQSPI_LOG_SUSPEND_AT: 1..DQSPI_LOG_PAGES"
+#endif
+
+#define LOG_ERASE_NONE       0
+#define LOG_ERASE_RUNNING    1
+#define LOG_ERASE_SUSPENDED  2
+
+/* seq numbers wrap: they are compared by their difference. The ISR side
+ * (LogKick() and the completions) owns head, tail, erased, first and the
+ * erase state, the thread side next and fill. */
+static struct {
+    uint8_t open;
+    uint8_t erase;                 /* LOG_ERASE_xxx */
+    volatile uint8_t prog;         /* page program in flight */
+    volatile uint8_t hold;         /* a reader has the flash */
+    uint8_t sync;                  /* DQSpiLogFlush(): suspend for any page */
+    uint8_t kicking, again;
+    uint32_t head;                 /* seq of the next page programmed */
+    uint32_t erased;               /* [head, erased) is erased */
+    uint32_t tail;                 /* oldest seq on the flash */
+    uint8_t first;                 /* ring page programmed next */
+    volatile uint8_t count;        /* closed ring pages, the one in flight included */
+    uint8_t next;                  /* ring page taking the writes */
+    uint16_t fill;                 /* its payload bytes */
+    DQSpiLogInfo info;
+} lg;
+
+/* the DMA reads the ring from SRAM1, as the read cache lines */
+static uint8_t lg_page[DQSPI_LOG_PAGES][DQSPI_LOG_PAGE_SIZE] __attribute__((section(".dqspi_sram"), aligned(32)));
+static uint8_t lg_rd[DQSPI_LOG_PAGE_SIZE] __attribute__((aligned(4)));
+
+
+static uint32_t LogAddr(uint32_t seq)
+{
+    return DQSPI_LOG_BASE + (seq & (LOG_PAGES - 1)) * DQSPI_LOG_PAGE_SIZE;
+}
+
+
+static uint16_t LogCrc(const uint8_t *p)
+{
+    const DQSpiLogPage *h = (const DQSpiLogPage *)p;
+    uint32_t crc;
+
+    crc = DQSpiCrc32(0, p, offsetof(DQSpiLogPage, crc));
+
+    return (uint16_t)DQSpiCrc32(crc, p + sizeof(DQSpiLogPage), h->len);
+}
+
+
+/* header of page p of the area into lg_rd, valid: a page written there */
+static int8_t LogHeader(uint32_t p, uint8_t *valid, uint32_t *seq)
+{
+    const DQSpiLogPage *h = (const DQSpiLogPage *)lg_rd;
+
+    if (DQSpiRead(DQSPI_LOG_BASE + p * DQSPI_LOG_PAGE_SIZE, lg_rd, sizeof(lg_rd)) != 0) {
+        return -1;
+    }
+
+    *seq = h->seq;
+    *valid = (h->seq & (LOG_PAGES - 1)) == p && h->len <= DQSPI_LOG_PAYLOAD && h->crc == LogCrc(lg_rd);
+
+    return 0;
+}
+
+
+/* seq of the first page of block b, from its first valid page: a page
+ * that failed to program keeps its seq and the ones after it are valid.
+ * valid is 0 when none is, up to the erased pages. */
+static int8_t LogBlockSeq(uint32_t b, uint8_t *valid, uint32_t *seq)
+{
+    uint32_t i;
+
+    for (i = 0; i != LOG_BLOCK_PAGES; i++) {
+        if (LogHeader(b * LOG_BLOCK_PAGES + i, valid, seq) != 0)
+            return -1;
+        if (*valid) {
+            *seq -= i;
+            break;
+        }
+        /* pages are programmed in order: erased from here on */
+        if (*seq == 0xFFFFFFFF)
+            break;
+    }
+
+    return 0;
+}
+
+
+/* the block at seq reads erased, through the XIP window */
+static int8_t LogBlank(uint32_t seq, uint8_t *blank)
+{
+    const uint32_t *w;
+    uint32_t i;
+
+    w = (const uint32_t *)DQSpiMap(LogAddr(seq), LOG_BLOCK_SIZE);
+    if (w == NULL) {
+        return -1;
+    }
+    for (i = 0; i != LOG_BLOCK_SIZE / 4 && w[i] == 0xFFFFFFFF; i++)
+        ;
+    *blank = i == LOG_BLOCK_SIZE / 4;
+
+    return DQSpiUnmap((const uint8_t *)w);
+}
+
+
+static void LogKick(void);
+
+
+static void LogProgDone(int8_t ret)
+{
+    /* a failed page keeps its seq, readers skip it */
+    if (ret != 0)
+        lg.info.errors++;
+    else
+        lg.info.pages++;
+
+    lg.head++;
+    lg.first = (lg.first + 1) % DQSPI_LOG_PAGES;
+    lg.count--;
+    lg.prog = 0;
+
+    LogKick();
+}
+
+
+static void LogEraseDone(int8_t ret)
+{
+    if (ret != 0) {
+        lg.info.errors++;
+    }
+    else {
+        lg.erased += LOG_BLOCK_PAGES;
+        lg.info.erases++;
+    }
+    lg.erase = LOG_ERASE_NONE;
+
+    LogKick();
+}
+
+
+static void LogSuspend(void)
+{
+    /* an erase that ended meanwhile has run LogEraseDone() */
+    if (DQSpiEraseSuspend() == 0 && lg.erase == LOG_ERASE_RUNNING) {
+        lg.erase = LOG_ERASE_SUSPENDED;
+        lg.info.suspends++;
+    }
+}
+
+
+/* pages first, then the erase ahead of them */
+static void LogStep(void)
+{
+    const DQSpiLogPage *h;
+    uint32_t a;
+    int8_t ret;
+
+    if (lg.prog || lg.hold)
+        return;
+
+    if (lg.erase == LOG_ERASE_RUNNING) {
+        if (lg.count == 0 || lg.head == lg.erased || (lg.count < DQSPI_LOG_SUSPEND_AT && !lg.sync))
+            return;
+        LogSuspend();
+        if (lg.erase == LOG_ERASE_RUNNING)
+            return;
+    }
+
+    if (lg.count != 0 && lg.head != lg.erased) {
+        /* header and payload only, the rest of the page stays erased */
+        h = (const DQSpiLogPage *)lg_page[lg.first];
+        lg.prog = 1;
+        ret = DQSpiProgramAsync(LogAddr(lg.head), lg_page[lg.first], sizeof(DQSpiLogPage) + h->len, LogProgDone);
+        if (ret != 0) {
+            /* tried again by the next step */
+            lg.prog = 0;
+            if (ret != DQSPI_BUSY)
+                lg.info.errors++;
+        }
+        return;
+    }
+
+    if (lg.erase == LOG_ERASE_SUSPENDED) {
+        if (DQSpiEraseResume() == 0)
+            lg.erase = LOG_ERASE_RUNNING;
+        return;
+    }
+
+    if (lg.erase == LOG_ERASE_NONE && lg.erased - lg.head < DQSPI_LOG_ERASE_AHEAD * LOG_BLOCK_PAGES) {
+        /* the block's pages of the previous lap are gone from now on */
+        a = lg.erased;
+        if ((int32_t)(a + LOG_BLOCK_PAGES - LOG_PAGES - lg.tail) > 0)
+            lg.tail = a + LOG_BLOCK_PAGES - LOG_PAGES;
+
+        ret = DQSpiEraseBlock64Async(LogAddr(a), LogEraseDone);
+        if (ret == 0)
+            lg.erase = LOG_ERASE_RUNNING;
+        else if (ret != DQSPI_BUSY)
+            lg.info.errors++;
+    }
+}
+
+
+/* Runs in the QUADSPI IRQ and, with it masked, in thread context. A
+ * completion inside a step (DQSpiEraseSuspend()) asks for one more. */
+static void LogKick(void)
+{
+    if (lg.kicking) {
+        lg.again = 1;
+        return;
+    }
+
+    lg.kicking = 1;
+    do {
+        lg.again = 0;
+        LogStep();
+    } while (lg.again);
+    lg.kicking = 0;
+}
+
+
+static void LogKickThread(void)
+{
+    HAL_NVIC_DisableIRQ(QUADSPI_IRQn);
+    LogKick();
+    HAL_NVIC_EnableIRQ(QUADSPI_IRQn);
+}
+
+
+/* the page taking the writes joins the ones waiting for the flash; the
+ * CRC is computed here, not in the IRQ, the CRC unit is not shared */
+static void LogClose(void)
+{
+    uint8_t *p = lg_page[lg.next];
+    DQSpiLogPage *h = (DQSpiLogPage *)p;
+
+    if (lg.fill == 0)
+        return;
+
+    /* pages are programmed in order, a failed one keeps its seq: the
+     * seq is known already */
+    HAL_NVIC_DisableIRQ(QUADSPI_IRQn);
+    h->seq = lg.head + lg.count;
+    HAL_NVIC_EnableIRQ(QUADSPI_IRQn);
+    h->len = lg.fill;
+    h->crc = LogCrc(p);
+
+    lg.next = (lg.next + 1) % DQSPI_LOG_PAGES;
+    lg.fill = 0;
+
+    HAL_NVIC_DisableIRQ(QUADSPI_IRQn);
+    lg.count++;
+    if (lg.count > lg.info.peak)
+        lg.info.peak = lg.count;
+    LogKick();
+    HAL_NVIC_EnableIRQ(QUADSPI_IRQn);
+}
+
+
+/* the blocks ahead that read blank need no erase: logging can start at
+ * full rate after a reset (a torn erase that reads blank is taken too) */
+static int8_t LogStart(void)
+{
+    uint8_t blank = 1;
+
+    while (blank && lg.erased - lg.head < DQSPI_LOG_ERASE_AHEAD * LOG_BLOCK_PAGES) {
+        if (LogBlank(lg.erased, &blank) != 0) {
+            return -1;
+        }
+        if (blank) {
+            lg.erased += LOG_BLOCK_PAGES;
+        }
+    }
+
+    lg.open = 1;
+    LogKickThread();
+
+    return 0;
+}
+
+
+/* Head: blocks 0..hb of the lap being written start with seq
+ * s0 + b * LOG_BLOCK_PAGES (LogBlockSeq(), a failed first page does not
+ * end the lap), the pages of hb are written up to the head.
+ * Block 0 without a valid first page was erased ahead of a head in the
+ * last blocks, or nothing was ever written. Tail: the first block with
+ * older pages after the head. */
+int8_t DQSpiLogOpen(void)
+{
+    uint32_t lo, hi, mid, hb, s0, s, base;
+    uint8_t v;
+
+    if (lg.open && (lg.prog || lg.erase != LOG_ERASE_NONE))
+        return DQSPI_BUSY;
+    memset(&lg, 0, sizeof(lg));
+
+    if (LogBlockSeq(0, &v, &s0) != 0)
+        return -1;
+
+    if (v) {
+        lo = 0;
+        hi = LOG_BLOCKS;
+        while (hi - lo > 1) {
+            mid = (lo + hi) / 2;
+            if (LogBlockSeq(mid, &v, &s) != 0)
+                return -1;
+            if (v && s == s0 + mid * LOG_BLOCK_PAGES)
+                lo = mid;
+            else
+                hi = mid;
+        }
+        hb = lo;
+        base = s0 + hb * LOG_BLOCK_PAGES;
+    }
+    else {
+        for (hb = LOG_BLOCKS - 1; hb != 0; hb--) {
+            if (LogBlockSeq(hb, &v, &base) != 0)
+                return -1;
+            if (v)
+                break;
+        }
+        if (hb == 0) {
+            /* empty */
+            return LogStart();
+        }
+    }
+
+    /* pages are programmed in order: the first one without seq is the head */
+    lo = 0;
+    hi = LOG_BLOCK_PAGES;
+    while (hi - lo > 1) {
+        mid = (lo + hi) / 2;
+        if (DQSpiRead(LogAddr(base + mid), (uint8_t *)&s, sizeof(s)) != 0)
+            return -1;
+        if (s != 0xFFFFFFFF)
+            lo = mid;
+        else
+            hi = mid;
+    }
+    lg.head = base + hi;
+
+    /* a program torn by a power loss leaves a page that takes no other */
+    if (hi != LOG_BLOCK_PAGES) {
+        if (DQSpiRead(LogAddr(lg.head), lg_rd, sizeof(lg_rd)) != 0)
+            return -1;
+        for (mid = 0; mid != sizeof(lg_rd) && lg_rd[mid] == 0xFF; mid++)
+            ;
+        if (mid != sizeof(lg_rd))
+            lg.head++;
+    }
+
+    /* the rest of the head block was erased before it */
+    lg.erased = lg.head;
+    if (lg.head & (LOG_BLOCK_PAGES - 1))
+        lg.erased = (lg.head | (LOG_BLOCK_PAGES - 1)) + 1;
+
+    lg.tail = base;
+    for (lo = 1; lo != LOG_BLOCKS; lo++) {
+        if (LogBlockSeq((hb + lo) % LOG_BLOCKS, &v, &s) != 0)
+            return -1;
+        if (v && (int32_t)(base - s) > 0) {
+            lg.tail = s;
+            break;
+        }
+    }
+
+    return LogStart();
+}
+
+
+/* DQSPI_BUSY: the RAM ring is full, the write is dropped */
+int8_t DQSpiLogWrite(const void *dat, uint16_t len)
+{
+    uint8_t *p;
+
+    if (!lg.open || len == 0 || len > DQSPI_LOG_PAYLOAD)
+        return -1;
+
+    /* writes never span pages */
+    if (lg.fill + len > DQSPI_LOG_PAYLOAD) {
+        LogClose();
+    }
+    if (lg.count == DQSPI_LOG_PAGES) {
+        lg.info.dropped += len;
+        return DQSPI_BUSY;
+    }
+
+    p = lg_page[lg.next] + sizeof(DQSpiLogPage);
+    memcpy(p + lg.fill, dat, len);
+    lg.fill += len;
+    lg.info.bytes += len;
+
+    if (lg.fill == DQSPI_LOG_PAYLOAD) {
+        LogClose();
+    }
+
+    return 0;
+}
+
+
+/* closes the page taking the writes and waits until every page is in the
+ * flash, suspending the erase for them */
+int8_t DQSpiLogFlush(void)
+{
+    uint32_t tick;
+
+    if (!lg.open)
+        return -1;
+
+    LogClose();
+
+    lg.sync = 1;
+    tick = HAL_GetTick();
+    while (lg.count != 0 && (HAL_GetTick() - tick) <= HAL_QPSI_TIMEOUT_DEFAULT_VALUE) {
+        DQSpiLogPoll();
+    }
+    lg.sync = 0;
+    LogKickThread();
+
+    return lg.count == 0 ? 0 : -1;
+}
+
+
+/* from the idle loop: driver timeouts, and what a busy controller
+ * refused (a live DQSpiMap() mapping) is started again */
+int8_t DQSpiLogPoll(void)
+{
+    int8_t ret;
+
+    if (!lg.open)
+        return -1;
+
+    ret = DQSpiPoll();
+    LogKickThread();
+
+    return ret;
+}
+
+
+/* the page in flight ends, nothing new starts and a running erase is
+ * suspended: the flash reads until LogRelease() */
+static int8_t LogHold(void)
+{
+    uint32_t tick = HAL_GetTick();
+
+    lg.hold = 1;
+    while (lg.prog) {
+        if ((HAL_GetTick() - tick) > HAL_QPSI_TIMEOUT_DEFAULT_VALUE) {
+            lg.hold = 0;
+            return -1;
+        }
+        DQSpiPoll();
+    }
+
+    HAL_NVIC_DisableIRQ(QUADSPI_IRQn);
+    if (lg.erase == LOG_ERASE_RUNNING) {
+        LogSuspend();
+    }
+    HAL_NVIC_EnableIRQ(QUADSPI_IRQn);
+
+    return lg.erase == LOG_ERASE_RUNNING ? -1 : 0;
+}
+
+
+static void LogRelease(void)
+{
+    lg.hold = 0;
+    LogKickThread();
+}
+
+
+int8_t DQSpiLogRewind(DQSpiLogCursor *c)
+{
+    if (!lg.open)
+        return -1;
+
+    c->seq = lg.tail;
+    c->lost = 0;
+
+    return 0;
+}
+
+
+/* Payload of the page at the cursor into dat (DQSPI_LOG_PAYLOAD bytes),
+ * DQSPI_LOG_END once at the head. A damaged page reads as 0 bytes. */
+int8_t DQSpiLogRead(DQSpiLogCursor *c, void *dat, uint16_t *len)
+{
+    const DQSpiLogPage *h = (const DQSpiLogPage *)lg_rd;
+    int8_t ret;
+
+    if (!lg.open)
+        return -1;
+
+    ret = LogHold();
+    if (ret != 0) {
+        LogRelease();
+        return ret;
+    }
+
+    /* erased by the log wrapping since the last read */
+    if ((int32_t)(c->seq - lg.tail) < 0) {
+        c->lost += lg.tail - c->seq;
+        c->seq = lg.tail;
+    }
+
+    if ((int32_t)(c->seq - lg.head) >= 0) {
+        ret = DQSPI_LOG_END;
+    }
+    else {
+        ret = DQSpiRead(LogAddr(c->seq), lg_rd, sizeof(lg_rd));
+    }
+    LogRelease();
+    if (ret != 0) {
+        return ret;
+    }
+
+    /* torn by a power loss, or a failed program */
+    if (h->seq != c->seq || h->len > DQSPI_LOG_PAYLOAD || h->crc != LogCrc(lg_rd)) {
+        c->lost++;
+        *len = 0;
+    }
+    else {
+        memcpy(dat, lg_rd + sizeof(DQSpiLogPage), h->len);
+        *len = h->len;
+    }
+    c->seq++;
+
+    return 0;
+}
+
+
+int8_t DQSpiLogStats(DQSpiLogInfo *info)
+{
+    if (!lg.open)
+        return -1;
+
+    HAL_NVIC_DisableIRQ(QUADSPI_IRQn);
+    *info = lg.info;
+    info->head = lg.head;
+    info->tail = lg.tail;
+    info->queued = lg.count;
+    HAL_NVIC_EnableIRQ(QUADSPI_IRQn);
+
+    return 0;
+}
+
+#endif
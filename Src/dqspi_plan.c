@@ -0,0 +1,106 @@
+
+#include <string.h>
+
+#include "main.h"
+
+#include "dqspi.h"
+#include "dqspi_plan.h"
+
+
+/* header, ops and data consistent, every op inside the flash */
+int8_t DQSpiPlanCheck(const uint8_t *plan, uint32_t len)
+{
+    DQSpiPlanHdr hdr;
+    DQSpiPlanOp op;
+    uint32_t blk_num, blk_size, size, align, data, i;
+
+    if (plan == NULL || len < sizeof(hdr)) {
+        return -1;
+    }
+    memcpy(&hdr, plan, sizeof(hdr));
+    if (hdr.magic != DQSPI_PLAN_MAGIC || hdr.version != DQSPI_PLAN_VERSION) {
+        return -1;
+    }
+    if (hdr.count > (len - sizeof(hdr)) / sizeof(op) ||
+        hdr.data_len != len - sizeof(hdr) - hdr.count * sizeof(op)) {
+        return -1;
+    }
+    if (DQSpiCrc32(0, plan + sizeof(hdr), len - sizeof(hdr)) != hdr.crc) {
+        return -1;
+    }
+
+    DQSpiFlashInfo(&blk_num, &blk_size, NULL, NULL);
+    size = blk_num * blk_size;
+
+    for (i = 0, data = 0; i != hdr.count; i++) {
+        memcpy(&op, plan + sizeof(hdr) + i * sizeof(op), sizeof(op));
+        switch (op.op) {
+        case DQSPI_PLAN_ERASE_4K:
+            align = 0x1000;
+            break;
+        case DQSPI_PLAN_ERASE_32K:
+            align = 0x8000;
+            break;
+        case DQSPI_PLAN_ERASE_64K:
+            align = 0x10000;
+            break;
+        case DQSPI_PLAN_ERASE_CHIP:
+            align = 1;
+            break;
+        case DQSPI_PLAN_PROGRAM:
+            if (op.len > size || op.addr > size - op.len || op.len > hdr.data_len - data) {
+                return -1;
+            }
+            data += op.len;
+            continue;
+        default:
+            return -1;
+        }
+        if (op.addr >= size || (op.addr & (align - 1)) != 0) {
+            return -1;
+        }
+    }
+
+    return data == hdr.data_len ? 0 : -1;
+}
+
+
+/* ops of one DQSpiExecBatch() call */
+#define PLAN_BATCH           8
+
+
+/* ops run in order, the first failing one stops the plan */
+int8_t DQSpiPlanRun(const uint8_t *plan, uint32_t len)
+{
+    DQSpiPlanHdr hdr;
+    DQSpiPlanOp op;
+    DQSpiOp batch[PLAN_BATCH];
+    const uint8_t *data;
+    uint32_t i, n = 0;
+    int8_t ret = 0;
+
+    if (DQSpiPlanCheck(plan, len) != 0) {
+        return -1;
+    }
+    memcpy(&hdr, plan, sizeof(hdr));
+    data = plan + sizeof(hdr) + hdr.count * sizeof(op);
+
+    for (i = 0; i != hdr.count && ret == 0; i++) {
+        memcpy(&op, plan + sizeof(hdr) + i * sizeof(op), sizeof(op));
+        memset(&batch[n], 0, sizeof(batch[n]));
+        batch[n].op = op.op;
+        batch[n].addr = op.addr;
+        if (op.op == DQSPI_PLAN_PROGRAM) {
+            batch[n].len = op.len;
+            batch[n].dat = data;
+            data += op.len;
+        }
+
+        if (++n == PLAN_BATCH || i + 1 == hdr.count) {
+            ret = DQSpiExecBatch(batch, n, NULL);
+            n = 0;
+        }
+    }
+
+    return ret;
+}
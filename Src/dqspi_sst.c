@@ -0,0 +1,141 @@
+#include <stddef.h>
+
+#include "main.h"
+
+#include "dqspi.h"
+#include "dqspi_sst.h"
+
+
+#define SST_LINES(n)         (((uint32_t)(n) + DQSPI_SST_KEYS - 1) / DQSPI_SST_KEYS)
+
+
+/* keys of a line <= x, DQSPI_SST_PAD never is: unrolled to conditional
+ * adds, no branch to mispredict */
+static uint32_t SstRank(const uint32_t *k, uint32_t x)
+{
+    return (k[0] <= x) + (k[1] <= x) + (k[2] <= x) + (k[3] <= x) +
+           (k[4] <= x) + (k[5] <= x) + (k[6] <= x) + (k[7] <= x);
+}
+
+
+/* the key line x belongs to: its first key is <= x, but in line 0 */
+static const uint32_t *SstDescend(const DQSpiSst *t, uint32_t x)
+{
+    const DQSpiSstHdr *h = t->hdr;
+    uint32_t l, n = 0;
+
+    for (l = 0; l != h->levels; l++) {
+        n = n * DQSPI_SST_FANOUT + SstRank((const uint32_t *)(t->base + h->level[l]) + n * DQSPI_SST_KEYS, x);
+    }
+
+    return (const uint32_t *)(t->base + h->keys) + n * DQSPI_SST_KEYS;
+}
+
+
+/* The layout is the builder's: only what a lookup relies on is checked,
+ * DQSpiSstCheck() covers the content. The table stays mapped until
+ * DQSpiSstClose(), the controller is not available for other commands
+ * meanwhile (DQSPI_BUSY). */
+int8_t DQSpiSstOpen(DQSpiSst *t, uint32_t addr)
+{
+    const DQSpiSstHdr *h;
+    uint32_t l, off, size;
+    int8_t ok;
+
+    h = (const DQSpiSstHdr *)DQSpiMap(addr, sizeof(DQSpiSstHdr));
+    if (h == NULL) {
+        return -1;
+    }
+
+    ok = h->magic == DQSPI_SST_MAGIC && h->version == DQSPI_SST_VERSION && h->count != 0 &&
+         h->levels <= DQSPI_SST_LEVELS_MAX && (addr & (DQSPI_SST_LINE - 1)) == 0;
+    off = sizeof(DQSpiSstHdr);
+    for (l = 0; ok && l != h->levels; l++) {
+        ok = h->level[l] >= off && (h->level[l] & (DQSPI_SST_LINE - 1)) == 0;
+        off = h->level[l] + DQSPI_SST_LINE;
+    }
+    ok = ok && h->keys >= off && (h->keys & (DQSPI_SST_LINE - 1)) == 0 &&
+         h->values >= h->keys + SST_LINES(h->count) * DQSPI_SST_LINE && h->values <= h->size &&
+         (uint64_t)h->count * h->val_len <= h->size - h->values;
+    size = h->size;
+    DQSpiUnmap((const uint8_t *)h);
+    if (!ok) {
+        return -1;
+    }
+
+    t->base = DQSpiMap(addr, size);
+    if (t->base == NULL) {
+        return -1;
+    }
+    t->hdr = (const DQSpiSstHdr *)t->base;
+
+    return 0;
+}
+
+
+int8_t DQSpiSstClose(DQSpiSst *t)
+{
+    int8_t ret;
+
+    if (t->base == NULL)
+        return -1;
+
+    ret = DQSpiUnmap(t->base);
+    t->base = NULL;
+    t->hdr = NULL;
+
+    return ret;
+}
+
+
+/* reads the whole table */
+int8_t DQSpiSstCheck(const DQSpiSst *t)
+{
+    if (t->base == NULL)
+        return -1;
+
+    return DQSpiCrc32(0, t->base + sizeof(DQSpiSstHdr), t->hdr->size - sizeof(DQSpiSstHdr)) == t->hdr->crc ? 0 : -1;
+}
+
+
+/* the value of key, in the XIP window, NULL if the table has no such key */
+const void *DQSpiSstFind(const DQSpiSst *t, uint32_t key)
+{
+    const uint32_t *k;
+    uint32_t i;
+
+    if (key == DQSPI_SST_PAD)
+        return NULL;
+
+    k = SstDescend(t, key);
+    i = SstRank(k, key);
+    if (i == 0 || k[i - 1] != key)
+        return NULL;
+
+    i += (uint32_t)(k - (const uint32_t *)(t->base + t->hdr->keys)) - 1;
+
+    return t->base + t->hdr->values + i * t->hdr->val_len;
+}
+
+
+/* the value of the greatest key <= key, stored to found (interpolation
+ * between calibration points); NULL below the first key */
+const void *DQSpiSstFloor(const DQSpiSst *t, uint32_t key, uint32_t *found)
+{
+    const uint32_t *k;
+    uint32_t i;
+
+    /* not a key: would count the padding */
+    if (key == DQSPI_SST_PAD)
+        key--;
+
+    k = SstDescend(t, key);
+    i = SstRank(k, key);
+    if (i == 0)
+        return NULL;
+
+    *found = k[i - 1];
+    i += (uint32_t)(k - (const uint32_t *)(t->base + t->hdr->keys)) - 1;
+
+    return t->base + t->hdr->values + i * t->hdr->val_len;
+}
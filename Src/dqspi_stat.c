@@ -0,0 +1,130 @@
+
+#include <string.h>
+
+#include "main.h"
+
+#include "dqspi_stat.h"
+
+
+#if DQSPI_STATS
+DQSpiStats DQSpiStatsBlock __attribute__((section(".noinit"), used));
+#endif
+#if DQSPI_TRACE
+DQSpiTrace DQSpiTraceRing __attribute__((section(".noinit"), used));
+#endif
+
+
+#if DQSPI_PROBES
+static uint8_t probe_init;     /* DWT set up since Init() */
+
+
+static void DQSpiStatInit(void)
+{
+#if DQSPI_STATS
+    uint32_t i;
+#endif
+
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->LAR = 0xC5ACCE55;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+
+    /* kept out of .bss, which Init() clears: the results span the calls
+     * of a session, and are garbage before the first */
+#if DQSPI_STATS
+    if (DQSpiStatsBlock.magic != DQSPI_STATS_MAGIC || DQSpiStatsBlock.size != sizeof(DQSpiStatsBlock)) {
+        memset(&DQSpiStatsBlock, 0, sizeof(DQSpiStatsBlock));
+        for (i = 0; i != DQSPI_OP_NUM; i++) {
+            DQSpiStatsBlock.op[i].min = 0xFFFFFFFF;
+        }
+        DQSpiStatsBlock.cpu_hz = SystemCoreClock;
+        DQSpiStatsBlock.size = sizeof(DQSpiStatsBlock);
+        DQSpiStatsBlock.magic = DQSPI_STATS_MAGIC;
+    }
+#endif
+#if DQSPI_TRACE
+    if (DQSpiTraceRing.magic != DQSPI_TRACE_MAGIC || DQSpiTraceRing.size != DQSPI_TRACE_RING) {
+        memset(&DQSpiTraceRing, 0, sizeof(DQSpiTraceRing));
+        DQSpiTraceRing.size = DQSPI_TRACE_RING;
+        DQSpiTraceRing.cpu_hz = SystemCoreClock;
+        DQSpiTraceRing.magic = DQSPI_TRACE_MAGIC;
+    }
+#endif
+    probe_init = 1;
+}
+
+
+#if DQSPI_TRACE
+static void DQSpiTraceEmit(const DQSpiTraceRec *r)
+{
+    const uint32_t *w = (const uint32_t *)r;
+    uint32_t i;
+
+    /* ITM enabled by the debugger (SWO viewer or openocd tpiu config) */
+    if ((CoreDebug->DEMCR & CoreDebug_DEMCR_TRCENA_Msk) &&
+        (ITM->TCR & ITM_TCR_ITMENA_Msk) &&
+        (ITM->TER & (1UL << DQSPI_TRACE_PORT))) {
+        for (i = 0; i != sizeof(*r) / 4; i++) {
+            while (ITM->PORT[DQSPI_TRACE_PORT].u32 == 0)
+                ;
+            ITM->PORT[DQSPI_TRACE_PORT].u32 = w[i];
+        }
+        return;
+    }
+
+    DQSpiTraceRing.rec[DQSpiTraceRing.head & (DQSPI_TRACE_RING - 1)] = *r;
+    DQSpiTraceRing.head++;
+}
+#endif
+
+
+uint32_t DQSpiStatBegin(void)
+{
+    if (!probe_init) {
+        DQSpiStatInit();
+    }
+
+    return DWT->CYCCNT;
+}
+
+
+void DQSpiStatEnd(uint32_t t0, DQSpiOpId op, uint8_t opcode, uint32_t addr, uint32_t len, int8_t ret)
+{
+    uint32_t t1 = DWT->CYCCNT;
+#if DQSPI_STATS
+    DQSpiOpStat *st = &DQSpiStatsBlock.op[op];
+    uint32_t c = t1 - t0;
+
+    st->count++;
+    if (ret != 0) {
+        st->errors++;
+    }
+    st->total += c;
+    if (c < st->min)
+        st->min = c;
+    if (c > st->max)
+        st->max = c;
+    st->hist[c != 0 ? 31 - __CLZ(c) : 0]++;
+#endif
+#if DQSPI_TRACE
+    DQSpiTraceRec r;
+
+    r.mark = DQSPI_TRACE_MARK;
+    r.op = op;
+    r.opcode = opcode;
+    r.result = ret;
+    r.addr = addr;
+    r.len = len;
+    r.t0 = t0;
+    r.t1 = t1;
+    DQSpiTraceEmit(&r);
+#endif
+}
+#endif
+
+
+void DQSpiStatReset(void)
+{
+#if DQSPI_PROBES
+    DQSpiStatInit();
+#endif
+}
@@ -0,0 +1,179 @@
+
+#include <stddef.h>
+#include <string.h>
+
+#include "main.h"
+
+#include "dqspi.h"
+#include "dqspi_plan.h"
+#include "loader_mbox.h"
+
+
+#if LOADER_MAILBOX
+#if (LOADER_MAILBOX_BUFS & (LOADER_MAILBOX_BUFS - 1)) != 0
+#error "LOADER_MAILBOX_BUFS must be a power of 2"
+#endif
+
+LoaderMbox LoaderMboxBlock __attribute__((section(".loader_mbox"), used));
+
+
+/* the host writes RAM through the debug port, behind the D-cache */
+static void MboxFetch(const volatile void *p, uint32_t len)
+{
+    if (SCB->CCR & SCB_CCR_DC_Msk) {
+        SCB_InvalidateDCache_by_Addr((void *)((uintptr_t)p & ~31UL), len + ((uintptr_t)p & 31));
+    }
+}
+
+
+static void MboxPublish(void)
+{
+    if (SCB->CCR & SCB_CCR_DC_Msk) {
+        SCB_CleanDCache_by_Addr((uint32_t *)&LoaderMboxBlock, offsetof(LoaderMbox, head));
+    }
+}
+
+
+/* largest aligned erase that fits, like qplan does without a previous
+ * image, a few per DQSpiExecBatch() call */
+static int8_t MboxErase(uint32_t addr, uint32_t len)
+{
+    DQSpiOp ops[8] = {0};
+    uint32_t end = addr + len, n;
+    int8_t ret = 0;
+
+    addr &= ~(0x1000UL - 1);
+    while (addr < end && ret == 0) {
+        for (n = 0; n != sizeof(ops) / sizeof(ops[0]) && addr < end; n++) {
+            ops[n].addr = addr;
+            if ((addr & 0xFFFF) == 0 && end - addr >= 0x10000) {
+                ops[n].op = DQSPI_BATCH_ERASE_64K;
+                addr += 0x10000;
+            }
+            else if ((addr & 0x7FFF) == 0 && end - addr >= 0x8000) {
+                ops[n].op = DQSPI_BATCH_ERASE_32K;
+                addr += 0x8000;
+            }
+            else {
+                ops[n].op = DQSPI_BATCH_ERASE_4K;
+                addr += 0x1000;
+            }
+        }
+        ret = DQSpiExecBatch(ops, n, NULL);
+    }
+
+    return ret;
+}
+
+
+static int8_t MboxRun(const LoaderMboxDesc *d, uint8_t *buf)
+{
+    DQSpiOp op = {0};
+
+    switch (d->op) {
+    case LOADER_MBOX_WRITE:
+        if (d->len > LOADER_MAILBOX_BUF_SIZE) {
+            return -1;
+        }
+        op.op = DQSPI_BATCH_PROGRAM;
+        op.addr = d->addr - DQSPI_MAP_ADDR;
+        op.len = d->len;
+        op.dat = buf;
+        return DQSpiExecBatch(&op, 1, NULL);
+    case LOADER_MBOX_ERASE:
+        return MboxErase(d->addr - DQSPI_MAP_ADDR, d->len);
+    case LOADER_MBOX_PLAN:
+        if (d->len > LOADER_MAILBOX_BUF_SIZE) {
+            return -1;
+        }
+        return DQSpiPlanRun(buf, d->len);
+    default:
+        return -1;
+    }
+}
+
+
+void LoaderMboxInit(void)
+{
+    LoaderMbox *m = &LoaderMboxBlock;
+
+    memset(m, 0, offsetof(LoaderMbox, buf));
+    m->version = LOADER_MBOX_VERSION;
+    m->nbuf = LOADER_MAILBOX_BUFS;
+    m->buf_size = LOADER_MAILBOX_BUF_SIZE;
+    m->magic = LOADER_MBOX_MAGIC;
+
+    if (SCB->CCR & SCB_CCR_DC_Msk) {
+        SCB_CleanDCache_by_Addr((uint32_t *)m, offsetof(LoaderMbox, buf));
+    }
+}
+
+
+/* serve requests until END, a failure or the host going quiet */
+int8_t LoaderMboxService(void)
+{
+    LoaderMbox *m = &LoaderMboxBlock;
+    LoaderMboxDesc d;
+    uint32_t last, slot;
+    int8_t ret = 0;
+
+    if (m->magic != LOADER_MBOX_MAGIC) {
+        return -1;
+    }
+    m->status = LOADER_MBOX_RUNNING;
+    MboxPublish();
+    last = HAL_GetTick();
+
+    for (;;) {
+        MboxFetch(&m->head, sizeof(m->head));
+        if (m->head == m->tail) {
+            if (HAL_GetTick() - last > LOADER_MAILBOX_TIMEOUT) {
+                m->status = LOADER_MBOX_TIMEOUT;
+                ret = -1;
+                break;
+            }
+            continue;
+        }
+
+        slot = m->tail & (LOADER_MAILBOX_BUFS - 1);
+        MboxFetch(&m->desc[slot], sizeof(d));
+        d = m->desc[slot];
+        if (d.op == LOADER_MBOX_END) {
+            m->tail++;
+            m->status = LOADER_MBOX_DONE;
+            break;
+        }
+
+        if (d.len <= LOADER_MAILBOX_BUF_SIZE) {
+            MboxFetch(m->buf[slot], d.len);
+        }
+        if (((d.flags & LOADER_MBOX_F_CRC) && (d.len > LOADER_MAILBOX_BUF_SIZE ||
+             DQSpiCrc32(0, m->buf[slot], d.len) != d.crc)) ||
+            MboxRun(&d, m->buf[slot]) != 0) {
+            m->error = m->tail;
+            m->status = LOADER_MBOX_ERROR;
+            ret = -1;
+            break;
+        }
+
+        if (d.op == LOADER_MBOX_WRITE) {
+            m->bytes += d.len;
+        }
+        m->tail++;
+        MboxPublish();
+        last = HAL_GetTick();
+    }
+    MboxPublish();
+
+    return ret;
+}
+
+
+/* Mailbox() returns here: the host's breakpoint */
+void __attribute__((noinline)) LoaderMboxTrap(void)
+{
+    __asm volatile ("" ::: "memory");
+    for (;;)
+        ;
+}
+#endif
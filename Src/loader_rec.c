@@ -0,0 +1,56 @@
+
+#include <string.h>
+
+#include "main.h"
+
+#include "dqspi.h"
+#include "loader_rec.h"
+
+
+#if LOADER_RECORD
+LoaderRec LoaderRecLog __attribute__((section(".noinit"), used));
+
+
+void LoaderRecBegin(LoaderRecStamp *t)
+{
+    /* kept out of .bss, which Init() clears: the log survives from one
+     * call of the session to the next, and is garbage before the first */
+    if (LoaderRecLog.magic != LOADER_REC_MAGIC || LoaderRecLog.size != LOADER_RECORD_SIZE) {
+        memset(&LoaderRecLog, 0, sizeof(LoaderRecLog));
+        LoaderRecLog.size = LOADER_RECORD_SIZE;
+        LoaderRecLog.magic = LOADER_REC_MAGIC;
+    }
+
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->LAR = 0xC5ACCE55;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+
+    t->tick = HAL_GetTick();
+    t->cycles = DWT->CYCCNT;
+}
+
+
+void LoaderRecEnd(const LoaderRecStamp *t, LoaderCallId call, uint32_t addr, uint32_t arg, const uint8_t *buf, int ret)
+{
+    uint32_t cycles = DWT->CYCCNT - t->cycles;
+    uint32_t ms = HAL_GetTick() - t->tick;
+    LoaderRecEntry *e;
+
+    /* Init() switched to the PLL, SystemCoreClock is only valid now */
+    LoaderRecLog.cpu_hz = SystemCoreClock;
+
+    if (LoaderRecLog.count < LOADER_RECORD_SIZE) {
+        e = &LoaderRecLog.e[LoaderRecLog.count];
+        e->call = call;
+        e->ret = (uint8_t)ret;
+        e->reserved = 0;
+        e->addr = addr;
+        e->arg = arg;
+        /* outside the timed section */
+        e->digest = buf != NULL ? DQSpiCrc32(0, buf, arg) : 0;
+        e->cycles = cycles;
+        e->ms = ms;
+    }
+    LoaderRecLog.count++;
+}
+#endif
@@ -26,6 +26,9 @@
 #include <sys/unistd.h> // STDOUT_FILENO, STDERR_FILENO
 #include <string.h>
 
+#include "dqspi.h"
+#include "dqspi_bench.h"
+
 /* USER CODE END Includes */
 
 /* Private typedef -----------------------------------------------------------*/
@@ -48,6 +51,9 @@
 QSPI_HandleTypeDef hqspi;
 
 /* USER CODE BEGIN PV */
+#if DQSPI_STREAM || DQSPI_LOG
+DMA_HandleTypeDef hdma_quadspi;
+#endif
 /* USER CODE END PV */
 
 /* Private function prototypes -----------------------------------------------*/
@@ -71,6 +77,9 @@ int main(void)
 {
   /* USER CODE BEGIN 1 */
 
+  /* MPU attributes of the QSPI window, I/D caches */
+  DQSpiMpuConfig();
+
   /* USER CODE END 1 */
 
   /* MCU Configuration--------------------------------------------------------*/
@@ -97,6 +106,11 @@ int main(void)
   MX_QUADSPI_Init();
   /* USER CODE BEGIN 2 */
 
+#if DQSPI_BENCH
+  /* Bench build configuration: run the suite, see Tools/bench.gdb */
+  DQSpiBench();
+#endif
+
   return 1;
 
   /* USER CODE END 2 */
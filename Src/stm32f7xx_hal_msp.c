@@ -22,6 +22,7 @@
 /* Includes ------------------------------------------------------------------*/
 #include "main.h"
 /* USER CODE BEGIN Includes */
+#include "dqspi.h"
 
 /* USER CODE END Includes */
 
@@ -42,6 +43,9 @@
 
 /* Private variables ---------------------------------------------------------*/
 /* USER CODE BEGIN PV */
+#if DQSPI_STREAM || DQSPI_LOG
+extern DMA_HandleTypeDef hdma_quadspi;
+#endif
 
 /* USER CODE END PV */
 
@@ -124,6 +128,34 @@ void HAL_QSPI_MspInit(QSPI_HandleTypeDef* hqspi)
     HAL_GPIO_Init(SPI_CS_GPIO_Port, &GPIO_InitStruct);
 
   /* USER CODE BEGIN QUADSPI_MspInit 1 */
+#if DQSPI_STREAM || DQSPI_LOG
+    /* QUADSPI DMA Init: DMA2 Stream7 channel 3; HAL_QSPI_Transmit_DMA()
+     * turns the direction around for the logger's page programs */
+    __HAL_RCC_DMA2_CLK_ENABLE();
+
+    hdma_quadspi.Instance = DMA2_Stream7;
+    hdma_quadspi.Init.Channel = DMA_CHANNEL_3;
+    hdma_quadspi.Init.Direction = DMA_PERIPH_TO_MEMORY;
+    hdma_quadspi.Init.PeriphInc = DMA_PINC_DISABLE;
+    hdma_quadspi.Init.MemInc = DMA_MINC_ENABLE;
+    hdma_quadspi.Init.PeriphDataAlignment = DMA_PDATAALIGN_BYTE;
+    hdma_quadspi.Init.MemDataAlignment = DMA_MDATAALIGN_BYTE;
+    hdma_quadspi.Init.Mode = DMA_NORMAL;
+    hdma_quadspi.Init.Priority = DMA_PRIORITY_HIGH;
+    hdma_quadspi.Init.FIFOMode = DMA_FIFOMODE_DISABLE;
+    if (HAL_DMA_Init(&hdma_quadspi) != HAL_OK)
+    {
+      Error_Handler();
+    }
+
+    __HAL_LINKDMA(hqspi,hdma,hdma_quadspi);
+
+    /* QUADSPI and DMA interrupt Init */
+    HAL_NVIC_SetPriority(DMA2_Stream7_IRQn, 5, 0);
+    HAL_NVIC_EnableIRQ(DMA2_Stream7_IRQn);
+    HAL_NVIC_SetPriority(QUADSPI_IRQn, 5, 0);
+    HAL_NVIC_EnableIRQ(QUADSPI_IRQn);
+#endif
 
   /* USER CODE END QUADSPI_MspInit 1 */
   }
@@ -157,6 +189,12 @@ void HAL_QSPI_MspDeInit(QSPI_HandleTypeDef* hqspi)
     HAL_GPIO_DeInit(GPIOC, SPI_IO0_Pin|SPI_IO1_Pin);
 
   /* USER CODE BEGIN QUADSPI_MspDeInit 1 */
+#if DQSPI_STREAM || DQSPI_LOG
+    HAL_DMA_DeInit(hqspi->hdma);
+
+    HAL_NVIC_DisableIRQ(DMA2_Stream7_IRQn);
+    HAL_NVIC_DisableIRQ(QUADSPI_IRQn);
+#endif
 
   /* USER CODE END QUADSPI_MspDeInit 1 */
   }
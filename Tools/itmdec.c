@@ -0,0 +1,200 @@
+/*
+ * Host decoder of the DQSPI_TRACE command trace.
+ *
+ *   itmdec [-p port] [-f hz] [-t] swo.bin      raw SWO capture (ITM packets)
+ *   itmdec -r [-t] ring.bin                    RAM ring dump:
+ *       (gdb) dump binary value ring.bin DQSpiTraceRing
+ *
+ * Output is CSV, or a timeline with the idle gap before every command
+ * with -t.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "dqspi_stat.h"
+
+
+static const char *op_name[DQSPI_OP_NUM] = {
+    "WREN", "PROGRAM", "ERASE_4K", "ERASE_32K", "ERASE_64K", "ERASE_CHIP",
+    "READ", "RESET", "MAP", "UNMAP", "OTHER"
+};
+
+static double cpu_hz = 216e6;
+static int timeline;
+static unsigned long nrec;
+static int64_t t_base, t_last;    /* cycle stamps unwrapped to 64 bit */
+static uint32_t cyc_prev;
+
+
+static int64_t Unwrap(uint32_t cyc)
+{
+    /* signed step: nested probes (WREN inside a program) end before the
+     * outer one and stamps go backwards; commands are far shorter than
+     * half a CYCCNT wrap (~10 s at 216 MHz) */
+    t_last += (int32_t)(cyc - cyc_prev);
+    cyc_prev = cyc;
+
+    return t_last;
+}
+
+
+static void Record(const DQSpiTraceRec *r)
+{
+    static int64_t end_prev;
+    int64_t t0, t1;
+    const char *name = r->op < DQSPI_OP_NUM ? op_name[r->op] : "?";
+
+    if (nrec == 0) {
+        cyc_prev = r->t0;
+        t_last = t_base = 0;
+        end_prev = 0;
+        if (timeline)
+            printf("%12s %12s %12s  %-10s %-6s %-10s %8s %s\n",
+                   "start_us", "dur_us", "gap_us", "op", "cmd", "addr", "len", "ret");
+        else
+            printf("seq,op,opcode,addr,len,t0,t1,cycles,us,result\n");
+    }
+    t0 = Unwrap(r->t0);
+    t1 = Unwrap(r->t1);
+
+    if (timeline) {
+        printf("%12.3f %12.3f %12.3f  %-10s 0x%02X   0x%08X %8u %d\n",
+               (t0 - t_base) * 1e6 / cpu_hz, (t1 - t0) * 1e6 / cpu_hz,
+               nrec != 0 && t0 > end_prev ? (t0 - end_prev) * 1e6 / cpu_hz : 0.0,
+               name, r->opcode, (unsigned)r->addr, (unsigned)r->len, r->result);
+    }
+    else {
+        printf("%lu,%s,0x%02X,0x%08X,%u,%u,%u,%u,%.3f,%d\n",
+               nrec, name, r->opcode, (unsigned)r->addr, (unsigned)r->len,
+               (unsigned)r->t0, (unsigned)r->t1, (unsigned)(r->t1 - r->t0),
+               (r->t1 - r->t0) * 1e6 / cpu_hz, r->result);
+    }
+    end_prev = t1;
+    nrec++;
+}
+
+
+static int DecodeRing(FILE *f)
+{
+    uint32_t hdr[4];
+    uint32_t first, i;
+    DQSpiTraceRec *rec;
+
+    if (fread(hdr, sizeof(hdr), 1, f) != 1 || hdr[0] != DQSPI_TRACE_MAGIC || hdr[2] == 0) {
+        fprintf(stderr, "itmdec: not a DQSpiTraceRing dump\n");
+        return -1;
+    }
+    if (hdr[1] != 0)
+        cpu_hz = hdr[1];
+
+    rec = malloc(hdr[2] * sizeof(*rec));
+    if (rec == NULL || fread(rec, sizeof(*rec), hdr[2], f) != hdr[2]) {
+        fprintf(stderr, "itmdec: truncated dump\n");
+        free(rec);
+        return -1;
+    }
+
+    first = hdr[3] > hdr[2] ? hdr[3] - hdr[2] : 0;
+    if (first != 0)
+        fprintf(stderr, "itmdec: ring wrapped, %u oldest records lost\n", (unsigned)first);
+    for (i = first; i != hdr[3]; i++) {
+        Record(&rec[i % hdr[2]]);
+    }
+    free(rec);
+
+    return 0;
+}
+
+
+static int DecodeItm(FILE *f, unsigned port)
+{
+    uint32_t w[sizeof(DQSpiTraceRec) / 4];
+    unsigned nw = 0, sz, i;
+    unsigned long lost = 0;
+    uint32_t v;
+    int h, c;
+
+    while ((h = getc(f)) != EOF) {
+        if ((h & 0x03) == 0) {
+            /* sync (0x00.. 0x80), overflow, timestamp or extension packet */
+            if (h == 0x70)
+                lost++;
+            else if (h != 0 && h != 0x80 && (h & 0x80)) {
+                while ((c = getc(f)) != EOF && (c & 0x80))
+                    ;
+            }
+            continue;
+        }
+
+        sz = (h & 0x03) == 3 ? 4 : (h & 0x03);
+        v = 0;
+        for (i = 0; i != sz; i++) {
+            if ((c = getc(f)) == EOF)
+                return 0;
+            v |= (uint32_t)c << (8 * i);
+        }
+        /* hardware source (DWT) or another stimulus port */
+        if ((h & 0x04) || (unsigned)(h >> 3) != port || sz != 4)
+            continue;
+
+        if (nw == 0 && (v & 0xFF) != DQSPI_TRACE_MARK)
+            continue;
+        w[nw++] = v;
+        if (nw == sizeof(w) / sizeof(w[0])) {
+            DQSpiTraceRec r;
+
+            memcpy(&r, w, sizeof(r));
+            Record(&r);
+            nw = 0;
+        }
+    }
+    if (lost)
+        fprintf(stderr, "itmdec: %lu ITM overflow packets, records may be missing\n", lost);
+
+    return 0;
+}
+
+
+int main(int argc, char *argv[])
+{
+    unsigned port = DQSPI_TRACE_PORT;
+    int ring = 0, opt, ret;
+    FILE *f;
+
+    while ((opt = getopt(argc, argv, "p:f:rt")) != -1) {
+        switch (opt) {
+        case 'p':
+            port = strtoul(optarg, NULL, 0);
+            break;
+        case 'f':
+            cpu_hz = strtod(optarg, NULL);
+            break;
+        case 'r':
+            ring = 1;
+            break;
+        case 't':
+            timeline = 1;
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-p port] [-f cpu_hz] [-r] [-t] file\n", argv[0]);
+            return 2;
+        }
+    }
+    if (optind != argc - 1 || port > 31) {
+        fprintf(stderr, "usage: %s [-p port] [-f cpu_hz] [-r] [-t] file\n", argv[0]);
+        return 2;
+    }
+
+    f = fopen(argv[optind], "rb");
+    if (f == NULL) {
+        perror(argv[optind]);
+        return 1;
+    }
+    ret = ring ? DecodeRing(f) : DecodeItm(f, port);
+    fclose(f);
+
+    return ret == 0 ? 0 : 1;
+}
@@ -0,0 +1,527 @@
+/*
+ * QSPI transfer cost estimator: bus clocks per phase and throughput of
+ * the driver's commands, before touching the hardware.
+ *
+ *   qcost [opts]                      report of the driver commands
+ *   qcost [opts] -s stream.txt        cost of a command stream
+ *   qcost [opts] -b bench.bin         cross-check a DQSpiBenchBlock dump
+ *   qcost [opts] -t trace.csv         cross-check an itmdec CSV trace
+ *
+ *   -f hz        QUADSPI kernel clock (HCLK), default 216 MHz
+ *   -p p[,p..]   ClockPrescaler(s) to compare, default 2 (MX_QUADSPI_Init)
+ *   -c n         nCS high time in clocks, default 1
+ *   -o ns        CPU time of one indirect HAL command, default 0
+ *
+ * A stream line describes one QSPI_CommandTypeDef, repeated n times:
+ *
+ *   instr=0xBB imode=1 amode=2 asize=24 abmode=2 absize=8 dummy=0 dmode=2 len=32 sioo=1 n=100
+ *
+ * Line modes are the number of lines (0, 1, 2, 4), sizes are in bits.
+ * With sioo=1 the instruction is sent only for the first repetition,
+ * as memory-mapped mode does once the flash is in continuous read mode.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "dqspi_bench.h"
+#include "dqspi_stat.h"
+#include "qspi_cost.h"
+#include "w25q_sim.h"
+
+
+#define MAX_PRESC            8
+#define MAP_LINE             32        /* Cortex-M7 D-cache line, one AXI burst */
+#define FLASH_FR_MAX         104000000 /* W25Q32FV fR, 0x3B/0xBB */
+#define PAGE_SIZE            256
+
+static QCostCfg cfg = { 216000000, 2, QSPI_CS_HIGH_TIME_1_CYCLE };
+static uint32_t presc[MAX_PRESC] = { 2 };
+static uint32_t npresc = 1;
+static uint32_t ovh_ns;
+static W25qSim typ;
+
+
+/* ---- driver commands, as built in Src/dqspi.c ------------------------ */
+
+static uint32_t Mode(uint32_t lines, int shift)
+{
+    return (lines == 4 ? 3 : lines) << shift;
+}
+
+
+static uint32_t Size(uint32_t bits, int shift)
+{
+    return bits ? ((bits / 8 - 1) & 3) << shift : 0;
+}
+
+
+static void Cmd(QSPI_CommandTypeDef *c, uint8_t instr, uint32_t imode, uint32_t amode,
+                uint32_t abmode, uint32_t dummy, uint32_t dmode, int sioo)
+{
+    memset(c, 0, sizeof(*c));
+    c->Instruction = instr;
+    c->InstructionMode = Mode(imode, 8);
+    c->AddressMode = Mode(amode, 10);
+    c->AddressSize = QSPI_ADDRESS_24_BITS;
+    c->AlternateByteMode = Mode(abmode, 14);
+    c->AlternateBytesSize = QSPI_ALTERNATE_BYTES_8_BITS;
+    c->DummyCycles = dummy;
+    c->DataMode = Mode(dmode, 24);
+    c->SIOOMode = sioo ? QSPI_SIOO_INST_ONLY_FIRST_CMD : QSPI_SIOO_INST_EVERY_CMD;
+}
+
+
+static QSPI_CommandTypeDef read_3b, map_bb, map_bb_cont, wren, rdsr1, pp, se;
+
+
+static void CmdInit(void)
+{
+    Cmd(&read_3b, 0x3B, 1, 1, 0, 8, 2, 0);
+    Cmd(&map_bb, 0xBB, 1, 2, 2, 0, 2, 0);
+    Cmd(&map_bb_cont, 0xBB, 1, 2, 2, 0, 2, 1);
+    Cmd(&wren, 0x06, 1, 0, 0, 0, 0, 0);
+    Cmd(&rdsr1, 0x05, 1, 0, 0, 0, 1, 0);
+    Cmd(&pp, 0x02, 1, 1, 0, 0, 1, 0);
+    Cmd(&se, 0x20, 1, 1, 0, 0, 0, 0);
+    typ.timing = W25Q_SIM_TYP;
+}
+
+
+static uint64_t Clk(const QSPI_CommandTypeDef *c, uint32_t len, int first)
+{
+    QCostClk k;
+
+    QCostPhases(&cfg, c, len, first, &k);
+
+    return k.total;
+}
+
+
+/* ns of one driver operation: bus, HAL overhead per command, flash busy */
+static double OpNs(uint8_t opcode, uint32_t len)
+{
+    uint64_t clk;
+    double ns;
+
+    switch (opcode) {
+    case 0x3B:
+        return QCostNs(&cfg, Clk(&read_3b, len, 1)) + ovh_ns;
+    case 0x02:
+        /* WREN, page program, at least one status poll after tPP */
+        clk = Clk(&wren, 0, 1) + Clk(&pp, len, 1) + Clk(&rdsr1, 1, 1);
+        ns = QCostNs(&cfg, clk) + 3.0 * ovh_ns;
+        return ns + W25qSimOpTime(&typ, opcode, len);
+    case 0x20:
+    case 0x52:
+    case 0xD8:
+    case 0xC7:
+        clk = Clk(&wren, 0, 1) + Clk(&se, 0, 1) + Clk(&rdsr1, 1, 1);
+        ns = QCostNs(&cfg, clk) + 3.0 * ovh_ns;
+        return ns + W25qSimOpTime(&typ, opcode, 0);
+    case 0x06:
+        return QCostNs(&cfg, Clk(&wren, 0, 1)) + ovh_ns;
+    default:
+        return -1;
+    }
+}
+
+
+/* ns of a mapped read of len bytes at a random address: one command,
+ * then whole cache lines, an unaligned block touches one line more */
+static double MapRndNs(const QSPI_CommandTypeDef *c, uint32_t len, int first)
+{
+    uint32_t lines = len / MAP_LINE + 1;
+
+    return QCostNs(&cfg, Clk(c, lines * MAP_LINE, first));
+}
+
+
+/* sequential mapped reads: nCS stays low, the prefetch streams data only */
+static double MapSeqNs(const QSPI_CommandTypeDef *c, uint32_t len)
+{
+    QCostClk k;
+
+    QCostPhases(&cfg, c, len, 1, &k);
+
+    return QCostNs(&cfg, k.data);
+}
+
+
+static double Mbs(uint32_t bytes, double ns)
+{
+    return ns > 0 ? bytes * 1e3 / ns : 0;
+}
+
+
+/* ---- report ----------------------------------------------------------- */
+
+typedef struct {
+    const char *name;
+    uint32_t bytes;
+    double ns;
+    uint64_t clk;           /* bus clocks, 0: not a single command */
+    uint32_t data_clk;
+} Row;
+
+
+static int Rows(Row *r)
+{
+    static const uint32_t rd_len[] = { 32, 256, 4096 };
+    static const char *rd_name[] = { "read 0x3B 32B", "read 0x3B 256B", "read 0x3B 4K" };
+    QCostClk k;
+    int n = 0;
+    uint32_t i;
+
+    for (i = 0; i != 3; i++) {
+        QCostPhases(&cfg, &read_3b, rd_len[i], 1, &k);
+        r[n++] = (Row){ rd_name[i], rd_len[i], QCostNs(&cfg, k.total) + ovh_ns, k.total, k.data };
+    }
+
+    QCostPhases(&cfg, &read_3b, MAP_LINE, 1, &k);
+    r[n++] = (Row){ "map 0x3B line", MAP_LINE, QCostNs(&cfg, k.total), k.total, k.data };
+    QCostPhases(&cfg, &map_bb, MAP_LINE, 1, &k);
+    r[n++] = (Row){ "map 0xBB line", MAP_LINE, QCostNs(&cfg, k.total), k.total, k.data };
+    QCostPhases(&cfg, &map_bb_cont, MAP_LINE, 0, &k);
+    r[n++] = (Row){ "map 0xBB cont line", MAP_LINE, QCostNs(&cfg, k.total), k.total, k.data };
+    QCostPhases(&cfg, &read_3b, 4096, 1, &k);
+    r[n++] = (Row){ "map sequential 4K", 4096, QCostNs(&cfg, k.data), k.data, k.data };
+
+    r[n++] = (Row){ "program 256B", PAGE_SIZE, OpNs(0x02, PAGE_SIZE), 0, 0 };
+    r[n++] = (Row){ "erase 4K", 0x1000, OpNs(0x20, 0), 0, 0 };
+    r[n++] = (Row){ "erase 64K", 0x10000, OpNs(0xD8, 0), 0, 0 };
+
+    return n;
+}
+
+
+static void Report(void)
+{
+    Row r[MAX_PRESC][16];
+    QCostClk k;
+    uint32_t i, j;
+    int n = 0;
+
+    printf("QUADSPI kernel clock %.1f MHz, nCS high %u clk, HAL overhead %u ns/command\n",
+           cfg.hclk / 1e6, (unsigned)(((cfg.cs_high >> 8) & 7) + 1), (unsigned)ovh_ns);
+
+    for (i = 0; i != npresc; i++) {
+        uint32_t hz;
+
+        cfg.prescaler = presc[i];
+        hz = cfg.hclk / (cfg.prescaler + 1);
+        printf("\nprescaler %u: CLK %.1f MHz%s\n", (unsigned)presc[i], hz / 1e6,
+               hz > FLASH_FR_MAX ? "  ** above fR 104 MHz of the W25Q32FV **" : "");
+
+        printf("  %-20s %5s %5s %5s %5s %6s %4s %7s\n",
+               "phases (clk)", "instr", "addr", "alt", "dummy", "data", "cs", "total");
+        QCostPhases(&cfg, &read_3b, MAP_LINE, 1, &k);
+        printf("  %-20s %5u %5u %5u %5u %6u %4u %7u\n", "0x3B 32B", k.instr, k.addr, k.alt, k.dummy, k.data, k.cs_high, k.total);
+        QCostPhases(&cfg, &map_bb, MAP_LINE, 1, &k);
+        printf("  %-20s %5u %5u %5u %5u %6u %4u %7u\n", "0xBB 32B", k.instr, k.addr, k.alt, k.dummy, k.data, k.cs_high, k.total);
+        QCostPhases(&cfg, &map_bb_cont, MAP_LINE, 0, &k);
+        printf("  %-20s %5u %5u %5u %5u %6u %4u %7u\n", "0xBB cont 32B", k.instr, k.addr, k.alt, k.dummy, k.data, k.cs_high, k.total);
+
+        printf("  %-20s %12s %10s %9s %5s\n", "operation", "ns/op", "MB/s", "overhead", "eff");
+        n = Rows(r[i]);
+        for (j = 0; j != (uint32_t)n; j++) {
+            const Row *w = &r[i][j];
+
+            if (w->clk != 0)
+                printf("  %-20s %12.1f %10.2f %8.1f%% %4.0f%%\n", w->name, w->ns, Mbs(w->bytes, w->ns),
+                       100.0 * (w->ns - QCostNs(&cfg, w->data_clk)) / w->ns, 100.0 * w->data_clk / w->clk);
+            else
+                printf("  %-20s %12.1f %10.3f %9s %5s\n", w->name, w->ns, Mbs(w->bytes, w->ns), "flash", "");
+        }
+    }
+
+    if (npresc < 2)
+        return;
+    printf("\nMB/s by prescaler\n  %-20s", "operation");
+    for (i = 0; i != npresc; i++)
+        printf("  presc %-4u", (unsigned)presc[i]);
+    printf("\n");
+    for (j = 0; j != (uint32_t)n; j++) {
+        printf("  %-20s", r[0][j].name);
+        for (i = 0; i != npresc; i++)
+            printf("  %10.3f", Mbs(r[i][j].bytes, r[i][j].ns));
+        printf("\n");
+    }
+}
+
+
+/* ---- command stream ---------------------------------------------------- */
+
+static int Stream(FILE *f)
+{
+    char line[256], *tok, *v;
+    QSPI_CommandTypeDef c;
+    QCostClk k;
+    uint64_t clk_all = 0, bytes_all = 0, clk, cmds_all = 0;
+    uint32_t len, n, i, lno = 0, amode, asize, abmode, absize;
+    double ns, ns_all = 0;
+
+    printf("%5s %-6s %7s %5s %5s %5s %5s %6s %4s %9s %12s %9s\n",
+           "line", "instr", "n", "instr", "addr", "alt", "dummy", "data", "cs", "clk", "ns", "MB/s");
+    while (fgets(line, sizeof(line), f) != NULL) {
+        lno++;
+        if ((v = strchr(line, '#')) != NULL)
+            *v = 0;
+        Cmd(&c, 0, 1, 0, 0, 0, 0, 0);
+        amode = abmode = 0;
+        asize = 24;
+        absize = 8;
+        len = 0;
+        n = 1;
+        i = 0;
+        for (tok = strtok(line, " \t\r\n"); tok != NULL; tok = strtok(NULL, " \t\r\n"), i++) {
+            unsigned long x;
+
+            if ((v = strchr(tok, '=')) == NULL) {
+                fprintf(stderr, "qcost: line %u: '%s' is not key=value\n", (unsigned)lno, tok);
+                return -1;
+            }
+            *v++ = 0;
+            x = strtoul(v, NULL, 0);
+            if (!strcmp(tok, "instr"))
+                c.Instruction = x;
+            else if (!strcmp(tok, "imode"))
+                c.InstructionMode = Mode(x, 8);
+            else if (!strcmp(tok, "amode"))
+                amode = x;
+            else if (!strcmp(tok, "asize"))
+                asize = x;
+            else if (!strcmp(tok, "abmode"))
+                abmode = x;
+            else if (!strcmp(tok, "absize"))
+                absize = x;
+            else if (!strcmp(tok, "dummy"))
+                c.DummyCycles = x;
+            else if (!strcmp(tok, "dmode"))
+                c.DataMode = Mode(x, 24);
+            else if (!strcmp(tok, "len"))
+                len = x;
+            else if (!strcmp(tok, "sioo"))
+                c.SIOOMode = x ? QSPI_SIOO_INST_ONLY_FIRST_CMD : QSPI_SIOO_INST_EVERY_CMD;
+            else if (!strcmp(tok, "n"))
+                n = x;
+            else {
+                fprintf(stderr, "qcost: line %u: unknown key '%s'\n", (unsigned)lno, tok);
+                return -1;
+            }
+        }
+        if (i == 0 || n == 0)
+            continue;
+        c.AddressMode = Mode(amode, 10);
+        c.AddressSize = Size(asize, 12);
+        c.AlternateByteMode = Mode(abmode, 14);
+        c.AlternateBytesSize = Size(absize, 16);
+
+        /* the first repetition carries the instruction, SIOO drops it after */
+        QCostPhases(&cfg, &c, len, 1, &k);
+        clk = k.total;
+        if (n > 1) {
+            QCostPhases(&cfg, &c, len, 0, &k);
+            clk += (uint64_t)(n - 1) * k.total;
+        }
+        ns = QCostNs(&cfg, clk) + (double)n * ovh_ns;
+        printf("%5u  0x%02X  %7u %5u %5u %5u %5u %6u %4u %9llu %12.1f %9.3f\n",
+               (unsigned)lno, (unsigned)c.Instruction, (unsigned)n, k.instr, k.addr, k.alt, k.dummy,
+               k.data, k.cs_high, (unsigned long long)clk, ns, Mbs(len * n, ns));
+        clk_all += clk;
+        ns_all += ns;
+        bytes_all += (uint64_t)len * n;
+        cmds_all += n;
+    }
+    printf("total %llu commands, %llu bytes, %llu clk, %.3f us, %.3f MB/s\n",
+           (unsigned long long)cmds_all, (unsigned long long)bytes_all, (unsigned long long)clk_all,
+           ns_all / 1e3, Mbs(bytes_all, ns_all));
+
+    return 0;
+}
+
+
+/* ---- cross-checks against DWT measurements ----------------------------- */
+
+static void Compare(const char *name, uint32_t count, double meas_cyc, double model_ns, uint32_t cpu_hz)
+{
+    double model_cyc = model_ns * cpu_hz / 1e9;
+
+    printf("%-16s %7u %12.0f %12.0f %12.0f %7.2f\n", name, (unsigned)count, meas_cyc, model_cyc,
+           meas_cyc - model_cyc, model_cyc > 0 ? meas_cyc / model_cyc : 0);
+}
+
+
+static int Bench(FILE *f)
+{
+    static const char *name[DQSPI_BENCH_NUM] = {
+        "read_seq", "read_rnd", "map_seq_3b", "map_rnd_3b", "map_seq_bb", "map_rnd_bb",
+        "map_seq_bb_cont", "map_rnd_bb_cont", "program", "erase_4k", "erase_32k", "erase_64k"
+    };
+    static const uint8_t erase_op[3] = { 0x20, 0x52, 0xD8 };
+    const QSPI_CommandTypeDef *map[3] = { &read_3b, &map_bb, &map_bb_cont };
+    DQSpiBenchResult b;
+    double ns;
+    uint32_t i, len;
+
+    if (fread(&b, sizeof(b), 1, f) != 1 || b.magic != DQSPI_BENCH_MAGIC || !b.done) {
+        fprintf(stderr, "qcost: not a complete DQSpiBenchBlock dump\n");
+        return -1;
+    }
+
+    printf("bench of flash %06X, cpu %u MHz, prescaler %u; p50 per operation, cycles\n",
+           (unsigned)b.flash_id, (unsigned)(b.cpu_hz / 1000000), (unsigned)cfg.prescaler);
+    printf("%-16s %7s %12s %12s %12s %7s\n", "case", "count", "measured", "model", "residual", "ratio");
+    for (i = 0; i != DQSPI_BENCH_NUM; i++) {
+        const DQSpiBenchCase *c = &b.c[i];
+
+        if (c->count == 0)
+            continue;
+        len = c->bytes / c->count;
+        switch (i) {
+        case DQSPI_BENCH_READ_SEQ:
+        case DQSPI_BENCH_READ_RND:
+            ns = OpNs(0x3B, len);
+            break;
+        case DQSPI_BENCH_MAP_SEQ_3B:
+        case DQSPI_BENCH_MAP_SEQ_BB:
+        case DQSPI_BENCH_MAP_SEQ_BB_CONT:
+            ns = MapSeqNs(map[(i - DQSPI_BENCH_MAP_SEQ_3B) / 2], len);
+            break;
+        case DQSPI_BENCH_MAP_RND_3B:
+        case DQSPI_BENCH_MAP_RND_BB:
+        case DQSPI_BENCH_MAP_RND_BB_CONT:
+            ns = MapRndNs(map[(i - DQSPI_BENCH_MAP_RND_3B) / 2], len, i != DQSPI_BENCH_MAP_RND_BB_CONT);
+            break;
+        case DQSPI_BENCH_PROGRAM:
+            ns = OpNs(0x02, len);
+            break;
+        default:
+            ns = OpNs(erase_op[i - DQSPI_BENCH_ERASE_4K], 0);
+            break;
+        }
+        Compare(name[i], c->count, c->p50, ns, b.cpu_hz);
+    }
+    printf("residual: CPU, HAL and cache time the bus model does not see (try -o),\n"
+           "program/erase use the typical datasheet times\n");
+
+    return 0;
+}
+
+
+static int Trace(FILE *f, uint32_t cpu_hz)
+{
+    static const char *op_name[DQSPI_OP_NUM] = {
+        "WREN", "PROGRAM", "ERASE_4K", "ERASE_32K", "ERASE_64K", "ERASE_CHIP",
+        "READ", "RESET", "MAP", "UNMAP", "OTHER"
+    };
+    struct {
+        uint32_t count;
+        double meas, model;
+    } acc[DQSPI_OP_NUM];
+    char line[256], op[32];
+    unsigned opcode, len, cyc;
+    uint32_t i;
+    double ns;
+
+    memset(acc, 0, sizeof(acc));
+    while (fgets(line, sizeof(line), f) != NULL) {
+        /* seq,op,opcode,addr,len,t0,t1,cycles,us,result */
+        if (sscanf(line, "%*u,%31[^,],%x,%*x,%u,%*u,%*u,%u", op, &opcode, &len, &cyc) != 4)
+            continue;
+        for (i = 0; i != DQSPI_OP_NUM && strcmp(op, op_name[i]); i++)
+            ;
+        if (i == DQSPI_OP_NUM || (ns = OpNs((uint8_t)opcode, len)) < 0)
+            continue;
+        acc[i].count++;
+        acc[i].meas += cyc;
+        acc[i].model += ns;
+    }
+
+    printf("trace at cpu %u MHz, prescaler %u; mean per operation, cycles\n",
+           (unsigned)(cpu_hz / 1000000), (unsigned)cfg.prescaler);
+    printf("%-16s %7s %12s %12s %12s %7s\n", "op", "count", "measured", "model", "residual", "ratio");
+    for (i = 0; i != DQSPI_OP_NUM; i++) {
+        if (acc[i].count != 0)
+            Compare(op_name[i], acc[i].count, acc[i].meas / acc[i].count, acc[i].model / acc[i].count, cpu_hz);
+    }
+
+    return 0;
+}
+
+
+static void Usage(const char *me)
+{
+    fprintf(stderr, "usage: %s [-f hz] [-p presc[,presc..]] [-c cs_clk] [-o ns] [-s stream | -b bench.bin | -t trace.csv]\n", me);
+}
+
+
+int main(int argc, char *argv[])
+{
+    const char *file = NULL;
+    char mode = 0, *p;
+    uint32_t cs;
+    int opt, ret;
+    FILE *f;
+
+    while ((opt = getopt(argc, argv, "f:p:c:o:s:b:t:")) != -1) {
+        switch (opt) {
+        case 'f':
+            cfg.hclk = strtoul(optarg, NULL, 0);
+            break;
+        case 'p':
+            npresc = 0;
+            for (p = optarg; *p && npresc != MAX_PRESC; p += *p == ',')
+                presc[npresc++] = strtoul(p, &p, 0);
+            break;
+        case 'c':
+            cs = strtoul(optarg, NULL, 0);
+            if (cs < 1 || cs > 8) {
+                Usage(argv[0]);
+                return 2;
+            }
+            cfg.cs_high = (cs - 1) << 8;
+            break;
+        case 'o':
+            ovh_ns = strtoul(optarg, NULL, 0);
+            break;
+        case 's':
+        case 'b':
+        case 't':
+            mode = (char)opt;
+            file = optarg;
+            break;
+        default:
+            Usage(argv[0]);
+            return 2;
+        }
+    }
+    if (optind != argc || npresc == 0 || cfg.hclk == 0) {
+        Usage(argv[0]);
+        return 2;
+    }
+    CmdInit();
+    cfg.prescaler = presc[0];
+
+    if (mode == 0) {
+        Report();
+        return 0;
+    }
+
+    f = fopen(file, mode == 'b' ? "rb" : "r");
+    if (f == NULL) {
+        perror(file);
+        return 1;
+    }
+    if (mode == 's')
+        ret = Stream(f);
+    else if (mode == 'b')
+        ret = Bench(f);
+    else
+        ret = Trace(f, cfg.hclk);
+    fclose(f);
+
+    return ret == 0 ? 0 : 1;
+}
@@ -0,0 +1,725 @@
+/*
+ * Programming plan optimizer: the cheapest set of 4K/32K/64K/chip
+ * erases and page programs that turns the device content into a new
+ * image, timed with the W25Q32FV datasheet figures, written as a plan
+ * for the loader Plan() entry point (Inc/dqspi_plan.h).
+ *
+ *   qplan [-p prev | -b] [-o plan.bin] [-s max_bytes] [-m] [-v] image
+ *
+ * Images are ELF (PT_LOAD segments by load address), Intel HEX or raw
+ * binary (file.bin[@addr], 0x90000000 by default).
+ *
+ *   -p prev   image known to be on the device, the rest of it erased:
+ *             unchanged pages are skipped, erases only where bits go
+ *             0 -> 1 and bytes outside the new image are preserved
+ *   -b        device known blank
+ *             (neither: sectors the image touches are erased, others kept)
+ *   -o file   write the plan
+ *   -s max    split it into self-contained plans of at most max bytes,
+ *             file.000, file.001, .. to run in order: a plan sits whole
+ *             in the loader RAM, LOADER_MAILBOX_BUF_SIZE for the mailbox
+ *   -m        datasheet worst-case times instead of typical
+ *   -v        list the plan
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "Dev_Inf.h"
+#include "dqspi.h"
+#include "dqspi_plan.h"
+#include "qspi_cost.h"
+#include "w25q_sim.h"
+
+
+#define FLASH_SIZE           W25Q_SIM_FLASH_SIZE
+#define PAGE                 256
+#define SECT                 0x1000
+#define NSECT                (FLASH_SIZE / SECT)
+#define SPS                  (SECT / PAGE)     /* pages per sector */
+
+extern struct StorageInfo const StorageInfo;
+
+typedef struct {
+    uint8_t *data;
+    uint8_t *def;          /* byte is part of the image */
+    uint32_t bytes;
+    uint32_t outside;      /* bytes outside the device window */
+} Image;
+
+static Image img, prev;
+static uint8_t *target;            /* content after the plan */
+static int old_known;
+static W25qSim timing;
+static QCostCfg bus = { 216000000, 2, QSPI_CS_HIGH_TIME_1_CYCLE };
+
+static DQSpiPlanOp *ops;
+static uint32_t nops, data_len;
+static uint8_t *plan_data;
+
+
+/* ---- image loading ----------------------------------------------------- */
+
+static void Put(Image *m, uint32_t addr, const uint8_t *p, uint32_t len)
+{
+    uint32_t i, a;
+
+    for (i = 0; i != len; i++) {
+        a = addr + i - StorageInfo.DeviceStartAddress;
+        if (addr + i < StorageInfo.DeviceStartAddress || a >= FLASH_SIZE) {
+            m->outside++;
+            continue;
+        }
+        m->bytes += !m->def[a];
+        m->data[a] = p[i];
+        m->def[a] = 1;
+    }
+}
+
+
+static int LoadElf(Image *m, const uint8_t *f, long n)
+{
+    uint32_t phoff, i, off, pa, fsz;
+    uint16_t phentsize, phnum;
+
+#define U16(o) ((uint32_t)f[o] | (uint32_t)f[(o) + 1] << 8)
+#define U32(o) (U16(o) | U16((o) + 2) << 16)
+    if (n < 52 || f[4] != 1 || f[5] != 1) {
+        fprintf(stderr, "qplan: only 32-bit little endian ELF\n");
+        return -1;
+    }
+    phoff = U32(28);
+    phentsize = U16(42);
+    phnum = U16(44);
+    for (i = 0; i != phnum; i++) {
+        off = phoff + i * phentsize;
+        if (off + 32 > (uint32_t)n)
+            return -1;
+        if (U32(off) != 1)             /* PT_LOAD */
+            continue;
+        pa = U32(off + 12);
+        fsz = U32(off + 16);
+        if (fsz == 0)
+            continue;
+        if (U32(off + 4) + fsz > (uint32_t)n)
+            return -1;
+        Put(m, pa, f + U32(off + 4), fsz);
+    }
+#undef U32
+#undef U16
+
+    return 0;
+}
+
+
+static int LoadHex(Image *m, const char *name)
+{
+    FILE *f = fopen(name, "r");
+    char line[600];
+    uint8_t rec[256];
+    uint32_t base = 0, len, addr, type, i, sum, x;
+
+    if (f == NULL) {
+        perror(name);
+        return -1;
+    }
+    while (fgets(line, sizeof(line), f) != NULL) {
+        if (line[0] != ':')
+            continue;
+        for (i = 0, sum = 0; i < 255 && sscanf(line + 1 + 2 * i, "%2x", &x) == 1; i++) {
+            rec[i] = (uint8_t)x;
+            sum += x;
+        }
+        if (i < 5 || i < rec[0] + 5u || (sum & 0xFF) != 0) {
+            fprintf(stderr, "qplan: %s: bad record %s", name, line);
+            fclose(f);
+            return -1;
+        }
+        len = rec[0];
+        addr = (uint32_t)rec[1] << 8 | rec[2];
+        type = rec[3];
+        if (type == 0)
+            Put(m, base + addr, rec + 4, len);
+        else if (type == 1)
+            break;
+        else if (type == 2 && len == 2)
+            base = ((uint32_t)rec[4] << 8 | rec[5]) << 4;
+        else if (type == 4 && len == 2)
+            base = ((uint32_t)rec[4] << 8 | rec[5]) << 16;
+    }
+    fclose(f);
+
+    return 0;
+}
+
+
+static int Load(Image *m, char *arg)
+{
+    uint32_t addr = StorageInfo.DeviceStartAddress;
+    char *at = strrchr(arg, '@');
+    uint8_t *buf;
+    FILE *f;
+    long n;
+    int ret;
+
+    m->data = malloc(FLASH_SIZE);
+    m->def = calloc(FLASH_SIZE, 1);
+    if (m->data == NULL || m->def == NULL)
+        return -1;
+    memset(m->data, StorageInfo.EraseValue, FLASH_SIZE);
+
+    if (at != NULL) {
+        *at = 0;
+        addr = strtoul(at + 1, NULL, 0);
+    }
+    f = fopen(arg, "rb");
+    if (f == NULL) {
+        perror(arg);
+        return -1;
+    }
+    fseek(f, 0, SEEK_END);
+    n = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    buf = malloc(n > 0 ? n : 1);
+    if (buf == NULL || fread(buf, 1, n, f) != (size_t)n) {
+        fprintf(stderr, "%s: read error\n", arg);
+        fclose(f);
+        free(buf);
+        return -1;
+    }
+    fclose(f);
+
+    if (n >= 4 && memcmp(buf, "\177ELF", 4) == 0)
+        ret = LoadElf(m, buf, n);
+    else if (n >= 1 && buf[0] == ':')
+        ret = LoadHex(m, arg);
+    else {
+        Put(m, addr, buf, n);
+        ret = 0;
+    }
+    free(buf);
+    if (m->outside != 0)
+        fprintf(stderr, "qplan: %s: %u bytes outside the flash window ignored\n", arg, (unsigned)m->outside);
+
+    return ret;
+}
+
+
+/* ---- timing ------------------------------------------------------------ */
+
+static double CmdNs(uint8_t instr, uint32_t addr_lines, uint32_t len)
+{
+    QSPI_CommandTypeDef c = {0};
+    QCostClk k;
+
+    c.InstructionMode = QSPI_INSTRUCTION_1_LINE;
+    c.Instruction = instr;
+    c.AddressMode = addr_lines ? QSPI_ADDRESS_1_LINE : QSPI_ADDRESS_NONE;
+    c.AddressSize = QSPI_ADDRESS_24_BITS;
+    c.DataMode = len ? QSPI_DATA_1_LINE : QSPI_DATA_NONE;
+    QCostPhases(&bus, &c, len, 1, &k);
+
+    return QCostNs(&bus, k.total);
+}
+
+
+/* WREN, command, one status poll, flash busy time */
+static double OpNs(uint8_t instr, uint32_t len)
+{
+    return CmdNs(0x06, 0, 0) + CmdNs(instr, instr != 0xC7, len) + CmdNs(0x05, 0, 1) +
+           W25qSimOpTime(&timing, instr, len);
+}
+
+
+static double ProgNs(uint32_t len)
+{
+    return len ? OpNs(0x02, len) : 0;
+}
+
+
+/* ---- planning ----------------------------------------------------------- */
+
+typedef struct {
+    uint8_t touched;       /* the image has bytes in it */
+    uint8_t need;          /* cannot be reached without an erase */
+    uint8_t erasable;      /* content known or ours to overwrite */
+    double keep_ns;        /* programs without erasing */
+    double fresh_ns;       /* programs after an erase */
+} Sect;
+
+static Sect sect[NSECT];
+static uint8_t erased[NSECT];
+
+
+/* first and last differing byte of a page, 0 if none */
+static uint32_t Span(uint32_t page, const uint8_t *from, uint32_t *start)
+{
+    uint32_t a = page * PAGE, lo = PAGE, hi = 0, i;
+
+    for (i = 0; i != PAGE; i++) {
+        if (target[a + i] != from[a + i]) {
+            if (lo == PAGE)
+                lo = i;
+            hi = i + 1;
+        }
+    }
+    *start = lo;
+
+    return lo == PAGE ? 0 : hi - lo;
+}
+
+
+static void Classify(void)
+{
+    static uint8_t ff[FLASH_SIZE];
+    uint32_t s, p, i, a, start;
+
+    memset(ff, 0xFF, sizeof(ff));
+    for (s = 0; s != NSECT; s++) {
+        Sect *c = &sect[s];
+
+        for (i = 0; i != SECT; i++) {
+            a = s * SECT + i;
+            if (img.def[a]) {
+                c->touched = 1;
+                if (img.data[a] & ~prev.data[a])
+                    c->need = 1;
+            }
+            /* unknown old content: the image bytes and erased elsewhere */
+            target[a] = img.def[a] ? img.data[a] : (old_known ? prev.data[a] : 0xFF);
+        }
+        if (!old_known)
+            c->need = c->touched;
+        c->erasable = old_known || c->touched;
+
+        for (p = s * SPS; p != (s + 1) * SPS; p++) {
+            if (!c->need)
+                c->keep_ns += ProgNs(Span(p, prev.data, &start));
+            c->fresh_ns += ProgNs(Span(p, ff, &start));
+        }
+    }
+}
+
+
+static double SectBest(uint32_t s)
+{
+    const Sect *c = &sect[s];
+
+    if (c->need)
+        return OpNs(0x20, 0) + c->fresh_ns;
+
+    return c->keep_ns;
+}
+
+
+static int RangeErasable(uint32_t s, uint32_t n, double *fresh)
+{
+    uint32_t i;
+
+    *fresh = 0;
+    for (i = s; i != s + n; i++) {
+        if (!sect[i].erasable)
+            return 0;
+        *fresh += sect[i].fresh_ns;
+    }
+
+    return 1;
+}
+
+
+static void AddOp(uint8_t op, uint32_t addr, uint32_t len)
+{
+    static uint32_t cap;
+
+    if (nops == cap) {
+        cap = cap ? 2 * cap : 256;
+        ops = realloc(ops, cap * sizeof(*ops));
+    }
+    memset(&ops[nops], 0, sizeof(ops[0]));
+    ops[nops].op = op;
+    ops[nops].addr = addr;
+    ops[nops].len = len;
+    nops++;
+}
+
+
+static void Erase(uint8_t op, uint32_t s, uint32_t n)
+{
+    AddOp(op, s * SECT, 0);
+    memset(erased + s, 1, n);
+}
+
+
+/* erase choice per 64K block, lowest modeled time wins */
+static void PlanErases(void)
+{
+    double total = 0, best, t, fresh, half[2];
+    uint32_t b, h, s, choice, hchoice[2];
+
+    for (b = 0; b != NSECT / 16; b++) {
+        for (h = 0; h != 2; h++) {
+            s = b * 16 + h * 8;
+            for (half[h] = 0; s != b * 16 + h * 8 + 8; s++)
+                half[h] += SectBest(s);
+            hchoice[h] = 0;
+            s = b * 16 + h * 8;
+            if (RangeErasable(s, 8, &fresh) && (t = OpNs(0x52, 0) + fresh) < half[h]) {
+                half[h] = t;
+                hchoice[h] = 1;
+            }
+        }
+        best = half[0] + half[1];
+        choice = 0;
+        if (RangeErasable(b * 16, 16, &fresh) && (t = OpNs(0xD8, 0) + fresh) < best) {
+            best = t;
+            choice = 1;
+        }
+
+        if (choice) {
+            Erase(DQSPI_PLAN_ERASE_64K, b * 16, 16);
+        }
+        else {
+            for (h = 0; h != 2; h++) {
+                s = b * 16 + h * 8;
+                if (hchoice[h]) {
+                    Erase(DQSPI_PLAN_ERASE_32K, s, 8);
+                    continue;
+                }
+                for (; s != b * 16 + h * 8 + 8; s++) {
+                    if (sect[s].need)
+                        Erase(DQSPI_PLAN_ERASE_4K, s, 1);
+                }
+            }
+        }
+        total += best;
+    }
+
+    /* one chip erase when everything is erased anyway and it is cheaper */
+    if (RangeErasable(0, NSECT, &fresh) && (t = OpNs(0xC7, 0) + fresh) < total) {
+        nops = 0;
+        Erase(DQSPI_PLAN_ERASE_CHIP, 0, NSECT);
+    }
+}
+
+
+/* programs after the erases, adjacent spans merged into one op */
+static void PlanPrograms(uint32_t *pages, uint32_t *skipped)
+{
+    uint32_t p, start, len, a, last_end = 0;
+    int open = 0;
+
+    *pages = *skipped = 0;
+    plan_data = malloc(FLASH_SIZE);
+    data_len = 0;
+
+    for (p = 0; p != FLASH_SIZE / PAGE; p++) {
+        a = p * PAGE;
+        if (erased[a / SECT]) {
+            /* compare against an erased page */
+            for (start = 0; start != PAGE && target[a + start] == 0xFF; start++)
+                ;
+            for (len = PAGE; len > start && target[a + len - 1] == 0xFF; len--)
+                ;
+            len -= start;
+        }
+        else {
+            len = Span(p, prev.data, &start);
+        }
+        if (len == 0) {
+            if (memchr(img.def + a, 1, PAGE) != NULL)
+                (*skipped)++;
+            open = 0;
+            continue;
+        }
+        (*pages)++;
+        if (open && last_end == a + start)
+            ops[nops - 1].len += len;
+        else
+            AddOp(DQSPI_PLAN_PROGRAM, a + start, len);
+        memcpy(plan_data + data_len, target + a + start, len);
+        data_len += len;
+        last_end = a + start + len;
+        open = start + len == PAGE;
+    }
+}
+
+
+/* apply the plan to the old content, it must give the target */
+static int Check(void)
+{
+    uint8_t *m = malloc(FLASH_SIZE);
+    uint32_t i, j, d = 0, sz;
+    int ok;
+
+    memcpy(m, prev.data, FLASH_SIZE);
+    for (i = 0; i != nops; i++) {
+        switch (ops[i].op) {
+        case DQSPI_PLAN_PROGRAM:
+            for (j = 0; j != ops[i].len; j++)
+                m[ops[i].addr + j] &= plan_data[d + j];
+            d += ops[i].len;
+            continue;
+        case DQSPI_PLAN_ERASE_4K:
+            sz = SECT;
+            break;
+        case DQSPI_PLAN_ERASE_32K:
+            sz = 0x8000;
+            break;
+        case DQSPI_PLAN_ERASE_64K:
+            sz = 0x10000;
+            break;
+        default:
+            sz = FLASH_SIZE;
+            break;
+        }
+        memset(m + ops[i].addr, 0xFF, sz);
+    }
+    ok = 1;
+    for (i = 0; i != FLASH_SIZE && ok; i++) {
+        /* with unknown old content only the image bytes are promised */
+        if (old_known || img.def[i])
+            ok = m[i] == target[i];
+    }
+    free(m);
+
+    return ok;
+}
+
+
+/* what CubeProgrammer does: erase the Dev_Inf sectors the image touches,
+ * write every image byte */
+static double Naive(void)
+{
+    uint32_t ssz = StorageInfo.sectors[0].SectorSize, s, p, lo, hi, i, a;
+    double t = 0;
+
+    for (s = 0; s != FLASH_SIZE / ssz; s++) {
+        for (i = 0; i != ssz && !img.def[s * ssz + i]; i++)
+            ;
+        if (i != ssz)
+            t += OpNs(ssz == 0x10000 ? 0xD8 : ssz == 0x8000 ? 0x52 : 0x20, 0);
+    }
+    for (p = 0; p != FLASH_SIZE / PAGE; p++) {
+        for (lo = PAGE, hi = 0, i = 0; i != PAGE; i++) {
+            a = p * PAGE + i;
+            if (img.def[a]) {
+                lo = lo == PAGE ? i : lo;
+                hi = i + 1;
+            }
+        }
+        if (lo != PAGE)
+            t += ProgNs(hi - lo);
+    }
+
+    return t;
+}
+
+
+static int WritePlan(const char *name, const DQSpiPlanOp *o, uint32_t n, const uint8_t *d, uint32_t len)
+{
+    DQSpiPlanHdr hdr = {0};
+    uint32_t crc;
+    FILE *f;
+
+    crc = DQSpiCrc32(0, (const uint8_t *)o, n * sizeof(*o));
+    crc = DQSpiCrc32(crc, d, len);
+    hdr.magic = DQSPI_PLAN_MAGIC;
+    hdr.version = DQSPI_PLAN_VERSION;
+    hdr.count = n;
+    hdr.data_len = len;
+    hdr.crc = crc;
+
+    f = fopen(name, "wb");
+    if (f == NULL) {
+        perror(name);
+        return -1;
+    }
+    if (fwrite(&hdr, sizeof(hdr), 1, f) != 1 ||
+        fwrite(o, sizeof(*o), n, f) != n ||
+        fwrite(d, 1, len, f) != len) {
+        fprintf(stderr, "%s: write error\n", name);
+        fclose(f);
+        return -1;
+    }
+    fclose(f);
+
+    return 0;
+}
+
+
+/* plans of at most max bytes, in the order of the ops: cut between ops,
+ * a program that does not fit at a page boundary (the data is in op
+ * order, each plan takes the next slice of it) */
+static int WriteSplit(const char *name, uint32_t max)
+{
+    DQSpiPlanOp *part = malloc((max - sizeof(DQSpiPlanHdr)) / sizeof(DQSpiPlanOp) * sizeof(*part));
+    char *fn = malloc(strlen(name) + 16);
+    uint32_t i, n = 0, len = 0, d0 = 0, files = 0, a, rem, c, used;
+
+    if (part == NULL || fn == NULL)
+        return -1;
+
+    for (i = 0; i != nops; i++) {
+        a = ops[i].addr;
+        rem = ops[i].op == DQSPI_PLAN_PROGRAM ? ops[i].len : 0;
+        do {
+            used = sizeof(DQSpiPlanHdr) + (n + 1) * sizeof(DQSpiPlanOp) + len;
+            /* a program takes a page at least, or its end */
+            if (n != 0 && (used > max || (rem != 0 && max - used < (rem < PAGE ? rem : PAGE)))) {
+                sprintf(fn, "%s.%03u", name, (unsigned)files++);
+                if (WritePlan(fn, part, n, plan_data + d0, len) != 0)
+                    return -1;
+                d0 += len;
+                n = len = 0;
+                used = sizeof(DQSpiPlanHdr) + sizeof(DQSpiPlanOp);
+            }
+            part[n] = ops[i];
+            if (rem != 0) {
+                c = max - used;
+                if (c < rem) {
+                    /* the next plan starts the page */
+                    if ((a + c) % PAGE < c)
+                        c -= (a + c) % PAGE;
+                }
+                else {
+                    c = rem;
+                }
+                part[n].addr = a;
+                part[n].len = c;
+                a += c;
+                rem -= c;
+                len += c;
+            }
+            n++;
+        } while (rem != 0);
+    }
+    if (n != 0) {
+        sprintf(fn, "%s.%03u", name, (unsigned)files++);
+        if (WritePlan(fn, part, n, plan_data + d0, len) != 0)
+            return -1;
+    }
+    printf("plan %s.000..%03u: %u plans of at most %u bytes\n", name, (unsigned)(files - 1), (unsigned)files,
+           (unsigned)max);
+    free(part);
+    free(fn);
+
+    return 0;
+}
+
+
+int main(int argc, char *argv[])
+{
+    static const char *op_name[] = { "", "erase 4K", "erase 32K", "erase 64K", "erase chip", "program" };
+    char *prev_name = NULL, *out = NULL;
+    uint32_t cnt[6] = {0}, pages, skipped, i, max = 0;
+    double erase_ns, prog_ns, naive_ns;
+    int opt, blank = 0, verbose = 0;
+
+    timing.timing = W25Q_SIM_TYP;
+    while ((opt = getopt(argc, argv, "p:bo:s:mv")) != -1) {
+        switch (opt) {
+        case 'p':
+            prev_name = optarg;
+            break;
+        case 'b':
+            blank = 1;
+            break;
+        case 'o':
+            out = optarg;
+            break;
+        case 's':
+            max = strtoul(optarg, NULL, 0);
+            break;
+        case 'm':
+            timing.timing = W25Q_SIM_MAX;
+            break;
+        case 'v':
+            verbose = 1;
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-p prev | -b] [-o plan.bin] [-s max_bytes] [-m] [-v] image\n", argv[0]);
+            return 2;
+        }
+    }
+    if (optind != argc - 1 || (prev_name != NULL && blank) ||
+        (max != 0 && (out == NULL || max < sizeof(DQSpiPlanHdr) + sizeof(DQSpiPlanOp) + PAGE))) {
+        fprintf(stderr, "usage: %s [-p prev | -b] [-o plan.bin] [-s max_bytes] [-m] [-v] image\n", argv[0]);
+        return 2;
+    }
+
+    if (Load(&img, argv[optind]) != 0)
+        return 1;
+    if (prev_name != NULL) {
+        if (Load(&prev, prev_name) != 0)
+            return 1;
+    }
+    else {
+        prev.data = malloc(FLASH_SIZE);
+        prev.def = calloc(FLASH_SIZE, 1);
+        if (prev.data == NULL || prev.def == NULL)
+            return 1;
+        /* unknown content is planned as if erased, every touched sector
+         * gets erased anyway */
+        memset(prev.data, 0xFF, FLASH_SIZE);
+    }
+    old_known = prev_name != NULL || blank;
+    target = malloc(FLASH_SIZE);
+    if (target == NULL)
+        return 1;
+
+    Classify();
+    PlanErases();
+    for (i = 0, erase_ns = 0; i != nops; i++) {
+        uint8_t op = ops[i].op;
+
+        erase_ns += OpNs(op == DQSPI_PLAN_ERASE_4K ? 0x20 : op == DQSPI_PLAN_ERASE_32K ? 0x52 :
+                         op == DQSPI_PLAN_ERASE_64K ? 0xD8 : 0xC7, 0);
+    }
+    PlanPrograms(&pages, &skipped);
+    for (i = 0, prog_ns = 0; i != nops; i++) {
+        cnt[ops[i].op]++;
+        if (ops[i].op == DQSPI_PLAN_PROGRAM) {
+            /* DQSpiWrite() splits at page boundaries */
+            uint32_t a = ops[i].addr, end = a + ops[i].len, n;
+
+            for (; a != end; a += n) {
+                n = PAGE - (a % PAGE);
+                n = n < end - a ? n : end - a;
+                prog_ns += ProgNs(n);
+            }
+        }
+    }
+    naive_ns = Naive();
+
+    if (verbose) {
+        for (i = 0; i != nops; i++)
+            printf("%-10s 0x%06X %6u\n", op_name[ops[i].op], (unsigned)ops[i].addr, (unsigned)ops[i].len);
+    }
+    printf("image %u bytes, device %s\n", (unsigned)img.bytes,
+           prev_name != NULL ? "content known" : blank ? "blank" : "content unknown");
+    printf("erase 4K x%u 32K x%u 64K x%u chip x%u, program %u pages (%u bytes), %u image pages unchanged\n",
+           (unsigned)cnt[1], (unsigned)cnt[2], (unsigned)cnt[3], (unsigned)cnt[4],
+           (unsigned)pages, (unsigned)data_len, (unsigned)skipped);
+    printf("estimate %s: erase %.1f ms + program %.1f ms = %.1f ms, full reprogram (%u KB sectors) %.1f ms\n",
+           timing.timing == W25Q_SIM_TYP ? "typ" : "max", erase_ns / 1e6, prog_ns / 1e6,
+           (erase_ns + prog_ns) / 1e6, (unsigned)(StorageInfo.sectors[0].SectorSize / 1024), naive_ns / 1e6);
+
+    if (!Check()) {
+        fprintf(stderr, "qplan: internal error, the plan does not produce the image\n");
+        return 1;
+    }
+    if (out != NULL && max != 0) {
+        if (WriteSplit(out, max) != 0)
+            return 1;
+    }
+    else if (out != NULL) {
+        if (WritePlan(out, ops, nops, plan_data, data_len) != 0)
+            return 1;
+        printf("plan %s: %u ops, %u bytes\n", out, (unsigned)nops,
+               (unsigned)(sizeof(DQSpiPlanHdr) + nops * sizeof(*ops) + data_len));
+    }
+
+    return 0;
+}
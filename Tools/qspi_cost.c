@@ -0,0 +1,43 @@
+/*
+ * QUADSPI bus cost model, see qspi_cost.h
+ */
+
+#include "qspi_cost.h"
+
+
+static uint32_t Lines(uint32_t mode)
+{
+    return mode == 3 ? 4 : mode;
+}
+
+
+static uint32_t Clocks(uint32_t bits, uint32_t lines)
+{
+    return lines ? (bits + lines - 1) / lines : 0;
+}
+
+
+void QCostPhases(const QCostCfg *cfg, const QSPI_CommandTypeDef *cmd, uint32_t len, int first, QCostClk *clk)
+{
+    uint32_t sioo = cmd->SIOOMode == QSPI_SIOO_INST_ONLY_FIRST_CMD;
+
+    clk->instr = (first || !sioo) ? Clocks(8, Lines((cmd->InstructionMode >> 8) & 3)) : 0;
+    clk->addr = Clocks((((cmd->AddressSize >> 12) & 3) + 1) * 8, Lines((cmd->AddressMode >> 10) & 3));
+    clk->alt = Clocks((((cmd->AlternateBytesSize >> 16) & 3) + 1) * 8, Lines((cmd->AlternateByteMode >> 14) & 3));
+    clk->dummy = cmd->DummyCycles;
+    clk->data = Clocks(len * 8, Lines((cmd->DataMode >> 24) & 3));
+    clk->cs_high = ((cfg->cs_high >> 8) & 7) + 1;
+    clk->total = clk->instr + clk->addr + clk->alt + clk->dummy + clk->data + clk->cs_high;
+}
+
+
+uint64_t QCostNs(const QCostCfg *cfg, uint64_t clk)
+{
+    return clk * (cfg->prescaler + 1) * 1000000000ULL / cfg->hclk;
+}
+
+
+double QCostCpuCycles(const QCostCfg *cfg, uint64_t clk, uint32_t cpu_hz)
+{
+    return (double)clk * (cfg->prescaler + 1) * cpu_hz / cfg->hclk;
+}
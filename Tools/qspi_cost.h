@@ -0,0 +1,42 @@
+/*
+ * QUADSPI bus cost model: exact clock counts of one command, phase by
+ * phase, as the STM32F7 controller sequences them (SDR only).
+ *
+ * Shared by the HAL shim (virtual bus time) and qcost (estimator).
+ */
+
+#ifndef __QSPI_COST_H__
+#define __QSPI_COST_H__
+
+#include <stdint.h>
+
+#include "stm32f7xx_hal.h"
+
+
+/* controller settings of MX_QUADSPI_Init() that change the bus time */
+typedef struct {
+    uint32_t hclk;          /* Hz, QUADSPI kernel clock */
+    uint32_t prescaler;     /* Init.ClockPrescaler, CLK = hclk / (prescaler + 1) */
+    uint32_t cs_high;       /* Init.ChipSelectHighTime */
+} QCostCfg;
+
+/* bus clocks of one nCS low..high transaction */
+typedef struct {
+    uint32_t instr;
+    uint32_t addr;
+    uint32_t alt;
+    uint32_t dummy;
+    uint32_t data;
+    uint32_t cs_high;       /* minimum nCS high time before the next command */
+    uint32_t total;
+} QCostClk;
+
+
+/* first: 0 when SIOO lets the controller skip the instruction (memory-
+ * mapped mode after the first access) */
+void QCostPhases(const QCostCfg *cfg, const QSPI_CommandTypeDef *cmd, uint32_t len, int first, QCostClk *clk);
+uint64_t QCostNs(const QCostCfg *cfg, uint64_t clk);
+double QCostCpuCycles(const QCostCfg *cfg, uint64_t clk, uint32_t cpu_hz);
+
+
+#endif
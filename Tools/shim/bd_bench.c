@@ -0,0 +1,149 @@
+/*
+ * Host benchmark of the wear-leveled block device (Inc/dqspi_bd.h) on the
+ * flash model: every block is written once, then a few hot blocks are
+ * erased and programmed over and over. The erase counts show how the
+ * static leveling spreads the wear; every block is read back against its
+ * last content, before and after a remount.
+ *
+ *   bd_bench [-i image] [-m] [-n cycles] [-h hot]
+ *
+ *   -n        erase+program cycles of the hot blocks, default 3000
+ *   -h        hot blocks, written in turn, default 2
+ *   -m        datasheet worst-case program/erase times
+ *
+ * The geometry and thresholds are the driver's: build with e.g.
+ * make LOADER_DEFS="-DDQSPI_BD_SECTORS=32 -DDQSPI_BD_STATIC_THRESHOLD=50"
+ * (make clean first) to see static moves within a short run.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "dqspi.h"
+#include "dqspi_bd.h"
+#include "shim.h"
+
+
+int Init(void);
+
+static uint32_t gen[DQSPI_BD_BLOCKS];   /* content written last, 0: never */
+
+
+/* content of a block for a generation */
+static void Fill(uint8_t *dat, uint32_t block, uint32_t g)
+{
+    uint32_t i, x = block * 0x9E3779B9 ^ g;
+
+    for (i = 0; i != DQSPI_BD_BLOCK_SIZE; i++) {
+        x = x * 1103515245 + 12345;
+        dat[i] = (uint8_t)(x >> 16);
+    }
+}
+
+
+static int Write(uint8_t *dat, uint32_t block, uint32_t g)
+{
+    Fill(dat, block, g);
+    if (DQSpiBdErase(block) != 0 || DQSpiBdProg(block, 0, dat, DQSPI_BD_BLOCK_SIZE) != 0 || DQSpiBdSync() != 0)
+        return -1;
+    gen[block] = g;
+
+    return 0;
+}
+
+
+static int Check(uint8_t *dat, uint8_t *rd)
+{
+    uint32_t b;
+
+    for (b = 0; b != DQSPI_BD_BLOCKS; b++) {
+        Fill(dat, b, gen[b]);
+        if (DQSpiBdRead(b, 0, rd, DQSPI_BD_BLOCK_SIZE) != 0 || memcmp(dat, rd, DQSPI_BD_BLOCK_SIZE) != 0)
+            return 0;
+    }
+
+    return 1;
+}
+
+
+int main(int argc, char *argv[])
+{
+    const char *image = NULL;
+    W25qSimTiming timing = W25Q_SIM_TYP;
+    uint32_t cycles = 3000, hot = 2, i, b, g = 0, ec_min, ec_max, moves;
+    uint64_t t0, t;
+    uint8_t *dat, *rd;
+    int opt, ok;
+
+    while ((opt = getopt(argc, argv, "i:mn:h:")) != -1) {
+        switch (opt) {
+        case 'i':
+            image = optarg;
+            break;
+        case 'm':
+            timing = W25Q_SIM_MAX;
+            break;
+        case 'n':
+            cycles = strtoul(optarg, NULL, 0);
+            break;
+        case 'h':
+            hot = strtoul(optarg, NULL, 0);
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-i image] [-m] [-n cycles] [-h hot]\n", argv[0]);
+            return 2;
+        }
+    }
+    if (optind != argc || hot == 0 || hot > DQSPI_BD_BLOCKS) {
+        fprintf(stderr, "usage: %s [-i image] [-m] [-n cycles] [-h hot]\n", argv[0]);
+        return 2;
+    }
+
+    if (ShimOpen(image, timing) != 0 || Init() != 1) {
+        fprintf(stderr, "%s: Init() failed\n", argv[0]);
+        return 1;
+    }
+    dat = ShimAlloc32(DQSPI_BD_BLOCK_SIZE);
+    rd = ShimAlloc32(DQSPI_BD_BLOCK_SIZE);
+    if (dat == NULL || rd == NULL || DQSpiBdMount() != 0) {
+        fprintf(stderr, "%s: DQSpiBdMount() failed\n", argv[0]);
+        return 1;
+    }
+
+    t0 = ShimNow();
+    for (b = 0; b != DQSPI_BD_BLOCKS; b++) {
+        if (Write(dat, b, ++g) != 0) {
+            fprintf(stderr, "%s: writing block %u failed\n", argv[0], (unsigned)b);
+            return 1;
+        }
+    }
+    /* the first blocks are the hot ones */
+    for (i = 0; i != cycles; i++) {
+        b = i % hot;
+        if (Write(dat, b, ++g) != 0) {
+            fprintf(stderr, "%s: cycle %u, block %u failed\n", argv[0], (unsigned)i, (unsigned)b);
+            return 1;
+        }
+    }
+    t = ShimNow() - t0;
+
+    DQSpiBdStats(&ec_min, &ec_max, &moves);
+    printf("%u sectors, %u blocks of %u bytes, static threshold %u\n", (unsigned)DQSPI_BD_SECTORS,
+           (unsigned)DQSPI_BD_BLOCKS, (unsigned)DQSPI_BD_BLOCK_SIZE, (unsigned)DQSPI_BD_STATIC_THRESHOLD);
+    printf("%u cycles over %u hot blocks in %.1f s: erase counts %u..%u, %u static moves, %llu sector erases\n",
+           (unsigned)cycles, (unsigned)hot, t / 1e9, (unsigned)ec_min, (unsigned)ec_max, (unsigned)moves,
+           (unsigned long long)ShimFlash()->stats.erase_4k);
+
+    ok = Check(dat, rd);
+    printf("read back: %s\n", ok ? "ok" : "MISMATCH");
+    ok = ok && DQSpiBdMount() == 0 && Check(dat, rd);
+    DQSpiBdStats(&ec_min, &ec_max, NULL);
+    printf("remount: erase counts %u..%u%s\n", (unsigned)ec_min, (unsigned)ec_max, ok ? ", verify ok" : ", verify MISMATCH");
+    ShimFree32(dat, DQSPI_BD_BLOCK_SIZE);
+    ShimFree32(rd, DQSPI_BD_BLOCK_SIZE);
+    ShimClose();
+
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,618 @@
+/*
+ * HAL QSPI shim: QSPI_CommandTypeDef descriptors are turned into bus
+ * transactions against the W25Q32FV model, and the virtual clock moves
+ * by the bus time of each one. The memory-mapped window is a real
+ * mapping at DQSPI_MAP_ADDR, readable only while the controller is in
+ * memory-mapped mode, so a stray XIP access faults like on the target.
+ *
+ * A DMA transmit or a background status poll leaves one QUADSPI
+ * interrupt pending: the clock runs its callback at the time it is due,
+ * as an ISR preempting whatever the caller was doing.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "main.h"
+#include "dqspi.h"
+#include "shim.h"
+#include "qspi_cost.h"
+
+
+#ifndef MAP_FIXED_NOREPLACE
+#define MAP_FIXED_NOREPLACE  0x100000
+#endif
+
+/* CPU time of one HAL_QSPI_xxx call, register setup and FIFO handling */
+#define SHIM_HAL_NS          500
+/* CPU time of one DWT/tick access in polling loops */
+#define SHIM_POLL_NS         50
+
+QSPI_HandleTypeDef hqspi;
+uint32_t g_pfnVectors;
+/* the loader .bss that Init() clears: empty, the driver state is the
+ * process's and carries over from one Init() to the next */
+uint32_t __bss_start__[1];
+extern uint32_t __bss_end__[1] __attribute__((alias("__bss_start__")));
+uint32_t SystemCoreClock = SHIM_CPU_HZ;
+
+SCB_Type ShimScb;
+CoreDebug_Type ShimCoreDebug;
+ITM_Type ShimItm;
+
+static DWT_Type dwt;
+static W25qSim flash;
+static uint64_t now;
+static uint8_t *win;
+
+static void (*tick_hook)(uint64_t now);
+
+static QSPI_CommandTypeDef pend;
+static uint8_t pend_valid;
+
+#define IRQ_NONE             0
+#define IRQ_TX               1   /* end of HAL_QSPI_Transmit_DMA() */
+#define IRQ_MATCH            2   /* next poll of HAL_QSPI_AutoPolling_IT() */
+
+static struct {
+    uint8_t kind;
+    uint8_t masked;          /* HAL_NVIC_DisableIRQ(QUADSPI_IRQn) */
+    uint8_t active;          /* in the callback: no nesting */
+    uint64_t at;
+    QSPI_CommandTypeDef cmd;
+    QSPI_AutoPollingTypeDef cfg;
+    uint8_t *data;
+} irq;
+
+static void Irq(void);
+
+
+/* ---- virtual clock ---------------------------------------------------- */
+
+static void SetNow(uint64_t t)
+{
+    now = t;
+    W25qSimSetTime(&flash, now);
+    dwt.CYCCNT = (uint32_t)(now * (SHIM_CPU_HZ / 1000000) / 1000);
+    if (tick_hook != NULL)
+        tick_hook(now);
+}
+
+
+/* an interrupt due meanwhile runs at its time, the caller's time goes on
+ * after it */
+static void Tick(uint64_t ns)
+{
+    uint64_t end = now + ns, t;
+
+    while (irq.kind != IRQ_NONE && !irq.masked && !irq.active && irq.at <= end) {
+        if (irq.at > now)
+            SetNow(irq.at);
+        t = now;
+        Irq();
+        end += now - t;
+    }
+    SetNow(end);
+}
+
+
+void ShimSetTickHook(void (*hook)(uint64_t now))
+{
+    tick_hook = hook;
+}
+
+
+uint64_t ShimNow(void)
+{
+    return now;
+}
+
+
+void ShimAdvance(uint64_t ns)
+{
+    Tick(ns);
+}
+
+
+DWT_Type *ShimDwt(void)
+{
+    Tick(SHIM_POLL_NS);
+
+    return &dwt;
+}
+
+
+HAL_StatusTypeDef HAL_Init(void)
+{
+    return HAL_OK;
+}
+
+
+uint32_t HAL_GetTick(void)
+{
+    Tick(SHIM_POLL_NS);
+
+    return (uint32_t)(now / 1000000);
+}
+
+
+void HAL_Delay(uint32_t Delay)
+{
+    Tick((uint64_t)Delay * 1000000);
+}
+
+
+void HAL_SuspendTick(void)
+{
+}
+
+
+void HAL_ResumeTick(void)
+{
+}
+
+
+void HAL_NVIC_EnableIRQ(IRQn_Type IRQn)
+{
+    if (IRQn == QUADSPI_IRQn) {
+        irq.masked = 0;
+        /* pending while masked: taken now */
+        Tick(0);
+    }
+}
+
+
+void HAL_NVIC_DisableIRQ(IRQn_Type IRQn)
+{
+    if (IRQn == QUADSPI_IRQn)
+        irq.masked = 1;
+}
+
+
+void SystemInit(void)
+{
+}
+
+
+void Error_Handler(void)
+{
+    fprintf(stderr, "shim: Error_Handler()\n");
+}
+
+
+/* ---- core peripherals ----------------------------------------------- */
+
+void SCB_EnableICache(void)
+{
+    ShimScb.CCR |= SCB_CCR_IC_Msk;
+}
+
+
+void SCB_EnableDCache(void)
+{
+    ShimScb.CCR |= SCB_CCR_DC_Msk;
+}
+
+
+void SCB_InvalidateICache(void)
+{
+}
+
+
+void SCB_CleanInvalidateDCache(void)
+{
+}
+
+
+void SCB_InvalidateDCache_by_Addr(void *addr, int32_t dsize)
+{
+    (void)addr;
+    (void)dsize;
+}
+
+
+void SCB_CleanDCache_by_Addr(uint32_t *addr, int32_t dsize)
+{
+    (void)addr;
+    (void)dsize;
+}
+
+
+uint32_t ITM_SendChar(uint32_t ch)
+{
+    return ch;
+}
+
+
+void HAL_MPU_Disable(void)
+{
+}
+
+
+void HAL_MPU_Enable(uint32_t MPU_Control)
+{
+    (void)MPU_Control;
+}
+
+
+void HAL_MPU_ConfigRegion(MPU_Region_InitTypeDef *MPU_Init)
+{
+    (void)MPU_Init;
+}
+
+
+/* ---- QSPI ----------------------------------------------------------- */
+
+/* bus time of one transaction, nCS high time included */
+static uint64_t BusNs(const QSPI_CommandTypeDef *cmd, uint32_t len)
+{
+    QCostCfg cfg = { SHIM_CPU_HZ, hqspi.Init.ClockPrescaler, hqspi.Init.ChipSelectHighTime };
+    QCostClk clk;
+
+    QCostPhases(&cfg, cmd, len, 1, &clk);
+
+    return QCostNs(&cfg, clk.total);
+}
+
+
+/* the transaction at the current time, no time spent */
+static int SimXfer(const QSPI_CommandTypeDef *cmd, uint8_t *data, uint32_t len, uint8_t write)
+{
+    W25qXfer x = {0};
+
+    x.instr = (uint8_t)cmd->Instruction;
+    x.has_instr = cmd->InstructionMode != QSPI_INSTRUCTION_NONE;
+    x.addr = cmd->Address;
+    x.addr_bytes = cmd->AddressMode != QSPI_ADDRESS_NONE ? ((cmd->AddressSize >> 12) & 3) + 1 : 0;
+    x.alt = cmd->AlternateBytes;
+    x.alt_bytes = cmd->AlternateByteMode != QSPI_ALTERNATE_BYTES_NONE ? ((cmd->AlternateBytesSize >> 16) & 3) + 1 : 0;
+    x.dummy = (uint8_t)cmd->DummyCycles;
+    x.data = data;
+    x.len = len;
+    x.write = write;
+
+    /* an ignored read returns whatever floats on the bus */
+    if (!write && len != 0)
+        memset(data, 0xFF, len);
+
+    return W25qSimXfer(&flash, &x);
+}
+
+
+static int Xfer(const QSPI_CommandTypeDef *cmd, uint8_t *data, uint32_t len, uint8_t write)
+{
+    Tick(SHIM_HAL_NS + BusNs(cmd, len));
+
+    return SimXfer(cmd, data, len, write);
+}
+
+
+static int Match(const QSPI_AutoPollingTypeDef *cfg, const uint8_t *sr)
+{
+    uint32_t v = 0, i;
+
+    for (i = 0; i != cfg->StatusBytesSize && i != 4; i++)
+        v |= (uint32_t)sr[i] << (8 * i);
+
+    return cfg->MatchMode == QSPI_MATCH_MODE_AND ? (v & cfg->Mask) == cfg->Match
+                                                 : (~(v ^ cfg->Match) & cfg->Mask) != 0;
+}
+
+
+/* time of the poll that can see a change: end of the operation, or of
+ * tSUS/tRES1 */
+static uint64_t PollNext(uint64_t poll_ns)
+{
+    if (W25qSimBusy(&flash) && flash.busy_end > now)
+        return flash.busy_end + poll_ns;
+    if (now < flash.ready_at)
+        return flash.ready_at + poll_ns;
+
+    return now + poll_ns;
+}
+
+
+static uint64_t PollNs(const QSPI_AutoPollingTypeDef *cfg)
+{
+    return (uint64_t)cfg->Interval * (hqspi.Init.ClockPrescaler + 1) * 1000000000ULL / SHIM_CPU_HZ;
+}
+
+
+/* the controller works alone, the CPU only pays for the ISR */
+static void Irq(void)
+{
+    uint8_t sr[4];
+
+    irq.active = 1;
+    switch (irq.kind) {
+    case IRQ_TX:
+        irq.kind = IRQ_NONE;
+        SimXfer(&irq.cmd, irq.data, irq.cmd.NbData, 1);
+        hqspi.State = HAL_QSPI_STATE_READY;
+        Tick(SHIM_HAL_NS);
+        HAL_QSPI_TxCpltCallback(&hqspi);
+        break;
+
+    case IRQ_MATCH:
+        SimXfer(&irq.cmd, sr, irq.cfg.StatusBytesSize, 0);
+        if (!Match(&irq.cfg, sr)) {
+            irq.at = PollNext(PollNs(&irq.cfg));
+            break;
+        }
+        irq.kind = IRQ_NONE;
+        hqspi.State = HAL_QSPI_STATE_READY;
+        Tick(SHIM_HAL_NS);
+        HAL_QSPI_StatusMatchCallback(&hqspi);
+        break;
+    }
+    irq.active = 0;
+}
+
+
+__attribute__((weak)) void HAL_QSPI_TxCpltCallback(QSPI_HandleTypeDef *h)
+{
+    (void)h;
+}
+
+
+__attribute__((weak)) void HAL_QSPI_StatusMatchCallback(QSPI_HandleTypeDef *h)
+{
+    (void)h;
+}
+
+
+HAL_StatusTypeDef HAL_QSPI_Init(QSPI_HandleTypeDef *h)
+{
+    h->State = HAL_QSPI_STATE_READY;
+    h->ErrorCode = 0;
+    pend_valid = 0;
+
+    return HAL_OK;
+}
+
+
+HAL_StatusTypeDef HAL_QSPI_DeInit(QSPI_HandleTypeDef *h)
+{
+    HAL_QSPI_Abort(h);
+    h->State = HAL_QSPI_STATE_RESET;
+
+    return HAL_OK;
+}
+
+
+HAL_StatusTypeDef HAL_QSPI_Command(QSPI_HandleTypeDef *h, QSPI_CommandTypeDef *cmd, uint32_t Timeout)
+{
+    (void)Timeout;
+
+    if (h->State != HAL_QSPI_STATE_READY)
+        return HAL_BUSY;
+
+    if (cmd->DataMode == QSPI_DATA_NONE) {
+        Xfer(cmd, NULL, 0, 0);
+        pend_valid = 0;
+    }
+    else {
+        /* the transfer starts with the data phase */
+        pend = *cmd;
+        pend_valid = 1;
+    }
+
+    return HAL_OK;
+}
+
+
+HAL_StatusTypeDef HAL_QSPI_Transmit(QSPI_HandleTypeDef *h, uint8_t *pData, uint32_t Timeout)
+{
+    (void)Timeout;
+
+    if (h->State != HAL_QSPI_STATE_READY || !pend_valid)
+        return HAL_ERROR;
+    pend_valid = 0;
+    Xfer(&pend, pData, pend.NbData, 1);
+
+    return HAL_OK;
+}
+
+
+HAL_StatusTypeDef HAL_QSPI_Receive(QSPI_HandleTypeDef *h, uint8_t *pData, uint32_t Timeout)
+{
+    (void)Timeout;
+
+    if (h->State != HAL_QSPI_STATE_READY || !pend_valid)
+        return HAL_ERROR;
+    pend_valid = 0;
+    Xfer(&pend, pData, pend.NbData, 0);
+
+    return HAL_OK;
+}
+
+
+HAL_StatusTypeDef HAL_QSPI_Receive_DMA(QSPI_HandleTypeDef *h, uint8_t *pData)
+{
+    (void)h;
+    (void)pData;
+
+    /* no DMA reads on the host, build with DQSPI_STREAM 0 */
+    return HAL_ERROR;
+}
+
+
+/* the data reaches the flash when the transfer ends */
+HAL_StatusTypeDef HAL_QSPI_Transmit_DMA(QSPI_HandleTypeDef *h, uint8_t *pData)
+{
+    if (h->State != HAL_QSPI_STATE_READY || !pend_valid)
+        return HAL_ERROR;
+    pend_valid = 0;
+    Tick(SHIM_HAL_NS);
+
+    irq.cmd = pend;
+    irq.data = pData;
+    irq.at = now + BusNs(&pend, pend.NbData);
+    irq.kind = IRQ_TX;
+    h->State = HAL_QSPI_STATE_BUSY_INDIRECT_TX;
+
+    return HAL_OK;
+}
+
+
+HAL_StatusTypeDef HAL_QSPI_AutoPolling_IT(QSPI_HandleTypeDef *h, QSPI_CommandTypeDef *cmd, QSPI_AutoPollingTypeDef *cfg)
+{
+    if (h->State != HAL_QSPI_STATE_READY)
+        return HAL_BUSY;
+    Tick(SHIM_HAL_NS);
+
+    irq.cmd = *cmd;
+    irq.cfg = *cfg;
+    irq.at = now + BusNs(cmd, cfg->StatusBytesSize);
+    irq.kind = IRQ_MATCH;
+    h->State = HAL_QSPI_STATE_BUSY_AUTO_POLLING;
+
+    return HAL_OK;
+}
+
+
+HAL_StatusTypeDef HAL_QSPI_AutoPolling(QSPI_HandleTypeDef *h, QSPI_CommandTypeDef *cmd, QSPI_AutoPollingTypeDef *cfg, uint32_t Timeout)
+{
+    uint64_t deadline = now + (uint64_t)Timeout * 1000000;
+    uint64_t poll_ns, t;
+    uint8_t sr[4];
+
+    if (h->State != HAL_QSPI_STATE_READY)
+        return HAL_BUSY;
+
+    poll_ns = PollNs(cfg);
+    for (;;) {
+        Xfer(cmd, sr, cfg->StatusBytesSize, 0);
+        if (Match(cfg, sr))
+            return HAL_OK;
+        if (now >= deadline)
+            return HAL_TIMEOUT;
+
+        /* nothing changes until the flash ends its operation: skip the
+         * polls in between, they only cost bus time */
+        if (W25qSimBusy(&flash)) {
+            t = flash.busy_end < deadline ? flash.busy_end : deadline;
+            if (t > now)
+                Tick(t - now);
+        }
+        else if (now < flash.ready_at) {
+            Tick(flash.ready_at - now);
+        }
+        else {
+            Tick(deadline - now);
+        }
+        Tick(poll_ns);
+    }
+}
+
+
+HAL_StatusTypeDef HAL_QSPI_MemoryMapped(QSPI_HandleTypeDef *h, QSPI_CommandTypeDef *cmd, QSPI_MemoryMappedTypeDef *cfg)
+{
+    uint8_t b;
+
+    (void)cfg;
+
+    if (h->State != HAL_QSPI_STATE_READY)
+        return HAL_BUSY;
+
+    /* first fetch puts the flash in continuous read mode if asked */
+    Xfer(cmd, &b, 1, 0);
+
+    mprotect(win, W25Q_SIM_FLASH_SIZE, PROT_READ | PROT_WRITE);
+    memcpy(win, flash.mem, W25Q_SIM_FLASH_SIZE);
+    mprotect(win, W25Q_SIM_FLASH_SIZE, PROT_READ);
+    h->State = HAL_QSPI_STATE_BUSY_MEM_MAPPED;
+
+    return HAL_OK;
+}
+
+
+HAL_StatusTypeDef HAL_QSPI_Abort(QSPI_HandleTypeDef *h)
+{
+    if (h->State == HAL_QSPI_STATE_BUSY_MEM_MAPPED) {
+        mprotect(win, W25Q_SIM_FLASH_SIZE, PROT_NONE);
+    }
+    irq.kind = IRQ_NONE;
+    Tick(SHIM_HAL_NS);
+    pend_valid = 0;
+    if (h->State != HAL_QSPI_STATE_RESET)
+        h->State = HAL_QSPI_STATE_READY;
+
+    return HAL_OK;
+}
+
+
+/* ---- harness side ------------------------------------------------- */
+
+int ShimOpen(const char *image, W25qSimTiming timing)
+{
+    if (W25qSimOpen(&flash, image, timing) != 0)
+        return -1;
+
+    win = mmap((void *)DQSPI_MAP_ADDR, W25Q_SIM_FLASH_SIZE, PROT_NONE,
+               MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0);
+    if (win != (uint8_t *)DQSPI_MAP_ADDR) {
+        fprintf(stderr, "shim: cannot map the QSPI window at 0x%08lX\n", (unsigned long)DQSPI_MAP_ADDR);
+        if (win != MAP_FAILED)
+            munmap(win, W25Q_SIM_FLASH_SIZE);
+        W25qSimClose(&flash);
+        return -1;
+    }
+    memset(&irq, 0, sizeof(irq));
+    SetNow(0);
+
+    return 0;
+}
+
+
+void ShimClose(void)
+{
+    munmap(win, W25Q_SIM_FLASH_SIZE);
+    W25qSimClose(&flash);
+}
+
+
+W25qSim *ShimFlash(void)
+{
+    return &flash;
+}
+
+
+void *ShimAlloc32(size_t len)
+{
+    void *p = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_32BIT, -1, 0);
+
+    return p == MAP_FAILED ? NULL : p;
+}
+
+
+void ShimFree32(void *p, size_t len)
+{
+    munmap(p, len);
+}
+
+
+/* Src/main.c main() up to the peripheral init, clocks and GPIO aside */
+int fw_main(void)
+{
+    DQSpiMpuConfig();
+    HAL_Init();
+
+    hqspi.Instance = QUADSPI;
+    hqspi.Init.ClockPrescaler = 2;
+    hqspi.Init.FifoThreshold = 4;
+    hqspi.Init.SampleShifting = QSPI_SAMPLE_SHIFTING_NONE;
+    hqspi.Init.FlashSize = 21;
+    hqspi.Init.ChipSelectHighTime = QSPI_CS_HIGH_TIME_1_CYCLE;
+    hqspi.Init.ClockMode = QSPI_CLOCK_MODE_0;
+    hqspi.Init.FlashID = QSPI_FLASH_ID_1;
+    hqspi.Init.DualFlash = QSPI_DUALFLASH_DISABLE;
+    if (HAL_QSPI_Init(&hqspi) != HAL_OK) {
+        Error_Handler();
+    }
+
+    return 1;
+}
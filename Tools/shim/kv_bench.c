@@ -0,0 +1,195 @@
+/*
+ * Host benchmark of the key-value store (Inc/dqspi_kv.h) on the flash
+ * model: random updates of a set of keys, then lookups, then a remount
+ * checked against a RAM copy.
+ *
+ *   kv_bench [-i image] [-m] [-g] [-k keys] [-v bytes] [-n puts] [-b batch] [-s seed]
+ *
+ *   -k        distinct keys, default 64
+ *   -v        value size, default 8 (counters)
+ *   -n        puts, default 20000
+ *   -b        puts per DQSpiKvPutBatch(), default 1
+ *   -g        DQSpiKvPoll() after every batch, as an idle loop would:
+ *             compaction and erases leave the put path
+ *   -m        datasheet worst-case program/erase times
+ *
+ * Write amplification is flash bytes programmed over the key and value
+ * bytes of the puts, from the flash model counters. Reads through the
+ * XIP window take no modeled time, the mount after Init() is not timed.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "dqspi.h"
+#include "dqspi_kv.h"
+#include "shim.h"
+
+
+#define BENCH_KEYS_MAX       1024
+#define BENCH_BATCH_MAX      32
+
+int Init(void);
+
+static char keys[BENCH_KEYS_MAX][16];
+static uint8_t model[BENCH_KEYS_MAX][DQSPI_KV_VALUE_MAX];
+
+
+static int Check(uint32_t nkeys, uint32_t vlen)
+{
+    uint8_t val[DQSPI_KV_VALUE_MAX];
+    uint16_t n;
+    uint32_t k;
+
+    for (k = 0; k != nkeys; k++) {
+        if (DQSpiKvGet(keys[k], val, sizeof(val), &n) != 0 || n != vlen || memcmp(val, model[k], vlen) != 0)
+            return 0;
+    }
+
+    return 1;
+}
+
+
+int main(int argc, char *argv[])
+{
+    const char *image = NULL;
+    W25qSimTiming timing = W25Q_SIM_TYP;
+    uint32_t nkeys = 64, vlen = 8, nputs = 20000, batch = 1, c, i, j, k, done, seed = 1;
+    uint64_t t0, t, put_ns = 0, put_max = 0, poll_ns = 0, get_ns, prog0, erase0;
+    DQSpiKvPut p[BENCH_BATCH_MAX];
+    const W25qSimStats *st;
+    const uint8_t *v;
+    DQSpiKvInfo info;
+    int opt, gc = 0, ok;
+    uint16_t n;
+
+    while ((opt = getopt(argc, argv, "i:mgk:v:n:b:s:")) != -1) {
+        switch (opt) {
+        case 'i':
+            image = optarg;
+            break;
+        case 'm':
+            timing = W25Q_SIM_MAX;
+            break;
+        case 'g':
+            gc = 1;
+            break;
+        case 'k':
+            nkeys = strtoul(optarg, NULL, 0);
+            break;
+        case 'v':
+            vlen = strtoul(optarg, NULL, 0);
+            break;
+        case 'n':
+            nputs = strtoul(optarg, NULL, 0);
+            break;
+        case 'b':
+            batch = strtoul(optarg, NULL, 0);
+            break;
+        case 's':
+            seed = strtoul(optarg, NULL, 0);
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-i image] [-m] [-g] [-k keys] [-v bytes] [-n puts] [-b batch] [-s seed]\n", argv[0]);
+            return 2;
+        }
+    }
+    if (optind != argc || nkeys == 0 || nkeys > BENCH_KEYS_MAX || vlen < 4 || vlen > DQSPI_KV_VALUE_MAX ||
+        batch == 0 || batch > BENCH_BATCH_MAX) {
+        fprintf(stderr, "usage: %s [-i image] [-m] [-g] [-k keys] [-v bytes] [-n puts] [-b batch] [-s seed]\n", argv[0]);
+        return 2;
+    }
+    srand(seed);
+
+    if (ShimOpen(image, timing) != 0 || Init() != 1) {
+        fprintf(stderr, "%s: Init() failed\n", argv[0]);
+        return 1;
+    }
+    st = &ShimFlash()->stats;
+
+    if (DQSpiKvMount() != 0) {
+        fprintf(stderr, "%s: DQSpiKvMount() failed\n", argv[0]);
+        return 1;
+    }
+    /* an idle loop would have erased the free sectors by now */
+    for (k = 0; gc && k != DQSPI_KV_SECTORS; k++)
+        DQSpiKvPoll();
+
+    /* the image may hold keys from an earlier run */
+    for (k = 0; k != nkeys; k++) {
+        snprintf(keys[k], sizeof(keys[k]), "key%u", (unsigned)k);
+        if (DQSpiKvGet(keys[k], model[k], DQSPI_KV_VALUE_MAX, &n) != 0 || n != vlen)
+            memset(model[k], 0, vlen);
+    }
+
+    prog0 = st->bytes_prog;
+    erase0 = st->erase_4k;
+    for (done = 0; done < nputs; done += batch) {
+        for (j = 0; j != batch; j++) {
+            k = rand() % nkeys;
+            /* a counter, then bytes that follow it */
+            memcpy(&c, model[k], 4);
+            c++;
+            memcpy(model[k], &c, 4);
+            for (i = 4; i != vlen; i++)
+                model[k][i] = model[k][0] + i;
+            p[j].key = keys[k];
+            p[j].val = model[k];
+            p[j].vlen = vlen;
+        }
+
+        t = ShimNow();
+        if (DQSpiKvPutBatch(p, batch) != 0) {
+            fprintf(stderr, "%s: DQSpiKvPutBatch() failed after %u puts\n", argv[0], (unsigned)done);
+            return 1;
+        }
+        t = ShimNow() - t;
+        put_ns += t;
+        if (t > put_max)
+            put_max = t;
+
+        if (gc) {
+            t = ShimNow();
+            if (DQSpiKvPoll() != 0) {
+                fprintf(stderr, "%s: DQSpiKvPoll() failed\n", argv[0]);
+                return 1;
+            }
+            poll_ns += ShimNow() - t;
+        }
+    }
+
+    DQSpiKvStats(&info);
+    printf("%u puts of %u keys, %u + %u bytes, batches of %u%s\n", (unsigned)done, (unsigned)nkeys,
+           (unsigned)strlen(keys[nkeys - 1]), (unsigned)vlen, (unsigned)batch, gc ? ", compaction in DQSpiKvPoll()" : "");
+    printf("puts %.3f ms, %.0f puts/s, %.1f us average, %.3f ms worst batch\n", put_ns / 1e6,
+           done * 1e9 / put_ns, put_ns / 1e3 / done, put_max / 1e6);
+    if (gc)
+        printf("poll %.3f ms, %.0f puts/s with it\n", poll_ns / 1e6, done * 1e9 / (put_ns + poll_ns));
+    printf("programmed %llu bytes for %u: write amplification %.2f, %llu sector erases, %u records copied\n",
+           (unsigned long long)(st->bytes_prog - prog0), (unsigned)info.user_bytes,
+           (double)(st->bytes_prog - prog0) / info.user_bytes, (unsigned long long)(st->erase_4k - erase0),
+           (unsigned)info.copies);
+
+    /* lookups: one read each, then the zero-copy path */
+    t0 = ShimNow();
+    ok = Check(nkeys, vlen);
+    get_ns = ShimNow() - t0;
+    printf("get %.2f us average%s\n", get_ns / 1e3 / nkeys, ok ? "" : ", MISMATCH");
+    for (k = 0; k != nkeys && ok; k++) {
+        v = DQSpiKvMap(keys[k], &n);
+        ok = v != NULL && n == vlen && memcmp(v, model[k], vlen) == 0;
+        if (v != NULL)
+            DQSpiUnmap(v);
+    }
+    printf("map %s\n", ok ? "ok" : "MISMATCH");
+
+    ok = ok && DQSpiKvMount() == 0 && Check(nkeys, vlen);
+    DQSpiKvStats(&info);
+    printf("remount: %u keys, %u live bytes, %u free sectors%s\n", (unsigned)info.keys,
+           (unsigned)info.live, (unsigned)info.free, ok ? ", verify ok" : ", verify MISMATCH");
+    ShimClose();
+
+    return ok ? 0 : 1;
+}
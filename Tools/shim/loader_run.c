@@ -0,0 +1,172 @@
+/*
+ * Run the external loader entry points on the host, against the flash
+ * model, and report the virtual time of every call.
+ *
+ *   loader_run [-i image] [-m] [-c chunk] cmd...
+ *
+ *   init                       Init()
+ *   write ADDR FILE            Write() of FILE, in -c sized calls
+ *   erase START END            SectorErase()
+ *   mass                       MassErase()
+ *   plan FILE                  Plan() of a Tools/qplan plan
+ *   verify ADDR FILE           compare the flash array with FILE
+ *
+ * -m uses the datasheet worst-case program/erase times. Addresses are
+ * loader addresses (0x90000000 based) like CubeProgrammer passes them.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "dqspi.h"
+#include "shim.h"
+
+
+int Init(void);
+int Write(uint32_t Address, uint32_t Size, uint32_t Buffer);
+int SectorErase(uint32_t EraseStartAddress, uint32_t EraseEndAddress);
+int MassErase(void);
+int Plan(uint32_t Buffer, uint32_t Size);
+
+
+static uint8_t *Load(const char *name, uint32_t *len)
+{
+    FILE *f = fopen(name, "rb");
+    uint8_t *p;
+    long n;
+
+    if (f == NULL) {
+        perror(name);
+        return NULL;
+    }
+    fseek(f, 0, SEEK_END);
+    n = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    p = ShimAlloc32(n > 0 ? n : 1);
+    if (p == NULL || fread(p, 1, n, f) != (size_t)n) {
+        fprintf(stderr, "%s: read error\n", name);
+        fclose(f);
+        return NULL;
+    }
+    fclose(f);
+    *len = n;
+
+    return p;
+}
+
+
+static void Report(const char *call, int ret, uint64_t t0)
+{
+    printf("%-40s = %d  %10.3f ms\n", call, ret, (ShimNow() - t0) / 1e6);
+}
+
+
+int main(int argc, char *argv[])
+{
+    const char *image = NULL;
+    W25qSimTiming timing = W25Q_SIM_TYP;
+    uint32_t chunk = 0, addr, len, off, n;
+    const W25qSimStats *st;
+    uint8_t *buf;
+    char call[64];
+    uint64_t t0;
+    int opt, i, ret, fail = 0;
+
+    while ((opt = getopt(argc, argv, "i:mc:")) != -1) {
+        switch (opt) {
+        case 'i':
+            image = optarg;
+            break;
+        case 'm':
+            timing = W25Q_SIM_MAX;
+            break;
+        case 'c':
+            chunk = strtoul(optarg, NULL, 0);
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-i image] [-m] [-c chunk] init|write A F|erase S E|mass|plan F|verify A F ...\n", argv[0]);
+            return 2;
+        }
+    }
+    if (ShimOpen(image, timing) != 0)
+        return 1;
+
+    for (i = optind; i < argc && !fail; i++) {
+        t0 = ShimNow();
+        if (strcmp(argv[i], "init") == 0) {
+            ret = Init();
+            Report("Init()", ret, t0);
+            fail = ret != 1;
+        }
+        else if (strcmp(argv[i], "mass") == 0) {
+            ret = MassErase();
+            Report("MassErase()", ret, t0);
+            fail = ret != 1;
+        }
+        else if (strcmp(argv[i], "erase") == 0 && i + 2 < argc) {
+            addr = strtoul(argv[i + 1], NULL, 0);
+            n = strtoul(argv[i + 2], NULL, 0);
+            ret = SectorErase(addr, n);
+            snprintf(call, sizeof(call), "SectorErase(0x%08X, 0x%08X)", (unsigned)addr, (unsigned)n);
+            Report(call, ret, t0);
+            fail = ret != 1;
+            i += 2;
+        }
+        else if (strcmp(argv[i], "plan") == 0 && i + 1 < argc) {
+            buf = Load(argv[i + 1], &len);
+            if (buf == NULL) {
+                fail = 1;
+                break;
+            }
+            t0 = ShimNow();
+            ret = Plan((uint32_t)(uintptr_t)buf, len);
+            snprintf(call, sizeof(call), "Plan(%s, 0x%X)", argv[i + 1], (unsigned)len);
+            Report(call, ret, t0);
+            fail = ret != 1;
+            ShimFree32(buf, len > 0 ? len : 1);
+            i += 1;
+        }
+        else if ((strcmp(argv[i], "write") == 0 || strcmp(argv[i], "verify") == 0) && i + 2 < argc) {
+            addr = strtoul(argv[i + 1], NULL, 0);
+            buf = Load(argv[i + 2], &len);
+            if (buf == NULL) {
+                fail = 1;
+                break;
+            }
+            if (argv[i][0] == 'v') {
+                off = addr - DQSPI_MAP_ADDR;
+                ret = off <= W25Q_SIM_FLASH_SIZE && len <= W25Q_SIM_FLASH_SIZE - off &&
+                      memcmp(ShimFlash()->mem + off, buf, len) == 0;
+                printf("verify 0x%08X %u bytes: %s\n", (unsigned)addr, (unsigned)len, ret ? "ok" : "MISMATCH");
+                fail = !ret;
+            }
+            else {
+                for (off = 0; off < len && !fail; off += n) {
+                    n = chunk != 0 && len - off > chunk ? chunk : len - off;
+                    t0 = ShimNow();
+                    ret = Write(addr + off, n, (uint32_t)(uintptr_t)(buf + off));
+                    snprintf(call, sizeof(call), "Write(0x%08X, 0x%X)", (unsigned)(addr + off), (unsigned)n);
+                    Report(call, ret, t0);
+                    fail = ret != 1;
+                }
+            }
+            ShimFree32(buf, len > 0 ? len : 1);
+            i += 2;
+        }
+        else {
+            fprintf(stderr, "%s: bad command %s\n", argv[0], argv[i]);
+            fail = 1;
+        }
+    }
+
+    st = &ShimFlash()->stats;
+    printf("total %.3f ms, flash busy %.3f ms, %u cmds, %u programs, erases 4k/32k/64k/chip %u/%u/%u/%u, %u ignored, %u violations\n",
+           ShimNow() / 1e6, st->busy_ns / 1e6, (unsigned)st->cmds, (unsigned)st->programs,
+           (unsigned)st->erase_4k, (unsigned)st->erase_32k, (unsigned)st->erase_64k, (unsigned)st->erase_chip,
+           (unsigned)st->ignored, (unsigned)st->violations);
+    ShimClose();
+
+    return fail;
+}
@@ -0,0 +1,238 @@
+/*
+ * Host benchmark of the circular logger (Inc/dqspi_log.h) on the flash
+ * model: samples written at a fixed data rate, with the DMA and the
+ * QUADSPI interrupt modeled by the shim. The log is then opened again,
+ * as after a reset, and read from the oldest page against the samples
+ * that were taken.
+ *
+ *   log_bench [-i image] [-m] [-d] [-r KB/s] [-w bytes] [-t ms]
+ *
+ *   -r        data rate, default 150 KB/s (1024 bytes)
+ *   -w        sample size, one DQSpiLogWrite() each, default 8
+ *   -t        logging time, default 10000 ms
+ *   -d        a reader follows the head while logging, DQSpiLogRead()
+ *             of up to 4 pages every ms
+ *   -m        datasheet worst-case program/erase times
+ *
+ * DQSpiLogPoll() runs every ms, as from an idle loop. Reads through the
+ * XIP window take no modeled time: the reopen time leaves out the blank
+ * check of the blocks ahead.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "dqspi.h"
+#include "dqspi_log.h"
+#include "shim.h"
+
+
+#define BENCH_SAMPLES_MAX    (1UL << 24)
+#define BENCH_MS             1000000ULL
+
+int Init(void);
+
+static uint8_t taken[BENCH_SAMPLES_MAX / 8];
+
+
+static void Sample(uint8_t *s, uint32_t n, uint32_t w)
+{
+    uint32_t i;
+
+    memcpy(s, &n, 4);
+    for (i = 4; i != w; i++)
+        s[i] = (uint8_t)(n * 7 + i);
+}
+
+
+/* samples of a page: intact, taken, in order */
+static int CheckPage(const uint8_t *p, uint16_t len, uint32_t w, int64_t *last, uint32_t *count)
+{
+    uint8_t s[DQSPI_LOG_PAYLOAD];
+    uint32_t n, off;
+
+    if (len % w != 0)
+        return 0;
+
+    for (off = 0; off != len; off += w) {
+        memcpy(&n, p + off, 4);
+        Sample(s, n, w);
+        if (n >= BENCH_SAMPLES_MAX || memcmp(s, p + off, w) != 0 || !(taken[n / 8] & (1 << (n % 8))) ||
+            (int64_t)n <= *last)
+            return 0;
+        *last = n;
+        (*count)++;
+    }
+
+    return 1;
+}
+
+
+int main(int argc, char *argv[])
+{
+    const char *image = NULL;
+    W25qSimTiming timing = W25Q_SIM_TYP;
+    uint32_t rate = 150, w = 8, ms = 10000, n, taken_n = 0, dropped = 0, rd_pages = 0, count, first, start, i;
+    uint64_t t, t0, t_end, next, poll_at, period, wr_ns = 0, wr_max = 0, open_ns, busy0;
+    uint8_t s[DQSPI_LOG_PAYLOAD], page[DQSPI_LOG_PAYLOAD];
+    int64_t rd_last = -1, last;
+    DQSpiLogInfo info, info2;
+    DQSpiLogCursor rd, c;
+    int opt, follow = 0, ok = 1;
+    uint16_t len;
+    int8_t ret;
+
+    while ((opt = getopt(argc, argv, "i:mdr:w:t:")) != -1) {
+        switch (opt) {
+        case 'i':
+            image = optarg;
+            break;
+        case 'm':
+            timing = W25Q_SIM_MAX;
+            break;
+        case 'd':
+            follow = 1;
+            break;
+        case 'r':
+            rate = strtoul(optarg, NULL, 0);
+            break;
+        case 'w':
+            w = strtoul(optarg, NULL, 0);
+            break;
+        case 't':
+            ms = strtoul(optarg, NULL, 0);
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-i image] [-m] [-d] [-r KB/s] [-w bytes] [-t ms]\n", argv[0]);
+            return 2;
+        }
+    }
+    if (optind != argc || rate == 0 || w < 4 || w > DQSPI_LOG_PAYLOAD || ms == 0) {
+        fprintf(stderr, "usage: %s [-i image] [-m] [-d] [-r KB/s] [-w bytes] [-t ms]\n", argv[0]);
+        return 2;
+    }
+
+    if (ShimOpen(image, timing) != 0 || Init() != 1) {
+        fprintf(stderr, "%s: Init() failed\n", argv[0]);
+        return 1;
+    }
+    if (DQSpiLogOpen() != 0) {
+        fprintf(stderr, "%s: DQSpiLogOpen() failed\n", argv[0]);
+        return 1;
+    }
+    DQSpiLogStats(&info);
+    /* the image may hold pages of an earlier run */
+    start = info.head;
+    rd.seq = start;
+    rd.lost = 0;
+
+    period = (uint64_t)w * 1000000000ULL / ((uint64_t)rate * 1024);
+    busy0 = ShimFlash()->stats.busy_ns;
+    t0 = ShimNow();
+    t_end = t0 + ms * BENCH_MS;
+    next = t0;
+    poll_at = t0 + BENCH_MS;
+    for (n = 0; ShimNow() < t_end && n != BENCH_SAMPLES_MAX; n++) {
+        t = ShimNow();
+        if (next > t)
+            ShimAdvance(next - t);
+        next += period;
+
+        Sample(s, n, w);
+        t = ShimNow();
+        ret = DQSpiLogWrite(s, w);
+        t = ShimNow() - t;
+        wr_ns += t;
+        if (t > wr_max)
+            wr_max = t;
+        if (ret == 0) {
+            taken[n / 8] |= 1 << (n % 8);
+            taken_n++;
+        }
+        else if (ret == DQSPI_BUSY) {
+            dropped++;
+        }
+        else {
+            fprintf(stderr, "%s: DQSpiLogWrite() failed\n", argv[0]);
+            return 1;
+        }
+
+        if (ShimNow() < poll_at)
+            continue;
+        poll_at += BENCH_MS;
+        DQSpiLogPoll();
+        for (i = 0; follow && i != 4; i++) {
+            ret = DQSpiLogRead(&rd, page, &len);
+            if (ret != 0)
+                break;
+            rd_pages++;
+            if (len != 0 && !CheckPage(page, len, w, &rd_last, &count))
+                ok = 0;
+        }
+    }
+    if (DQSpiLogFlush() != 0) {
+        fprintf(stderr, "%s: DQSpiLogFlush() failed\n", argv[0]);
+        return 1;
+    }
+    t = ShimNow() - t0;
+    DQSpiLogStats(&info);
+
+    printf("%u KB/s of %u-byte samples for %u ms: %u samples, %u dropped (%.2f%%)\n", (unsigned)rate,
+           (unsigned)w, (unsigned)ms, (unsigned)n, (unsigned)dropped, n ? 100.0 * dropped / n : 0.0);
+    printf("logged %.1f KB/s: %u pages, %u block erases, %u suspends, peak %u/%u pages queued, %u errors\n",
+           taken_n * (double)w / 1024 * 1e9 / t, (unsigned)info.pages, (unsigned)info.erases,
+           (unsigned)info.suspends, (unsigned)info.peak, DQSPI_LOG_PAGES, (unsigned)info.errors);
+    printf("flash busy %.1f%%, DQSpiLogWrite() %.2f us average, %.1f us worst\n",
+           100.0 * (ShimFlash()->stats.busy_ns - busy0) / t, wr_ns / 1e3 / n, wr_max / 1e3);
+    if (follow)
+        printf("reader: %u pages, %u lost%s\n", (unsigned)rd_pages, (unsigned)rd.lost, ok ? "" : ", MISMATCH");
+
+    /* as after a reset: the head and the tail from the flash alone, once
+     * the erase ahead is done */
+    for (;;) {
+        DQSpiLogStats(&info);
+        t = ShimNow();
+        ret = DQSpiLogOpen();
+        open_ns = ShimNow() - t;
+        if (ret != DQSPI_BUSY)
+            break;
+        ShimAdvance(BENCH_MS);
+        DQSpiLogPoll();
+    }
+    DQSpiLogStats(&info2);
+    if (ret != 0 || info2.head != info.head || info2.tail != info.tail)
+        ok = 0;
+    printf("reopen %.1f us: head %u, tail %u%s\n", open_ns / 1e3, (unsigned)info2.head, (unsigned)info2.tail,
+           (info2.head == info.head && info2.tail == info.tail) ? "" : ", MISMATCH");
+
+    /* every sample taken since the first one still on the flash */
+    DQSpiLogRewind(&c);
+    if ((int32_t)(start - c.seq) > 0)
+        c.seq = start;
+    count = 0;
+    last = -1;
+    first = 0xFFFFFFFF;
+    rd_pages = 0;
+    while ((ret = DQSpiLogRead(&c, page, &len)) == 0) {
+        rd_pages++;
+        if (len == 0)
+            continue;
+        if (first == 0xFFFFFFFF)
+            memcpy(&first, page, 4);
+        if (!CheckPage(page, len, w, &last, &count)) {
+            ok = 0;
+            break;
+        }
+    }
+    for (i = first, n = 0; first != 0xFFFFFFFF && i <= (uint32_t)last; i++)
+        n += (taken[i / 8] >> (i % 8)) & 1;
+    if (ret != DQSPI_LOG_END || count != n || c.lost != 0)
+        ok = 0;
+    printf("read back %u pages: %u samples from #%u, %u lost pages%s\n", (unsigned)rd_pages,
+           (unsigned)count, (unsigned)(first == 0xFFFFFFFF ? 0 : first), (unsigned)c.lost, ok ? ", verify ok" : ", verify MISMATCH");
+    ShimClose();
+
+    return ok ? 0 : 1;
+}
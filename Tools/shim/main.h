@@ -0,0 +1,12 @@
+/*
+ * Host replacement of Inc/main.h: same entry points, HAL from the shim.
+ */
+
+#ifndef __MAIN_H
+#define __MAIN_H
+
+#include "stm32f7xx_hal.h"
+
+void Error_Handler(void);
+
+#endif
@@ -0,0 +1,233 @@
+/*
+ * Host stand-in for the mailbox programming mode (Inc/loader_mbox.h):
+ * a modeled debug probe fills the ring while Mailbox() programs it, on
+ * the same virtual clock, and the result is compared with the plain
+ * call/return Write() flow on the same link.
+ *
+ *   mbox_run [-i image] [-m] [-e] [-r kB/s] [-l us] ADDR FILE
+ *
+ *   -e        erase the range first (ERASE request / SectorErase())
+ *   -r        SWD memory write throughput, default 400 kB/s
+ *   -l        probe round trip (USB), default 250 us: one per block
+ *             write, one per status read, three per call/return
+ *   -m        datasheet worst-case program/erase times
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "dqspi.h"
+#include "loader_mbox.h"
+#include "shim.h"
+
+
+int Init(void);
+int Write(uint32_t Address, uint32_t Size, uint32_t Buffer);
+int SectorErase(uint32_t EraseStartAddress, uint32_t EraseEndAddress);
+int Mailbox(void);
+
+static uint8_t *fw;
+static uint32_t fw_addr, fw_len;
+static double kbps = 400;
+static uint64_t rtt_ns = 250000;
+static int erase;
+
+/* probe model state */
+static uint32_t next_off;          /* next file offset to send */
+static int erase_sent, end_sent, active;
+static uint64_t xfer_end, last_end, free_since;
+static LoaderMboxDesc xfer;
+
+
+static uint64_t XferNs(uint32_t len)
+{
+    return (uint64_t)((len + sizeof(LoaderMboxDesc) + 4) * 1e6 / kbps) + rtt_ns;
+}
+
+
+/* called on every virtual clock step while the loader runs */
+static void Probe(uint64_t now)
+{
+    LoaderMbox *m = &LoaderMboxBlock;
+    uint32_t slot;
+
+    for (;;) {
+        if (!active) {
+            if (end_sent)
+                return;
+            /* a status read tells the probe a slot is free */
+            if (m->head - m->tail >= m->nbuf) {
+                free_since = 0;
+                return;
+            }
+            if (free_since == 0)
+                free_since = now + rtt_ns;
+
+            memset(&xfer, 0, sizeof(xfer));
+            if (erase && !erase_sent) {
+                xfer.op = LOADER_MBOX_ERASE;
+                xfer.addr = fw_addr;
+                xfer.len = fw_len;
+            }
+            else if (next_off < fw_len) {
+                xfer.op = LOADER_MBOX_WRITE;
+                xfer.addr = fw_addr + next_off;
+                xfer.len = fw_len - next_off < m->buf_size ? fw_len - next_off : m->buf_size;
+            }
+            else {
+                xfer.op = LOADER_MBOX_END;
+            }
+            xfer_end = (last_end > free_since ? last_end : free_since) +
+                       XferNs(xfer.op == LOADER_MBOX_WRITE ? xfer.len : 0);
+            active = 1;
+        }
+        if (now < xfer_end)
+            return;
+
+        /* the block write has landed: data, descriptor, then head */
+        slot = m->head & (m->nbuf - 1);
+        if (xfer.op == LOADER_MBOX_WRITE) {
+            memcpy(m->buf[slot], fw + next_off, xfer.len);
+            xfer.flags = LOADER_MBOX_F_CRC;
+            xfer.crc = DQSpiCrc32(0, m->buf[slot], xfer.len);
+            next_off += xfer.len;
+        }
+        erase_sent |= xfer.op == LOADER_MBOX_ERASE;
+        end_sent = xfer.op == LOADER_MBOX_END;
+        m->desc[slot] = xfer;
+        m->head++;
+        last_end = xfer_end;
+        active = 0;
+    }
+}
+
+
+static int Verify(void)
+{
+    uint32_t off = fw_addr - DQSPI_MAP_ADDR;
+
+    return memcmp(ShimFlash()->mem + off, fw, fw_len) == 0;
+}
+
+
+/* Write() per buffer: transfer, call, wait for the return, in sequence */
+static double RunAbi(W25qSimTiming timing)
+{
+    uint32_t off, n;
+    uint64_t t0;
+    int ok = 1;
+
+    if (ShimOpen(NULL, timing) != 0 || Init() != 1)
+        return -1;
+    t0 = ShimNow();
+    if (erase) {
+        ShimAdvance(3 * rtt_ns);
+        ok = SectorErase(fw_addr, fw_addr + fw_len - 1) == 1;
+    }
+    for (off = 0; off < fw_len && ok; off += n) {
+        n = fw_len - off < LOADER_MAILBOX_BUF_SIZE ? fw_len - off : LOADER_MAILBOX_BUF_SIZE;
+        ShimAdvance(XferNs(n) + 3 * rtt_ns);
+        ok = Write(fw_addr + off, n, (uint32_t)(uintptr_t)(fw + off)) == 1;
+    }
+    ok = ok && Verify();
+    t0 = ShimNow() - t0;
+    ShimClose();
+
+    return ok ? t0 / 1e6 : -1;
+}
+
+
+int main(int argc, char *argv[])
+{
+    const char *image = NULL;
+    W25qSimTiming timing = W25Q_SIM_TYP;
+    const LoaderMbox *m = &LoaderMboxBlock;
+    double abi_ms = -1, mbox_ms;
+    int opt, ret, ok, pfd[2];
+    uint64_t t0;
+    FILE *f;
+    long n;
+
+    while ((opt = getopt(argc, argv, "i:mer:l:")) != -1) {
+        switch (opt) {
+        case 'i':
+            image = optarg;
+            break;
+        case 'm':
+            timing = W25Q_SIM_MAX;
+            break;
+        case 'e':
+            erase = 1;
+            break;
+        case 'r':
+            kbps = strtod(optarg, NULL);
+            break;
+        case 'l':
+            rtt_ns = strtoull(optarg, NULL, 0) * 1000;
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-i image] [-m] [-e] [-r kB/s] [-l us] ADDR FILE\n", argv[0]);
+            return 2;
+        }
+    }
+    if (optind != argc - 2 || kbps <= 0) {
+        fprintf(stderr, "usage: %s [-i image] [-m] [-e] [-r kB/s] [-l us] ADDR FILE\n", argv[0]);
+        return 2;
+    }
+    fw_addr = strtoul(argv[optind], NULL, 0);
+    f = fopen(argv[optind + 1], "rb");
+    if (f == NULL) {
+        perror(argv[optind + 1]);
+        return 1;
+    }
+    fseek(f, 0, SEEK_END);
+    n = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    fw = ShimAlloc32(n > 0 ? n : 1);
+    if (fw == NULL || n <= 0 || fread(fw, 1, n, f) != (size_t)n ||
+        fw_addr < DQSPI_MAP_ADDR || fw_addr - DQSPI_MAP_ADDR + n > W25Q_SIM_FLASH_SIZE) {
+        fprintf(stderr, "%s: cannot load at 0x%08X\n", argv[optind + 1], (unsigned)fw_addr);
+        fclose(f);
+        return 1;
+    }
+    fclose(f);
+    fw_len = n;
+
+    /* reference run in a child: the loader keeps static state */
+    if (pipe(pfd) == 0) {
+        if (fork() == 0) {
+            abi_ms = RunAbi(timing);
+            ret = write(pfd[1], &abi_ms, sizeof(abi_ms)) != sizeof(abi_ms);
+            _exit(ret);
+        }
+        if (read(pfd[0], &abi_ms, sizeof(abi_ms)) != sizeof(abi_ms))
+            abi_ms = -1;
+        wait(NULL);
+    }
+
+    if (ShimOpen(image, timing) != 0 || Init() != 1) {
+        fprintf(stderr, "%s: Init() failed\n", argv[0]);
+        return 1;
+    }
+    t0 = ShimNow();
+    ShimSetTickHook(Probe);
+    ret = Mailbox();
+    ShimSetTickHook(NULL);
+    mbox_ms = (ShimNow() - t0) / 1e6;
+    ok = ret == 1 && Verify();
+
+    printf("mailbox %u x %u bytes, link %.0f kB/s, round trip %.0f us\n",
+           (unsigned)m->nbuf, (unsigned)m->buf_size, kbps, rtt_ns / 1e3);
+    printf("Mailbox() = %d, status %u, %u requests, %u bytes, %.3f ms%s\n", ret, (unsigned)m->status,
+           (unsigned)m->tail, (unsigned)m->bytes, mbox_ms, ok ? ", verify ok" : ", verify MISMATCH");
+    if (abi_ms >= 0)
+        printf("call/return Write() %.3f ms, mailbox %.1f%% of it\n", abi_ms, 100.0 * mbox_ms / abi_ms);
+    else
+        printf("call/return Write() run failed\n");
+    ShimClose();
+
+    return ok ? 0 : 1;
+}
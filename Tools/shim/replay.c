@@ -0,0 +1,286 @@
+/*
+ * Replay a recorded programming session through the loader, against
+ * the flash model, and report the modeled time of every call.
+ *
+ *   replay [-i image] [-m] [-q] [-f fw.bin[@addr]] session
+ *
+ * The session is a LoaderRecLog dump of a LOADER_RECORD build
+ *     (gdb) dump binary value rec.bin LoaderRecLog
+ * or a text file, one call per line:
+ *     init | write ADDR SIZE | erase START END | mass
+ *
+ * Write data comes from -f when given (the image that was programmed,
+ * loaded at addr, 0x90000000 by default: recorded digests are checked
+ * against it), otherwise it is generated from the recorded digest.
+ * -m uses the datasheet worst-case times, -q prints only the totals.
+ *
+ * To compare loader strategies build the shim objects with other driver
+ * options and replay the same session:
+ *     make -C Tools clean replay LOADER_DEFS=-DDQSPI_WRITE_BUFFER=1
+ */
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "dqspi.h"
+#include "loader_rec.h"
+#include "shim.h"
+
+
+#define MAX_CALLS            65536
+
+int Init(void);
+int Write(uint32_t Address, uint32_t Size, uint32_t Buffer);
+int SectorErase(uint32_t EraseStartAddress, uint32_t EraseEndAddress);
+int MassErase(void);
+
+static const char *call_name[LOADER_CALL_NUM] = { "Init", "Write", "SectorErase", "MassErase", "Plan", "Mailbox" };
+
+static LoaderRecEntry calls[MAX_CALLS];
+static uint32_t ncalls;
+static uint32_t cpu_hz;        /* of the recording, 0 for a text session */
+
+static uint8_t *fw;
+static uint32_t fw_addr = DQSPI_MAP_ADDR, fw_len;
+
+
+static int LoadRec(FILE *f)
+{
+    LoaderRec hdr;
+    uint32_t n;
+
+    if (fread(&hdr, offsetof(LoaderRec, e), 1, f) != 1 || hdr.magic != LOADER_REC_MAGIC) {
+        fprintf(stderr, "replay: not a LoaderRecLog dump\n");
+        return -1;
+    }
+    n = hdr.count < hdr.size ? hdr.count : hdr.size;
+    if (n > MAX_CALLS || fread(calls, sizeof(calls[0]), n, f) != n) {
+        fprintf(stderr, "replay: truncated dump\n");
+        return -1;
+    }
+    if (hdr.count > hdr.size)
+        fprintf(stderr, "replay: log full, %u calls not recorded\n", (unsigned)(hdr.count - hdr.size));
+    ncalls = n;
+    cpu_hz = hdr.cpu_hz;
+
+    return 0;
+}
+
+
+static int LoadText(FILE *f)
+{
+    char line[128], op[16];
+    unsigned long a, b;
+    LoaderRecEntry *e;
+    int n;
+
+    while (fgets(line, sizeof(line), f) != NULL) {
+        if (line[0] == '#' || (n = sscanf(line, "%15s %li %li", op, &a, &b)) < 1)
+            continue;
+        if (ncalls == MAX_CALLS) {
+            fprintf(stderr, "replay: more than %u calls\n", MAX_CALLS);
+            return -1;
+        }
+        e = &calls[ncalls];
+        memset(e, 0, sizeof(*e));
+        if (!strcmp(op, "init"))
+            e->call = LOADER_CALL_INIT;
+        else if (!strcmp(op, "mass"))
+            e->call = LOADER_CALL_MASS;
+        else if (n == 3 && (!strcmp(op, "write") || !strcmp(op, "erase"))) {
+            e->call = op[0] == 'w' ? LOADER_CALL_WRITE : LOADER_CALL_ERASE;
+            e->addr = a;
+            e->arg = b;
+        }
+        else {
+            fprintf(stderr, "replay: bad line: %s", line);
+            return -1;
+        }
+        e->ret = 1;
+        ncalls++;
+    }
+
+    return 0;
+}
+
+
+static int LoadFw(char *arg)
+{
+    char *at = strchr(arg, '@');
+    FILE *f;
+    long n;
+
+    if (at != NULL) {
+        *at = 0;
+        fw_addr = strtoul(at + 1, NULL, 0);
+    }
+    f = fopen(arg, "rb");
+    if (f == NULL) {
+        perror(arg);
+        return -1;
+    }
+    fseek(f, 0, SEEK_END);
+    n = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    fw = malloc(n > 0 ? n : 1);
+    if (fw == NULL || fread(fw, 1, n, f) != (size_t)n) {
+        fprintf(stderr, "%s: read error\n", arg);
+        fclose(f);
+        return -1;
+    }
+    fclose(f);
+    fw_len = n;
+
+    return 0;
+}
+
+
+/* Write buffer of a call: the image slice, or bytes derived from the digest */
+static void Fill(uint8_t *buf, const LoaderRecEntry *e, int *mismatch)
+{
+    uint32_t off = e->addr - fw_addr, i, x;
+
+    *mismatch = 0;
+    if (fw != NULL && e->addr >= fw_addr && off <= fw_len && e->arg <= fw_len - off) {
+        memcpy(buf, fw + off, e->arg);
+        *mismatch = cpu_hz != 0 && DQSpiCrc32(0, buf, e->arg) != e->digest;
+        return;
+    }
+    x = e->digest | 1;
+    for (i = 0; i != e->arg; i++) {
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        buf[i] = (uint8_t)x;
+    }
+}
+
+
+int main(int argc, char *argv[])
+{
+    const char *image = NULL;
+    W25qSimTiming timing = W25Q_SIM_TYP;
+    const W25qSimStats *st;
+    const LoaderRecEntry *e;
+    uint64_t t0, model[LOADER_CALL_NUM] = {0}, rec_ns = 0;
+    uint32_t count[LOADER_CALL_NUM] = {0}, i, bytes = 0, bad = 0, mismatches = 0;
+    double ns, rns;
+    uint8_t *buf;
+    int opt, quiet = 0, ret, mismatch;
+    FILE *f;
+
+    while ((opt = getopt(argc, argv, "i:mqf:")) != -1) {
+        switch (opt) {
+        case 'i':
+            image = optarg;
+            break;
+        case 'm':
+            timing = W25Q_SIM_MAX;
+            break;
+        case 'q':
+            quiet = 1;
+            break;
+        case 'f':
+            if (LoadFw(optarg) != 0)
+                return 1;
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-i image] [-m] [-q] [-f fw.bin[@addr]] session\n", argv[0]);
+            return 2;
+        }
+    }
+    if (optind != argc - 1) {
+        fprintf(stderr, "usage: %s [-i image] [-m] [-q] [-f fw.bin[@addr]] session\n", argv[0]);
+        return 2;
+    }
+
+    f = fopen(argv[optind], "rb");
+    if (f == NULL) {
+        perror(argv[optind]);
+        return 1;
+    }
+    ret = (getc(f) == (LOADER_REC_MAGIC & 0xFF)) ? (rewind(f), LoadRec(f)) : (rewind(f), LoadText(f));
+    fclose(f);
+    if (ret != 0)
+        return 1;
+
+    buf = ShimAlloc32(W25Q_SIM_FLASH_SIZE);
+    if (buf == NULL || ShimOpen(image, timing) != 0)
+        return 1;
+
+    if (!quiet)
+        printf("%6s  %-12s %-10s %-10s %3s %12s %12s\n", "call", "entry", "addr", "arg", "ret", "model_ms", "rec_ms");
+    for (i = 0; i != ncalls; i++) {
+        e = &calls[i];
+        mismatch = 0;
+        t0 = ShimNow();
+        switch (e->call) {
+        case LOADER_CALL_INIT:
+            ret = Init();
+            break;
+        case LOADER_CALL_WRITE:
+            if (e->arg > W25Q_SIM_FLASH_SIZE) {
+                ret = 0;
+                break;
+            }
+            Fill(buf, e, &mismatch);
+            mismatches += mismatch;
+            bytes += e->arg;
+            t0 = ShimNow();
+            ret = Write(e->addr, e->arg, (uint32_t)(uintptr_t)buf);
+            break;
+        case LOADER_CALL_ERASE:
+            ret = SectorErase(e->addr, e->arg);
+            break;
+        case LOADER_CALL_MASS:
+            ret = MassErase();
+            break;
+        case LOADER_CALL_PLAN:
+        case LOADER_CALL_MAILBOX:
+            /* the data is not recorded */
+            fprintf(stderr, "replay: call %u: %s() not replayed\n", (unsigned)i, call_name[e->call]);
+            continue;
+        default:
+            fprintf(stderr, "replay: call %u: unknown entry %u\n", (unsigned)i, e->call);
+            continue;
+        }
+        ns = ShimNow() - t0;
+        model[e->call] += ns;
+        count[e->call]++;
+        bad += ret != e->ret;
+
+        /* the cycle count wraps after ~19 s, long calls go by the tick */
+        rns = 0;
+        if (cpu_hz != 0) {
+            rns = e->ms > 10000 ? e->ms * 1e6 : e->cycles * 1e9 / cpu_hz;
+            rec_ns += rns;
+        }
+        if (!quiet)
+            printf("%6u  %-12s 0x%08X 0x%08X %d%s %12.3f %12.3f%s\n", (unsigned)i, call_name[e->call],
+                   (unsigned)e->addr, (unsigned)e->arg, ret, ret != e->ret ? "!" : " ",
+                   ns / 1e6, rns / 1e6, mismatch ? "  digest mismatch" : "");
+    }
+
+    printf("\n%-12s %8s %14s\n", "entry", "calls", "model_ms");
+    for (i = 0; i != LOADER_CALL_NUM; i++) {
+        if (count[i] != 0)
+            printf("%-12s %8u %14.3f\n", call_name[i], (unsigned)count[i], model[i] / 1e6);
+    }
+    st = &ShimFlash()->stats;
+    printf("total %u calls, %u bytes written, model %.3f ms", (unsigned)ncalls, (unsigned)bytes, ShimNow() / 1e6);
+    if (cpu_hz != 0)
+        printf(", recorded %.3f ms", rec_ns / 1e6);
+    printf("\nflash busy %.3f ms, %u cmds, %u programs, erases 4k/32k/64k/chip %u/%u/%u/%u, %u violations\n",
+           st->busy_ns / 1e6, (unsigned)st->cmds, (unsigned)st->programs, (unsigned)st->erase_4k,
+           (unsigned)st->erase_32k, (unsigned)st->erase_64k, (unsigned)st->erase_chip, (unsigned)st->violations);
+    if (bad != 0)
+        printf("%u calls returned differently than recorded\n", (unsigned)bad);
+    if (mismatches != 0)
+        printf("%u Write buffers do not match the recorded digest\n", (unsigned)mismatches);
+    ShimClose();
+
+    return bad != 0;
+}
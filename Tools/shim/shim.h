@@ -0,0 +1,30 @@
+/*
+ * Host run of the loader: virtual clock and flash model behind the
+ * HAL shim. The loader sources are built with -Dmain=fw_main, the
+ * shim provides fw_main() in place of Src/main.c.
+ */
+
+#ifndef __SHIM_H__
+#define __SHIM_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "w25q_sim.h"
+
+
+#define SHIM_CPU_HZ          216000000UL   /* SYSCLK of SystemClock_Config() */
+
+int ShimOpen(const char *image, W25qSimTiming timing);
+void ShimClose(void);
+uint64_t ShimNow(void);                    /* virtual time, ns */
+void ShimAdvance(uint64_t ns);
+void ShimSetTickHook(void (*hook)(uint64_t now));   /* runs after every clock step */
+W25qSim *ShimFlash(void);
+void *ShimAlloc32(size_t len);             /* buffer addressable with 32 bits */
+void ShimFree32(void *p, size_t len);
+
+int fw_main(void);
+
+
+#endif
@@ -0,0 +1,252 @@
+/*
+ * Host benchmark of the sorted table (Inc/dqspi_sst.h) on the flash
+ * model: a table of random keys is built (Tools/sst_build.c),
+ * programmed, opened through the XIP window and checked with every key,
+ * as many misses and floor lookups. The lines the lookups read are
+ * counted on a model of the D-cache, against a binary search over the
+ * same keys.
+ *
+ *   sst_bench [-i image] [-n records] [-v bytes] [-a addr] [-l lookups] [-s seed]
+ *
+ *   -n        records, default 200000
+ *   -v        value size, default 8
+ *   -a        flash offset of the table, 64K aligned, default 0
+ *   -l        random lookups on the cache model, default 100000
+ *
+ * Reads through the XIP window take no modeled time: the cache model
+ * replays the lines each search reads, 8K 4-way LRU with 32-byte lines
+ * like the STM32F730 D-cache. Every miss is one QSPI line fill.
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "dqspi.h"
+#include "dqspi_sst.h"
+#include "sst_build.h"
+#include "shim.h"
+
+
+#define BENCH_BLOCK          0x10000
+#define CACHE_SETS           64
+#define CACHE_WAYS           4
+
+int Init(void);
+
+static uint32_t cache[CACHE_SETS][CACHE_WAYS];     /* line numbers + 1, MRU first */
+static uint32_t lines, misses;
+
+
+static void Value(uint8_t *v, uint32_t key, uint32_t val_len)
+{
+    uint32_t i;
+
+    for (i = 0; i != val_len; i++)
+        v[i] = (uint8_t)(key * 7 + i);
+}
+
+
+/* one read of [off, off + len) of the table */
+static void Touch(uint32_t off, uint32_t len)
+{
+    uint32_t l, set, w, *c;
+
+    for (l = off / DQSPI_SST_LINE; len != 0 && l <= (off + len - 1) / DQSPI_SST_LINE; l++) {
+        lines++;
+        set = l % CACHE_SETS;
+        c = cache[set];
+        for (w = 0; w != CACHE_WAYS - 1 && c[w] != l + 1; w++)
+            ;
+        if (c[w] != l + 1)
+            misses++;
+        memmove(&c[1], &c[0], w * sizeof(*c));
+        c[0] = l + 1;
+    }
+}
+
+
+/* the lines DQSpiSstFind() reads */
+static void TraceTree(const uint8_t *t, uint32_t key)
+{
+    const DQSpiSstHdr *h = (const DQSpiSstHdr *)t;
+    const uint32_t *k;
+    uint32_t l, n = 0, i, r;
+
+    for (l = 0; l != h->levels; l++) {
+        Touch(h->level[l] + n * DQSPI_SST_LINE, DQSPI_SST_LINE);
+        k = (const uint32_t *)(t + h->level[l]) + n * DQSPI_SST_KEYS;
+        for (i = 0, r = 0; i != DQSPI_SST_KEYS; i++)
+            r += k[i] <= key;
+        n = n * DQSPI_SST_FANOUT + r;
+    }
+    Touch(h->keys + n * DQSPI_SST_LINE, DQSPI_SST_LINE);
+    k = (const uint32_t *)(t + h->keys) + n * DQSPI_SST_KEYS;
+    for (i = 0, r = 0; i != DQSPI_SST_KEYS; i++)
+        r += k[i] <= key;
+    Touch(h->values + (n * DQSPI_SST_KEYS + r - 1) * h->val_len, h->val_len);
+}
+
+
+/* a binary search over the same keys, then the value */
+static void TraceBinary(const uint8_t *t, uint32_t key)
+{
+    const DQSpiSstHdr *h = (const DQSpiSstHdr *)t;
+    const uint32_t *k = (const uint32_t *)(t + h->keys);
+    uint32_t lo = 0, hi = h->count, mid;
+
+    while (hi - lo > 1) {
+        mid = (lo + hi) / 2;
+        Touch(h->keys + mid * 4, 4);
+        if (k[mid] <= key)
+            lo = mid;
+        else
+            hi = mid;
+    }
+    Touch(h->keys + lo * 4, 4);
+    Touch(h->values + lo * h->val_len, h->val_len);
+}
+
+
+static uint32_t Rand32(void)
+{
+    return (uint32_t)rand() << 16 ^ (uint32_t)rand();
+}
+
+
+int main(int argc, char *argv[])
+{
+    const char *image = NULL, *err;
+    uint32_t count = 200000, val_len = 8, addr = 0, nlook = 100000, seed = 1, size, gap, i, j, key, found;
+    uint32_t tree_lines, tree_misses, bin_lines, bin_misses;
+    uint8_t *rec, *t, v[256];
+    const uint8_t *p;
+    uint32_t *keys;
+    DQSpiSst sst;
+    int opt, ok = 1;
+
+    while ((opt = getopt(argc, argv, "i:n:v:a:l:s:")) != -1) {
+        switch (opt) {
+        case 'i':
+            image = optarg;
+            break;
+        case 'n':
+            count = strtoul(optarg, NULL, 0);
+            break;
+        case 'v':
+            val_len = strtoul(optarg, NULL, 0);
+            break;
+        case 'a':
+            addr = strtoul(optarg, NULL, 0);
+            break;
+        case 'l':
+            nlook = strtoul(optarg, NULL, 0);
+            break;
+        case 's':
+            seed = strtoul(optarg, NULL, 0);
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-i image] [-n records] [-v bytes] [-a addr] [-l lookups] [-s seed]\n", argv[0]);
+            return 2;
+        }
+    }
+    if (optind != argc || count == 0 || count > 0x10000000 || val_len > sizeof(v) || (addr & (BENCH_BLOCK - 1)) != 0) {
+        fprintf(stderr, "usage: %s [-i image] [-n records] [-v bytes] [-a addr] [-l lookups] [-s seed]\n", argv[0]);
+        return 2;
+    }
+    srand(seed);
+
+    /* increasing keys with random gaps, the records shuffled */
+    keys = malloc(count * sizeof(*keys));
+    rec = malloc((size_t)count * (4 + val_len));
+    if (keys == NULL || rec == NULL)
+        return 1;
+    gap = (uint32_t)(0x7FFFFFF0ULL / count);
+    for (i = 0, key = 0; i != count; i++) {
+        key += 1 + Rand32() % (gap > 1 ? 2 * gap - 1 : 1);
+        keys[i] = key;
+    }
+    for (i = 0; i != count; i++) {
+        j = Rand32() % (i + 1);
+        memmove(rec + (size_t)i * (4 + val_len), rec + (size_t)j * (4 + val_len), 4 + val_len);
+        memcpy(rec + (size_t)j * (4 + val_len), &keys[i], 4);
+        Value(rec + (size_t)j * (4 + val_len) + 4, keys[i], val_len);
+    }
+
+    t = SstBuild(rec, count, val_len, &size, &err);
+    if (t == NULL) {
+        fprintf(stderr, "%s: %s\n", argv[0], err);
+        return 1;
+    }
+    if (size > W25Q_SIM_FLASH_SIZE - addr) {
+        fprintf(stderr, "%s: the table takes %u bytes, more than the flash has\n", argv[0], (unsigned)size);
+        return 1;
+    }
+
+    if (ShimOpen(image, W25Q_SIM_TYP) != 0 || Init() != 1) {
+        fprintf(stderr, "%s: Init() failed\n", argv[0]);
+        return 1;
+    }
+    for (i = addr; i < addr + size; i += BENCH_BLOCK) {
+        if (DQSpiEraseBlock64(i) != 0)
+            return 1;
+    }
+    if (DQSpiWrite(addr, t, size) != 0) {
+        fprintf(stderr, "%s: DQSpiWrite() failed\n", argv[0]);
+        return 1;
+    }
+
+    if (DQSpiSstOpen(&sst, addr) != 0 || DQSpiSstCheck(&sst) != 0) {
+        fprintf(stderr, "%s: DQSpiSstOpen() failed\n", argv[0]);
+        return 1;
+    }
+    printf("%u records, %u-byte values: %u bytes, %u index levels of %u bytes\n", (unsigned)count,
+           (unsigned)val_len, (unsigned)size, (unsigned)sst.hdr->levels, (unsigned)(sst.hdr->keys - sizeof(DQSpiSstHdr)));
+
+    /* every key, its neighbours as misses, floor lookups between them */
+    for (i = 0; i != count && ok; i++) {
+        Value(v, keys[i], val_len);
+        p = DQSpiSstFind(&sst, keys[i]);
+        ok = p != NULL && memcmp(p, v, val_len) == 0;
+        key = keys[i] + 1;
+        if (ok && (i + 1 == count || key != keys[i + 1])) {
+            ok = DQSpiSstFind(&sst, key) == NULL && DQSpiSstFloor(&sst, key, &found) == (const void *)p &&
+                 found == keys[i];
+        }
+    }
+    ok = ok && (keys[0] == 0 || (DQSpiSstFind(&sst, keys[0] - 1) == NULL && DQSpiSstFloor(&sst, 0, &found) == NULL));
+    ok = ok && DQSpiSstFind(&sst, DQSPI_SST_PAD) == NULL &&
+         DQSpiSstFloor(&sst, DQSPI_SST_PAD, &found) != NULL && found == keys[count - 1];
+    printf("find and floor of every key: %s\n", ok ? "ok" : "MISMATCH");
+    DQSpiSstClose(&sst);
+
+    /* random hits, the same sequence for both searches */
+    srand(seed);
+    memset(cache, 0, sizeof(cache));
+    lines = misses = 0;
+    for (i = 0; i != nlook; i++)
+        TraceTree(t, keys[Rand32() % count]);
+    tree_lines = lines;
+    tree_misses = misses;
+
+    srand(seed);
+    memset(cache, 0, sizeof(cache));
+    lines = misses = 0;
+    for (i = 0; i != nlook; i++)
+        TraceBinary(t, keys[Rand32() % count]);
+    bin_lines = lines;
+    bin_misses = misses;
+
+    printf("%u random lookups, lines read / QSPI line fills per lookup (8K D-cache):\n", (unsigned)nlook);
+    printf("  index:         %5.2f / %5.2f\n", (double)tree_lines / nlook, (double)tree_misses / nlook);
+    printf("  binary search: %5.2f / %5.2f (log2 n = %.1f)\n", (double)bin_lines / nlook,
+           (double)bin_misses / nlook, log2(count));
+    ShimClose();
+    free(t);
+    free(rec);
+    free(keys);
+
+    return ok ? 0 : 1;
+}
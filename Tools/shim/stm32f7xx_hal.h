@@ -0,0 +1,307 @@
+/*
+ * Host stand-in of the STM32F7 HAL, only the surface used by dqspi.c,
+ * dqspi_stat.c and Loader_Src.c. Constant values match the real HAL
+ * (CCR/CR bit encodings) so command descriptors decode the same way.
+ * Core peripherals (SCB, DWT, CoreDebug, ITM, MPU) are plain structs;
+ * every DWT access moves the virtual clock a little so busy-wait loops
+ * on CYCCNT terminate.
+ */
+
+#ifndef __STM32F7xx_HAL_H
+#define __STM32F7xx_HAL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+
+#define __IO                 volatile
+
+typedef enum {
+    HAL_OK = 0x00U,
+    HAL_ERROR = 0x01U,
+    HAL_BUSY = 0x02U,
+    HAL_TIMEOUT = 0x03U
+} HAL_StatusTypeDef;
+
+typedef enum {
+    HAL_UNLOCKED = 0x00U,
+    HAL_LOCKED = 0x01U
+} HAL_LockTypeDef;
+
+
+/* ---- QUADSPI ------------------------------------------------------------ */
+
+typedef struct {
+    uint32_t dummy;
+} QUADSPI_TypeDef;
+
+typedef struct {
+    uint32_t dummy;
+} DMA_HandleTypeDef;
+
+typedef struct {
+    uint32_t ClockPrescaler;
+    uint32_t FifoThreshold;
+    uint32_t SampleShifting;
+    uint32_t FlashSize;
+    uint32_t ChipSelectHighTime;
+    uint32_t ClockMode;
+    uint32_t FlashID;
+    uint32_t DualFlash;
+} QSPI_InitTypeDef;
+
+typedef enum {
+    HAL_QSPI_STATE_RESET = 0x00U,
+    HAL_QSPI_STATE_READY = 0x01U,
+    HAL_QSPI_STATE_BUSY = 0x02U,
+    HAL_QSPI_STATE_BUSY_INDIRECT_TX = 0x12U,
+    HAL_QSPI_STATE_BUSY_INDIRECT_RX = 0x22U,
+    HAL_QSPI_STATE_BUSY_AUTO_POLLING = 0x42U,
+    HAL_QSPI_STATE_BUSY_MEM_MAPPED = 0x82U,
+    HAL_QSPI_STATE_ABORT = 0x08U,
+    HAL_QSPI_STATE_ERROR = 0x04U
+} HAL_QSPI_StateTypeDef;
+
+typedef struct {
+    QUADSPI_TypeDef *Instance;
+    QSPI_InitTypeDef Init;
+    uint8_t *pTxBuffPtr;
+    __IO uint32_t TxXferSize;
+    __IO uint32_t TxXferCount;
+    uint8_t *pRxBuffPtr;
+    __IO uint32_t RxXferSize;
+    __IO uint32_t RxXferCount;
+    DMA_HandleTypeDef *hdma;
+    __IO HAL_LockTypeDef Lock;
+    __IO HAL_QSPI_StateTypeDef State;
+    __IO uint32_t ErrorCode;
+    uint32_t Timeout;
+} QSPI_HandleTypeDef;
+
+typedef struct {
+    uint32_t Instruction;
+    uint32_t Address;
+    uint32_t AlternateBytes;
+    uint32_t AddressSize;
+    uint32_t AlternateBytesSize;
+    uint32_t DummyCycles;
+    uint32_t InstructionMode;
+    uint32_t AddressMode;
+    uint32_t AlternateByteMode;
+    uint32_t DataMode;
+    uint32_t NbData;
+    uint32_t DdrMode;
+    uint32_t DdrHoldHalfCycle;
+    uint32_t SIOOMode;
+} QSPI_CommandTypeDef;
+
+typedef struct {
+    uint32_t Match;
+    uint32_t Mask;
+    uint32_t Interval;
+    uint32_t StatusBytesSize;
+    uint32_t MatchMode;
+    uint32_t AutomaticStop;
+} QSPI_AutoPollingTypeDef;
+
+typedef struct {
+    uint32_t TimeOutPeriod;
+    uint32_t TimeOutActivation;
+} QSPI_MemoryMappedTypeDef;
+
+#define QUADSPI                        ((QUADSPI_TypeDef *)0)
+
+#define QSPI_SAMPLE_SHIFTING_NONE      0x00000000U
+#define QSPI_SAMPLE_SHIFTING_HALFCYCLE 0x00000010U
+#define QSPI_CS_HIGH_TIME_1_CYCLE      0x00000000U
+#define QSPI_CS_HIGH_TIME_2_CYCLE      0x00000100U
+#define QSPI_CS_HIGH_TIME_3_CYCLE      0x00000200U
+#define QSPI_CS_HIGH_TIME_4_CYCLE      0x00000300U
+#define QSPI_CLOCK_MODE_0              0x00000000U
+#define QSPI_CLOCK_MODE_3              0x00000001U
+#define QSPI_FLASH_ID_1                0x00000000U
+#define QSPI_FLASH_ID_2                0x00000080U
+#define QSPI_DUALFLASH_ENABLE          0x00000040U
+#define QSPI_DUALFLASH_DISABLE         0x00000000U
+
+#define QSPI_ADDRESS_8_BITS            0x00000000U
+#define QSPI_ADDRESS_16_BITS           0x00001000U
+#define QSPI_ADDRESS_24_BITS           0x00002000U
+#define QSPI_ADDRESS_32_BITS           0x00003000U
+#define QSPI_ALTERNATE_BYTES_8_BITS    0x00000000U
+#define QSPI_ALTERNATE_BYTES_16_BITS   0x00010000U
+#define QSPI_ALTERNATE_BYTES_24_BITS   0x00020000U
+#define QSPI_ALTERNATE_BYTES_32_BITS   0x00030000U
+#define QSPI_INSTRUCTION_NONE          0x00000000U
+#define QSPI_INSTRUCTION_1_LINE        0x00000100U
+#define QSPI_INSTRUCTION_2_LINES       0x00000200U
+#define QSPI_INSTRUCTION_4_LINES       0x00000300U
+#define QSPI_ADDRESS_NONE              0x00000000U
+#define QSPI_ADDRESS_1_LINE            0x00000400U
+#define QSPI_ADDRESS_2_LINES           0x00000800U
+#define QSPI_ADDRESS_4_LINES           0x00000C00U
+#define QSPI_ALTERNATE_BYTES_NONE      0x00000000U
+#define QSPI_ALTERNATE_BYTES_1_LINE    0x00004000U
+#define QSPI_ALTERNATE_BYTES_2_LINES   0x00008000U
+#define QSPI_ALTERNATE_BYTES_4_LINES   0x0000C000U
+#define QSPI_DATA_NONE                 0x00000000U
+#define QSPI_DATA_1_LINE               0x01000000U
+#define QSPI_DATA_2_LINES              0x02000000U
+#define QSPI_DATA_4_LINES              0x03000000U
+#define QSPI_DDR_MODE_DISABLE          0x00000000U
+#define QSPI_DDR_MODE_ENABLE           0x80000000U
+#define QSPI_DDR_HHC_ANALOG_DELAY      0x00000000U
+#define QSPI_DDR_HHC_HALF_CLK_DELAY    0x40000000U
+#define QSPI_SIOO_INST_EVERY_CMD       0x00000000U
+#define QSPI_SIOO_INST_ONLY_FIRST_CMD  0x10000000U
+#define QSPI_MATCH_MODE_AND            0x00000000U
+#define QSPI_MATCH_MODE_OR             0x00800000U
+#define QSPI_AUTOMATIC_STOP_DISABLE    0x00000000U
+#define QSPI_AUTOMATIC_STOP_ENABLE     0x00400000U
+#define QSPI_TIMEOUT_COUNTER_DISABLE   0x00000000U
+#define QSPI_TIMEOUT_COUNTER_ENABLE    0x00000008U
+
+#define HAL_QSPI_TIMEOUT_DEFAULT_VALUE 5000U
+#define HAL_QPSI_TIMEOUT_DEFAULT_VALUE HAL_QSPI_TIMEOUT_DEFAULT_VALUE
+
+HAL_StatusTypeDef HAL_QSPI_Init(QSPI_HandleTypeDef *hqspi);
+HAL_StatusTypeDef HAL_QSPI_DeInit(QSPI_HandleTypeDef *hqspi);
+HAL_StatusTypeDef HAL_QSPI_Command(QSPI_HandleTypeDef *hqspi, QSPI_CommandTypeDef *cmd, uint32_t Timeout);
+HAL_StatusTypeDef HAL_QSPI_Transmit(QSPI_HandleTypeDef *hqspi, uint8_t *pData, uint32_t Timeout);
+HAL_StatusTypeDef HAL_QSPI_Receive(QSPI_HandleTypeDef *hqspi, uint8_t *pData, uint32_t Timeout);
+HAL_StatusTypeDef HAL_QSPI_Receive_DMA(QSPI_HandleTypeDef *hqspi, uint8_t *pData);
+HAL_StatusTypeDef HAL_QSPI_Transmit_DMA(QSPI_HandleTypeDef *hqspi, uint8_t *pData);
+HAL_StatusTypeDef HAL_QSPI_AutoPolling(QSPI_HandleTypeDef *hqspi, QSPI_CommandTypeDef *cmd, QSPI_AutoPollingTypeDef *cfg, uint32_t Timeout);
+HAL_StatusTypeDef HAL_QSPI_AutoPolling_IT(QSPI_HandleTypeDef *hqspi, QSPI_CommandTypeDef *cmd, QSPI_AutoPollingTypeDef *cfg);
+HAL_StatusTypeDef HAL_QSPI_MemoryMapped(QSPI_HandleTypeDef *hqspi, QSPI_CommandTypeDef *cmd, QSPI_MemoryMappedTypeDef *cfg);
+HAL_StatusTypeDef HAL_QSPI_Abort(QSPI_HandleTypeDef *hqspi);
+void HAL_QSPI_RxCpltCallback(QSPI_HandleTypeDef *hqspi);
+void HAL_QSPI_TxCpltCallback(QSPI_HandleTypeDef *hqspi);
+void HAL_QSPI_StatusMatchCallback(QSPI_HandleTypeDef *hqspi);
+void HAL_QSPI_ErrorCallback(QSPI_HandleTypeDef *hqspi);
+
+
+/* ---- tick, irq, system ------------------------------------------------ */
+
+HAL_StatusTypeDef HAL_Init(void);
+uint32_t HAL_GetTick(void);
+void HAL_Delay(uint32_t Delay);
+void HAL_SuspendTick(void);
+void HAL_ResumeTick(void);
+
+typedef int IRQn_Type;
+#define DMA2_Stream7_IRQn    70
+#define QUADSPI_IRQn         92
+void HAL_NVIC_EnableIRQ(IRQn_Type IRQn);
+void HAL_NVIC_DisableIRQ(IRQn_Type IRQn);
+
+extern uint32_t SystemCoreClock;
+void SystemInit(void);
+
+#define __disable_irq()      do { } while (0)
+#define __enable_irq()       do { } while (0)
+#define __DSB()              do { } while (0)
+#define __ISB()              do { } while (0)
+#define __CLZ(x)             ((uint8_t)((x) ? __builtin_clz(x) : 32))
+
+
+/* ---- core peripherals ----------------------------------------------- */
+
+typedef struct {
+    __IO uint32_t CCR;
+    __IO uint32_t VTOR;
+} SCB_Type;
+
+typedef struct {
+    __IO uint32_t CTRL;
+    __IO uint32_t CYCCNT;
+    __IO uint32_t LAR;
+} DWT_Type;
+
+typedef struct {
+    __IO uint32_t DHCSR;
+    __IO uint32_t DEMCR;
+} CoreDebug_Type;
+
+typedef struct {
+    union {
+        __IO uint8_t u8;
+        __IO uint16_t u16;
+        __IO uint32_t u32;
+    } PORT[32];
+    __IO uint32_t TER;
+    __IO uint32_t TCR;
+} ITM_Type;
+
+extern SCB_Type ShimScb;
+extern CoreDebug_Type ShimCoreDebug;
+extern ITM_Type ShimItm;
+DWT_Type *ShimDwt(void);
+
+#define SCB                  (&ShimScb)
+#define DWT                  (ShimDwt())
+#define CoreDebug            (&ShimCoreDebug)
+#define ITM                  (&ShimItm)
+
+#define SCB_CCR_IC_Msk                 (1UL << 17)
+#define SCB_CCR_DC_Msk                 (1UL << 16)
+#define DWT_CTRL_CYCCNTENA_Msk         (1UL << 0)
+#define CoreDebug_DEMCR_TRCENA_Msk     (1UL << 24)
+#define ITM_TCR_ITMENA_Msk             (1UL << 0)
+
+void SCB_EnableICache(void);
+void SCB_EnableDCache(void);
+void SCB_InvalidateICache(void);
+void SCB_CleanInvalidateDCache(void);
+void SCB_InvalidateDCache_by_Addr(void *addr, int32_t dsize);
+void SCB_CleanDCache_by_Addr(uint32_t *addr, int32_t dsize);
+uint32_t ITM_SendChar(uint32_t ch);
+
+
+/* ---- MPU ------------------------------------------------------------ */
+
+typedef struct {
+    uint8_t Enable;
+    uint8_t Number;
+    uint32_t BaseAddress;
+    uint8_t Size;
+    uint8_t SubRegionDisable;
+    uint8_t TypeExtField;
+    uint8_t AccessPermission;
+    uint8_t DisableExec;
+    uint8_t IsShareable;
+    uint8_t IsCacheable;
+    uint8_t IsBufferable;
+} MPU_Region_InitTypeDef;
+
+#define MPU_REGION_ENABLE              0x01U
+#define MPU_REGION_DISABLE             0x00U
+#define MPU_REGION_NUMBER0             0x00U
+#define MPU_REGION_NUMBER1             0x01U
+#define MPU_REGION_NUMBER2             0x02U
+#define MPU_REGION_SIZE_256KB          0x11U
+#define MPU_REGION_SIZE_4MB            0x15U
+#define MPU_REGION_SIZE_256MB          0x1BU
+#define MPU_TEX_LEVEL0                 0x00U
+#define MPU_TEX_LEVEL1                 0x01U
+#define MPU_REGION_NO_ACCESS           0x00U
+#define MPU_REGION_FULL_ACCESS         0x03U
+#define MPU_REGION_PRIV_RO_URO         0x06U
+#define MPU_INSTRUCTION_ACCESS_ENABLE  0x00U
+#define MPU_INSTRUCTION_ACCESS_DISABLE 0x01U
+#define MPU_ACCESS_SHAREABLE           0x01U
+#define MPU_ACCESS_NOT_SHAREABLE       0x00U
+#define MPU_ACCESS_CACHEABLE           0x01U
+#define MPU_ACCESS_NOT_CACHEABLE       0x00U
+#define MPU_ACCESS_BUFFERABLE          0x01U
+#define MPU_ACCESS_NOT_BUFFERABLE      0x00U
+#define MPU_PRIVILEGED_DEFAULT         0x04U
+
+#define SRAM1_BASE                     0x20010000UL
+
+void HAL_MPU_Disable(void);
+void HAL_MPU_Enable(uint32_t MPU_Control);
+void HAL_MPU_ConfigRegion(MPU_Region_InitTypeDef *MPU_Init);
+
+
+#endif
@@ -0,0 +1,85 @@
+/*
+ * Inspect and prepare W25Q32FV simulator images.
+ *
+ *   w25qimg image info                 status registers, used sectors
+ *   w25qimg image dump addr len        hex dump
+ *   w25qimg image load addr file       program a binary, no erase
+ *   w25qimg image erase                back to factory state
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "w25q_sim.h"
+
+
+static void Dump(const uint8_t *p, uint32_t addr, uint32_t len)
+{
+    uint32_t i;
+
+    for (i = 0; i < len; i++) {
+        if ((i & 15) == 0)
+            printf("%s%08X:", i ? "\n" : "", (unsigned)(addr + i));
+        printf(" %02X", p[i]);
+    }
+    printf("\n");
+}
+
+
+int main(int argc, char *argv[])
+{
+    W25qSim f;
+    uint32_t addr, len, i, used;
+    FILE *in;
+    int c, ret = 0;
+
+    if (argc < 3) {
+        fprintf(stderr, "usage: %s image info|dump addr len|load addr file|erase\n", argv[0]);
+        return 2;
+    }
+    if (strcmp(argv[2], "erase") == 0)
+        remove(argv[1]);
+    if (W25qSimOpen(&f, argv[1], W25Q_SIM_TYP) != 0)
+        return 1;
+
+    if (strcmp(argv[2], "info") == 0) {
+        used = 0;
+        for (addr = 0; addr != W25Q_SIM_FLASH_SIZE; addr += W25Q_SIM_SEC_SIZE) {
+            for (i = 0; i != W25Q_SIM_SEC_SIZE && f.mem[addr + i] == 0xFF; i++)
+                ;
+            used += i != W25Q_SIM_SEC_SIZE;
+        }
+        printf("SR1 %02X SR2 %02X SR3 %02X\n", f.sr[0], f.sr[1], f.sr[2]);
+        printf("programmed sectors %u of %u\n", (unsigned)used, (unsigned)(W25Q_SIM_FLASH_SIZE / W25Q_SIM_SEC_SIZE));
+    }
+    else if (strcmp(argv[2], "dump") == 0 && argc == 5) {
+        addr = strtoul(argv[3], NULL, 0) & (W25Q_SIM_FLASH_SIZE - 1);
+        len = strtoul(argv[4], NULL, 0);
+        if (len > W25Q_SIM_FLASH_SIZE - addr)
+            len = W25Q_SIM_FLASH_SIZE - addr;
+        Dump(f.mem + addr, addr, len);
+    }
+    else if (strcmp(argv[2], "load") == 0 && argc == 5) {
+        addr = strtoul(argv[3], NULL, 0);
+        in = fopen(argv[4], "rb");
+        if (in == NULL) {
+            perror(argv[4]);
+            ret = 1;
+        }
+        else {
+            /* 1 -> 0 only, like a program without erase */
+            while (addr < W25Q_SIM_FLASH_SIZE && (c = getc(in)) != EOF)
+                f.mem[addr++] &= (uint8_t)c;
+            fclose(in);
+        }
+    }
+    else if (strcmp(argv[2], "erase") != 0) {
+        fprintf(stderr, "%s: bad command\n", argv[0]);
+        ret = 2;
+    }
+
+    W25qSimClose(&f);
+
+    return ret;
+}
@@ -0,0 +1,577 @@
+/*
+ * W25Q32FV behavioural model, see w25q_sim.h
+ */
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "w25q_sim.h"
+
+
+/* image trailer layout */
+#define TRL_SEC              0x000     /* 3 x 256 security registers */
+#define TRL_NV               0x300     /* SR1..SR3 non-volatile bits */
+#define TRL_UID              0x310     /* 8 byte unique id */
+#define TRL_MAGIC            0xFF8
+#define SIM_MAGIC            "W25QSIM1"
+
+#define JEDEC_MID            0xEF
+#define JEDEC_TYPE           0x40
+#define JEDEC_CAP            0x16
+#define DEVICE_ID            0x15      /* 0xAB / 0x90 */
+
+#define SR1_WRITABLE         0xFC      /* SRP0 SEC TB BP2..BP0 */
+#define SR2_WRITABLE         0x43      /* CMP QE SRP1, LB bits are OTP */
+#define SR2_LB               0x38
+#define SR3_WRITABLE         0xE4
+
+#define US                   1000ULL
+#define MS                   1000000ULL
+
+/* datasheet AC characteristics, typical and max */
+static const struct {
+    uint64_t bp1, bp2, pp, se, be1, be2, ce, w, dp, res1, rst, sus;
+} tm[2] = {
+    { 30 * US,  2500,  700 * US,  45 * MS,  120 * MS,  150 * MS, 10000 * MS, 10 * MS, 3 * US, 3 * US, 30 * US, 20 * US },
+    { 50 * US, 12000, 3000 * US, 400 * MS, 1600 * MS, 2000 * MS, 50000 * MS, 15 * MS, 3 * US, 3 * US, 30 * US, 20 * US },
+};
+
+
+uint64_t W25qSimOpTime(const W25qSim *f, uint8_t instr, uint32_t len)
+{
+    uint64_t t;
+
+    switch (instr) {
+    case 0x02:
+    case 0x42:
+        /* first byte plus each additional one, bounded by tPP */
+        if (len == 0)
+            return 0;
+        if (len > W25Q_SIM_PAGE_SIZE)
+            len = W25Q_SIM_PAGE_SIZE;
+        t = tm[f->timing].bp1 + (uint64_t)(len - 1) * tm[f->timing].bp2;
+        return t < tm[f->timing].pp ? t : tm[f->timing].pp;
+    case 0x20:
+    case 0x44:
+        return tm[f->timing].se;
+    case 0x52:
+        return tm[f->timing].be1;
+    case 0xD8:
+        return tm[f->timing].be2;
+    case 0xC7:
+    case 0x60:
+        return tm[f->timing].ce;
+    case 0x01:
+    case 0x31:
+    case 0x11:
+        return tm[f->timing].w;
+    default:
+        return 0;
+    }
+}
+
+
+static void SimSync(W25qSim *f)
+{
+    if ((f->sr[0] & W25Q_SR1_BUSY) && f->now >= f->busy_end) {
+        f->sr[0] &= ~(W25Q_SR1_BUSY | W25Q_SR1_WEL);
+    }
+}
+
+
+static void SimBusy(W25qSim *f, uint8_t instr, uint32_t len)
+{
+    uint64_t t = W25qSimOpTime(f, instr, len);
+
+    f->sr[0] |= W25Q_SR1_BUSY;
+    f->busy_end = f->now + t;
+    f->stats.busy_ns += t;
+}
+
+
+static void SimNvSave(W25qSim *f)
+{
+    f->nv[0] = f->sr[0] & SR1_WRITABLE;
+    f->nv[1] = f->sr[1] & (SR2_WRITABLE | SR2_LB);
+    f->nv[2] = f->sr[2] & SR3_WRITABLE;
+}
+
+
+static void SimPowerOn(W25qSim *f)
+{
+    f->sr[0] = f->nv[0];
+    f->sr[1] = f->nv[1];
+    f->sr[2] = f->nv[2];
+    f->wel_volatile = 0;
+    f->pd = 0;
+    f->cont = 0;
+    f->rst_en = 0;
+    f->busy_left = 0;
+}
+
+
+int W25qSimOpen(W25qSim *f, const char *image, W25qSimTiming timing)
+{
+    struct stat st;
+    uint8_t *trl;
+    uint32_t h, i;
+    int fresh = 1;
+
+    memset(f, 0, sizeof(*f));
+    f->fd = -1;
+    f->timing = timing;
+
+    if (image != NULL) {
+        f->fd = open(image, O_RDWR | O_CREAT, 0644);
+        if (f->fd < 0 || fstat(f->fd, &st) != 0) {
+            perror(image);
+            return -1;
+        }
+        fresh = st.st_size != W25Q_SIM_IMAGE_SIZE;
+        if (fresh && ftruncate(f->fd, W25Q_SIM_IMAGE_SIZE) != 0) {
+            perror(image);
+            close(f->fd);
+            return -1;
+        }
+        f->img = mmap(NULL, W25Q_SIM_IMAGE_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, f->fd, 0);
+    }
+    else {
+        f->img = mmap(NULL, W25Q_SIM_IMAGE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    }
+    if (f->img == MAP_FAILED) {
+        perror("mmap");
+        if (f->fd >= 0)
+            close(f->fd);
+        return -1;
+    }
+
+    trl = f->img + W25Q_SIM_FLASH_SIZE;
+    f->mem = f->img;
+    f->sec = trl + TRL_SEC;
+    f->nv = trl + TRL_NV;
+
+    if (fresh || memcmp(trl + TRL_MAGIC, SIM_MAGIC, 8) != 0) {
+        /* factory state: erased array and registers, a made up unique id */
+        memset(f->img, 0xFF, W25Q_SIM_FLASH_SIZE);
+        memset(trl, 0, 0x1000);
+        memset(f->sec, 0xFF, 3 * 256);
+        h = 2166136261u;
+        for (i = 0; image != NULL && image[i]; i++)
+            h = (h ^ (uint8_t)image[i]) * 16777619u;
+        for (i = 0; i != 8; i++)
+            trl[TRL_UID + i] = (uint8_t)(h >> (8 * (i & 3))) ^ (uint8_t)i;
+        memcpy(trl + TRL_MAGIC, SIM_MAGIC, 8);
+    }
+    SimPowerOn(f);
+
+    return 0;
+}
+
+
+void W25qSimClose(W25qSim *f)
+{
+    if (f->img != NULL && f->img != MAP_FAILED) {
+        if (f->fd >= 0)
+            msync(f->img, W25Q_SIM_IMAGE_SIZE, MS_SYNC);
+        munmap(f->img, W25Q_SIM_IMAGE_SIZE);
+    }
+    if (f->fd >= 0)
+        close(f->fd);
+    f->img = NULL;
+    f->fd = -1;
+}
+
+
+void W25qSimSetTime(W25qSim *f, uint64_t ns)
+{
+    if (ns > f->now)
+        f->now = ns;
+    SimSync(f);
+}
+
+
+int W25qSimBusy(W25qSim *f)
+{
+    SimSync(f);
+
+    return (f->sr[0] & W25Q_SR1_BUSY) != 0;
+}
+
+
+static void SimProgram(uint8_t *page, uint32_t off, const uint8_t *d, uint32_t len)
+{
+    uint32_t i;
+
+    /* only the last 256 bytes sent are kept, the address wraps in the page */
+    if (len > W25Q_SIM_PAGE_SIZE) {
+        off += len - W25Q_SIM_PAGE_SIZE;
+        d += len - W25Q_SIM_PAGE_SIZE;
+        len = W25Q_SIM_PAGE_SIZE;
+    }
+    for (i = 0; i != len; i++) {
+        page[(off + i) & (W25Q_SIM_PAGE_SIZE - 1)] &= d[i];
+    }
+}
+
+
+/* security register number from an 0x42/0x44/0x48 address, 0 if invalid */
+static int SimSecReg(uint32_t addr)
+{
+    uint32_t r = addr >> 12;
+
+    return (r >= 1 && r <= 3 && (addr & 0xF00) == 0) ? (int)r : 0;
+}
+
+
+static int SimRead(W25qSim *f, W25qXfer *x, uint32_t addr)
+{
+    uint32_t i;
+
+    if (x->write)
+        return -1;
+    for (i = 0; i != x->len; i++) {
+        x->data[i] = f->mem[(addr + i) & (W25Q_SIM_FLASH_SIZE - 1)];
+    }
+    f->stats.bytes_read += x->len;
+
+    return 0;
+}
+
+
+/* suspended: erases, status and security register writes are not
+ * allowed, programs neither during a program suspend nor into the
+ * sector/block of a suspended erase */
+static int SimSuspendRefused(const W25qSim *f, uint8_t instr, uint32_t a)
+{
+    uint32_t size;
+
+    switch (instr) {
+    case 0x20:
+    case 0x52:
+    case 0xD8:
+    case 0xC7:
+    case 0x60:
+    case 0x01:
+    case 0x31:
+    case 0x11:
+    case 0x42:
+    case 0x44:
+        return 1;
+
+    case 0x02:
+        size = f->busy_instr == 0x20 ? 0x1000 : f->busy_instr == 0x52 ? 0x8000 :
+               f->busy_instr == 0xD8 ? 0x10000 : 0;
+        return size == 0 || (a & ~(size - 1)) == (f->busy_addr & ~(size - 1));
+    }
+
+    return 0;
+}
+
+
+static int SimExpect(W25qSim *f, W25qXfer *x, uint8_t abytes, uint8_t dummy)
+{
+    if (x->addr_bytes != abytes || x->dummy != dummy) {
+        f->stats.violations++;
+        return -1;
+    }
+
+    return 0;
+}
+
+
+int W25qSimXfer(W25qSim *f, W25qXfer *x)
+{
+    uint8_t instr = x->instr;
+    uint32_t a = x->addr & (W25Q_SIM_FLASH_SIZE - 1);
+    uint8_t rd[3];
+    int r, busy;
+
+    SimSync(f);
+    f->stats.cmds++;
+
+    if (f->now < f->ready_at) {
+        /* tRES1/tDP/tRST/tSUS not elapsed: the part does not listen, the
+         * bus floats high and a status poll just reads BUSY */
+        if (instr != 0x05 && instr != 0x35 && instr != 0x15)
+            f->stats.violations++;
+        f->stats.ignored++;
+        return -1;
+    }
+
+    /* continuous read mode: no instruction, address and M on IO0/IO1 */
+    if (f->cont) {
+        if (x->has_instr || x->alt_bytes != 1) {
+            f->stats.violations++;
+            f->cont = 0;
+            return -1;
+        }
+        f->cont = (x->alt & 0x30) == 0x20;
+        return SimRead(f, x, a);
+    }
+    if (!x->has_instr) {
+        f->stats.violations++;
+        return -1;
+    }
+
+    if (f->pd) {
+        if (instr != 0xAB) {
+            f->stats.ignored++;
+            return -1;
+        }
+        f->pd = 0;
+        f->ready_at = f->now + tm[f->timing].res1;
+        if (!x->write && x->len != 0) {
+            memset(x->data, DEVICE_ID, x->len);
+        }
+        return 0;
+    }
+
+    busy = (f->sr[0] & W25Q_SR1_BUSY) != 0;
+    if (busy && instr != 0x05 && instr != 0x35 && instr != 0x15 &&
+        instr != 0x75 && instr != 0x66 && instr != 0x99) {
+        f->stats.ignored++;
+        return -1;
+    }
+
+    if ((f->sr[1] & W25Q_SR2_SUS) && SimSuspendRefused(f, instr, a)) {
+        f->stats.violations++;
+        f->stats.ignored++;
+        return -1;
+    }
+
+    /* reset enable must come right before reset */
+    if (instr != 0x99)
+        f->rst_en = instr == 0x66;
+
+    switch (instr) {
+    case 0x66:
+        return 0;
+
+    case 0x99:
+        if (!f->rst_en) {
+            f->stats.ignored++;
+            return -1;
+        }
+        SimPowerOn(f);
+        f->ready_at = f->now + tm[f->timing].rst;
+        return 0;
+
+    case 0x06:
+        f->sr[0] |= W25Q_SR1_WEL;
+        f->wel_volatile = 0;
+        return 0;
+
+    case 0x50:
+        f->wel_volatile = 1;
+        return 0;
+
+    case 0x04:
+        f->sr[0] &= ~W25Q_SR1_WEL;
+        return 0;
+
+    case 0x05:
+    case 0x35:
+    case 0x15:
+        if (x->write)
+            return -1;
+        r = instr == 0x05 ? 0 : instr == 0x35 ? 1 : 2;
+        /* the status register is output continuously */
+        memset(x->data, f->sr[r], x->len);
+        return 0;
+
+    case 0x01:
+    case 0x31:
+    case 0x11:
+        if (!x->write || x->len == 0)
+            return -1;
+        if (!(f->sr[0] & W25Q_SR1_WEL) && !f->wel_volatile) {
+            f->stats.ignored++;
+            return -1;
+        }
+        memcpy(rd, f->sr, 3);
+        if (instr == 0x01) {
+            rd[0] = (rd[0] & ~SR1_WRITABLE) | (x->data[0] & SR1_WRITABLE);
+            if (x->len > 1)
+                rd[1] = (rd[1] & ~SR2_WRITABLE) | (x->data[1] & SR2_WRITABLE) | (x->data[1] & SR2_LB);
+        }
+        else if (instr == 0x31) {
+            rd[1] = (rd[1] & ~SR2_WRITABLE) | (x->data[0] & SR2_WRITABLE) | (x->data[0] & SR2_LB);
+        }
+        else {
+            rd[2] = (rd[2] & ~SR3_WRITABLE) | (x->data[0] & SR3_WRITABLE);
+        }
+        f->sr[0] = (f->sr[0] & 0x03) | (rd[0] & ~0x03);
+        f->sr[1] = rd[1];
+        f->sr[2] = rd[2];
+        f->stats.status_writes++;
+        if (f->wel_volatile) {
+            /* volatile write: immediate, no tW, image untouched */
+            f->wel_volatile = 0;
+            return 0;
+        }
+        SimNvSave(f);
+        f->busy_instr = 0;
+        SimBusy(f, instr, 0);
+        return 0;
+
+    case 0x02:
+        if (!x->write || x->addr_bytes != 3)
+            return -1;
+        if (!(f->sr[0] & W25Q_SR1_WEL)) {
+            f->stats.ignored++;
+            return -1;
+        }
+        SimProgram(&f->mem[a & ~(W25Q_SIM_PAGE_SIZE - 1)], a, x->data, x->len);
+        f->stats.programs++;
+        f->stats.bytes_prog += x->len;
+        /* a program during an erase suspend keeps the erase's */
+        if (!(f->sr[1] & W25Q_SR2_SUS)) {
+            f->busy_instr = instr;
+            f->busy_addr = a;
+        }
+        SimBusy(f, instr, x->len);
+        return 0;
+
+    case 0x20:
+    case 0x52:
+    case 0xD8:
+    case 0xC7:
+    case 0x60:
+        if (!(f->sr[0] & W25Q_SR1_WEL)) {
+            f->stats.ignored++;
+            return -1;
+        }
+        if (instr == 0x20) {
+            memset(&f->mem[a & ~0xFFFUL], 0xFF, 0x1000);
+            f->stats.erase_4k++;
+        }
+        else if (instr == 0x52) {
+            memset(&f->mem[a & ~0x7FFFUL], 0xFF, 0x8000);
+            f->stats.erase_32k++;
+        }
+        else if (instr == 0xD8) {
+            memset(&f->mem[a & ~0xFFFFUL], 0xFF, 0x10000);
+            f->stats.erase_64k++;
+        }
+        else {
+            memset(f->mem, 0xFF, W25Q_SIM_FLASH_SIZE);
+            f->stats.erase_chip++;
+        }
+        /* a chip erase cannot be suspended */
+        f->busy_instr = (instr == 0xC7 || instr == 0x60) ? 0 : instr;
+        f->busy_addr = a;
+        SimBusy(f, instr, 0);
+        return 0;
+
+    case 0x75:
+        /* only program/erase of the array can be suspended */
+        if (!busy || (f->sr[1] & W25Q_SR2_SUS))
+            return 0;
+        if (f->busy_instr != 0x02 && f->busy_instr != 0x20 && f->busy_instr != 0x52 && f->busy_instr != 0xD8) {
+            f->stats.ignored++;
+            return 0;
+        }
+        f->busy_left = f->busy_end - f->now;
+        f->sr[0] &= ~W25Q_SR1_BUSY;
+        f->sr[1] |= W25Q_SR2_SUS;
+        f->ready_at = f->now + tm[f->timing].sus;
+        return 0;
+
+    case 0x7A:
+        if (!(f->sr[1] & W25Q_SR2_SUS))
+            return 0;
+        f->sr[1] &= ~W25Q_SR2_SUS;
+        f->sr[0] |= W25Q_SR1_BUSY;
+        f->busy_end = f->now + f->busy_left;
+        f->busy_left = 0;
+        return 0;
+
+    case 0x03:
+        SimExpect(f, x, 3, 0);
+        return SimRead(f, x, a);
+
+    case 0x0B:
+    case 0x3B:
+        SimExpect(f, x, 3, 8);
+        return SimRead(f, x, a);
+
+    case 0xBB:
+        /* M byte, no dummy: 4 clocks of M on 2 lines are the dummy */
+        if (x->addr_bytes != 3 || x->alt_bytes != 1 || x->dummy != 0) {
+            f->stats.violations++;
+        }
+        f->cont = x->alt_bytes == 1 && (x->alt & 0x30) == 0x20;
+        return SimRead(f, x, a);
+
+    case 0x9F:
+        if (x->write)
+            return -1;
+        for (r = 0; r != (int)x->len; r++)
+            x->data[r] = r == 0 ? JEDEC_MID : r == 1 ? JEDEC_TYPE : r == 2 ? JEDEC_CAP : 0xFF;
+        return 0;
+
+    case 0x4B:
+        if (x->write)
+            return -1;
+        SimExpect(f, x, 0, 32);
+        for (r = 0; r != (int)x->len; r++)
+            x->data[r] = r < 8 ? f->nv[TRL_UID - TRL_NV + r] : 0xFF;
+        return 0;
+
+    case 0xB9:
+        f->pd = 1;
+        f->cont = 0;
+        f->ready_at = f->now + tm[f->timing].dp;
+        return 0;
+
+    case 0xAB:
+        /* release from power-down while not in power-down: id read */
+        if (!x->write && x->len != 0)
+            memset(x->data, DEVICE_ID, x->len);
+        return 0;
+
+    case 0x48:
+        if (x->write)
+            return -1;
+        SimExpect(f, x, 3, 8);
+        r = SimSecReg(x->addr);
+        if (r == 0) {
+            f->stats.violations++;
+            return -1;
+        }
+        for (a = 0; a != x->len; a++)
+            x->data[a] = f->sec[(r - 1) * 256 + ((x->addr + a) & 0xFF)];
+        f->stats.bytes_read += x->len;
+        return 0;
+
+    case 0x42:
+    case 0x44:
+        r = SimSecReg(x->addr);
+        if (r == 0 || (instr == 0x42 && !x->write)) {
+            f->stats.violations++;
+            return -1;
+        }
+        if (!(f->sr[0] & W25Q_SR1_WEL) || (f->sr[1] & (W25Q_SR2_LB1 << (r - 1)))) {
+            f->stats.ignored++;
+            return -1;
+        }
+        if (instr == 0x42) {
+            SimProgram(&f->sec[(r - 1) * 256], x->addr & 0xFF, x->data, x->len);
+            f->stats.bytes_prog += x->len;
+        }
+        else {
+            memset(&f->sec[(r - 1) * 256], 0xFF, 256);
+        }
+        f->busy_instr = 0;
+        SimBusy(f, instr, x->len);
+        return 0;
+
+    default:
+        f->stats.ignored++;
+        return -1;
+    }
+}
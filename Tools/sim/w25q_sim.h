@@ -0,0 +1,98 @@
+/*
+ * W25Q32FV behavioural model for host builds.
+ *
+ * The array, the security registers and the non-volatile status bits
+ * live in an image file that is mmap'd, so the flash content survives
+ * between runs like the real part does. Commands are handed over one
+ * bus transaction at a time (W25qXfer); time only moves when the
+ * caller says so (W25qSimSetTime) and BUSY follows the datasheet
+ * program/erase times.
+ *
+ * Not modelled: block protection (BP/TB/CMP/SEC), quad mode, DTR.
+ */
+
+#ifndef __W25Q_SIM_H__
+#define __W25Q_SIM_H__
+
+#include <stdint.h>
+
+
+#define W25Q_SIM_FLASH_SIZE   0x00400000UL
+#define W25Q_SIM_PAGE_SIZE    256
+#define W25Q_SIM_SEC_SIZE     0x1000UL
+#define W25Q_SIM_IMAGE_SIZE   (W25Q_SIM_FLASH_SIZE + 0x1000)   /* array + trailer */
+
+/* status register bits */
+#define W25Q_SR1_BUSY         0x01
+#define W25Q_SR1_WEL          0x02
+#define W25Q_SR2_LB1          0x08
+#define W25Q_SR2_SUS          0x80
+
+typedef enum {
+    W25Q_SIM_TYP = 0,      /* typical datasheet times */
+    W25Q_SIM_MAX           /* worst case, what the timeouts must cover */
+} W25qSimTiming;
+
+/* one nCS low..high bus transaction */
+typedef struct {
+    uint8_t instr;
+    uint8_t has_instr;     /* 0 in continuous read mode (SIOO) */
+    uint32_t addr;
+    uint8_t addr_bytes;    /* 0: no address phase */
+    uint32_t alt;
+    uint8_t alt_bytes;     /* 0: no alternate (M) byte */
+    uint8_t dummy;         /* dummy clocks */
+    uint8_t *data;
+    uint32_t len;
+    uint8_t write;         /* data goes to the flash */
+} W25qXfer;
+
+typedef struct {
+    uint32_t cmds;
+    uint32_t ignored;      /* dropped: busy, no WEL, power-down, locked */
+    uint32_t violations;   /* protocol errors: wrong dummy, tRES1/tRST not met.. */
+    uint32_t programs;
+    uint32_t erase_4k;
+    uint32_t erase_32k;
+    uint32_t erase_64k;
+    uint32_t erase_chip;
+    uint32_t status_writes;
+    uint64_t bytes_read;
+    uint64_t bytes_prog;
+    uint64_t busy_ns;      /* time spent programming/erasing */
+} W25qSimStats;
+
+typedef struct {
+    int fd;
+    uint8_t *img;          /* mmap'd image */
+    uint8_t *mem;          /* flash array */
+    uint8_t *sec;          /* 3 x 256 security registers */
+    uint8_t *nv;           /* non-volatile SR1..SR3, then the unique id */
+
+    uint8_t sr[3];
+    uint8_t wel_volatile;  /* 0x50: next status write is volatile */
+    uint8_t pd;            /* deep power-down */
+    uint8_t cont;          /* 0xBB continuous read mode */
+    uint8_t rst_en;        /* 0x66 seen */
+
+    uint64_t now;          /* ns */
+    uint64_t busy_end;
+    uint64_t busy_left;    /* suspended program/erase */
+    uint8_t busy_instr;    /* program/erase of the array that may be suspended (0: none), its address */
+    uint32_t busy_addr;
+    uint64_t ready_at;     /* tRES1, tDP, tRST, tSUS */
+    W25qSimTiming timing;
+
+    W25qSimStats stats;
+} W25qSim;
+
+
+int W25qSimOpen(W25qSim *f, const char *image, W25qSimTiming timing);
+void W25qSimClose(W25qSim *f);
+void W25qSimSetTime(W25qSim *f, uint64_t ns);
+int W25qSimBusy(W25qSim *f);
+int W25qSimXfer(W25qSim *f, W25qXfer *x);
+uint64_t W25qSimOpTime(const W25qSim *f, uint8_t instr, uint32_t len);
+
+
+#endif
@@ -0,0 +1,114 @@
+/*
+ * Sorted table builder, see sst_build.h
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "dqspi.h"
+#include "sst_build.h"
+
+
+#define LINES(n)             (((uint32_t)(n) + DQSPI_SST_KEYS - 1) / DQSPI_SST_KEYS)
+
+typedef struct {
+    uint32_t key;
+    uint32_t rec;          /* input record */
+} Ent;
+
+
+static int EntCmp(const void *a, const void *b)
+{
+    uint32_t x = ((const Ent *)a)->key, y = ((const Ent *)b)->key;
+
+    return x < y ? -1 : x > y;
+}
+
+
+uint8_t *SstBuild(const uint8_t *rec, uint32_t count, uint16_t val_len, uint32_t *size, const char **err)
+{
+    uint32_t nodes[DQSPI_SST_LEVELS_MAX], span[DQSPI_SST_LEVELS_MAX];
+    uint32_t rsize = 4 + val_len, lines = LINES(count), m, l, n, i, c, levels = 0;
+    uint32_t *k, *keys;
+    DQSpiSstHdr h;
+    uint8_t *t;
+    Ent *e;
+
+    if (count == 0) {
+        *err = "no records";
+        return NULL;
+    }
+
+    /* levels bottom up: span is the key lines under one child */
+    for (m = lines, c = 1; m > 1; m = (m + DQSPI_SST_FANOUT - 1) / DQSPI_SST_FANOUT, c *= DQSPI_SST_FANOUT) {
+        if (levels == DQSPI_SST_LEVELS_MAX) {
+            *err = "too many records";
+            return NULL;
+        }
+        nodes[levels] = (m + DQSPI_SST_FANOUT - 1) / DQSPI_SST_FANOUT;
+        span[levels] = c;
+        levels++;
+    }
+
+    memset(&h, 0, sizeof(h));
+    h.magic = DQSPI_SST_MAGIC;
+    h.version = DQSPI_SST_VERSION;
+    h.val_len = val_len;
+    h.count = count;
+    h.levels = levels;
+    n = sizeof(h);
+    for (l = 0; l != levels; l++) {
+        h.level[l] = n;
+        n += nodes[levels - 1 - l] * DQSPI_SST_LINE;
+    }
+    h.keys = n;
+    h.values = n + lines * DQSPI_SST_LINE;
+    h.size = h.values + count * val_len;
+
+    e = malloc(count * sizeof(*e));
+    t = malloc(h.size);
+    if (e == NULL || t == NULL) {
+        free(e);
+        free(t);
+        *err = "out of memory";
+        return NULL;
+    }
+    for (i = 0; i != count; i++) {
+        memcpy(&e[i].key, rec + (size_t)i * rsize, 4);
+        e[i].rec = i;
+    }
+    qsort(e, count, sizeof(*e), EntCmp);
+
+    memset(t, 0xFF, h.size);
+    keys = (uint32_t *)(t + h.keys);
+    for (i = 0; i != count; i++) {
+        if (e[i].key == DQSPI_SST_PAD || (i != 0 && e[i].key == e[i - 1].key)) {
+            *err = e[i].key == DQSPI_SST_PAD ? "key 0xFFFFFFFF is reserved" : "duplicate key";
+            free(e);
+            free(t);
+            return NULL;
+        }
+        keys[i] = e[i].key;
+        memcpy(t + h.values + (size_t)i * val_len, rec + (size_t)e[i].rec * rsize + 4, val_len);
+    }
+    free(e);
+
+    /* key j of node n: the first key of the leftmost key line under
+     * child n * FANOUT + j + 1; missing children keep the padding */
+    for (l = 0; l != levels; l++) {
+        k = (uint32_t *)(t + h.level[levels - 1 - l]);
+        for (n = 0; n != nodes[l]; n++) {
+            for (i = 0; i != DQSPI_SST_KEYS; i++) {
+                c = (n * DQSPI_SST_FANOUT + i + 1) * span[l];
+                if (c < lines)
+                    k[n * DQSPI_SST_KEYS + i] = keys[c * DQSPI_SST_KEYS];
+            }
+        }
+    }
+
+    memcpy(t, &h, sizeof(h));
+    ((DQSpiSstHdr *)t)->crc = DQSpiCrc32(0, t + sizeof(h), h.size - sizeof(h));
+    *size = h.size;
+
+    return t;
+}
@@ -0,0 +1,20 @@
+/*
+ * Sorted table builder: the layout of Inc/dqspi_sst.h from a set of
+ * records. Shared by sstgen and the host benchmark.
+ */
+
+#ifndef __SST_BUILD_H__
+#define __SST_BUILD_H__
+
+#include <stdint.h>
+
+#include "dqspi_sst.h"
+
+
+/* rec: count records of a little-endian 32-bit key and val_len bytes,
+ * in any order. Returns the table (free() it), *size its bytes, or NULL
+ * and *err for a duplicate or invalid key. */
+uint8_t *SstBuild(const uint8_t *rec, uint32_t count, uint16_t val_len, uint32_t *size, const char **err);
+
+
+#endif
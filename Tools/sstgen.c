@@ -0,0 +1,204 @@
+/*
+ * Sorted table builder: writes a table of Inc/dqspi_sst.h, searched on
+ * the target with DQSpiSstFind() through the XIP window. The table goes
+ * to the flash like any image, e.g. qplan table.bin@0x90200000.
+ *
+ *   sstgen [-v bytes | -t] [-o table.bin] input
+ *
+ *   -v        binary input: records of a little-endian 32-bit key and
+ *             a value of this many bytes, default 4
+ *   -t        text input: one record per line, the key then the value
+ *             as 32-bit words, integers (0x.. hex) or floats; every line
+ *             has as many words, '#' starts a comment
+ *   -o file   write the table
+ *
+ * Records may come in any order; keys must be unique, 0xFFFFFFFF is
+ * reserved.
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "dqspi_sst.h"
+#include "sst_build.h"
+
+
+#define TEXT_WORDS_MAX       64
+
+static uint8_t *rec;
+static uint32_t count, cap;
+
+
+static int Add(const uint8_t *r, uint32_t rsize)
+{
+    uint8_t *p;
+
+    if (count == cap) {
+        cap = cap ? cap * 2 : 4096;
+        p = realloc(rec, (size_t)cap * rsize);
+        if (p == NULL)
+            return -1;
+        rec = p;
+    }
+    memcpy(rec + (size_t)count * rsize, r, rsize);
+    count++;
+
+    return 0;
+}
+
+
+static int LoadBin(const char *name, uint16_t val_len)
+{
+    uint8_t r[4 + 0xFFFF];
+    FILE *f = fopen(name, "rb");
+    size_t n;
+
+    if (f == NULL) {
+        perror(name);
+        return -1;
+    }
+    while ((n = fread(r, 1, 4 + val_len, f)) == 4u + val_len) {
+        if (Add(r, 4 + val_len) != 0) {
+            fclose(f);
+            return -1;
+        }
+    }
+    fclose(f);
+    if (n != 0) {
+        fprintf(stderr, "%s: %u bytes after the last record\n", name, (unsigned)n);
+        return -1;
+    }
+
+    return 0;
+}
+
+
+static int LoadText(const char *name, uint16_t *val_len)
+{
+    uint32_t w[1 + TEXT_WORDS_MAX], lno = 0, n;
+    char line[1024], *tok, *end, *c;
+    FILE *f = fopen(name, "r");
+    float v;
+
+    if (f == NULL) {
+        perror(name);
+        return -1;
+    }
+    *val_len = 0xFFFF;
+    while (fgets(line, sizeof(line), f) != NULL) {
+        lno++;
+        if ((c = strchr(line, '#')) != NULL)
+            *c = 0;
+        n = 0;
+        for (tok = strtok(line, " \t,\r\n"); tok != NULL; tok = strtok(NULL, " \t,\r\n")) {
+            if (n == 1 + TEXT_WORDS_MAX) {
+                fprintf(stderr, "%s:%u: more than %u words\n", name, (unsigned)lno, TEXT_WORDS_MAX);
+                goto fail;
+            }
+            /* the key is always an integer */
+            if (n != 0 && strpbrk(tok, ".eE") != NULL && strncmp(tok, "0x", 2) != 0) {
+                v = strtof(tok, &end);
+                memcpy(&w[n], &v, 4);
+            }
+            else {
+                w[n] = strtoul(tok, &end, 0);
+            }
+            if (*end != 0) {
+                fprintf(stderr, "%s:%u: '%s' is not a number\n", name, (unsigned)lno, tok);
+                goto fail;
+            }
+            n++;
+        }
+        if (n == 0)
+            continue;
+        if (*val_len == 0xFFFF)
+            *val_len = (n - 1) * 4;
+        if ((n - 1) * 4 != *val_len) {
+            fprintf(stderr, "%s:%u: %u value words, the first record has %u\n", name, (unsigned)lno,
+                    (unsigned)(n - 1), (unsigned)(*val_len / 4));
+            goto fail;
+        }
+        if (Add((const uint8_t *)w, 4 * n) != 0)
+            goto fail;
+    }
+    fclose(f);
+    if (*val_len == 0xFFFF)
+        *val_len = 0;
+
+    return 0;
+
+fail:
+    fclose(f);
+    return -1;
+}
+
+
+int main(int argc, char *argv[])
+{
+    uint16_t val_len = 4;
+    const DQSpiSstHdr *h;
+    const char *out = NULL, *err;
+    uint32_t size, lines, bs;
+    int opt, text = 0;
+    uint8_t *t;
+    FILE *f;
+
+    while ((opt = getopt(argc, argv, "v:to:")) != -1) {
+        switch (opt) {
+        case 'v':
+            val_len = strtoul(optarg, NULL, 0);
+            break;
+        case 't':
+            text = 1;
+            break;
+        case 'o':
+            out = optarg;
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-v bytes | -t] [-o table.bin] input\n", argv[0]);
+            return 2;
+        }
+    }
+    if (optind != argc - 1) {
+        fprintf(stderr, "usage: %s [-v bytes | -t] [-o table.bin] input\n", argv[0]);
+        return 2;
+    }
+
+    if ((text ? LoadText(argv[optind], &val_len) : LoadBin(argv[optind], val_len)) != 0)
+        return 1;
+    t = SstBuild(rec, count, val_len, &size, &err);
+    if (t == NULL) {
+        fprintf(stderr, "%s: %s\n", argv[optind], err);
+        return 1;
+    }
+    h = (const DQSpiSstHdr *)t;
+
+    /* lines read by a lookup, the value may straddle two; a binary search
+     * reads a new line until the range fits one */
+    lines = h->levels + 1 + (val_len ? 1 + (val_len - 1 + DQSPI_SST_LINE - 1) / DQSPI_SST_LINE : 0);
+    bs = count > DQSPI_SST_KEYS ? (uint32_t)ceil(log2((double)count / DQSPI_SST_KEYS)) + 1 : 1;
+    printf("table: %u records, %u-byte values, %u index levels (%u bytes), %u bytes\n", (unsigned)count,
+           (unsigned)val_len, (unsigned)h->levels, (unsigned)(h->keys - sizeof(DQSpiSstHdr)), (unsigned)size);
+    printf("lookup: %u lines at most, binary search over the keys %u + value\n", (unsigned)lines, (unsigned)bs);
+
+    if (out != NULL) {
+        f = fopen(out, "wb");
+        if (f == NULL) {
+            perror(out);
+            return 1;
+        }
+        if (fwrite(t, 1, size, f) != size) {
+            fprintf(stderr, "%s: write error\n", out);
+            fclose(f);
+            return 1;
+        }
+        fclose(f);
+    }
+    free(t);
+    free(rec);
+
+    return 0;
+}